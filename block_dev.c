@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * Basic-block translation cache
+ *
+ * A block is a run of predecoded instructions starting at start_pc and
+ * ending with the first JAL, JALR, branch, ECALL or unknown instruction
+ * (or at a page boundary / BLOCK_MAX_LEN). Blocks are found by start pc
+ * through a hash table.
+ *
+ * Each block has two chain slots, one for each possible successor of its
+ * final instruction (taken target and fall-through for branches, the
+ * target for JAL). Once a successor has been looked up it is linked into
+ * the slot, so the hash table is only consulted for indirect jumps and
+ * first-time exits.
+ *
+ * Any store that overlaps a translated instruction flushes the whole
+ * cache, which also drops every chain. The words covered by blocks are
+ * tracked in a direct-mapped tag table. Slots shared by two words are
+ * marked ambiguous and treated as covered, so the check never misses.
+ *
+ * Each machine has its own cache, allocated when run_block first runs
+ * on it. With the jit engine, blocks executed JIT_THRESHOLD times are
+ * compiled to host code by jit_compile and run natively from then on.
+ *
+ * With timing_enabled, each block is costed by the timing model when
+ * translated and charged on every execution, whether interpreted or
+ * compiled. The profiler (prof_enabled) counts executions the same way.
+ */
+#define BLOCK_MAX_LEN    64
+#define BLOCK_MAX        (1 << 14)
+#define BLOCK_OPS_MAX    (BLOCK_MAX * 8)
+#define BLOCK_HASH_BITS  12
+#define BLOCK_WORD_BITS  16
+#define JIT_THRESHOLD    16
+
+#define WORD_EMPTY       0
+#define WORD_AMBIGUOUS   2
+
+typedef struct block block_t;
+
+struct block {
+    uint32_t  start_pc;
+    uint32_t  len;            // Number of instructions
+    rv_insn_t *ops;
+    block_t   *hash_next;
+    uint32_t  chain_pc[2];    // Successor pcs known at translation time
+    block_t   *chain[2];      // Linked successors (NULL until resolved)
+    uint32_t  exec_count;     // Executions, for JIT tiering
+    jit_fn_t  jit;            // Compiled code, or NULL
+    timing_block_t timing;    // Estimated cost, with timing_enabled
+    prof_rec_t *prof;         // Profile record, with prof_enabled
+};
+
+struct block_cache {
+    block_t   blocks[BLOCK_MAX];
+    rv_insn_t ops[BLOCK_OPS_MAX];
+    block_t  *hash[1 << BLOCK_HASH_BITS];
+    uint32_t  words[1 << BLOCK_WORD_BITS];
+    uint32_t  nblocks;
+    uint32_t  nops;
+
+    uint64_t translated;      // Blocks built
+    uint64_t translated_ops;
+    uint64_t flushes;
+    uint64_t executed;
+    uint64_t chain_hits;      // Block exits that followed a chain link
+    uint64_t lookups;         // Block exits that went through the hash table
+};
+
+static inline uint32_t block_hash_index(uint32_t start_pc) {
+    return (start_pc >> 2) & ((1 << BLOCK_HASH_BITS) - 1);
+}
+
+void block_flush(rv_machine_t *rv) {
+    block_cache_t *c = rv->blocks;
+    c->nblocks = 0;
+    c->nops = 0;
+    memset(c->hash, 0, sizeof(c->hash));
+    memset(c->words, 0, sizeof(c->words));
+    jit_reset(rv);
+    rv->block_generation++;
+    c->flushes++;
+}
+
+void block_free(rv_machine_t *rv) {
+    jit_free(rv);
+    free(rv->blocks);
+}
+
+void block_invalidate_range(rv_machine_t *rv, uint32_t addr, uint32_t len) {
+    if (rv->blocks == NULL)
+        return;
+    uint32_t first = addr & ~3u;
+    uint32_t last  = (addr + len - 1) & ~3u;
+    for (uint32_t a = first; ; a += 4) {
+        uint32_t tag = rv->blocks->words[(a >> 2) & ((1 << BLOCK_WORD_BITS) - 1)];
+        if (tag == (a | 1) || tag == WORD_AMBIGUOUS) {
+            block_flush(rv);
+            return;
+        }
+        if (a == last)
+            break;
+    }
+}
+
+static void block_mark_word(block_cache_t *c, uint32_t a) {
+    uint32_t *tag = &c->words[(a >> 2) & ((1 << BLOCK_WORD_BITS) - 1)];
+    if (*tag == WORD_EMPTY)
+        *tag = a | 1;
+    else if (*tag != (a | 1))
+        *tag = WORD_AMBIGUOUS;
+}
+
+static int ends_block(uint8_t op) {
+    switch (op) {
+        case INSTR_JAL:
+        case INSTR_JALR:
+        case INSTR_BEQ:
+        case INSTR_BNE:
+        case INSTR_BLT:
+        case INSTR_BGE:
+        case INSTR_BLTU:
+        case INSTR_BGEU:
+        case INSTR_ECALL:
+        case INSTR_UNKNOWN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static block_t *block_translate(rv_machine_t *rv, uint32_t start_pc) {
+    block_cache_t *c = rv->blocks;
+    if (c->nblocks == BLOCK_MAX || c->nops + BLOCK_MAX_LEN > BLOCK_OPS_MAX)
+        block_flush(rv);
+
+    block_t *b = &c->blocks[c->nblocks++];
+    b->start_pc = start_pc;
+    b->ops = &c->ops[c->nops];
+    b->len = 0;
+    b->exec_count = 0;
+    b->jit = NULL;
+
+    uint32_t a = start_pc;
+    for (;;) {
+        rv_insn_t *d = &b->ops[b->len++];
+        predecode_at(rv, a, d);
+        block_mark_word(c, a);
+        if (ends_block(d->op) || b->len == BLOCK_MAX_LEN)
+            break;
+        a += 4;
+        if ((a & ((1 << PAGE_SHIFT) - 1)) == 0)
+            break; // Do not cross a page boundary
+    }
+    c->nops += b->len;
+    if (timing_on())
+        timing_block(&b->timing, b->ops, b->len, rv->vtype);
+    if (prof_on())
+        b->prof = prof_block(b->ops, b->len);
+
+    // Successors that can be linked directly
+    const rv_insn_t *last = &b->ops[b->len - 1];
+    b->chain[0] = b->chain[1] = NULL;
+    b->chain_pc[0] = b->chain_pc[1] = 1; // Never a valid pc
+    switch (last->op) {
+        case INSTR_JAL:
+            b->chain_pc[0] = last->pc + last->imm;
+            break;
+        case INSTR_BEQ:
+        case INSTR_BNE:
+        case INSTR_BLT:
+        case INSTR_BGE:
+        case INSTR_BLTU:
+        case INSTR_BGEU:
+            b->chain_pc[0] = last->pc + last->imm;
+            b->chain_pc[1] = last->pc + 4;
+            break;
+        case INSTR_JALR:
+        case INSTR_ECALL:
+        case INSTR_UNKNOWN:
+            break;
+        default:
+            b->chain_pc[1] = last->pc + 4; // Split by length or page
+            break;
+    }
+
+    uint32_t h = block_hash_index(start_pc);
+    b->hash_next = c->hash[h];
+    c->hash[h] = b;
+
+    c->translated++;
+    c->translated_ops += b->len;
+    return b;
+}
+
+static block_t *block_lookup(rv_machine_t *rv, uint32_t start_pc) {
+    rv->blocks->lookups++;
+    for (block_t *b = rv->blocks->hash[block_hash_index(start_pc)]; b != NULL; b = b->hash_next) {
+        if (b->start_pc == start_pc)
+            return b;
+    }
+    return block_translate(rv, start_pc);
+}
+
+uint64_t run_block(rv_machine_t *rv, uint64_t max_cycle) {
+    uint64_t cycle_count = 0;
+    block_t *b = NULL;
+
+    if (rv->blocks == NULL) {
+        rv->blocks = calloc(1, sizeof(block_cache_t));
+        if (rv->blocks == NULL) {
+            fprintf(stderr, "Error: Out of memory for the block cache\n");
+            exit(1);
+        }
+    }
+    block_cache_t *c = rv->blocks;
+    int use_jit = rv->engine == RV_ENGINE_JIT;
+
+    while (cycle_count < max_cycle) {
+        if (b == NULL)
+            b = block_lookup(rv, rv->pc);
+
+        if (use_jit && b->jit == NULL && ++b->exec_count == JIT_THRESHOLD) {
+            if (!jit_space_ok(rv)) {
+                block_flush(rv); // Code cache full : start over
+                b = NULL;
+                continue;
+            }
+            b->jit = jit_compile(rv, b->ops, b->len);
+        }
+
+        uint32_t gen = rv->block_generation;
+        uint32_t i;
+        int r = 1;
+#ifdef MEM_GUARD
+        rv->block_pc = b->start_pc; // A fault counts the block's instructions from here
+#endif
+        if (timing_on() && b->timing.rvv)
+            timing_block_enter(&b->timing, b->ops, b->len, rv->vtype);
+        if (b->jit != NULL && b->len <= max_cycle - cycle_count) {
+            // Native code; it returns early only after a store flushed the caches
+            rv->pc = b->jit(rv->xreg, MEM_JIT_ARG(rv));
+            i = (rv->block_generation == gen) ? b->len : (rv->pc - b->start_pc) / 4;
+            rv->jit_executed++;
+        } else {
+            uint32_t n = b->len;
+            if (n > max_cycle - cycle_count)
+                n = max_cycle - cycle_count;
+
+            // Execute the block body
+            for (i = 0; i < n; i++) {
+                const rv_insn_t *d = &b->ops[i];
+                r = d->handler(rv, d);
+                if (r != 1) {
+                    if (r != 0) {
+                        i += (r == RV_HALT);
+                        break; // ECALL or breakpoint, always last in the block
+                    }
+                    rv->pc = rv->pc + 4; // Unknown instruction
+                }
+                if (rv->block_generation != gen) {
+                    i++;
+                    break; // The block was overwritten; continue from pc
+                }
+            }
+        }
+        cycle_count += i;
+        rv->instret += i;
+        c->executed++;
+        if (timing_on())
+            timing_block_exit(&b->timing, b->ops, b->len, i, rv->pc);
+        if (prof_on())
+            prof_block_exit(b->prof, i, rv->pc);
+        if (r > 1)
+            break;
+
+        if (rv->block_generation != gen || i != b->len) {
+            b = NULL;
+            continue;
+        }
+
+        // Follow a chain link if the exit matches one
+        block_t *next = NULL;
+        for (int k = 0; k < 2; k++) {
+            if (b->chain_pc[k] == rv->pc) {
+                if (b->chain[k] == NULL) {
+                    b->chain[k] = block_lookup(rv, rv->pc);
+                    if (rv->block_generation != gen)
+                        break; // Translation flushed the cache, b is gone
+                } else {
+                    c->chain_hits++;
+                }
+                next = b->chain[k];
+                break;
+            }
+        }
+        b = (rv->block_generation == gen) ? next : NULL;
+    }
+    return cycle_count;
+}
+
+void block_print_stats(rv_machine_t *rv, FILE *fp) {
+    const block_cache_t *c = rv->blocks;
+    if (c == NULL)
+        return; // The block engine never ran
+    uint64_t exits = c->chain_hits + c->lookups;
+    fprintf(fp, "blocks : translated = %llu, average length = %.2f, flushes = %llu, executed = %llu\n",
+            (unsigned long long)c->translated,
+            c->translated ? (double)c->translated_ops / c->translated : 0.0,
+            (unsigned long long)c->flushes, (unsigned long long)c->executed);
+    fprintf(fp, "blocks : chain hits = %llu, lookups = %llu, chain hit rate = %.2f%%\n",
+            (unsigned long long)c->chain_hits, (unsigned long long)c->lookups,
+            exits ? 100.0 * c->chain_hits / exits : 0.0);
+}
@@ -1,8 +1,9 @@
 #!/bin/bash
 
-#riscv64-unknown-elf-gcc -march=rv32imv -mabi=ilp32 -nostartfiles -O2 -T link.ld -o program.elf start.s $1
+#riscv64-unknown-elf-gcc -march=rv32imav -mabi=ilp32 -nostartfiles -O2 -T link.ld -o program.elf start.s $1
 
 CC=/usr/local/opt/llvm/bin/clang
-$CC --target=riscv32-unknown-elf -march=rv32imv -mabi=ilp32d -O2 -nostdlib -ffreestanding -T link.ld -o program.elf start.s $1
+$CC --target=riscv32-unknown-elf -march=rv32imav -mabi=ilp32d -O2 -nostdlib -ffreestanding -T link.ld -o program.elf start.s $1
+# rv_dev loads program.elf directly; the flat image is kept for older tools
 riscv64-unknown-elf-objcopy -O binary program.elf program.bin
 
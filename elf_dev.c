@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rv32.h"
+
+/*
+ * ELF32 loader
+ *
+ * Every PT_LOAD segment is placed at its p_vaddr in guest memory, and the
+ * bytes between p_filesz and p_memsz (.bss) are cleared rather than read.
+ * Read-only segments whose file offset and address share the same page
+ * offset are mapped straight from the file with MAP_PRIVATE through
+ * mem_map_file, so the image is paged in on demand and guest stores only
+ * touch private copies. Partial pages at either end are copied with pread.
+ *
+ * Guest memory is reached only through mem_host_page and mem_map_file, so
+ * the loader also serves emulators with a flat memory array.
+ *
+ * Symbols are process-wide : elf_load_symbols keeps the function and
+ * label symbols of one file, sorted by address, for elf_symbol_at.
+ */
+elf_sym_t *elf_syms;
+uint32_t   elf_nsyms;
+
+static int read_at(int fd, void *buf, size_t len, off_t off) {
+    uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, off);
+        if (n <= 0)
+            return -1;
+        p += n;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Copy len bytes of fd at off to guest memory at addr
+static int copy_in(rv_machine_t *rv, int fd, uint32_t addr, uint32_t len, off_t off) {
+    while (len > 0) {
+        uint32_t n = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (n > len)
+            n = len;
+        uint8_t *page = mem_host_page(rv, addr);
+        if (page == NULL || read_at(fd, page + (addr & MEM_PAGE_MASK), n, off) != 0)
+            return -1;
+        addr += n;
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int zero_fill(rv_machine_t *rv, uint32_t addr, uint32_t len) {
+    while (len > 0) {
+        uint32_t n = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (n > len)
+            n = len;
+        uint8_t *page = mem_host_page(rv, addr);
+        if (page == NULL)
+            return -1;
+        memset(page + (addr & MEM_PAGE_MASK), 0, n);
+        addr += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int load_segment(rv_machine_t *rv, int fd, const Elf32_Phdr *ph) {
+    if ((uint64_t) ph->p_vaddr + ph->p_memsz > (1ull << 32) || ph->p_filesz > ph->p_memsz) {
+        fprintf(stderr, "Error: Bad segment at 0x%x (0x%x bytes)\n", ph->p_vaddr, ph->p_memsz);
+        return -1;
+    }
+    uint32_t vaddr = ph->p_vaddr;
+    uint32_t filesz = ph->p_filesz;
+    uint32_t map_start = 0, map_len = 0;
+
+    if (!(ph->p_flags & PF_W) && (vaddr & MEM_PAGE_MASK) == (ph->p_offset & MEM_PAGE_MASK)) {
+        // Whole pages inside the file data are mapped copy-on-write
+        uint32_t head = (MEM_PAGE_SIZE - (vaddr & MEM_PAGE_MASK)) & MEM_PAGE_MASK;
+        if (head < filesz) {
+            uint32_t len = (filesz - head) & ~MEM_PAGE_MASK;
+            if (len > 0 && mem_map_file(rv, vaddr + head, len, fd, ph->p_offset + head) == 0) {
+                map_start = head;
+                map_len = len;
+            }
+        }
+    }
+    uint32_t rest = map_start + map_len;
+    if (copy_in(rv, fd, vaddr, map_start, ph->p_offset) != 0 ||
+        copy_in(rv, fd, vaddr + rest, filesz - rest, ph->p_offset + rest) != 0 ||
+        zero_fill(rv, vaddr + filesz, ph->p_memsz - filesz) != 0) {
+        fprintf(stderr, "Error: Cannot load segment at 0x%x (0x%x bytes)\n", ph->p_vaddr, ph->p_memsz);
+        return -1;
+    }
+    return 0;
+}
+
+static int sym_cmp(const void *a, const void *b) {
+    uint32_t x = ((const elf_sym_t *) a)->addr, y = ((const elf_sym_t *) b)->addr;
+    return x < y ? -1 : x > y;
+}
+
+// Keep the function and label symbols of the first SHT_SYMTAB
+static void load_symbols(int fd, const Elf32_Ehdr *eh) {
+    if (eh->e_shoff == 0 || eh->e_shentsize != sizeof(Elf32_Shdr))
+        return;
+    Elf32_Shdr *sh = malloc(eh->e_shnum * sizeof(Elf32_Shdr));
+    if (sh == NULL || read_at(fd, sh, eh->e_shnum * sizeof(Elf32_Shdr), eh->e_shoff) != 0)
+        goto out;
+
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum)
+            continue;
+        const Elf32_Shdr *strtab = &sh[sh[i].sh_link];
+        uint32_t n = sh[i].sh_size / sizeof(Elf32_Sym);
+        Elf32_Sym *syms = malloc(sh[i].sh_size);
+        char *str = malloc(strtab->sh_size + 1);
+        elf_syms = malloc(n * sizeof(elf_sym_t));
+        if (syms == NULL || str == NULL || elf_syms == NULL ||
+            read_at(fd, syms, sh[i].sh_size, sh[i].sh_offset) != 0 ||
+            read_at(fd, str, strtab->sh_size, strtab->sh_offset) != 0) {
+            free(syms);
+            free(str);
+            free(elf_syms);
+            elf_syms = NULL;
+            break;
+        }
+        str[strtab->sh_size] = '\0';
+        for (uint32_t k = 0; k < n; k++) {
+            uint8_t type = ELF32_ST_TYPE(syms[k].st_info);
+            if ((type != STT_FUNC && type != STT_NOTYPE) || syms[k].st_shndx == SHN_UNDEF ||
+                syms[k].st_name == 0 || syms[k].st_name >= strtab->sh_size)
+                continue;
+            elf_syms[elf_nsyms].addr = syms[k].st_value;
+            elf_syms[elf_nsyms].size = syms[k].st_size;
+            elf_syms[elf_nsyms].name = str + syms[k].st_name;
+            elf_nsyms++;
+        }
+        free(syms); // Names stay in str for the life of the program
+        qsort(elf_syms, elf_nsyms, sizeof(elf_sym_t), sym_cmp);
+        break;
+    }
+out:
+    free(sh);
+}
+
+// The symbol at or below addr, or NULL
+const elf_sym_t *elf_symbol_at(uint32_t addr) {
+    uint32_t lo = 0, hi = elf_nsyms;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (elf_syms[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? &elf_syms[lo - 1] : NULL;
+}
+
+int elf_is_elf(const uint8_t *head, size_t len) {
+    return len >= SELFMAG && memcmp(head, ELFMAG, SELFMAG) == 0;
+}
+
+// Open path and read its header. Returns the file descriptor, -1 if the
+// file cannot be opened, or -2 if it is not a little-endian RV32 ELF file.
+static int elf_open(const char *path, Elf32_Ehdr *eh) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
+        return -1;
+    }
+    if (read_at(fd, eh, sizeof(*eh), 0) != 0 || !elf_is_elf(eh->e_ident, EI_NIDENT) ||
+        eh->e_ident[EI_CLASS] != ELFCLASS32 || eh->e_ident[EI_DATA] != ELFDATA2LSB ||
+        eh->e_machine != EM_RISCV || eh->e_phentsize != sizeof(Elf32_Phdr)) {
+        close(fd);
+        return -2;
+    }
+    return fd;
+}
+
+// Load the segments of path into the memory of rv
+int elf_load(rv_machine_t *rv, const char *path, uint32_t *entry) {
+    Elf32_Ehdr eh;
+    int fd = elf_open(path, &eh);
+    if (fd == -2)
+        fprintf(stderr, "Error: %s is not a little-endian RV32 ELF file\n", path);
+    if (fd < 0)
+        return -1;
+
+    for (int i = 0; i < eh.e_phnum; i++) {
+        Elf32_Phdr ph;
+        if (read_at(fd, &ph, sizeof(ph), eh.e_phoff + i * sizeof(ph)) != 0) {
+            fprintf(stderr, "Error: Cannot read program headers of %s\n", path);
+            close(fd);
+            return -1;
+        }
+        if (ph.p_type == PT_LOAD && ph.p_memsz != 0 && load_segment(rv, fd, &ph) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    *entry = eh.e_entry;
+    close(fd); // Mappings stay valid after close
+    return 0;
+}
+
+// Keep the symbols of path for elf_symbol_at, once per process. Other
+// files, such as flat binaries, have no symbols.
+int elf_load_symbols(const char *path) {
+    Elf32_Ehdr eh;
+    if (elf_syms != NULL)
+        return 0;
+    int fd = elf_open(path, &eh);
+    if (fd < 0)
+        return fd == -2 ? 0 : -1;
+    load_symbols(fd, &eh);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * engine_test : runs the same programs on every engine and compares them
+ *
+ * Each program is run to its ECALL on the interp, threaded, block and jit
+ * engines, with loops long enough for the jit to compile them :
+ *
+ *     arith  : M-extension arithmetic, loads and stores in a loop
+ *     smc    : each iteration stores a new immediate into an ADDI that
+ *              runs next, in the block after the store
+ *     smc.i  : the same followed by FENCE.I
+ *     inline : the store patches an ADDI later in its own block
+ *
+ * The x registers, the exit code, the instructions retired and the data
+ * the program wrote must match the interp engine's. Prints each
+ * difference and exits nonzero if any check fails.
+ *
+ * Build: gcc -O2 -o engine_test engine_test.c $(ls *_dev.c | grep -v '^rv_dev.c$') -lpthread
+ * Usage: engine_test
+ */
+
+#define TEST_DATA  0x10000 // 64 words written by the programs
+#define TEST_ITERS 1000
+#define TEST_MAX   64      // Instructions per program
+
+static const char *const engines[] = { "interp", "threaded", "block", "jit" };
+static int fails;
+
+typedef struct {
+    uint32_t code[TEST_MAX];
+    uint32_t len;
+} prog_t;
+
+typedef struct {
+    rv_exit_t exit;
+    uint32_t  xreg[32];
+    uint32_t  data[64];
+    uint64_t  jit_executed;
+} result_t;
+
+static uint32_t r_type(uint32_t f7, uint32_t rs2, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t op) {
+    return (f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op;
+}
+
+static uint32_t i_type(int32_t imm, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t op) {
+    return ((uint32_t) imm << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op;
+}
+
+static uint32_t s_type(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t f3) {
+    uint32_t u = (uint32_t) imm;
+    return ((u >> 5) << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | ((u & 0x1F) << 7) | 0x23;
+}
+
+static uint32_t b_type(int32_t off, uint32_t rs2, uint32_t rs1, uint32_t f3) {
+    uint32_t u = (uint32_t) off;
+    return (((u >> 12) & 1) << 31) | (((u >> 5) & 0x3F) << 25) | (rs2 << 20) | (rs1 << 15) |
+           (f3 << 12) | (((u >> 1) & 0xF) << 8) | (((u >> 11) & 1) << 7) | 0x63;
+}
+
+static uint32_t j_type(int32_t off, uint32_t rd) {
+    uint32_t u = (uint32_t) off;
+    return (((u >> 20) & 1) << 31) | (((u >> 1) & 0x3FF) << 21) | (((u >> 11) & 1) << 20) |
+           (((u >> 12) & 0xFF) << 12) | (rd << 7) | 0x6F;
+}
+
+#define ADD(rd, a, b)   r_type(0x00, b, a, 0x0, rd, 0x33)
+#define SUB(rd, a, b)   r_type(0x20, b, a, 0x0, rd, 0x33)
+#define XOR(rd, a, b)   r_type(0x00, b, a, 0x4, rd, 0x33)
+#define OR(rd, a, b)    r_type(0x00, b, a, 0x6, rd, 0x33)
+#define MUL(rd, a, b)   r_type(0x01, b, a, 0x0, rd, 0x33)
+#define DIVU(rd, a, b)  r_type(0x01, b, a, 0x5, rd, 0x33)
+#define REM(rd, a, b)   r_type(0x01, b, a, 0x6, rd, 0x33)
+#define ADDI(rd, a, i)  i_type(i, a, 0x0, rd, 0x13)
+#define ANDI(rd, a, i)  i_type(i, a, 0x7, rd, 0x13)
+#define SLLI(rd, a, i)  i_type(i, a, 0x1, rd, 0x13)
+#define SRAI(rd, a, i)  i_type(0x400 | (i), a, 0x5, rd, 0x13)
+#define LW(rd, a, i)    i_type(i, a, 0x2, rd, 0x03)
+#define LBU(rd, a, i)   i_type(i, a, 0x4, rd, 0x03)
+#define SW(b, a, i)     s_type(i, b, a, 0x2)
+#define SB(b, a, i)     s_type(i, b, a, 0x0)
+#define BLT(a, b, off)  b_type(off, b, a, 0x4)
+#define JAL(rd, off)    j_type(off, rd)
+#define LUI(rd, i)      (((uint32_t) (i) << 12) | ((rd) << 7) | 0x37)
+#define FENCE_I         0x0000100F
+#define ECALL           0x00000073
+
+static uint32_t emit(prog_t *p, uint32_t instr) {
+    p->code[p->len] = instr;
+    return 4 * p->len++;
+}
+
+// x5 counts to x6 = TEST_ITERS, x7 points at TEST_DATA
+static void prologue(prog_t *p) {
+    emit(p, ADDI(5, 0, 0));
+    emit(p, ADDI(6, 0, TEST_ITERS));
+    emit(p, LUI(7, TEST_DATA >> 12));
+    emit(p, ADDI(10, 0, 0));
+}
+
+// Loop back to top while x5 < x6, then exit with x3 = x10 & 0xFF
+static void epilogue(prog_t *p, uint32_t top) {
+    uint32_t at = emit(p, ADDI(5, 5, 1));
+    emit(p, BLT(5, 6, (int32_t) top - (int32_t) (at + 4)));
+    emit(p, ANDI(3, 10, 0xFF));
+    emit(p, ECALL);
+}
+
+static void prog_arith(prog_t *p) {
+    prologue(p);
+    uint32_t top = emit(p, MUL(11, 5, 5));
+    emit(p, ADD(10, 10, 11));
+    emit(p, XOR(12, 10, 5));
+    emit(p, SLLI(13, 5, 2));
+    emit(p, ANDI(13, 13, 0xFC));
+    emit(p, ADD(13, 13, 7));
+    emit(p, SW(12, 13, 0));
+    emit(p, LW(14, 13, 0));
+    emit(p, LBU(15, 13, 1));
+    emit(p, SB(5, 13, 2));
+    emit(p, ADD(10, 10, 14));
+    emit(p, SUB(10, 10, 15));
+    emit(p, SRAI(16, 10, 3));
+    emit(p, SUB(10, 10, 16));
+    emit(p, ADDI(17, 5, 7));
+    emit(p, DIVU(18, 10, 17));
+    emit(p, REM(19, 10, 17));
+    emit(p, XOR(10, 10, 18));
+    emit(p, ADD(10, 10, 19));
+    epilogue(p, top);
+}
+
+// Each iteration writes ADDI x10, x10, x5 & 0x7FF over the instruction
+// at patch. With jump, the ADDI starts the block after a JAL; without,
+// it follows the store in the same block.
+static void prog_smc(prog_t *p, int fence, int jump) {
+    prologue(p);
+    emit(p, LUI(22, ADDI(10, 10, 0) >> 12));
+    emit(p, ADDI(22, 22, ADDI(10, 10, 0) & 0x7FF)); // x22 = ADDI x10, x10, 0
+    uint32_t base = emit(p, ADDI(23, 0, 0));        // x23 = patch, set below
+    uint32_t top = emit(p, ANDI(21, 5, 0x7FF));
+    emit(p, SLLI(21, 21, 20));
+    emit(p, OR(21, 21, 22));
+    emit(p, SW(21, 23, 0));
+    if (fence)
+        emit(p, FENCE_I);
+    if (jump)
+        emit(p, JAL(0, 4));
+    uint32_t patch = emit(p, ADDI(10, 10, 0));
+    emit(p, SW(10, 7, 0));
+    p->code[base / 4] = ADDI(23, 0, (int32_t) patch);
+    epilogue(p, top);
+}
+
+static int run(const prog_t *p, int engine, result_t *res) {
+    rv_machine_t *rv = rv_create(engine);
+    if (rv == NULL) {
+        fprintf(stderr, "Error: Out of memory for the machine\n");
+        return -1;
+    }
+    mem_map_ram(rv, 0, TEST_DATA + 0x1000);
+    rv_write_mem(rv, 0, p->code, 4 * p->len);
+    rv_set_pc(rv, 0);
+    res->exit = rv_run(rv, 100 * TEST_ITERS * TEST_MAX);
+    for (uint32_t r = 0; r < 32; r++)
+        res->xreg[r] = rv_get_reg(rv, r);
+    rv_read_mem(rv, TEST_DATA, res->data, sizeof(res->data));
+    res->jit_executed = rv->jit_executed;
+    rv_destroy(rv);
+    return 0;
+}
+
+// With hot, the jit engine must have run compiled blocks. A sum other
+// than SUM_ANY is the x10 every engine must end with.
+#define SUM_ANY UINT32_MAX
+
+static void check(const char *name, const prog_t *p, int hot, uint32_t sum) {
+    result_t want, got;
+    if (run(p, RV_ENGINE_INTERP, &want) != 0)
+        exit(1);
+    if (want.exit.reason != RV_EXIT_ECALL) {
+        printf("FAIL %-8s interp stopped with reason %d\n", name, want.exit.reason);
+        fails++;
+        return;
+    }
+    if (sum != SUM_ANY && want.xreg[10] != sum) {
+        printf("FAIL %-8s interp   x10 = %u, expected %u\n", name, want.xreg[10], sum);
+        fails++;
+    }
+    for (int e = RV_ENGINE_THREADED; e <= RV_ENGINE_JIT; e++) {
+        if (run(p, e, &got) != 0)
+            exit(1);
+        if (got.exit.reason != want.exit.reason || got.exit.value != want.exit.value ||
+            got.exit.pc != want.exit.pc) {
+            printf("FAIL %-8s %-8s exit %d/%u at %08x, expected %d/%u at %08x\n",
+                   name, engines[e], got.exit.reason, got.exit.value, got.exit.pc,
+                   want.exit.reason, want.exit.value, want.exit.pc);
+            fails++;
+        }
+        if (got.exit.instret != want.exit.instret) {
+            printf("FAIL %-8s %-8s instret = %llu, expected %llu\n", name, engines[e],
+                   (unsigned long long) got.exit.instret, (unsigned long long) want.exit.instret);
+            fails++;
+        }
+        for (uint32_t r = 0; r < 32; r++) {
+            if (got.xreg[r] != want.xreg[r]) {
+                printf("FAIL %-8s %-8s x%u = %08x, expected %08x\n",
+                       name, engines[e], r, got.xreg[r], want.xreg[r]);
+                fails++;
+            }
+        }
+        if (memcmp(got.data, want.data, sizeof(got.data)) != 0) {
+            printf("FAIL %-8s %-8s data differs\n", name, engines[e]);
+            fails++;
+        }
+        if (e == RV_ENGINE_JIT && hot && got.jit_executed == 0) {
+            printf("FAIL %-8s jit      no block was compiled\n", name);
+            fails++;
+        }
+    }
+}
+
+// The smc programs add 0, 1, ... TEST_ITERS - 1 into x10 if each patch
+// is seen by the next execution of the ADDI
+int main(void) {
+    prog_t p;
+
+    memset(&p, 0, sizeof(p));
+    prog_arith(&p);
+    check("arith", &p, 1, SUM_ANY);
+
+    memset(&p, 0, sizeof(p));
+    prog_smc(&p, 0, 1);
+    check("smc", &p, 0, TEST_ITERS * (TEST_ITERS - 1) / 2);
+
+    memset(&p, 0, sizeof(p));
+    prog_smc(&p, 1, 1);
+    check("smc.i", &p, 0, TEST_ITERS * (TEST_ITERS - 1) / 2);
+
+    memset(&p, 0, sizeof(p));
+    prog_smc(&p, 0, 0);
+    check("inline", &p, 0, TEST_ITERS * (TEST_ITERS - 1) / 2);
+
+    printf("engines : %s\n", fails ? "FAIL" : "ok");
+    return fails != 0;
+}
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * Predecode cache
+ *
+ * Direct-mapped on (pc >> 2), tagged with the full pc. A record is valid
+ * when its handler is non-NULL and its tag matches.
+ *
+ * Every page that holds a cached instruction is marked in
+ * rv->icache_code_pages, so icache_notify_store only leaves the fast path
+ * for stores into code pages. Those stores invalidate the overlapped words,
+ * which keeps self-modifying programs correct. Translated basic blocks
+ * are notified through block_invalidate_range.
+ *
+ * An instruction at a breakpoint is cached as an unknown instruction
+ * whose handler stops the machine, so the engines pay nothing for
+ * breakpoints and blocks end at them.
+ */
+static int exec_unknown(rv_machine_t *rv, const rv_insn_t *d) {
+    return 0;
+}
+
+static void decode_at(rv_machine_t *rv, uint32_t pc, rv_insn_t *d) {
+    // pc is word aligned unless a jalr target was misaligned
+    uint32_t instr = (pc & 3) == 0 ? mem_read32_aligned(rv, pc) : mem_read32(rv, pc);
+
+    if (predecode_rv32i_instr(instr, d) == 0 &&
+        predecode_rv32m_instr(instr, d) == 0 &&
+        predecode_rv32a_instr(instr, d) == 0 &&
+        predecode_rvv_instr(instr, d) == 0) {
+        d->handler = exec_unknown;
+        d->instr   = instr;
+        d->imm     = 0;
+        d->op      = INSTR_UNKNOWN;
+        d->rd = d->rs1 = d->rs2 = 0;
+    }
+    d->pc = pc;
+}
+
+// Stops before the instruction, unless rv_run is resuming from this
+// breakpoint : then the instruction is decoded again and executed
+static int exec_break(rv_machine_t *rv, const rv_insn_t *d) {
+    if (!rv->break_resume) {
+        rv->exit_reason = RV_EXIT_BREAK;
+        return RV_BREAK;
+    }
+    rv->break_resume = 0;
+    rv_insn_t insn;
+    decode_at(rv, d->pc, &insn);
+    return insn.handler(rv, &insn);
+}
+
+int icache_init(rv_machine_t *rv) {
+    rv->icache = calloc(1 << ICACHE_BITS, sizeof(rv_insn_t));
+    rv->icache_code_pages = calloc(1 << (32 - PAGE_SHIFT - 5), sizeof(uint32_t));
+    return rv->icache != NULL && rv->icache_code_pages != NULL ? 0 : -1;
+}
+
+void icache_free(rv_machine_t *rv) {
+    free(rv->icache);
+    free(rv->icache_code_pages);
+}
+
+// Fetch and predecode the instruction at pc into *d, and mark its page
+// as holding code so that stores into it are reported.
+void predecode_at(rv_machine_t *rv, uint32_t pc, rv_insn_t *d) {
+    decode_at(rv, pc, d);
+    if (rv->nbreakpoints != 0 && rv_breakpoint_at(rv, pc)) {
+        d->handler = exec_break;
+        d->op      = INSTR_UNKNOWN;
+    }
+    d->label = rv->icache_labels != NULL ? rv->icache_labels[d->op] : NULL;
+
+    uint32_t page = pc >> PAGE_SHIFT;
+    rv->icache_code_pages[page >> 5] |= 1u << (page & 0x1F);
+}
+
+const rv_insn_t *icache_fetch_slow(rv_machine_t *rv, uint32_t pc) {
+    rv_insn_t *d = &rv->icache[(pc >> 2) & ((1 << ICACHE_BITS) - 1)];
+    rv->icache_misses++;
+    predecode_at(rv, pc, d);
+    return d;
+}
+
+void icache_invalidate_range(rv_machine_t *rv, uint32_t addr, uint32_t len) {
+    uint32_t first = addr & ~3u;
+    uint32_t last  = (addr + len - 1) & ~3u;
+    for (uint32_t a = first; ; a += 4) {
+        rv_insn_t *d = &rv->icache[(a >> 2) & ((1 << ICACHE_BITS) - 1)];
+        if (d->handler != NULL && d->pc == a) {
+            d->handler = NULL;
+            rv->icache_invalidations++;
+        }
+        if (a == last)
+            break;
+    }
+    block_invalidate_range(rv, addr, len);
+}
+
+// Only the slots of pages marked as holding code can be valid, so a
+// program with little code is flushed without clearing the whole cache
+void icache_flush(rv_machine_t *rv) {
+    const uint32_t page_slots = 1 << (PAGE_SHIFT - 2);
+    const uint32_t max_pages  = (1 << ICACHE_BITS) / page_slots;
+    uint32_t *code = rv->icache_code_pages;
+    uint32_t pages = 0;
+    for (uint32_t w = 0; w < (1 << (32 - PAGE_SHIFT - 5)); w++) {
+        for (uint32_t bits = code[w]; bits != 0; bits &= bits - 1) {
+            uint32_t page = w * 32 + __builtin_ctz(bits);
+            if (++pages <= max_pages)
+                memset(&rv->icache[(page * page_slots) & ((1 << ICACHE_BITS) - 1)], 0,
+                       page_slots * sizeof(rv_insn_t));
+        }
+        code[w] = 0;
+    }
+    if (pages > max_pages)
+        memset(rv->icache, 0, (1 << ICACHE_BITS) * sizeof(rv_insn_t));
+}
+
+void icache_print_stats(rv_machine_t *rv, FILE *fp) {
+    uint64_t total = rv->icache_hits + rv->icache_misses;
+    fprintf(fp, "icache : hits = %llu, misses = %llu, invalidations = %llu, hit rate = %.2f%%\n",
+            (unsigned long long)rv->icache_hits, (unsigned long long)rv->icache_misses,
+            (unsigned long long)rv->icache_invalidations,
+            total ? 100.0 * rv->icache_hits / total : 0.0);
+}
@@ -0,0 +1,821 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "rv32.h"
+
+/*
+ * x86-64 JIT backend for RV32IM basic blocks
+ *
+ * run_block counts executions per block and hands blocks that reach
+ * JIT_THRESHOLD to jit_compile. The generated code has the signature
+ *
+ *     uint32_t block(uint32_t *xreg, void *mem)
+ *
+ * and returns the next pc. It runs the whole block, including the final
+ * branch or jump.
+ *
+ * Register allocation is per block. The most used guest registers are
+ * kept in host registers for the whole block: they are loaded once at
+ * entry and written back to xreg[] only at exits. Other guest registers
+ * are read from and written to xreg[] (r15 based) directly. r14 holds
+ * mem (rv->tlb, or rv->mem_base with MEM_GUARD). rax, rcx and rdx are
+ * scratch. xreg is inside the machine, so the helpers called from
+ * compiled code get the machine back from r15.
+ *
+ * Loads probe the read TLB inline and access the host page directly on a
+ * hit. Stores do the same against the write TLB (rv->tlb_w, at a fixed
+ * offset from r14), which only holds pages a store has already reached
+ * through the slow path. TLB misses and accesses that cross a page go
+ * through jit_mem_load / jit_mem_store. With MEM_GUARD they address
+ * [mem_base + addr] directly, and the host address of every access is
+ * recorded with its guest pc so jit_fault_pc can name the instruction
+ * that faulted.
+ *
+ * A store checks rv->icache_code_pages inline. If it hits a code page, it
+ * calls jit_store_notify with the caller-saved registers preserved. When
+ * that flushes the translation caches, the block writes back its
+ * registers and returns right after the store, because the rest of the
+ * block may be stale.
+ *
+ * Blocks with vector instructions, ECALL or unknown encodings are not
+ * compiled and keep running in the interpreter. Each machine has its own
+ * code cache, mapped when its first block is compiled.
+ */
+#define JIT_CODE_SIZE       (16 << 20)
+#define JIT_MAX_BLOCK_BYTES (16 << 10)
+
+// Guest pc of each compiled load and store, in code order (MEM_GUARD)
+typedef struct {
+    uint32_t off; // Offset of the access instruction in code
+    uint32_t pc;
+} jit_access_t;
+
+struct jit_cache {
+    uint8_t *code;            // Code cache (RWX)
+    uint32_t used;
+    int      failed;
+
+    jit_access_t *access;
+    uint32_t      naccess;
+    uint32_t      access_cap;
+
+    uint64_t compiled;        // Blocks compiled
+    uint64_t rejected;        // Hot blocks the JIT cannot compile
+    uint64_t code_bytes;      // Bytes of code generated
+};
+
+void jit_reset(rv_machine_t *rv) {
+    if (rv->jit == NULL)
+        return;
+    rv->jit->used = 0;
+    rv->jit->naccess = 0;
+}
+
+void jit_free(rv_machine_t *rv) {
+    jit_cache_t *c = rv->jit;
+    if (c == NULL)
+        return;
+    if (c->code != NULL)
+        munmap(c->code, JIT_CODE_SIZE);
+    free(c->access);
+    free(c);
+}
+
+// Guest pc of the load or store at host_pc, if it is in compiled code
+int jit_fault_pc(rv_machine_t *rv, uintptr_t host_pc, uint32_t *guest_pc) {
+    const jit_cache_t *c = rv->jit;
+    if (c == NULL || c->code == NULL ||
+        host_pc < (uintptr_t) c->code || host_pc >= (uintptr_t) c->code + c->used)
+        return 0;
+    uint32_t off = host_pc - (uintptr_t) c->code;
+    uint32_t lo = 0, hi = c->naccess;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (c->access[mid].off < off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == c->naccess || c->access[lo].off != off)
+        return 0;
+    *guest_pc = c->access[lo].pc;
+    return 1;
+}
+
+int jit_space_ok(rv_machine_t *rv) {
+    return rv->jit == NULL || rv->jit->used + JIT_MAX_BLOCK_BYTES <= JIT_CODE_SIZE;
+}
+
+// Called from compiled code for stores that hit a code page. Returns 1 if
+// the translation caches were flushed.
+static int jit_store_notify(rv_machine_t *rv, uint32_t addr, uint32_t len) {
+    uint32_t gen = rv->block_generation;
+    icache_invalidate_range(rv, addr, len);
+    return rv->block_generation != gen;
+}
+
+#if defined(__x86_64__)
+
+// Host registers
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Host registers available for guest registers, callee-saved first
+static const int host_pool[] = { RBX, RBP, R12, R13, RSI, RDI, R8, R9, R10, R11 };
+#define HOST_POOL_SIZE ((int)(sizeof(host_pool) / sizeof(host_pool[0])))
+
+// Condition codes for jcc / setcc / cmovcc
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_L = 0xC, CC_GE = 0xD };
+
+_Static_assert(sizeof(mem_tlb_t) == 16 && offsetof(mem_tlb_t, page) == 8,
+               "the TLB probe assumes 16-byte entries");
+
+// Emitter state, per thread so that machines on different threads can
+// compile at the same time
+static __thread uint8_t *p;            // Emit pointer
+static __thread int8_t   map[32];      // Guest register -> host register, or -1
+static __thread uint32_t dirty;        // Guest registers modified in host registers
+
+static void emit8(uint8_t b)   { *p++ = b; }
+static void emit32(uint32_t v) { memcpy(p, &v, 4); p += 4; }
+static void emit64(uint64_t v) { memcpy(p, &v, 8); p += 8; }
+
+static void emit_opcode(int opc) {
+    if (opc > 0xFF)
+        emit8(opc >> 8);
+    emit8(opc & 0xFF);
+}
+
+// op reg, rm (register direct)
+static void emit_rr(int w, int opc, int reg, int rm) {
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40)
+        emit8(rex);
+    emit_opcode(opc);
+    emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op reg, [r15 + 4 * g] (guest register slot)
+static void emit_rslot(int w, int opc, int reg, int g) {
+    emit8(0x41 | (w << 3) | ((reg >> 3) << 2));
+    emit_opcode(opc);
+    emit8(0x40 | ((reg & 7) << 3) | 7);
+    emit8(4 * g);
+}
+
+// op reg, guest register g (host register or slot)
+static void emit_rg(int w, int opc, int reg, int g) {
+    if (map[g] >= 0)
+        emit_rr(w, opc, reg, map[g]);
+    else
+        emit_rslot(w, opc, reg, g);
+}
+
+// op reg, [rcx] (host address of a guest access)
+static void emit_rmem(int opc, int reg) {
+    if (reg >= 8)
+        emit8(0x44);
+    emit_opcode(opc);
+    emit8(((reg & 7) << 3) | 1);
+}
+
+// Group-1 ALU op with a 32-bit immediate : op rm, imm
+static void emit_alu_imm(int digit, int rm, int32_t imm) {
+    if (rm >= 8)
+        emit8(0x41);
+    if (imm >= -128 && imm <= 127) {
+        emit8(0x83);
+        emit8(0xC0 | (digit << 3) | (rm & 7));
+        emit8((uint8_t) imm);
+    } else {
+        emit8(0x81);
+        emit8(0xC0 | (digit << 3) | (rm & 7));
+        emit32((uint32_t) imm);
+    }
+}
+
+static void emit_mov_imm(int reg, uint32_t imm) {
+    if (reg >= 8)
+        emit8(0x41);
+    emit8(0xB8 + (reg & 7));
+    emit32(imm);
+}
+
+static void emit_push(int reg) {
+    if (reg >= 8)
+        emit8(0x41);
+    emit8(0x50 + (reg & 7));
+}
+
+static void emit_pop(int reg) {
+    if (reg >= 8)
+        emit8(0x41);
+    emit8(0x58 + (reg & 7));
+}
+
+// reg = guest register g (32-bit, zero-extended into the 64-bit register)
+static void emit_load_guest(int reg, int g) {
+    if (g == 0)
+        emit_rr(0, 0x33, reg, reg);   // xor reg, reg
+    else
+        emit_rg(0, 0x8B, reg, g);     // mov reg, g
+}
+
+// guest register g = reg
+static void emit_store_guest(int g, int reg) {
+    if (g == 0)
+        return;
+    if (map[g] >= 0) {
+        emit_rr(0, 0x8B, map[g], reg);
+        dirty |= 1u << g;
+    } else {
+        emit_rslot(0, 0x89, reg, g);
+    }
+}
+
+// eax = eax <op> guest register g, for the 0x03-style ALU opcodes
+static void emit_alu_guest(int opc, int g) {
+    if (g == 0) {
+        emit_rr(0, 0x33, RCX, RCX);
+        emit_rr(0, opc, RAX, RCX);
+    } else {
+        emit_rg(0, opc, RAX, g);
+    }
+}
+
+static void emit_writeback(uint32_t regs) {
+    for (int g = 1; g < 32; g++) {
+        if ((regs >> g) & 1)
+            emit_rslot(0, 0x89, map[g], g);
+    }
+}
+
+static void emit_epilogue(void) {
+    emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08); // add rsp, 8
+    emit_pop(R15);
+    emit_pop(R14);
+    emit_pop(R13);
+    emit_pop(R12);
+    emit_pop(RBP);
+    emit_pop(RBX);
+    emit8(0xC3);                                        // ret
+}
+
+// Leave the block with eax = next pc
+static void emit_exit(uint32_t regs) {
+    emit_writeback(regs);
+    emit_epilogue();
+}
+
+static void emit_setcc_eax(int cc) {
+    emit8(0x0F); emit8(0x90 | cc); emit8(0xC0); // setcc al
+    emit8(0x0F); emit8(0xB6); emit8(0xC0);      // movzx eax, al
+}
+
+static uint8_t *emit_jcc32(int cc) {
+    emit8(0x0F); emit8(0x80 | cc);
+    emit32(0);
+    return p - 4;
+}
+
+static uint8_t *emit_jcc8(int cc) {
+    emit8(0x70 | cc);
+    emit8(0);
+    return p - 1;
+}
+
+static uint8_t *emit_jmp8(void) {
+    emit8(0xEB);
+    emit8(0);
+    return p - 1;
+}
+
+static uint8_t *emit_jmp32(void) {
+    emit8(0xE9);
+    emit32(0);
+    return p - 4;
+}
+
+static void patch32(uint8_t *at) {
+    int32_t rel = (int32_t)(p - (at + 4));
+    memcpy(at, &rel, 4);
+}
+
+static void patch8(uint8_t *at) {
+    *at = (uint8_t)(p - (at + 1));
+}
+
+static void emit_call(void *fn) {
+    emit8(0x48); emit8(0xB8); emit64((uint64_t)(uintptr_t) fn); // mov rax, imm64
+    emit8(0xFF); emit8(0xD0);                                   // call rax
+}
+
+// rdi = the machine, the first argument of the helpers
+static void emit_machine_arg(void) {
+    emit8(0x49); emit8(0x8D); emit8(0xBF);              // lea rdi, [r15 - offset of xreg]
+    emit32((uint32_t) -(int32_t) offsetof(rv_machine_t, xreg));
+}
+
+// Preserve the caller-saved host registers holding guest registers
+// around a call, keeping rsp 16-byte aligned
+static __thread int saved[HOST_POOL_SIZE];
+static __thread int nsaved;
+
+static void emit_save_caller(void) {
+    nsaved = 0;
+    for (int g = 1; g < 32; g++) {
+        int r = map[g];
+        if (r == RSI || r == RDI || (r >= R8 && r <= R11))
+            saved[nsaved++] = r;
+    }
+    for (int i = 0; i < nsaved; i++)
+        emit_push(saved[i]);
+    if (nsaved & 1) {
+        emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08); // sub rsp, 8
+    }
+}
+
+static void emit_restore_caller(void) {
+    if (nsaved & 1) {
+        emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08); // add rsp, 8
+    }
+    for (int i = nsaved - 1; i >= 0; i--)
+        emit_pop(saved[i]);
+}
+
+// Store helper slow path : notify the caches and leave if they were flushed
+static void emit_store_notify(rv_machine_t *rv, const rv_insn_t *d, uint32_t len) {
+    // eax = address
+    emit_rr(0, 0x8B, RDX, RAX);                       // mov edx, eax
+    emit8(0xC1); emit8(0xEA); emit8(PAGE_SHIFT);      // shr edx, 12
+    emit8(0x48); emit8(0xB9);                         // mov rcx, icache_code_pages
+    emit64((uint64_t)(uintptr_t) rv->icache_code_pages);
+    emit8(0x0F); emit8(0xA3); emit8(0x11);            // bt [rcx], edx
+    uint8_t *to_slow = NULL;
+    if (len > 1) {
+        to_slow = emit_jcc32(CC_B);                   // jc slow
+        emit8(0x8D); emit8(0x50); emit8(len - 1);     // lea edx, [rax + len - 1]
+        emit8(0xC1); emit8(0xEA); emit8(PAGE_SHIFT);  // shr edx, 12
+        emit8(0x0F); emit8(0xA3); emit8(0x11);        // bt [rcx], edx
+    }
+    uint8_t *to_skip = emit_jcc32(CC_AE);             // jnc skip
+    if (to_slow != NULL)
+        patch32(to_slow);
+
+    emit_save_caller();
+    emit_rr(0, 0x8B, RSI, RAX);                       // mov esi, eax
+    emit_mov_imm(RDX, len);                           // mov edx, len
+    emit_machine_arg();
+    emit_call((void *) jit_store_notify);
+    emit_restore_caller();
+    emit8(0x85); emit8(0xC0);                         // test eax, eax
+    uint8_t *to_skip2 = emit_jcc32(CC_E);             // jz skip
+    emit_mov_imm(RAX, d->pc + 4);
+    emit_exit(dirty);
+
+    patch32(to_skip);
+    patch32(to_skip2);
+}
+
+// eax = guest register rs1 + imm
+static void emit_addr(const rv_insn_t *d) {
+    emit_load_guest(RAX, d->rs1);
+    if (d->imm != 0)
+        emit_alu_imm(0, RAX, d->imm);
+}
+
+// Guest memory slow paths : TLB misses and accesses crossing a page
+static uint32_t jit_mem_load(rv_machine_t *rv, uint32_t addr, uint32_t op) {
+    switch (op) {
+        case INSTR_LB:  return (int32_t)(int8_t) mem_read8(rv, addr);
+        case INSTR_LH:  return (int32_t)(int16_t) mem_read16(rv, addr);
+        case INSTR_LBU: return mem_read8(rv, addr);
+        case INSTR_LHU: return mem_read16(rv, addr);
+        default:        return mem_read32(rv, addr);
+    }
+}
+
+static uint32_t jit_mem_store(rv_machine_t *rv, uint32_t addr, uint32_t val, uint32_t size) {
+    if (size == 1)
+        mem_write8(rv, addr, val);
+    else if (size == 2)
+        mem_write16(rv, addr, val);
+    else
+        mem_write32(rv, addr, val);
+    return addr;
+}
+
+#ifdef MEM_GUARD
+// eax = guest address. rcx = host address in the guard reservation;
+// there is no slow path, out-of-range accesses fault.
+static uint8_t *emit_host_addr(uint32_t size, int write, uint8_t **to_miss2) {
+    emit8(0x49); emit8(0x8D); emit8(0x0C); emit8(0x06);    // lea rcx, [r14 + rax]
+    *to_miss2 = NULL;
+    return NULL;
+}
+#else
+// Offset of the write TLB from the read TLB (r14)
+#define JIT_TLB_W ((uint32_t)(offsetof(rv_machine_t, tlb_w) - offsetof(rv_machine_t, tlb)))
+
+// eax = guest address. Falls through with rcx = host address when the
+// page is in the read (or, for a store, the write) TLB and the access
+// stays inside it; otherwise jumps to the returned patch point.
+static uint8_t *emit_host_addr(uint32_t size, int write, uint8_t **to_miss2) {
+    emit_rr(0, 0x8B, RDX, RAX);                            // mov edx, eax
+    emit8(0xC1); emit8(0xEA); emit8(PAGE_SHIFT);           // shr edx, 12
+    emit_rr(0, 0x8B, RCX, RDX);                            // mov ecx, edx
+    emit_alu_imm(4, RCX, (1 << MEM_TLB_BITS) - 1);         // and ecx, mask
+    emit8(0xC1); emit8(0xE1); emit8(4);                    // shl ecx, 4
+    emit8(0xFF); emit8(0xC2);                              // inc edx
+    if (write) {
+        emit8(0x41); emit8(0x39); emit8(0x94); emit8(0x0E); // cmp [r14 + rcx + tlb_w], edx
+        emit32(JIT_TLB_W);
+    } else {
+        emit8(0x41); emit8(0x39); emit8(0x14); emit8(0x0E); // cmp [r14 + rcx], edx
+    }
+    uint8_t *to_miss = emit_jcc32(CC_NE);
+    emit_rr(0, 0x8B, RDX, RAX);                            // mov edx, eax
+    emit_alu_imm(4, RDX, MEM_PAGE_MASK);                   // and edx, 0xfff
+    *to_miss2 = NULL;
+    if (size > 1) {
+        emit_alu_imm(7, RDX, MEM_PAGE_SIZE - size);        // cmp edx, page - size
+        *to_miss2 = emit_jcc32(CC_A);
+    }
+    if (write) {
+        emit8(0x49); emit8(0x8B); emit8(0x8C); emit8(0x0E); // mov rcx, [r14 + rcx + tlb_w + 8]
+        emit32(JIT_TLB_W + offsetof(mem_tlb_t, page));
+    } else {
+        emit8(0x49); emit8(0x8B); emit8(0x4C); emit8(0x0E); // mov rcx, [r14 + rcx + 8]
+        emit8(offsetof(mem_tlb_t, page));
+    }
+    emit_rr(1, 0x03, RCX, RDX);                            // add rcx, rdx
+    return to_miss;
+}
+#endif
+
+// Record the guest pc of the access emitted next
+static void note_access(jit_cache_t *c, const rv_insn_t *d) {
+#ifdef MEM_GUARD
+    if (c->naccess == c->access_cap) {
+        uint32_t cap = c->access_cap ? 2 * c->access_cap : 4096;
+        jit_access_t *a = realloc(c->access, cap * sizeof(jit_access_t));
+        if (a == NULL) {
+            fprintf(stderr, "Error: Out of memory for JIT tables\n");
+            exit(1);
+        }
+        c->access = a;
+        c->access_cap = cap;
+    }
+    c->access[c->naccess].off = p - c->code;
+    c->access[c->naccess].pc  = d->pc;
+    c->naccess++;
+#endif
+}
+
+static void emit_load(rv_machine_t *rv, const rv_insn_t *d) {
+    static const int opc[] = { 0x0FBE, 0x0FBF, 0x8B, 0x0FB6, 0x0FB7 };
+    static const uint32_t sizes[] = { 1, 2, 4, 1, 2 };
+    uint8_t *to_miss2;
+    emit_addr(d);
+    uint8_t *to_miss = emit_host_addr(sizes[d->op - INSTR_LB], 0, &to_miss2);
+    note_access(rv->jit, d);
+    emit_rmem(opc[d->op - INSTR_LB], RAX);
+    if (to_miss != NULL) {
+        uint8_t *to_done = emit_jmp32();
+
+        patch32(to_miss);
+        if (to_miss2 != NULL)
+            patch32(to_miss2);
+        emit_save_caller();
+        emit_rr(0, 0x8B, RSI, RAX);                        // mov esi, eax
+        emit_mov_imm(RDX, d->op);                          // mov edx, op
+        emit_machine_arg();
+        emit_call((void *) jit_mem_load);
+        emit_restore_caller();
+
+        patch32(to_done);
+    }
+    emit_store_guest(d->rd, RAX);
+}
+
+static void emit_store(rv_machine_t *rv, const rv_insn_t *d, uint32_t size) {
+    uint8_t *to_miss2;
+    emit_addr(d);
+    uint8_t *to_miss = emit_host_addr(size, 1, &to_miss2);
+    emit_load_guest(RDX, d->rs2);
+    note_access(rv->jit, d);
+    if (size == 2)
+        emit8(0x66);
+    emit_rmem(size == 1 ? 0x88 : 0x89, RDX);
+    if (to_miss != NULL) {
+        uint8_t *to_done = emit_jmp32();
+
+        patch32(to_miss);
+        if (to_miss2 != NULL)
+            patch32(to_miss2);
+        emit_save_caller();
+        emit_load_guest(RDX, d->rs2);                      // Before rsi/rdi change
+        emit_rr(0, 0x8B, RSI, RAX);                        // mov esi, eax
+        emit_mov_imm(RCX, size);                           // mov ecx, size
+        emit_machine_arg();
+        emit_call((void *) jit_mem_store);                 // Returns the address
+        emit_restore_caller();
+
+        patch32(to_done);
+    }
+    emit_store_notify(rv, d, size);
+}
+
+// 64-bit operand for MULH* : movsxd (signed) or mov (unsigned)
+static void emit_load_guest64(int reg, int g, int sign) {
+    if (g == 0)
+        emit_rr(0, 0x33, reg, reg);
+    else if (sign)
+        emit_rg(1, 0x63, reg, g);   // movsxd reg, g
+    else
+        emit_rg(0, 0x8B, reg, g);   // mov reg32, g (zero-extends)
+}
+
+static void emit_divrem(const rv_insn_t *d, int is_signed, int is_rem) {
+    emit_load_guest(RAX, d->rs1);
+    emit_load_guest(RCX, d->rs2);
+    emit8(0x85); emit8(0xC9);                          // test ecx, ecx
+    uint8_t *to_zero = emit_jcc8(CC_E);
+    uint8_t *to_ovf = NULL;
+    if (is_signed) {
+        emit8(0x83); emit8(0xF9); emit8(0xFF);         // cmp ecx, -1
+        uint8_t *to_do = emit_jcc8(CC_NE);
+        emit8(0x3D); emit32(0x80000000);               // cmp eax, INT32_MIN
+        to_ovf = emit_jcc8(CC_E);
+        patch8(to_do);
+        emit8(0x99);                                   // cdq
+        emit8(0xF7); emit8(0xF9);                      // idiv ecx
+    } else {
+        emit8(0x31); emit8(0xD2);                      // xor edx, edx
+        emit8(0xF7); emit8(0xF1);                      // div ecx
+    }
+    uint8_t *to_done = emit_jmp8();
+
+    // Division by zero : quotient -1, remainder = dividend
+    patch8(to_zero);
+    if (is_rem)
+        emit_rr(0, 0x8B, RDX, RAX);                    // mov edx, eax
+    else
+        emit_mov_imm(RAX, 0xFFFFFFFF);
+    uint8_t *to_done2 = emit_jmp8();
+
+    // INT32_MIN / -1 : quotient INT32_MIN (already in eax), remainder 0
+    if (to_ovf != NULL) {
+        patch8(to_ovf);
+        emit8(0x31); emit8(0xD2);                      // xor edx, edx
+    }
+
+    patch8(to_done);
+    patch8(to_done2);
+    emit_store_guest(d->rd, is_rem ? RDX : RAX);
+}
+
+static int jit_supported(uint8_t op) {
+    return op <= INSTR_AND || (op >= INSTR_MUL && op <= INSTR_REMU);
+}
+
+static void alloc_registers(const rv_insn_t *ops, uint32_t len) {
+    uint32_t uses[32] = {0};
+    for (uint32_t i = 0; i < len; i++) {
+        uses[ops[i].rd]++;
+        uses[ops[i].rs1]++;
+        uses[ops[i].rs2]++;
+    }
+    uses[0] = 0;
+    memset(map, -1, sizeof(map));
+    for (int k = 0; k < HOST_POOL_SIZE; k++) {
+        int best = 0;
+        for (int g = 1; g < 32; g++) {
+            if (map[g] < 0 && uses[g] > uses[best])
+                best = g;
+        }
+        if (best == 0 || uses[best] < 2)
+            break;
+        map[best] = host_pool[k];
+    }
+}
+
+jit_fn_t jit_compile(rv_machine_t *rv, const rv_insn_t *ops, uint32_t len) {
+    if (rv->jit == NULL && (rv->jit = calloc(1, sizeof(jit_cache_t))) == NULL)
+        return NULL;
+    jit_cache_t *c = rv->jit;
+    for (uint32_t i = 0; i < len; i++) {
+        if (!jit_supported(ops[i].op)) {
+            c->rejected++;
+            return NULL;
+        }
+    }
+
+    if (c->code == NULL) {
+        if (c->failed)
+            return NULL;
+        void *m = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) {
+            fprintf(stderr, "Warning: Cannot allocate JIT code cache, using the interpreter\n");
+            c->failed = 1;
+            return NULL;
+        }
+        c->code = m;
+    }
+    if (!jit_space_ok(rv))
+        return NULL;
+
+    uint8_t *start = c->code + c->used;
+    p = start;
+    dirty = 0;
+    alloc_registers(ops, len);
+
+    // Prologue
+    emit_push(RBX);
+    emit_push(RBP);
+    emit_push(R12);
+    emit_push(R13);
+    emit_push(R14);
+    emit_push(R15);
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08); // sub rsp, 8
+    emit8(0x49); emit8(0x89); emit8(0xFF);              // mov r15, rdi
+    emit8(0x49); emit8(0x89); emit8(0xF6);              // mov r14, rsi
+    for (int g = 1; g < 32; g++) {
+        if (map[g] >= 0)
+            emit_rslot(0, 0x8B, map[g], g);
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        const rv_insn_t *d = &ops[i];
+        switch (d->op) {
+            case INSTR_LUI:
+                emit_mov_imm(RAX, d->imm);
+                emit_store_guest(d->rd, RAX);
+                break;
+            case INSTR_AUIPC:
+                emit_mov_imm(RAX, d->pc + d->imm);
+                emit_store_guest(d->rd, RAX);
+                break;
+            case INSTR_JAL:
+                emit_mov_imm(RAX, d->pc + 4);
+                emit_store_guest(d->rd, RAX);
+                emit_mov_imm(RAX, d->pc + d->imm);
+                emit_exit(dirty);
+                break;
+            case INSTR_JALR:
+                emit_addr(d);
+                emit_alu_imm(4, RAX, -2);                 // and eax, ~1
+                emit_mov_imm(RCX, d->pc + 4);
+                emit_store_guest(d->rd, RCX);
+                emit_exit(dirty);
+                break;
+            case INSTR_BEQ:
+            case INSTR_BNE:
+            case INSTR_BLT:
+            case INSTR_BGE:
+            case INSTR_BLTU:
+            case INSTR_BGEU: {
+                static const int cc[] = { CC_E, CC_NE, CC_L, CC_GE, CC_B, CC_AE };
+                emit_load_guest(RAX, d->rs1);
+                if (d->rs2 == 0)
+                    emit_alu_imm(7, RAX, 0);              // cmp eax, 0
+                else
+                    emit_rg(0, 0x3B, RAX, d->rs2);        // cmp eax, rs2
+                emit_writeback(dirty);                    // mov keeps the flags
+                emit_mov_imm(RAX, d->pc + 4);
+                emit_mov_imm(RCX, d->pc + d->imm);
+                emit_rr(0, 0x0F40 | cc[d->op - INSTR_BEQ], RAX, RCX); // cmovcc eax, ecx
+                emit_epilogue();
+                break;
+            }
+            case INSTR_LB:
+            case INSTR_LH:
+            case INSTR_LW:
+            case INSTR_LBU:
+            case INSTR_LHU:
+                emit_load(rv, d);
+                break;
+            case INSTR_SB:
+            case INSTR_SH:
+            case INSTR_SW:
+                emit_store(rv, d, 1u << (d->op - INSTR_SB));
+                break;
+            case INSTR_ADDI:
+                emit_addr(d);
+                emit_store_guest(d->rd, RAX);
+                break;
+            case INSTR_SLTI:
+            case INSTR_SLTIU:
+                emit_load_guest(RAX, d->rs1);
+                emit_alu_imm(7, RAX, d->imm);             // cmp eax, imm
+                emit_setcc_eax(d->op == INSTR_SLTI ? CC_L : CC_B);
+                emit_store_guest(d->rd, RAX);
+                break;
+            case INSTR_XORI:
+            case INSTR_ORI:
+            case INSTR_ANDI: {
+                int digit = d->op == INSTR_XORI ? 6 : d->op == INSTR_ORI ? 1 : 4;
+                emit_load_guest(RAX, d->rs1);
+                emit_alu_imm(digit, RAX, d->imm);
+                emit_store_guest(d->rd, RAX);
+                break;
+            }
+            case INSTR_SLLI:
+            case INSTR_SRLI:
+            case INSTR_SRAI: {
+                int digit = d->op == INSTR_SLLI ? 4 : d->op == INSTR_SRLI ? 5 : 7;
+                emit_load_guest(RAX, d->rs1);
+                emit8(0xC1); emit8(0xC0 | (digit << 3)); emit8(d->imm);
+                emit_store_guest(d->rd, RAX);
+                break;
+            }
+            case INSTR_ADD:
+            case INSTR_SUB:
+            case INSTR_XOR:
+            case INSTR_OR:
+            case INSTR_AND: {
+                int opc = d->op == INSTR_ADD ? 0x03 : d->op == INSTR_SUB ? 0x2B :
+                          d->op == INSTR_XOR ? 0x33 : d->op == INSTR_OR ? 0x0B : 0x23;
+                emit_load_guest(RAX, d->rs1);
+                emit_alu_guest(opc, d->rs2);
+                emit_store_guest(d->rd, RAX);
+                break;
+            }
+            case INSTR_SLL:
+            case INSTR_SRL:
+            case INSTR_SRA: {
+                int digit = d->op == INSTR_SLL ? 4 : d->op == INSTR_SRL ? 5 : 7;
+                emit_load_guest(RCX, d->rs2);
+                emit_load_guest(RAX, d->rs1);
+                emit8(0xD3); emit8(0xC0 | (digit << 3));  // shift eax, cl
+                emit_store_guest(d->rd, RAX);
+                break;
+            }
+            case INSTR_SLT:
+            case INSTR_SLTU:
+                emit_load_guest(RAX, d->rs1);
+                emit_alu_guest(0x3B, d->rs2);             // cmp eax, rs2
+                emit_setcc_eax(d->op == INSTR_SLT ? CC_L : CC_B);
+                emit_store_guest(d->rd, RAX);
+                break;
+            case INSTR_MUL:
+                emit_load_guest(RAX, d->rs1);
+                emit_alu_guest(0x0FAF, d->rs2);           // imul eax, rs2
+                emit_store_guest(d->rd, RAX);
+                break;
+            case INSTR_MULH:
+            case INSTR_MULHSU:
+            case INSTR_MULHU:
+                emit_load_guest64(RAX, d->rs1, d->op != INSTR_MULHU);
+                emit_load_guest64(RCX, d->rs2, d->op == INSTR_MULH);
+                emit_rr(1, 0x0FAF, RAX, RCX);              // imul rax, rcx
+                emit8(0x48); emit8(0xC1); emit8(0xE8); emit8(32); // shr rax, 32
+                emit_store_guest(d->rd, RAX);
+                break;
+            case INSTR_DIV:  emit_divrem(d, 1, 0); break;
+            case INSTR_DIVU: emit_divrem(d, 0, 0); break;
+            case INSTR_REM:  emit_divrem(d, 1, 1); break;
+            case INSTR_REMU: emit_divrem(d, 0, 1); break;
+        }
+    }
+
+    // Block split by length or page boundary : fall through to the next pc
+    const rv_insn_t *last = &ops[len - 1];
+    if (last->op < INSTR_JAL || last->op > INSTR_BGEU) {
+        emit_mov_imm(RAX, last->pc + 4);
+        emit_exit(dirty);
+    }
+
+    uint32_t size = p - start;
+    if (size > JIT_MAX_BLOCK_BYTES) {
+        fprintf(stderr, "Error: JIT block at 0x%08x overflowed (%u bytes)\n", ops[0].pc, size);
+        abort();
+    }
+    c->used += (size + 15) & ~15u;
+    c->compiled++;
+    c->code_bytes += size;
+    return (jit_fn_t) start;
+}
+
+#else
+
+jit_fn_t jit_compile(rv_machine_t *rv, const rv_insn_t *ops, uint32_t len) {
+    if (rv->jit == NULL && (rv->jit = calloc(1, sizeof(jit_cache_t))) == NULL)
+        return NULL;
+    rv->jit->rejected++;
+    return NULL;
+}
+
+#endif
+
+void jit_print_stats(rv_machine_t *rv, FILE *fp) {
+    static const jit_cache_t none;
+    const jit_cache_t *c = rv->jit != NULL ? rv->jit : &none;
+    fprintf(fp, "jit : compiled = %llu, rejected = %llu, code bytes = %llu, executed = %llu\n",
+            (unsigned long long)c->compiled, (unsigned long long)c->rejected,
+            (unsigned long long)c->code_bytes, (unsigned long long)rv->jit_executed);
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rv32.h"
+
+/*
+ * Machine
+ *
+ * rv_create builds one guest with empty memory, x0-x31 and pc cleared and
+ * VLEN at VLEN_MIN. The predecode cache is allocated up front; the block
+ * cache and the JIT code cache are allocated by the engines that use
+ * them. rv_destroy releases all of it, including file mappings made by
+ * the loader. rv_reset readies a machine for another program without
+ * giving up its caches, so a host thread can run many short programs on
+ * one machine.
+ *
+ * rv_create_hart adds a hart to the guest of boot : it shares boot's
+ * memory, starts at boot's pc and has boot's engine and VLEN, with
+ * mhartid = hartid. The memory goes away with the last of its harts.
+ * Resetting a hart gives it memory of its own again.
+ *
+ * rv_run dispatches to the engine picked at creation; the handler loop
+ * itself is run_interp below. It returns when the instruction budget is
+ * used up, at a breakpoint, after an ECALL or on a guest access fault
+ * (MEM_GUARD builds), with the reason and the instructions retired. The
+ * block and jit engines check the budget once per block; a block that
+ * does not fit in what is left is interpreted up to the budget. A run
+ * that starts on a breakpoint executes that instruction, so a stopped
+ * machine can be resumed with another rv_run.
+ *
+ * After a fault in compiled code, registers the block wrote before the
+ * faulting access may not have been written back.
+ *
+ * The accessors are for embedders and see the same state as the engines.
+ * Guest memory written through rv_write_mem is kept coherent with cached
+ * code.
+ */
+// The best kernel set, unless vkern_init already picked one
+static void vkern_default(void) {
+    if (vkern_isa == NULL)
+        vkern_init(NULL);
+}
+
+rv_machine_t *rv_create(int engine) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, vkern_default);
+    rv_machine_t *rv = calloc(1, sizeof(rv_machine_t));
+    if (rv == NULL)
+        return NULL;
+    rv->engine = engine;
+    if (mem_init(rv) != 0 || icache_init(rv) != 0 || rvv_set_vlen(rv, VLEN_MIN) != 0) {
+        rv_destroy(rv);
+        return NULL;
+    }
+    return rv;
+}
+
+rv_machine_t *rv_create_hart(rv_machine_t *boot, uint32_t hartid) {
+    rv_machine_t *rv = calloc(1, sizeof(rv_machine_t));
+    if (rv == NULL)
+        return NULL;
+    rv->engine = boot->engine;
+    rv->hartid = hartid;
+    rv->pc     = boot->pc;
+    mem_share(rv, boot);
+    if (icache_init(rv) != 0 || rvv_set_vlen(rv, boot->vlen) != 0) {
+        rv_destroy(rv);
+        return NULL;
+    }
+    return rv;
+}
+
+// Guest memory is released and every cache emptied, but the allocations
+// of the caches are kept for the next program
+int rv_reset(rv_machine_t *rv) {
+    mem_free(rv);
+    if (mem_init(rv) != 0)
+        return -1;
+    icache_flush(rv);
+    if (rv->blocks != NULL)
+        block_flush(rv);
+    if (rvv_set_vlen(rv, rv->vlen) != 0)
+        return -1;
+    rv->pc = 0;
+    memset(rv->xreg, 0, sizeof(rv->xreg));
+    rv->vtype = 0;
+    rv->instret = 0;
+    rv->nbreakpoints = 0;
+    rv->reserve_valid = 0;
+    return 0;
+}
+
+void rv_destroy(rv_machine_t *rv) {
+    if (rv == NULL)
+        return;
+    block_free(rv);
+    rvv_free(rv);
+    icache_free(rv);
+    mem_free(rv);
+    free(rv);
+}
+
+// ELF files are loaded by segment and start at their entry point,
+// anything else is a flat binary loaded at address 0
+int rv_load(rv_machine_t *rv, const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Cannot open file %s\n", path);
+        return -1;
+    }
+
+    uint8_t head[4];
+    size_t head_len = fread(head, 1, sizeof(head), fp);
+    if (elf_is_elf(head, head_len)) {
+        fclose(fp);
+        uint32_t entry;
+        if (elf_load(rv, path, &entry) != 0)
+            return -1;
+        rv->pc = entry;
+        return 0;
+    }
+
+    // Load program into memory, one page at a time
+    fseek(fp, 0, SEEK_SET);
+    uint8_t buf[MEM_PAGE_SIZE];
+    uint32_t addr = 0;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        rv_write_mem(rv, addr, buf, n);
+        addr += n;
+        if (addr == 0) {
+            fprintf(stderr, "Warning: File %s is too large, only 4 GiB will be loaded\n", path);
+            break;
+        }
+    }
+    if (ferror(fp)) {
+        fprintf(stderr, "Error: fread failed to read file %s\n", path);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    mem_map_ram(rv, 0, MEM_FLAT_SIZE);
+    rv->pc = 0;
+    return 0;
+}
+
+// The handler loop : one icache lookup and handler call per instruction
+uint64_t run_interp(rv_machine_t *rv, uint64_t max_cycle) {
+    uint64_t start = rv->instret;
+    // Trace output after each instruction, decided once for the run
+    int staged = trace_harts_on();
+    int tail = staged || trace_level >= TRACE_FULL;
+
+    while (rv->instret - start < max_cycle) {
+        const rv_insn_t *d = icache_lookup(rv, rv->pc);
+        debug("%08x : %08x : ", rv->pc, d->instr);
+
+        trace_rec_t *r = trace_bin_on() ? trace_begin(rv, d) : NULL;
+
+        int instr_valid = d->handler(rv, d);
+        if (r != NULL)
+            trace_end(rv, r, instr_valid);
+
+        if (instr_valid != 1) {
+            if (instr_valid != 0) {
+                rv->instret += (instr_valid == RV_HALT);
+                if (staged)
+                    trace_commit(rv);
+                break;
+            }
+            debug("unknown : instr = 0x%08x\n", d->instr);
+            rv->pc = rv->pc + 4;  
+        }
+        if (__builtin_expect(tail, 0)) {
+            debug("--------------------\n");
+            if (staged)
+                trace_commit(rv);
+        }
+        rv->instret++;
+    }
+    return rv->instret - start;
+}
+
+rv_exit_t rv_run(rv_machine_t *rv, uint64_t budget) {
+    rv_exit_t e;
+    uint64_t start = rv->instret;
+    rv->exit_reason  = RV_EXIT_BUDGET;
+    rv->exit_value   = 0;
+    rv->break_resume = rv->nbreakpoints != 0 && rv_breakpoint_at(rv, rv->pc);
+#ifdef MEM_GUARD
+    rv_machine_t *outer = mem_running;
+    sigjmp_buf *outer_jmp = rv->fault_jmp;
+    sigjmp_buf fault;
+    mem_running = rv;
+    rv->fault_jmp = &fault;
+    // The handler runs with SA_NODEFER, so the signal mask needs no restoring
+    if (sigsetjmp(fault, 0) != 0) {
+        rv->exit_reason = RV_EXIT_FAULT;
+        rv->exit_value  = rv->fault_addr;
+        if (trace_harts_on())
+            trace_commit(rv);
+    } else
+#endif
+    switch (rv->engine) {
+        case RV_ENGINE_THREADED: run_threaded(rv, budget); break;
+        case RV_ENGINE_BLOCK:
+        case RV_ENGINE_JIT:      run_block(rv, budget); break;
+        default:                 run_interp(rv, budget); break;
+    }
+#ifdef MEM_GUARD
+    mem_running = outer;
+    rv->fault_jmp = outer_jmp;
+#endif
+    e.reason  = rv->exit_reason;
+    e.pc      = rv->pc;
+    e.value   = rv->exit_value;
+    e.instret = rv->instret - start;
+    return e;
+}
+
+// The cached copies of the instruction at pc are dropped, so the next
+// fetch sees the change
+int rv_set_breakpoint(rv_machine_t *rv, uint32_t pc) {
+    if (rv_breakpoint_at(rv, pc))
+        return 0;
+    if (rv->nbreakpoints == RV_BREAKPOINTS_MAX)
+        return -1;
+    rv->breakpoints[rv->nbreakpoints++] = pc;
+    icache_invalidate_range(rv, pc, 4);
+    return 0;
+}
+
+void rv_clear_breakpoint(rv_machine_t *rv, uint32_t pc) {
+    for (uint32_t i = 0; i < rv->nbreakpoints; i++) {
+        if (rv->breakpoints[i] == pc) {
+            rv->breakpoints[i] = rv->breakpoints[--rv->nbreakpoints];
+            icache_invalidate_range(rv, pc, 4);
+            return;
+        }
+    }
+}
+
+int rv_breakpoint_at(const rv_machine_t *rv, uint32_t pc) {
+    for (uint32_t i = 0; i < rv->nbreakpoints; i++) {
+        if (rv->breakpoints[i] == pc)
+            return 1;
+    }
+    return 0;
+}
+
+uint32_t rv_get_reg(const rv_machine_t *rv, uint32_t r) {
+    return r < 32 ? rv->xreg[r] : 0;
+}
+
+void rv_set_reg(rv_machine_t *rv, uint32_t r, uint32_t val) {
+    if (r > 0 && r < 32)
+        rv->xreg[r] = val;
+}
+
+uint32_t rv_get_pc(const rv_machine_t *rv) {
+    return rv->pc;
+}
+
+void rv_set_pc(rv_machine_t *rv, uint32_t pc) {
+    rv->pc = pc;
+}
+
+void rv_read_mem(rv_machine_t *rv, uint32_t addr, void *dst, uint32_t len) {
+    mem_read_block(rv, addr, dst, len);
+}
+
+// Cached code overlapping the range is dropped, one page at a time
+void rv_write_mem(rv_machine_t *rv, uint32_t addr, const void *src, uint32_t len) {
+    const uint8_t *s = src;
+    while (len > 0) {
+        uint32_t n = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (n > len)
+            n = len;
+        mem_write_block(rv, addr, s, n);
+        icache_notify_store(rv, addr, n);
+        addr += n;
+        s += n;
+        len -= n;
+    }
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "rv32.h"
+
+/*
+ * mem_bench : per-access cost of the guest memory accessors
+ *
+ * Each test walks a 16 KiB guest buffer (four pages, so the TLB always
+ * hits) and reports nanoseconds per access for
+ *
+ *     bytes : one mem_read8 / mem_write8 per byte, as the vector element
+ *             copies used to do
+ *     split : one translation, then the value assembled from or split
+ *             into bytes, as the scalar loads and stores used to do
+ *     word  : the mem_read / mem_write accessors of rv32.h
+ *
+ * for aligned addresses and for addresses one byte off. Compilers that
+ * merge adjacent byte accesses (GCC at -O2) turn split into word; the
+ * per-byte translations of bytes cannot be merged.
+ *
+ * Build: gcc -O2 -o mem_bench mem_bench.c mem_dev.c
+ * Usage: mem_bench [iterations]
+ */
+
+static rv_machine_t *rv; // Only its memory and TLB are used
+
+#ifdef MEM_GUARD
+int jit_fault_pc(rv_machine_t *rv, uintptr_t host_pc, uint32_t *guest_pc) {
+    return 0;
+}
+#else
+void sched_access(rv_machine_t *rv, uint32_t page, int write) {
+}
+#endif
+
+#define BENCH_BASE  0x10000
+#define BENCH_BYTES (16 << 10)
+#define BENCH_MASK  (BENCH_BYTES - 1)
+
+static uint32_t read32_bytes(uint32_t addr) {
+    return mem_read8(rv, addr) | (mem_read8(rv, addr + 1) << 8) |
+           (mem_read8(rv, addr + 2) << 16) | ((uint32_t) mem_read8(rv, addr + 3) << 24);
+}
+
+static uint32_t read32_split(uint32_t addr) {
+    if ((addr & MEM_PAGE_MASK) > MEM_PAGE_SIZE - 4)
+        return read32_bytes(addr);
+    const uint8_t *p = mem_ptr(rv, addr);
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void write32_bytes(uint32_t addr, uint32_t val) {
+    mem_write8(rv, addr, val & 0xFF);
+    mem_write8(rv, addr + 1, (val >> 8) & 0xFF);
+    mem_write8(rv, addr + 2, (val >> 16) & 0xFF);
+    mem_write8(rv, addr + 3, val >> 24);
+}
+
+static void write32_split(uint32_t addr, uint32_t val) {
+    if ((addr & MEM_PAGE_MASK) > MEM_PAGE_SIZE - 4) {
+        write32_bytes(addr, val);
+        return;
+    }
+    uint8_t *p = mem_ptr_w(rv, addr);
+    p[0] = val & 0xFF;
+    p[1] = (val >> 8) & 0xFF;
+    p[2] = (val >> 16) & 0xFF;
+    p[3] = val >> 24;
+}
+
+static uint32_t read16_bytes(uint32_t addr) {
+    return mem_read8(rv, addr) | (mem_read8(rv, addr + 1) << 8);
+}
+
+static uint32_t read16_split(uint32_t addr) {
+    if ((addr & MEM_PAGE_MASK) > MEM_PAGE_SIZE - 2)
+        return read16_bytes(addr);
+    const uint8_t *p = mem_ptr(rv, addr);
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t read16_word(uint32_t addr) {
+    return mem_read16(rv, addr);
+}
+
+static uint32_t read32_word(uint32_t addr) {
+    return mem_read32(rv, addr);
+}
+
+static void write32_word(uint32_t addr, uint32_t val) {
+    mem_write32(rv, addr, val);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Loads at base + (i * step) within the buffer; returns ns per access
+static double bench_read(uint32_t (*rd)(uint32_t), uint32_t off, uint32_t step, uint64_t n, uint32_t *sum) {
+    uint32_t s = 0, a = 0;
+    double t = now();
+    for (uint64_t i = 0; i < n; i++) {
+        s += rd(BENCH_BASE + off + a);
+        a = (a + step) & BENCH_MASK & ~7u;
+    }
+    t = now() - t;
+    *sum += s;
+    return t * 1e9 / n;
+}
+
+static double bench_write(void (*wr)(uint32_t, uint32_t), uint32_t off, uint64_t n) {
+    uint32_t a = 0;
+    double t = now();
+    for (uint64_t i = 0; i < n; i++) {
+        wr(BENCH_BASE + off + a, (uint32_t) i);
+        a = (a + 8) & BENCH_MASK & ~7u;
+    }
+    t = now() - t;
+    return t * 1e9 / n;
+}
+
+int main(int argc, char **argv) {
+    uint64_t n = argc > 1 ? strtoull(argv[1], NULL, 0) : 100000000;
+    uint32_t sum = 0;
+
+    rv = calloc(1, sizeof(rv_machine_t));
+    if (rv == NULL || mem_init(rv) != 0) {
+        fprintf(stderr, "Error: Cannot create the guest memory\n");
+        return 1;
+    }
+    mem_map_ram(rv, BENCH_BASE, BENCH_BYTES + MEM_PAGE_SIZE);
+    for (uint32_t a = 0; a < BENCH_BYTES; a++)
+        mem_write8(rv, BENCH_BASE + a, a * 7);
+
+    printf("%-22s %10s %10s %10s\n", "ns/access", "bytes", "split", "word");
+    for (uint32_t off = 0; off < 2; off++) {
+        printf("load32  %-14s %10.3f %10.3f %10.3f\n", off ? "unaligned" : "aligned",
+               bench_read(read32_bytes, off, 8, n, &sum),
+               bench_read(read32_split, off, 8, n, &sum),
+               bench_read(read32_word, off, 8, n, &sum));
+        printf("load16  %-14s %10.3f %10.3f %10.3f\n", off ? "unaligned" : "aligned",
+               bench_read(read16_bytes, off, 8, n, &sum),
+               bench_read(read16_split, off, 8, n, &sum),
+               bench_read(read16_word, off, 8, n, &sum));
+        printf("store32 %-14s %10.3f %10.3f %10.3f\n", off ? "unaligned" : "aligned",
+               bench_write(write32_bytes, off, n),
+               bench_write(write32_split, off, n),
+               bench_write(write32_word, off, n));
+    }
+    fprintf(stderr, "checksum %08x\n", sum);
+    return 0;
+}
@@ -0,0 +1,364 @@
+#define _GNU_SOURCE // REG_RIP
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "rv32.h"
+
+/*
+ * Sparse guest memory
+ *
+ * Each guest has an rv_mem_t. Its l1 holds 1024 pointers to
+ * second-level tables of 1024 page pointers each, covering the whole
+ * 4 GiB guest address space with 4 KiB pages. Tables and pages are
+ * allocated zero-filled when first touched, so the host footprint
+ * follows the pages the program uses.
+ *
+ * Accesses go through rv->tlb (rv32.h), a direct-mapped cache of page
+ * translations, and stores through rv->tlb_w, which only a store miss
+ * fills. mem_translate_slow walks the tables on a miss and refills the
+ * slot; under the deterministic scheduler it first asks sched_access
+ * whether the hart may touch the page yet. Pages are never freed or
+ * moved until mem_free; mem_map_file only maps pages no TLB can hold yet.
+ *
+ * Harts of one guest share the rv_mem_t, counted in refs, and keep
+ * their own TLBs. First-touch allocation installs a table or page with
+ * compare-and-swap and frees it again when another hart got there
+ * first, so concurrent harts agree on every page without a lock.
+ *
+ * With MEM_GUARD the guest space is a single PROT_NONE reservation
+ * instead, plus one guard page for accesses that run past 4 GiB. Pages
+ * become accessible only through the loader calls below (mem_host_page,
+ * mem_map_ram, mem_map_file), so guest accesses need no check at all. A
+ * SIGSEGV inside the reservation of the machine running on the faulting
+ * thread is a guest access fault : the handler records the faulting
+ * guest pc (looked up in the JIT tables when the fault comes from
+ * compiled code) and address and jumps to the run loop.
+ */
+static void mem_oom(void) {
+    fprintf(stderr, "Error: Out of memory for guest pages\n");
+    exit(1);
+}
+
+#ifdef MEM_GUARD
+
+#define MEM_RESERVE ((1ull << 32) + MEM_PAGE_SIZE)
+
+struct rv_mem {
+    uint32_t refs;                                  // Machines sharing it
+    uint8_t *base;                                  // Reservation
+    uint64_t pages;                                 // Pages made accessible
+    uint32_t mapped[1 << (32 - PAGE_SHIFT - 5)];    // Accessible pages
+};
+
+__thread rv_machine_t *mem_running;
+
+static inline int mem_is_mapped(const rv_mem_t *m, uint32_t page) {
+    return (m->mapped[page >> 5] >> (page & 0x1F)) & 1;
+}
+
+static void mem_fault(int sig, siginfo_t *si, void *uc) {
+    rv_machine_t *rv = mem_running;
+    uint8_t *a = si->si_addr;
+    if (rv == NULL || a < rv->mem_base || a >= rv->mem_base + MEM_RESERVE) {
+        signal(SIGSEGV, SIG_DFL); // Not a guest access : crash as usual
+        return;
+    }
+    rv->fault_addr = (uint32_t)(a - rv->mem_base);
+    rv->fault_pc = rv->pc;
+#if defined(__x86_64__) && defined(REG_RIP)
+    uint32_t jit_pc;
+    if (jit_fault_pc(rv, ((ucontext_t *) uc)->uc_mcontext.gregs[REG_RIP], &jit_pc))
+        rv->fault_pc = jit_pc;
+#endif
+    rv->pc = rv->fault_pc;
+    if (rv->engine == RV_ENGINE_BLOCK || rv->engine == RV_ENGINE_JIT)
+        rv->instret += (rv->fault_pc - rv->block_pc) / 4; // Retired in the block so far
+    if (rv->fault_jmp != NULL)
+        siglongjmp(*rv->fault_jmp, 1);
+    fprintf(stderr, "Error: Access fault at pc 0x%08x, address 0x%08x\n", rv->fault_pc, rv->fault_addr);
+    _exit(1);
+}
+
+static void mem_install_handler(void) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = mem_fault;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER; // Left by siglongjmp without restoring the mask
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+}
+
+// Reserve the guest space of rv; the handler is installed once per process
+int mem_init(rv_machine_t *rv) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    rv_mem_t *m = calloc(1, sizeof(rv_mem_t));
+    if (m == NULL)
+        return -1;
+    m->base = mmap(NULL, MEM_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m->base == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot reserve the guest address space\n");
+        free(m);
+        return -1;
+    }
+    m->refs = 1;
+    rv->mem = m;
+    rv->mem_base = m->base;
+    pthread_once(&once, mem_install_handler);
+    return 0;
+}
+
+void mem_share(rv_machine_t *rv, rv_machine_t *from) {
+    __atomic_add_fetch(&from->mem->refs, 1, __ATOMIC_RELAXED);
+    rv->mem = from->mem;
+    rv->mem_base = from->mem_base;
+}
+
+void mem_free(rv_machine_t *rv) {
+    rv_mem_t *m = rv->mem;
+    if (m == NULL)
+        return;
+    rv->mem = NULL;
+    if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return; // Still used by other harts
+    munmap(m->base, MEM_RESERVE); // File mappings are inside
+    free(m);
+}
+
+// Make the pages covering [addr, addr + len) accessible
+int mem_map_ram(rv_machine_t *rv, uint32_t addr, uint32_t len) {
+    rv_mem_t *m = rv->mem;
+    if (len == 0)
+        return 0;
+    uint32_t first = addr >> PAGE_SHIFT;
+    uint32_t last  = (uint32_t)(((uint64_t) addr + len - 1) >> PAGE_SHIFT);
+    if (last > (1u << (32 - PAGE_SHIFT)) - 1)
+        return -1;
+    if (mprotect(m->base + ((uint64_t) first << PAGE_SHIFT),
+                 (uint64_t)(last - first + 1) << PAGE_SHIFT, PROT_READ | PROT_WRITE) != 0)
+        mem_oom();
+    for (uint32_t p = first; p <= last; p++) {
+        if (!mem_is_mapped(m, p)) {
+            m->mapped[p >> 5] |= 1u << (p & 0x1F);
+            m->pages++;
+        }
+    }
+    return 0;
+}
+
+// Host address of the page holding addr, made accessible on first use
+uint8_t *mem_host_page(rv_machine_t *rv, uint32_t addr) {
+    if (!mem_is_mapped(rv->mem, addr >> PAGE_SHIFT))
+        mem_map_ram(rv, addr & ~MEM_PAGE_MASK, MEM_PAGE_SIZE);
+    return rv->mem->base + (addr & ~MEM_PAGE_MASK);
+}
+
+// Map len bytes of fd at off (both page aligned) copy-on-write at addr.
+// Returns -1 and maps nothing if a page in the range is already in use.
+int mem_map_file(rv_machine_t *rv, uint32_t addr, uint32_t len, int fd, int64_t off) {
+    rv_mem_t *m = rv->mem;
+    for (uint32_t a = 0; a < len; a += MEM_PAGE_SIZE) {
+        if (mem_is_mapped(m, (addr + a) >> PAGE_SHIFT))
+            return -1;
+    }
+    if (mmap(m->base + addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, off) == MAP_FAILED)
+        return -1;
+    for (uint32_t a = 0; a < len; a += MEM_PAGE_SIZE) {
+        uint32_t p = (addr + a) >> PAGE_SHIFT;
+        m->mapped[p >> 5] |= 1u << (p & 0x1F);
+        m->pages++;
+    }
+    return 0;
+}
+
+#else
+
+typedef struct mem_file mem_file_t;
+struct mem_file {
+    mem_file_t *next;
+    uint32_t    addr;   // Guest range of one mem_map_file call
+    uint32_t    len;
+    uint8_t    *host;
+};
+
+struct rv_mem {
+    uint32_t    refs;   // Machines sharing it
+    uint8_t   **l1[1 << MEM_L1_BITS];
+    uint64_t    pages;  // Host pages allocated or mapped
+    mem_file_t *files;  // Unmapped rather than freed by mem_free
+};
+
+static uint8_t **mem_slot(rv_mem_t *m, uint32_t addr) {
+    uint8_t ***l1 = &m->l1[addr >> (32 - MEM_L1_BITS)];
+    uint8_t **l2 = __atomic_load_n(l1, __ATOMIC_ACQUIRE);
+    if (l2 == NULL) {
+        uint8_t **t = calloc(1 << MEM_L2_BITS, sizeof(uint8_t *));
+        if (t == NULL)
+            mem_oom();
+        if (__atomic_compare_exchange_n(l1, &l2, t, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            l2 = t;
+        else
+            free(t); // Another hart installed one; l2 is now that table
+    }
+    return &l2[(addr >> PAGE_SHIFT) & ((1 << MEM_L2_BITS) - 1)];
+}
+
+void mem_tlb_flush(rv_machine_t *rv) {
+    memset(rv->tlb, 0, sizeof(rv->tlb));
+    memset(rv->tlb_w, 0, sizeof(rv->tlb_w));
+}
+
+int mem_init(rv_machine_t *rv) {
+    mem_tlb_flush(rv); // Empty after a previous mem_free
+    rv->mem = calloc(1, sizeof(rv_mem_t));
+    if (rv->mem == NULL)
+        return -1;
+    rv->mem->refs = 1;
+    return 0;
+}
+
+void mem_share(rv_machine_t *rv, rv_machine_t *from) {
+    __atomic_add_fetch(&from->mem->refs, 1, __ATOMIC_RELAXED);
+    mem_tlb_flush(rv);
+    rv->mem = from->mem;
+}
+
+void mem_free(rv_machine_t *rv) {
+    rv_mem_t *m = rv->mem;
+    if (m == NULL)
+        return;
+    rv->mem = NULL;
+    if (__atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return; // Still used by other harts
+    while (m->files != NULL) {
+        mem_file_t *f = m->files;
+        for (uint32_t a = 0; a < f->len; a += MEM_PAGE_SIZE)
+            *mem_slot(m, f->addr + a) = NULL;
+        munmap(f->host, f->len);
+        m->files = f->next;
+        free(f);
+    }
+    for (uint32_t i = 0; i < (1 << MEM_L1_BITS); i++) {
+        if (m->l1[i] == NULL)
+            continue;
+        for (uint32_t j = 0; j < (1 << MEM_L2_BITS); j++)
+            free(m->l1[i][j]);
+        free(m->l1[i]);
+    }
+    free(m);
+}
+
+// Host address of the page holding addr, allocated on first touch
+uint8_t *mem_host_page(rv_machine_t *rv, uint32_t addr) {
+    uint8_t **slot = mem_slot(rv->mem, addr);
+    uint8_t *page = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (page == NULL) {
+        uint8_t *p = calloc(1, MEM_PAGE_SIZE);
+        if (p == NULL)
+            mem_oom();
+        if (__atomic_compare_exchange_n(slot, &page, p, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            page = p;
+            __atomic_add_fetch(&rv->mem->pages, 1, __ATOMIC_RELAXED);
+        } else {
+            free(p); // Another hart touched the page first
+        }
+    }
+    return page;
+}
+
+// A store fills both TLBs, a load only the read TLB
+uint8_t *mem_translate_slow(rv_machine_t *rv, uint32_t addr, int write) {
+    if (rv->sched != NULL)
+        sched_access(rv, addr >> PAGE_SHIFT, write);
+    uint8_t *page = mem_host_page(rv, addr);
+    uint32_t slot = (addr >> PAGE_SHIFT) & ((1 << MEM_TLB_BITS) - 1);
+    rv->tlb[slot].tag  = (addr >> PAGE_SHIFT) + 1;
+    rv->tlb[slot].page = page;
+    if (write) {
+        rv->tlb_w[slot].tag  = (addr >> PAGE_SHIFT) + 1;
+        rv->tlb_w[slot].page = page;
+    }
+    rv->tlb_misses++;
+    return page + (addr & MEM_PAGE_MASK);
+}
+
+// Every page is RAM here; pages are allocated when first touched
+int mem_map_ram(rv_machine_t *rv, uint32_t addr, uint32_t len) {
+    return 0;
+}
+
+// Map len bytes of fd at off (both page aligned) copy-on-write at addr.
+// Returns -1 and maps nothing if a page in the range is already in use.
+// Unused pages were never translated, so no TLB slot needs clearing.
+int mem_map_file(rv_machine_t *rv, uint32_t addr, uint32_t len, int fd, int64_t off) {
+    rv_mem_t *m = rv->mem;
+    for (uint32_t a = 0; a < len; a += MEM_PAGE_SIZE) {
+        if (*mem_slot(m, addr + a) != NULL)
+            return -1;
+    }
+    mem_file_t *f = malloc(sizeof(mem_file_t));
+    if (f == NULL)
+        return -1;
+    uint8_t *host = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, off);
+    if (host == MAP_FAILED) {
+        free(f);
+        return -1;
+    }
+    for (uint32_t a = 0; a < len; a += MEM_PAGE_SIZE) {
+        *mem_slot(m, addr + a) = host + a;
+        m->pages++;
+    }
+    f->addr = addr;
+    f->len  = len;
+    f->host = host;
+    f->next = m->files;
+    m->files = f;
+    return 0;
+}
+
+#endif
+
+void mem_write_block(rv_machine_t *rv, uint32_t addr, const void *src, uint32_t len) {
+    const uint8_t *s = src;
+    while (len > 0) {
+        uint32_t n = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (n > len)
+            n = len;
+        memcpy(mem_host_page(rv, addr) + (addr & MEM_PAGE_MASK), s, n);
+        addr += n;
+        s += n;
+        len -= n;
+    }
+}
+
+void mem_read_block(rv_machine_t *rv, uint32_t addr, void *dst, uint32_t len) {
+    uint8_t *d = dst;
+    while (len > 0) {
+        uint32_t n = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (n > len)
+            n = len;
+        memcpy(d, mem_host_page(rv, addr) + (addr & MEM_PAGE_MASK), n);
+        addr += n;
+        d += n;
+        len -= n;
+    }
+}
+
+void mem_print_stats(rv_machine_t *rv, FILE *fp) {
+#ifdef MEM_GUARD
+    fprintf(fp, "mem : pages = %llu (%llu KiB), guard pages\n",
+            (unsigned long long)rv->mem->pages,
+            (unsigned long long)rv->mem->pages * (MEM_PAGE_SIZE / 1024));
+#else
+    fprintf(fp, "mem : pages = %llu (%llu KiB), tlb misses = %llu\n",
+            (unsigned long long)rv->mem->pages,
+            (unsigned long long)rv->mem->pages * (MEM_PAGE_SIZE / 1024),
+            (unsigned long long)rv->tlb_misses);
+#endif
+}
@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * Profiler
+ *
+ * Counts executed instructions per pc, per mnemonic and per call stack.
+ * Like the timing model it runs over the basic blocks of block_dev.c :
+ * when a block is translated it is matched with a record keyed by start
+ * pc and instruction words, which outlives cache flushes, and each
+ * execution adds one to the record and the block length to the current
+ * stack frame. Per-pc and per-mnemonic counts are expanded from the
+ * records at exit, so the engines do no work per instruction. Blocks cut
+ * short count their instructions one by one.
+ *
+ * Calls are JAL and JALR with rd = ra, returns are JALR x0, 0(ra). Stack
+ * frames form a tree with a node per distinct chain of call targets,
+ * rooted at the first pc executed; recursion deeper than PROF_DEPTH_MAX
+ * stays in the deepest frame.
+ *
+ * At exit the stacks are written to the profile file as folded lines,
+ *
+ *     _start;main;memcpy 1234
+ *
+ * the input of flamegraph.pl, inferno and speedscope, and the hottest
+ * pcs and the mnemonic histogram go to stderr. Targets are named by the
+ * ELF symbol holding them, as hex addresses otherwise.
+ */
+#define PROF_HASH_BITS 12
+#define PROF_DEPTH_MAX 256
+#define PROF_TOP       20 // Hot pcs listed
+
+enum { PROF_NONE, PROF_CALL, PROF_RET };
+
+struct prof_rec {
+    prof_rec_t *next;     // Hash chain
+    uint32_t start_pc;
+    uint32_t len;
+    uint32_t kind;        // Final instruction, PROF_CALL or PROF_RET
+    uint64_t full;        // Executions of the whole block
+    uint64_t *cut;        // Executions per instruction of blocks cut short
+    uint8_t  *op;
+    uint32_t instr[];
+};
+
+typedef struct {
+    uint32_t target;      // Call target, the first pc at the root
+    uint32_t parent;
+    uint32_t child;       // First callee, 0 when none
+    uint32_t sibling;     // Next callee of the parent
+    uint64_t count;       // Instructions executed in this frame
+} prof_node_t;
+
+int prof_enabled;
+
+static FILE        *prof_fp;
+static prof_rec_t  *prof_hash[1 << PROF_HASH_BITS];
+static prof_node_t *prof_nodes;
+static uint32_t     prof_nnodes, prof_cap;
+static uint32_t     prof_cur;   // Current frame
+static uint32_t     prof_deep;  // Calls past PROF_DEPTH_MAX not yet returned
+static uint32_t     prof_depth;
+
+static const char *const prof_names[INSTR_COUNT] = {
+    [INSTR_LUI]    = "lui",    [INSTR_AUIPC]  = "auipc",  [INSTR_JAL]    = "jal",
+    [INSTR_JALR]   = "jalr",   [INSTR_BEQ]    = "beq",    [INSTR_BNE]    = "bne",
+    [INSTR_BLT]    = "blt",    [INSTR_BGE]    = "bge",    [INSTR_BLTU]   = "bltu",
+    [INSTR_BGEU]   = "bgeu",   [INSTR_LB]     = "lb",     [INSTR_LH]     = "lh",
+    [INSTR_LW]     = "lw",     [INSTR_LBU]    = "lbu",    [INSTR_LHU]    = "lhu",
+    [INSTR_SB]     = "sb",     [INSTR_SH]     = "sh",     [INSTR_SW]     = "sw",
+    [INSTR_ADDI]   = "addi",   [INSTR_SLTI]   = "slti",   [INSTR_SLTIU]  = "sltiu",
+    [INSTR_XORI]   = "xori",   [INSTR_ORI]    = "ori",    [INSTR_ANDI]   = "andi",
+    [INSTR_SLLI]   = "slli",   [INSTR_SRLI]   = "srli",   [INSTR_SRAI]   = "srai",
+    [INSTR_ADD]    = "add",    [INSTR_SUB]    = "sub",    [INSTR_SLL]    = "sll",
+    [INSTR_SLT]    = "slt",    [INSTR_SLTU]   = "sltu",   [INSTR_XOR]    = "xor",
+    [INSTR_SRL]    = "srl",    [INSTR_SRA]    = "sra",    [INSTR_OR]     = "or",
+    [INSTR_AND]    = "and",    [INSTR_ECALL]  = "ecall",  [INSTR_MUL]    = "mul",
+    [INSTR_MULH]   = "mulh",   [INSTR_MULHSU] = "mulhsu", [INSTR_MULHU]  = "mulhu",
+    [INSTR_DIV]    = "div",    [INSTR_DIVU]   = "divu",   [INSTR_REM]    = "rem",
+    [INSTR_REMU]   = "remu",   [INSTR_RVV]    = "vector", [INSTR_UNKNOWN] = "unknown",
+    [INSTR_FENCE]  = "fence",  [INSTR_FENCE_I] = "fence.i",
+    [INSTR_CSRRW]  = "csrrw",  [INSTR_CSRRS]  = "csrrs",  [INSTR_CSRRC]  = "csrrc",
+    [INSTR_CSRRWI] = "csrrwi", [INSTR_CSRRSI] = "csrrsi", [INSTR_CSRRCI] = "csrrci",
+    [INSTR_LR_W]      = "lr.w",      [INSTR_SC_W]      = "sc.w",
+    [INSTR_AMOSWAP_W] = "amoswap.w", [INSTR_AMOADD_W]  = "amoadd.w",
+    [INSTR_AMOXOR_W]  = "amoxor.w",  [INSTR_AMOAND_W]  = "amoand.w",
+    [INSTR_AMOOR_W]   = "amoor.w",   [INSTR_AMOMIN_W]  = "amomin.w",
+    [INSTR_AMOMAX_W]  = "amomax.w",  [INSTR_AMOMINU_W] = "amominu.w",
+    [INSTR_AMOMAXU_W] = "amomaxu.w",
+};
+
+// Vector operations by funct6, as decoded by rvv_dev.c
+static const char *const prof_opi[64] = {
+    [0x00] = "vadd",    [0x02] = "vsub",    [0x03] = "vrsub",   [0x04] = "vminu",
+    [0x05] = "vmin",    [0x06] = "vmaxu",   [0x07] = "vmax",    [0x09] = "vand",
+    [0x0A] = "vor",     [0x0B] = "vxor",    [0x10] = "vmseq",   [0x11] = "vmsne",
+    [0x12] = "vmsltu",  [0x13] = "vmslt",   [0x14] = "vmsleu",  [0x15] = "vmsle",
+    [0x16] = "vmsgtu",  [0x17] = "vmsgt",   [0x25] = "vsll",    [0x26] = "vsrl",
+    [0x27] = "vsra",    [0x2C] = "vnsrl",   [0x2D] = "vnsra",   [0x30] = "vwaddu",
+    [0x31] = "vwadd",   [0x32] = "vwsubu",  [0x33] = "vwsub",   [0x34] = "vwaddu",
+    [0x35] = "vwadd",   [0x36] = "vwsubu",  [0x37] = "vwsub",
+};
+
+static const char *const prof_opm[64] = {
+    [0x08] = "vmul",    [0x09] = "vmulh",   [0x0A] = "vmulhu",  [0x0B] = "vmulhsu",
+    [0x0C] = "vdiv",    [0x0D] = "vdivu",   [0x0E] = "vrem",    [0x0F] = "vremu",
+    [0x20] = "vmacc",   [0x21] = "vnmsac",  [0x22] = "vmadd",   [0x23] = "vnmsub",
+    [0x38] = "vwmulu",  [0x3A] = "vwmulsu", [0x3B] = "vwmul",   [0x3C] = "vwmaccu",
+    [0x3D] = "vwmacc",  [0x3E] = "vwmaccus", [0x3F] = "vwmaccsu",
+};
+
+static const char *const prof_red[64] = {
+    [0x00] = "vredsum", [0x01] = "vredand", [0x02] = "vredor",  [0x03] = "vredxor",
+    [0x04] = "vredminu", [0x05] = "vredmin", [0x06] = "vredmaxu", [0x07] = "vredmax",
+    [0x30] = "vwredsumu", [0x31] = "vwredsum",
+};
+
+// Mnemonic of a vector instruction into buf
+static void prof_rvv_name(uint32_t instr, char *buf, size_t size) {
+    uint32_t opcode = instr & 0x7F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t funct6 = instr >> 26;
+
+    if (opcode != 0x57) {
+        // Width field 0/1/2/3 for 8/16/32/64, nf in bits 31-29
+        static const char *const mops[4] = { "e", "uxei", "se", "oxei" };
+        uint32_t eew = 8u << (funct3 & 0x3);
+        uint32_t nf = (instr >> 29) + 1;
+        uint32_t mop = (instr >> 26) & 0x3;
+        char c = (opcode == 0x07) ? 'l' : 's';
+        if (nf > 1)
+            snprintf(buf, size, "v%cseg%u%s%u.v", c, nf, mops[mop], eew);
+        else
+            snprintf(buf, size, "v%c%s%u.v", c, mops[mop], eew);
+        return;
+    }
+
+    const char *name = NULL, *form = "";
+    switch (funct3) {
+        case 0x7:
+            name = ((instr >> 31) == 0) ? "vsetvli" : ((instr >> 30) == 0x3) ? "vsetivli" : "vsetvl";
+            break;
+        case 0x1:
+            name = prof_red[funct6];
+            form = ".vs";
+            break;
+        case 0x0: case 0x3: case 0x4:
+            form = (funct3 == 0x0) ? ".vv" : (funct3 == 0x3) ? ".vi" : ".vx";
+            name = prof_opi[funct6];
+            if ((funct6 >= 0x34 && funct6 <= 0x37) || funct6 == 0x2C || funct6 == 0x2D)
+                form = (funct3 == 0x0) ? ".wv" : (funct3 == 0x3) ? ".wi" : ".wx"; // vs2 at 2 * SEW
+            break;
+        case 0x2: case 0x6:
+            form = (funct3 == 0x2) ? ".vv" : ".vx";
+            name = prof_opm[funct6];
+            if (funct3 == 0x2 && funct6 == 0x10) {
+                uint32_t vs1 = (instr >> 15) & 0x1F;
+                name = (vs1 == 0x10) ? "vcpop" : (vs1 == 0x11) ? "vfirst" : NULL;
+                form = ".m";
+            } else if (funct3 == 0x2 && funct6 >= 0x17 && funct6 <= 0x1F) {
+                static const char *const masks[9] = { "vcompress",
+                    "vmandn", "vmand", "vmor", "vmxor", "vmorn", "vmnand", "vmnor", "vmxnor" };
+                name = masks[funct6 - 0x17];
+                form = (funct6 == 0x17) ? ".vm" : ".mm";
+            }
+            break;
+    }
+    if (name != NULL)
+        snprintf(buf, size, "%s%s", name, form);
+    else
+        snprintf(buf, size, "vector.%u.%02x", funct3, funct6);
+}
+
+static void prof_name(uint8_t op, uint32_t instr, char *buf, size_t size) {
+    if (op == INSTR_RVV)
+        prof_rvv_name(instr, buf, size);
+    else
+        snprintf(buf, size, "%s", prof_names[op]);
+}
+
+// Name of a code address : symbol, symbol+offset or hex
+static void prof_where(uint32_t addr, char *buf, size_t size) {
+    const elf_sym_t *s = elf_symbol_at(addr);
+    if (s == NULL)
+        snprintf(buf, size, "0x%08x", addr);
+    else if (s->addr == addr)
+        snprintf(buf, size, "%s", s->name);
+    else
+        snprintf(buf, size, "%s+0x%x", s->name, addr - s->addr);
+}
+
+static uint32_t prof_new_node(uint32_t target, uint32_t parent) {
+    if (prof_nnodes == prof_cap) {
+        uint32_t cap = prof_cap ? 2 * prof_cap : 256;
+        prof_node_t *n = realloc(prof_nodes, cap * sizeof(prof_node_t));
+        if (n == NULL) {
+            fprintf(stderr, "Error: Out of memory for the profile\n");
+            exit(1);
+        }
+        prof_nodes = n;
+        prof_cap = cap;
+    }
+    prof_node_t *n = &prof_nodes[prof_nnodes];
+    n->target = target;
+    n->parent = parent;
+    n->child = n->sibling = 0;
+    n->count = 0;
+    if (prof_nnodes > 0) {
+        n->sibling = prof_nodes[parent].child;
+        prof_nodes[parent].child = prof_nnodes;
+    }
+    return prof_nnodes++;
+}
+
+// Start profiling; the folded stacks are written to path at exit
+int prof_open(const char *path) {
+    prof_fp = fopen(path, "w");
+    if (prof_fp == NULL)
+        return -1;
+    prof_enabled = 1;
+    return 0;
+}
+
+// The record of a block of len instructions, created on first use
+prof_rec_t *prof_block(const rv_insn_t *ops, uint32_t len) {
+    if (prof_nnodes == 0)
+        prof_cur = prof_new_node(ops[0].pc, 0);
+
+    uint32_t h = (ops[0].pc >> 2) & ((1 << PROF_HASH_BITS) - 1);
+    for (prof_rec_t *r = prof_hash[h]; r != NULL; r = r->next) {
+        uint32_t k = 0;
+        if (r->start_pc != ops[0].pc || r->len != len)
+            continue;
+        while (k < len && r->instr[k] == ops[k].instr)
+            k++;
+        if (k == len)
+            return r;
+    }
+
+    prof_rec_t *r = malloc(sizeof(prof_rec_t) + len * (sizeof(uint32_t) + 1));
+    if (r == NULL) {
+        fprintf(stderr, "Error: Out of memory for the profile\n");
+        exit(1);
+    }
+    r->start_pc = ops[0].pc;
+    r->len = len;
+    r->full = 0;
+    r->cut = NULL;
+    r->op = (uint8_t *) &r->instr[len];
+    for (uint32_t k = 0; k < len; k++) {
+        r->instr[k] = ops[k].instr;
+        r->op[k] = ops[k].op;
+    }
+
+    const rv_insn_t *last = &ops[len - 1];
+    r->kind = PROF_NONE;
+    if ((last->op == INSTR_JAL || last->op == INSTR_JALR) && last->rd == 1)
+        r->kind = PROF_CALL;
+    else if (last->op == INSTR_JALR && last->rd == 0 && last->rs1 == 1 && last->imm == 0)
+        r->kind = PROF_RET;
+
+    r->next = prof_hash[h];
+    prof_hash[h] = r;
+    return r;
+}
+
+// Count n executed instructions of block r; pc is the next pc
+void prof_block_exit(prof_rec_t *r, uint32_t n, uint32_t pc) {
+    prof_nodes[prof_cur].count += n;
+    if (n != r->len) {
+        if (r->cut == NULL)
+            r->cut = calloc(r->len, sizeof(uint64_t));
+        if (r->cut != NULL) {
+            for (uint32_t k = 0; k < n; k++)
+                r->cut[k]++;
+        }
+        return;
+    }
+    r->full++;
+
+    if (r->kind == PROF_CALL) {
+        if (prof_depth == PROF_DEPTH_MAX) {
+            prof_deep++;
+            return;
+        }
+        uint32_t c = prof_nodes[prof_cur].child;
+        while (c != 0 && prof_nodes[c].target != pc)
+            c = prof_nodes[c].sibling;
+        prof_cur = (c != 0) ? c : prof_new_node(pc, prof_cur);
+        prof_depth++;
+    } else if (r->kind == PROF_RET) {
+        if (prof_deep > 0) {
+            prof_deep--;
+        } else if (prof_depth > 0) {
+            prof_cur = prof_nodes[prof_cur].parent;
+            prof_depth--;
+        }
+    }
+}
+
+// Folded stack of node i into buf, root first
+static void prof_stack(uint32_t i, char *buf, size_t size) {
+    char name[128];
+    if (i != 0) {
+        prof_stack(prof_nodes[i].parent, buf, size);
+        strncat(buf, ";", size - strlen(buf) - 1);
+    }
+    prof_where(prof_nodes[i].target, name, sizeof(name));
+    strncat(buf, name, size - strlen(buf) - 1);
+}
+
+typedef struct {
+    uint32_t pc;
+    uint32_t instr;
+    uint8_t  op;
+    uint64_t count;
+} prof_pc_t;
+
+typedef struct {
+    char     name[24];
+    uint64_t count;
+} prof_mnem_t;
+
+static int prof_by_pc(const void *a, const void *b) {
+    uint32_t x = ((const prof_pc_t *) a)->pc, y = ((const prof_pc_t *) b)->pc;
+    return x < y ? -1 : x > y;
+}
+
+static int prof_by_count(const void *a, const void *b) {
+    uint64_t x = ((const prof_pc_t *) a)->count, y = ((const prof_pc_t *) b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int prof_mnem_by_count(const void *a, const void *b) {
+    uint64_t x = ((const prof_mnem_t *) a)->count, y = ((const prof_mnem_t *) b)->count;
+    return x < y ? 1 : x > y ? -1 : strcmp(((const prof_mnem_t *) a)->name, ((const prof_mnem_t *) b)->name);
+}
+
+// Hot pcs and the mnemonic histogram, expanded from the block records
+static void prof_print_flat(FILE *fp) {
+    uint64_t total = 0;
+    uint32_t n = 0, cap = 1024;
+    prof_pc_t *pcs = malloc(cap * sizeof(prof_pc_t));
+    for (uint32_t h = 0; h < (1 << PROF_HASH_BITS) && pcs != NULL; h++) {
+        for (prof_rec_t *r = prof_hash[h]; r != NULL; r = r->next) {
+            for (uint32_t k = 0; k < r->len; k++) {
+                uint64_t c = r->full + (r->cut != NULL ? r->cut[k] : 0);
+                if (c == 0)
+                    continue;
+                if (n == cap) {
+                    prof_pc_t *p = realloc(pcs, 2 * cap * sizeof(prof_pc_t));
+                    if (p == NULL)
+                        break;
+                    pcs = p;
+                    cap *= 2;
+                }
+                pcs[n++] = (prof_pc_t) { r->start_pc + 4 * k, r->instr[k], r->op[k], c };
+                total += c;
+            }
+        }
+    }
+    if (pcs == NULL)
+        return;
+
+    // Blocks entered part way overlap : merge their counts per pc
+    qsort(pcs, n, sizeof(prof_pc_t), prof_by_pc);
+    uint32_t m = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        if (m > 0 && pcs[m - 1].pc == pcs[k].pc)
+            pcs[m - 1].count += pcs[k].count;
+        else
+            pcs[m++] = pcs[k];
+    }
+
+    // Histogram by mnemonic
+    uint32_t nm = 0;
+    prof_mnem_t *mn = calloc(m + 1, sizeof(prof_mnem_t));
+    for (uint32_t k = 0; k < m && mn != NULL; k++) {
+        char name[24];
+        prof_name(pcs[k].op, pcs[k].instr, name, sizeof(name));
+        uint32_t j = 0;
+        while (j < nm && strcmp(mn[j].name, name) != 0)
+            j++;
+        if (j == nm)
+            snprintf(mn[nm++].name, sizeof(mn[0].name), "%s", name);
+        mn[j].count += pcs[k].count;
+    }
+
+    fprintf(fp, "prof : instructions = %llu, pcs = %u, frames = %u\n",
+            (unsigned long long)total, m, prof_nnodes);
+    qsort(pcs, m, sizeof(prof_pc_t), prof_by_count);
+    fprintf(fp, "%14s %7s  %-10s %-12s %s\n", "count", "%", "pc", "mnemonic", "where");
+    for (uint32_t k = 0; k < m && k < PROF_TOP; k++) {
+        char name[24], where[128];
+        prof_name(pcs[k].op, pcs[k].instr, name, sizeof(name));
+        prof_where(pcs[k].pc, where, sizeof(where));
+        fprintf(fp, "%14llu %6.2f%%  0x%08x %-12s %s\n", (unsigned long long)pcs[k].count,
+                100.0 * pcs[k].count / total, pcs[k].pc, name, where);
+    }
+    if (mn != NULL) {
+        qsort(mn, nm, sizeof(prof_mnem_t), prof_mnem_by_count);
+        fprintf(fp, "%14s %7s  %s\n", "count", "%", "mnemonic");
+        for (uint32_t k = 0; k < nm; k++)
+            fprintf(fp, "%14llu %6.2f%%  %s\n", (unsigned long long)mn[k].count,
+                    100.0 * mn[k].count / total, mn[k].name);
+    }
+    free(mn);
+    free(pcs);
+}
+
+// Write the folded stacks and print the flat profile
+void prof_close(void) {
+    if (prof_fp == NULL)
+        return;
+    char stack[4096];
+    for (uint32_t i = 0; i < prof_nnodes; i++) {
+        if (prof_nodes[i].count == 0)
+            continue;
+        stack[0] = '\0';
+        prof_stack(i, stack, sizeof(stack));
+        fprintf(prof_fp, "%s %llu\n", stack, (unsigned long long)prof_nodes[i].count);
+    }
+    fclose(prof_fp);
+    prof_fp = NULL;
+    prof_print_flat(stderr);
+}
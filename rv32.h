@@ -1,10 +1,636 @@
-int decode_rv32i_instr(uint32_t);
-int decode_rv32m_instr(uint32_t);
-int decode_rvv_instr(uint32_t);
+#ifndef RV32_H
+#define RV32_H
 
-#define DEBUG
-#ifdef DEBUG
-#define debug(...) printf(__VA_ARGS__)
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef enum {
+    INSTR_LUI,
+    INSTR_AUIPC,
+    INSTR_JAL,
+    INSTR_JALR,
+    INSTR_BEQ,
+    INSTR_BNE,
+    INSTR_BLT,
+    INSTR_BGE,
+    INSTR_BLTU,
+    INSTR_BGEU,
+    INSTR_LB,
+    INSTR_LH,
+    INSTR_LW,
+    INSTR_LBU,
+    INSTR_LHU,
+    INSTR_SB,
+    INSTR_SH,
+    INSTR_SW,
+    INSTR_ADDI,
+    INSTR_SLTI,
+    INSTR_SLTIU,
+    INSTR_XORI,
+    INSTR_ORI,
+    INSTR_ANDI,
+    INSTR_SLLI,
+    INSTR_SRLI,
+    INSTR_SRAI,
+    INSTR_ADD,
+    INSTR_SUB,
+    INSTR_SLL,
+    INSTR_SLT,
+    INSTR_SLTU,
+    INSTR_XOR,
+    INSTR_SRL,
+    INSTR_SRA,
+    INSTR_OR,
+    INSTR_AND,
+    INSTR_ECALL,
+    INSTR_FENCE,
+    INSTR_FENCE_I,
+    INSTR_CSRRW,   // Only reads of the CSRs in exec_csr execute
+    INSTR_CSRRS,
+    INSTR_CSRRC,
+    INSTR_CSRRWI,
+    INSTR_CSRRSI,
+    INSTR_CSRRCI,
+    INSTR_MUL,
+    INSTR_MULH,
+    INSTR_MULHSU,
+    INSTR_MULHU,
+    INSTR_DIV,
+    INSTR_DIVU,
+    INSTR_REM,
+    INSTR_REMU,
+    INSTR_LR_W,
+    INSTR_SC_W,
+    INSTR_AMOSWAP_W,
+    INSTR_AMOADD_W,
+    INSTR_AMOXOR_W,
+    INSTR_AMOAND_W,
+    INSTR_AMOOR_W,
+    INSTR_AMOMIN_W,
+    INSTR_AMOMAX_W,
+    INSTR_AMOMINU_W,
+    INSTR_AMOMAXU_W,
+    INSTR_RVV,     // Any vector instruction, executed by decode_rvv_instr
+    INSTR_UNKNOWN,
+    INSTR_COUNT
+} Instruction;
+
+// Predecoded instruction record.
+// Register indices and the sign-extended immediate are extracted once, so
+// executing a cached instruction is a single indirect call.
+typedef struct rv_insn rv_insn_t;
+typedef struct rv_machine rv_machine_t;
+typedef int (*rv_handler_t)(rv_machine_t *, const rv_insn_t *);
+
+struct rv_insn {
+    rv_handler_t handler; // Returns 1 if executed, 0 if unknown, or RV_HALT / RV_BREAK
+    const void  *label;   // Dispatch label of the threaded engine
+    uint32_t pc;          // Tag : address this record was decoded from
+    uint32_t instr;       // Raw instruction word
+    int32_t  imm;         // Sign-extended immediate (shamt for shifts)
+    uint8_t  op;          // Instruction
+    uint8_t  rd;
+    uint8_t  rs1;
+    uint8_t  rs2;
+};
+
+// Handler results that stop the machine : after the instruction retired
+// (ECALL), or before it executed (breakpoint). The handler sets
+// rv->exit_reason first.
+#define RV_HALT  2
+#define RV_BREAK 3
+
+int decode_rv32i_instr(rv_machine_t *, uint32_t);
+int decode_rv32m_instr(rv_machine_t *, uint32_t);
+int decode_rv32a_instr(rv_machine_t *, uint32_t);
+int decode_rvv_instr(rv_machine_t *, uint32_t);
+
+int predecode_rv32i_instr(uint32_t, rv_insn_t *);
+int predecode_rv32m_instr(uint32_t, rv_insn_t *);
+int predecode_rv32a_instr(uint32_t, rv_insn_t *);
+int predecode_rvv_instr(uint32_t, rv_insn_t *);
+
+// Guest memory (mem_dev.c)
+// The 32-bit guest address space is split into 4 KiB pages through a
+// two-level page table; host pages are allocated on first touch. The
+// direct-mapped TLB holds the most recently used page of each slot, so
+// most accesses are a tag compare and an index.
+//
+// Built with -DMEM_GUARD, the guest space is instead one 4 GiB host
+// reservation at rv->mem_base where only loaded pages are accessible. An
+// access is mem_base + addr with no check; stray accesses hit PROT_NONE
+// pages and the SIGSEGV handler turns them into a guest access fault.
+//
+// The harts of one guest share an rv_mem_t (mem_share). Pages are
+// allocated on first touch without a lock, so harts may run on several
+// host threads; loading and mapping files is for one thread at a time.
+#define PAGE_SHIFT    12
+#define MEM_PAGE_SIZE (1u << PAGE_SHIFT)
+#define MEM_PAGE_MASK (MEM_PAGE_SIZE - 1)
+#define MEM_L1_BITS   10
+#define MEM_L2_BITS   (32 - PAGE_SHIFT - MEM_L1_BITS)
+#define MEM_TLB_BITS  6
+#define MEM_FLAT_SIZE (1u << 24) // RAM mapped at 0 for flat binaries
+
+typedef struct {
+    uint32_t tag;  // Page number + 1, 0 when empty
+    uint8_t *page; // Host address of the page
+} mem_tlb_t;
+
+typedef struct rv_mem rv_mem_t; // Page table or reservation of one guest
+
+int  mem_init(rv_machine_t *rv);
+void mem_share(rv_machine_t *rv, rv_machine_t *from); // rv uses the memory of from
+void mem_free(rv_machine_t *rv); // Released with its last machine
+uint8_t *mem_host_page(rv_machine_t *rv, uint32_t addr);
+int  mem_map_ram(rv_machine_t *rv, uint32_t addr, uint32_t len);
+int  mem_map_file(rv_machine_t *rv, uint32_t addr, uint32_t len, int fd, int64_t off);
+void mem_write_block(rv_machine_t *rv, uint32_t addr, const void *src, uint32_t len);
+void mem_read_block(rv_machine_t *rv, uint32_t addr, void *dst, uint32_t len);
+void mem_print_stats(rv_machine_t *rv, FILE *fp);
+
+#ifdef MEM_GUARD
+#include <setjmp.h>
+#endif
+
+// Machine (machine_dev.c)
+// All the state of one guest : registers, vector unit, address space and
+// the caches built from its code. Engines, handlers and memory accessors
+// take the machine they act on, so a process can hold any number of
+// guests, each driven by one host thread at a time. Tracing, the timing
+// model and the profiler stay process-wide; they follow the single
+// machine of the command-line emulator. Tracing also follows the harts
+// of the deterministic scheduler, which then runs them one at a time.
+//
+// A machine is one hart. Further harts of a guest are made with
+// rv_create_hart and share its memory but nothing else : each has its
+// own registers and caches, so a hart sees code written by another only
+// after a FENCE.I.
+typedef struct block_cache block_cache_t; // block_dev.c
+typedef struct jit_cache   jit_cache_t;   // jit_dev.c
+typedef struct vdec_cache  vdec_cache_t;  // rvv_dev.c
+typedef struct sched_hart  sched_hart_t;  // sched_dev.c
+
+enum { RV_ENGINE_INTERP, RV_ENGINE_THREADED, RV_ENGINE_BLOCK, RV_ENGINE_JIT };
+
+// Why rv_run returned; RV_EXIT_STOP only from rv_run_harts(_det)
+enum { RV_EXIT_BUDGET, RV_EXIT_BREAK, RV_EXIT_ECALL, RV_EXIT_FAULT, RV_EXIT_STOP };
+
+typedef struct {
+    int      reason;  // RV_EXIT_*
+    uint32_t pc;      // Next instruction : after an ECALL, at a breakpoint or fault
+    uint32_t value;   // ECALL : exit code (x3), fault : guest address
+    uint64_t instret; // Instructions retired by this run
+} rv_exit_t;
+
+#define RV_BREAKPOINTS_MAX 16
+
+struct rv_machine {
+    uint32_t pc;                     // Program counter
+    uint32_t xreg[32];               // Register file
+    uint32_t vl;                     // Vector Length
+    uint32_t vtype;                  // Vector Type Register
+    uint32_t vlen;                   // Bits per vector register
+    uint32_t vlenb;                  // Bytes per vector register
+    uint8_t *vreg;                   // Vector register file
+    int      engine;                 // RV_ENGINE_*, dispatched by rv_run
+    uint64_t instret;                // Instructions retired over the machine's life
+    int      exit_reason;            // RV_EXIT_* of the current run
+    uint32_t exit_value;
+    uint32_t breakpoints[RV_BREAKPOINTS_MAX];
+    uint32_t nbreakpoints;
+    int      break_resume;           // The run starts on a breakpoint : execute it
+    uint32_t hartid;                 // mhartid
+    uint32_t reserve_addr;           // LR.W reservation, with the value it read
+    uint32_t reserve_value;
+    int      reserve_valid;
+
+    rv_mem_t *mem;
+#ifdef MEM_GUARD
+    uint8_t    *mem_base;            // Host address of guest address 0
+    sigjmp_buf *fault_jmp;           // Target of guest access faults, or NULL
+    uint32_t    fault_pc;            // Set by the SIGSEGV handler before the jump
+    uint32_t    fault_addr;
+    uint32_t    block_pc;            // Entry of the running block, to count up to a fault
+#else
+    mem_tlb_t tlb[1 << MEM_TLB_BITS];   // Pages that may be read
+    mem_tlb_t tlb_w[1 << MEM_TLB_BITS]; // Pages that may be written, also in tlb
+    uint64_t  tlb_misses;
+#endif
+    sched_hart_t *sched;             // Deterministic scheduler running the hart, or NULL
+
+    rv_insn_t *icache;               // Predecoded instructions (icache_dev.c)
+    uint32_t  *icache_code_pages;    // Pages holding predecoded instructions
+    uint64_t   icache_hits;
+    uint64_t   icache_misses;
+    uint64_t   icache_invalidations;
+    const void *const *icache_labels; // Threaded engine labels, once it has run
+
+    block_cache_t *blocks;           // NULL until run_block first runs
+    jit_cache_t   *jit;              // NULL until a block is first compiled
+    uint32_t       block_generation; // Bumped on every block flush
+    uint64_t       jit_executed;     // Compiled block executions
+    vdec_cache_t  *vdec;
+};
+
+rv_machine_t *rv_create(int engine); // NULL when out of memory
+rv_machine_t *rv_create_hart(rv_machine_t *boot, uint32_t hartid); // Shares the memory of boot
+void      rv_destroy(rv_machine_t *rv);
+int       rv_reset(rv_machine_t *rv); // As created, with the same engine and VLEN
+int       rv_load(rv_machine_t *rv, const char *path); // ELF, or flat at 0; sets pc
+rv_exit_t rv_run(rv_machine_t *rv, uint64_t budget); // Until budget, breakpoint, ECALL or fault
+int       rv_set_breakpoint(rv_machine_t *rv, uint32_t pc); // -1 when RV_BREAKPOINTS_MAX are set
+void      rv_clear_breakpoint(rv_machine_t *rv, uint32_t pc);
+int       rv_breakpoint_at(const rv_machine_t *rv, uint32_t pc);
+uint32_t  rv_get_reg(const rv_machine_t *rv, uint32_t r);
+void      rv_set_reg(rv_machine_t *rv, uint32_t r, uint32_t val);
+uint32_t  rv_get_pc(const rv_machine_t *rv);
+void      rv_set_pc(rv_machine_t *rv, uint32_t pc);
+void      rv_read_mem(rv_machine_t *rv, uint32_t addr, void *dst, uint32_t len);
+void      rv_write_mem(rv_machine_t *rv, uint32_t addr, const void *src, uint32_t len);
+
+// Multi-hart runner (smp_dev.c)
+// Runs each hart on its own host thread until it stops or has retired
+// budget instructions. Once harts[0] stops, the others are stopped too,
+// within RV_SMP_SLICE instructions, and report RV_EXIT_STOP. Returns -1
+// if a thread could not be started.
+#define RV_SMP_SLICE (1u << 20)
+
+int rv_run_harts(rv_machine_t **harts, uint32_t n, uint64_t budget, rv_exit_t *exits);
+
+// Deterministic scheduler (sched_dev.c)
+// Runs the harts in rounds of one quantum each, on up to threads host
+// threads at once, so that repeated runs retire the same instructions
+// with the same results and traces whatever the threads and the host.
+// The seed picks the order in which the harts of a round take turns
+// where they share pages. Stops as rv_run_harts does, at the end of the
+// round in which harts[0] stopped.
+typedef struct {
+    uint64_t seed;
+    uint32_t quantum;  // Instructions per hart and round
+    uint32_t threads;  // Harts running at once, at least 1
+} rv_sched_cfg_t;
+
+int  rv_run_harts_det(rv_machine_t **harts, uint32_t n, uint64_t budget,
+                      const rv_sched_cfg_t *cfg, rv_exit_t *exits);
+void sched_access(rv_machine_t *rv, uint32_t page, int write); // From mem_translate_slow
+
+#ifdef MEM_GUARD
+// The machine rv_run is running on this thread, for the SIGSEGV handler.
+// Its fault_pc and fault_addr are set before the jump to *fault_jmp,
+// which rv_run turns into RV_EXIT_FAULT.
+extern __thread rv_machine_t *mem_running;
+
+#define MEM_JIT_ARG(rv) ((void *) (rv)->mem_base) // Passed to compiled blocks
+
+// Whether an n-byte access at addr is contiguous in host memory
+#define MEM_IN_PAGE(addr, n) 1
+
+// Host address of guest byte addr, to read it or to write it
+static inline uint8_t *mem_ptr(rv_machine_t *rv, uint32_t addr) {
+    return rv->mem_base + addr;
+}
+
+static inline uint8_t *mem_ptr_w(rv_machine_t *rv, uint32_t addr) {
+    return rv->mem_base + addr;
+}
+#else
+uint8_t *mem_translate_slow(rv_machine_t *rv, uint32_t addr, int write);
+void     mem_tlb_flush(rv_machine_t *rv);
+
+#define MEM_JIT_ARG(rv) ((void *) (rv)->tlb)
+
+#define MEM_IN_PAGE(addr, n) (((addr) & MEM_PAGE_MASK) <= MEM_PAGE_SIZE - (n))
+
+// Host address of guest byte addr, to read it or to write it. Stores
+// probe a TLB of their own so that the first write to a page, not only
+// the first access, reaches mem_translate_slow.
+static inline uint8_t *mem_ptr(rv_machine_t *rv, uint32_t addr) {
+    const mem_tlb_t *t = &rv->tlb[(addr >> PAGE_SHIFT) & ((1 << MEM_TLB_BITS) - 1)];
+    if (t->tag == (addr >> PAGE_SHIFT) + 1)
+        return t->page + (addr & MEM_PAGE_MASK);
+    return mem_translate_slow(rv, addr, 0);
+}
+
+static inline uint8_t *mem_ptr_w(rv_machine_t *rv, uint32_t addr) {
+    const mem_tlb_t *t = &rv->tlb_w[(addr >> PAGE_SHIFT) & ((1 << MEM_TLB_BITS) - 1)];
+    if (t->tag == (addr >> PAGE_SHIFT) + 1)
+        return t->page + (addr & MEM_PAGE_MASK);
+    return mem_translate_slow(rv, addr, 1);
+}
+#endif
+
+// Little-endian 16/32/64-bit values at any host address. On little-endian
+// hosts these are single (possibly unaligned) host loads and stores.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static inline uint16_t load_le16(const uint8_t *p) { uint16_t v; memcpy(&v, p, 2); return v; }
+static inline uint32_t load_le32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline void store_le16(uint8_t *p, uint16_t v) { memcpy(p, &v, 2); }
+static inline void store_le32(uint8_t *p, uint32_t v) { memcpy(p, &v, 4); }
+static inline uint64_t load_le64(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline void store_le64(uint8_t *p, uint64_t v) { memcpy(p, &v, 8); }
+#else
+static inline uint16_t load_le16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+static inline uint32_t load_le32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+static inline void store_le16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+static inline void store_le32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+static inline uint64_t load_le64(const uint8_t *p) {
+    return load_le32(p) | ((uint64_t) load_le32(p + 4) << 32);
+}
+static inline void store_le64(uint8_t *p, uint64_t v) {
+    store_le32(p, (uint32_t) v);
+    store_le32(p + 4, (uint32_t)(v >> 32));
+}
+#endif
+
+// Guest accessors. Unaligned accesses are allowed; one that crosses a
+// page is split. The _aligned variants require natural alignment, so
+// they never cross a page and skip that check.
+static inline uint8_t mem_read8(rv_machine_t *rv, uint32_t addr) {
+    return *mem_ptr(rv, addr);
+}
+
+static inline uint16_t mem_read16_aligned(rv_machine_t *rv, uint32_t addr) {
+    return load_le16(mem_ptr(rv, addr));
+}
+
+static inline uint32_t mem_read32_aligned(rv_machine_t *rv, uint32_t addr) {
+    return load_le32(mem_ptr(rv, addr));
+}
+
+static inline uint16_t mem_read16(rv_machine_t *rv, uint32_t addr) {
+    if (MEM_IN_PAGE(addr, 2))
+        return load_le16(mem_ptr(rv, addr));
+    return mem_read8(rv, addr) | (mem_read8(rv, addr + 1) << 8);
+}
+
+static inline uint32_t mem_read32(rv_machine_t *rv, uint32_t addr) {
+    if (MEM_IN_PAGE(addr, 4))
+        return load_le32(mem_ptr(rv, addr));
+    return mem_read16(rv, addr) | ((uint32_t) mem_read16(rv, addr + 2) << 16);
+}
+
+static inline void mem_write8(rv_machine_t *rv, uint32_t addr, uint8_t val) {
+    *mem_ptr_w(rv, addr) = val;
+}
+
+static inline void mem_write16_aligned(rv_machine_t *rv, uint32_t addr, uint16_t val) {
+    store_le16(mem_ptr_w(rv, addr), val);
+}
+
+static inline void mem_write32_aligned(rv_machine_t *rv, uint32_t addr, uint32_t val) {
+    store_le32(mem_ptr_w(rv, addr), val);
+}
+
+static inline void mem_write16(rv_machine_t *rv, uint32_t addr, uint16_t val) {
+    if (MEM_IN_PAGE(addr, 2)) {
+        store_le16(mem_ptr_w(rv, addr), val);
+        return;
+    }
+    mem_write8(rv, addr, val & 0xFF);
+    mem_write8(rv, addr + 1, (val >> 8) & 0xFF);
+}
+
+static inline void mem_write32(rv_machine_t *rv, uint32_t addr, uint32_t val) {
+    if (MEM_IN_PAGE(addr, 4)) {
+        store_le32(mem_ptr_w(rv, addr), val);
+        return;
+    }
+    mem_write16(rv, addr, val & 0xFFFF);
+    mem_write16(rv, addr + 2, val >> 16);
+}
+
+// Predecode cache (icache_dev.c)
+#define ICACHE_BITS 16
+
+int  icache_init(rv_machine_t *rv);
+void icache_free(rv_machine_t *rv);
+void predecode_at(rv_machine_t *rv, uint32_t pc, rv_insn_t *d);
+const rv_insn_t *icache_fetch_slow(rv_machine_t *rv, uint32_t pc);
+void icache_invalidate_range(rv_machine_t *rv, uint32_t addr, uint32_t len);
+void icache_flush(rv_machine_t *rv);
+void icache_print_stats(rv_machine_t *rv, FILE *fp);
+
+static inline const rv_insn_t *icache_lookup(rv_machine_t *rv, uint32_t pc) {
+    const rv_insn_t *d = &rv->icache[(pc >> 2) & ((1 << ICACHE_BITS) - 1)];
+    if (d->handler != NULL && d->pc == pc) {
+        rv->icache_hits++;
+        return d;
+    }
+    return icache_fetch_slow(rv, pc);
+}
+
+// Must be called for every guest store so cached code stays coherent.
+// Only pages that hold predecoded instructions take the slow path.
+static inline void icache_notify_store(rv_machine_t *rv, uint32_t addr, uint32_t len) {
+    const uint32_t *code = rv->icache_code_pages;
+    uint32_t first = addr >> PAGE_SHIFT;
+    uint32_t last  = (addr + len - 1) >> PAGE_SHIFT;
+    if (((code[first >> 5] >> (first & 0x1F)) & 1) ||
+        ((code[last  >> 5] >> (last  & 0x1F)) & 1))
+        icache_invalidate_range(rv, addr, len);
+}
+
+// Basic-block translation cache (block_dev.c)
+void block_invalidate_range(rv_machine_t *rv, uint32_t addr, uint32_t len);
+void block_flush(rv_machine_t *rv);
+void block_free(rv_machine_t *rv);
+void block_print_stats(rv_machine_t *rv, FILE *fp);
+
+// x86-64 JIT for hot blocks (jit_dev.c)
+typedef uint32_t (*jit_fn_t)(uint32_t *xreg, void *mem); // mem = MEM_JIT_ARG(rv)
+
+jit_fn_t jit_compile(rv_machine_t *rv, const rv_insn_t *ops, uint32_t len);
+int  jit_space_ok(rv_machine_t *rv);
+void jit_reset(rv_machine_t *rv);
+void jit_free(rv_machine_t *rv);
+void jit_print_stats(rv_machine_t *rv, FILE *fp);
+int  jit_fault_pc(rv_machine_t *rv, uintptr_t host_pc, uint32_t *guest_pc);
+
+// Execution engines : run up to max_cycle instructions from rv->pc, or
+// until a handler returns RV_HALT or RV_BREAK, and return the number of
+// instructions retired. rv->instret is kept current for fault exits.
+uint64_t run_interp(rv_machine_t *rv, uint64_t max_cycle);   // machine_dev.c
+uint64_t run_threaded(rv_machine_t *rv, uint64_t max_cycle); // threaded_dev.c
+uint64_t run_block(rv_machine_t *rv, uint64_t max_cycle);    // block_dev.c
+
+// Vector unit (rvv_dev.c)
+// VLEN is a power of two picked per machine with rvv_set_vlen. The
+// register file is one cache-aligned array with a stride of VLEN/8 bytes,
+// so a register group is a single contiguous span from its first register.
+#define VLEN_MIN 128
+#define VLEN_MAX 4096
+
+int  rvv_set_vlen(rv_machine_t *rv, uint32_t bits);
+void rvv_free(rv_machine_t *rv);
+void vdec_print_stats(rv_machine_t *rv, FILE *fp); // Decode cache, keyed by instruction word and vtype
+
+// Vector integer kernels (vkern_dev.c)
+// Element-wise operations over n elements in vreg layout, resolved once
+// per instruction from funct6 and vsew.
+typedef void (*vkern_vv_t)(uint8_t *d, const uint8_t *a, const uint8_t *b, uint32_t n);
+typedef void (*vkern_vs_t)(uint8_t *d, const uint8_t *a, uint32_t s, uint32_t n);
+typedef uint64_t (*vkern_red_t)(const uint8_t *a, uint64_t acc, uint32_t n);
+
+extern vkern_vv_t  vkern_vv[64][4];  // [funct6][vsew], NULL without a kernel
+extern vkern_vs_t  vkern_vs[64][4];  // Shifts by a uniform amount
+extern vkern_vv_t  vkern_mv[64][4];  // Multiplies (OPMVV, OPMVX), reading d too
+extern vkern_red_t vkern_red[64][4]; // Reductions, folding n elements into acc
+extern const char *vkern_isa;        // Selected kernel set, NULL before vkern_init
+
+// The first rv_create picks the best set if none was chosen. Changing the
+// set while machines run on other threads is not safe.
+int vkern_init(const char *isa);
+
+// Timing model (timing_dev.c)
+// Estimated cycles of an in-order core from per-class latency and
+// throughput tables, charged per basic block by the block engine and
+// reported per ELF symbol.
+typedef struct {
+    uint64_t cycles;
+    uint64_t instret;
+} timing_count_t;
+
+typedef struct {
+    uint32_t cycles[2];    // Block cost, falling through or taking the final branch
+    uint32_t vtype;        // vtype at entry the costs are for
+    uint32_t rvv;          // Has vector instructions
+    timing_count_t *count; // Symbol charged
+} timing_block_t;
+
+extern int timing_enabled;
+
+int  timing_load(const char *path); // NULL for the built-in tables
+void timing_block(timing_block_t *t, const rv_insn_t *ops, uint32_t len, uint32_t vtype);
+void timing_block_enter(timing_block_t *t, const rv_insn_t *ops, uint32_t len, uint32_t vtype);
+void timing_block_exit(const timing_block_t *t, const rv_insn_t *ops, uint32_t len, uint32_t n,
+                       uint32_t pc);
+void timing_print_stats(FILE *fp);
+
+#define timing_on() __builtin_expect(timing_enabled, 0)
+
+// Profiler (prof_dev.c)
+// Instruction counts per pc, per mnemonic and per call stack, gathered
+// per basic block by the block engine. The stacks are written as folded
+// lines for flamegraph tools.
+typedef struct prof_rec prof_rec_t;
+
+extern int prof_enabled;
+
+int         prof_open(const char *path);
+prof_rec_t *prof_block(const rv_insn_t *ops, uint32_t len);
+void        prof_block_exit(prof_rec_t *r, uint32_t n, uint32_t pc);
+void        prof_close(void);
+
+#define prof_on() __builtin_expect(prof_enabled, 0)
+
+// ELF32 loader (elf_dev.c)
+typedef struct {
+    uint32_t    addr;
+    uint32_t    size;
+    const char *name;
+} elf_sym_t;
+
+extern elf_sym_t *elf_syms;  // Sorted by address
+extern uint32_t   elf_nsyms;
+
+int elf_is_elf(const uint8_t *head, size_t len);
+int elf_load(rv_machine_t *rv, const char *path, uint32_t *entry);
+int elf_load_symbols(const char *path);
+const elf_sym_t *elf_symbol_at(uint32_t addr);
+
+// Tracing (trace_dev.c)
+// debug() lines are emitted at TRACE_FULL, debug_flow() lines (jumps,
+// branches and ecall) at TRACE_FLOW and above. Each site costs one
+// predictable branch when tracing is off; build with -DNO_TRACE to
+// compile them out entirely.
+enum { TRACE_OFF, TRACE_FLOW, TRACE_FULL };
+
+extern int trace_level;
+
+void trace_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void trace_flush(void);
+int  trace_open(const char *path);
+int  trace_parse_level(const char *s);
+
+#ifndef NO_TRACE
+#define debug(...)      do { if (__builtin_expect(trace_level >= TRACE_FULL, 0)) trace_printf(__VA_ARGS__); } while (0)
+#define debug_flow(...) do { if (__builtin_expect(trace_level >= TRACE_FLOW, 0)) trace_printf(__VA_ARGS__); } while (0)
 #else
 #define debug(...)
-#endif
\ No newline at end of file
+#define debug_flow(...)
+#endif
+
+// Binary trace (trace_dev.c, decoded offline by rvtrace.c)
+// The file starts with a trace_header_t holding the initial pc and
+// registers, followed by fixed-size trace_rec_t records. Instruction pcs
+// are stored relative to the previous pc + 4; a TRACE_REC_PC record
+// resets the base when the distance does not fit in 16 bits. Traces of
+// several harts (the deterministic scheduler) give the registers of each
+// hart in TRACE_REC_REG records and mark each change of hart.
+#define TRACE_MAGIC   "RVTB"
+#define TRACE_VERSION 3
+
+enum {
+    TRACE_REC_INSN,    // value = xreg[rd] after, or store data
+    TRACE_REC_UNKNOWN, // Not executed (unknown, or stopped at a breakpoint)
+    TRACE_REC_VSET,    // value = vl, addr = vtype after the instruction
+    TRACE_REC_PC,      // addr = pc of the next record
+    TRACE_REC_HART,    // value = hartid of the next records, addr = pc of the next record
+    TRACE_REC_REG,     // instr = hartid, op = register, value = its initial value
+};
+
+typedef struct {
+    char     magic[4];
+    uint16_t version;
+    uint16_t rec_size;
+    uint32_t pc;
+    uint32_t xreg[32];
+} trace_header_t;
+
+typedef struct {
+    uint8_t  kind;
+    uint8_t  op;       // Instruction
+    int16_t  pc_delta; // pc - (previous pc + 4)
+    uint32_t instr;
+    uint32_t value;
+    uint32_t addr;     // Load/store effective address
+} trace_rec_t;
+
+extern int trace_bin_enabled;
+
+int          trace_bin_open(const char *path);
+void         trace_bin_close(void);
+trace_rec_t *trace_begin(rv_machine_t *rv, const rv_insn_t *d);
+void         trace_end(rv_machine_t *rv, trace_rec_t *r, int valid);
+
+// Set while the deterministic scheduler runs traced harts : output is
+// staged per instruction and written out by trace_commit
+extern int trace_harts;
+
+void trace_harts_begin(rv_machine_t **harts, uint32_t n);
+void trace_harts_end(void);
+void trace_commit(rv_machine_t *rv);
+
+#ifndef NO_TRACE
+#define trace_bin_on()   __builtin_expect(trace_bin_enabled, 0)
+#define trace_harts_on() __builtin_expect(trace_harts, 0)
+#else
+#define trace_bin_on()   0
+#define trace_harts_on() 0
+#endif
+
+#endif // RV32_H
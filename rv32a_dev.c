@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * RV32A (atomic instructions)
+ *
+ * Each AMO is one host atomic operation on the guest word, so harts on
+ * different host threads see them as atomic without any lock, and
+ * ordinary loads and stores stay plain host accesses. The aq and rl bits
+ * are not decoded : every atomic is sequentially consistent.
+ *
+ * LR.W records the address and the value it read in the hart. SC.W
+ * stores with a compare-and-swap against that value, so it fails when
+ * another hart changed the word since the LR.W. A store that writes the
+ * value back unchanged (or changes it and changes it back) goes
+ * unnoticed, which the LR/SC retry loops of compiled code do not depend
+ * on.
+ *
+ * Misaligned addresses are unknown instructions : the host atomic needs
+ * an aligned word, and there are no traps to raise.
+ */
+
+// Guest words are little-endian; the host atomics see them in host order
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define le_host(v) (v)
+#else
+#define le_host(v) __builtin_bswap32(v)
+#endif
+
+// Host word of the guest word at addr, NULL when misaligned. Pages are
+// host page aligned, so an aligned guest word is an aligned host word.
+// Only LR.W translates for a read; everything else may store.
+static inline uint32_t *amo_word(rv_machine_t *rv, uint32_t addr, int write) {
+    if ((addr & 3) != 0)
+        return NULL;
+    return (uint32_t *) (write ? mem_ptr_w(rv, addr) : mem_ptr(rv, addr));
+}
+
+static int exec_lr_w(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    uint32_t addr = rv->xreg[d->rs1];
+    uint32_t *p = amo_word(rv, addr, 0);
+    if (p == NULL)
+        return 0;
+    uint32_t val = le_host(__atomic_load_n(p, __ATOMIC_SEQ_CST));
+    rv->reserve_addr  = addr;
+    rv->reserve_value = val;
+    rv->reserve_valid = 1;
+    if (rd != 0)
+        rv->xreg[rd] = val;
+    rv->pc += 4;
+    debug("lr.w : xreg[0x%x] = mem[0x%x](0x%x)\n", rd, addr, rd != 0 ? val : 0);
+    return 1;
+}
+
+// rd is 0 when the store happened, 1 when it failed
+static int exec_sc_w(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    uint32_t addr = rv->xreg[d->rs1];
+    uint32_t val = rv->xreg[d->rs2];
+    uint32_t *p = amo_word(rv, addr, 1);
+    if (p == NULL)
+        return 0;
+    uint32_t expect = le_host(rv->reserve_value);
+    int ok = rv->reserve_valid && rv->reserve_addr == addr &&
+             __atomic_compare_exchange_n(p, &expect, le_host(val), 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    rv->reserve_valid = 0;
+    if (ok)
+        icache_notify_store(rv, addr, 4);
+    if (rd != 0)
+        rv->xreg[rd] = !ok;
+    rv->pc += 4;
+    debug("sc.w : mem[0x%x] = 0x%x, xreg[0x%x] = 0x%x\n", addr, val, rd, rd != 0 ? !ok : 0);
+    return 1;
+}
+
+// rd gets the old value of the word, the word gets f(old, rs2)
+#define AMO_END(name)                                                            \
+    icache_notify_store(rv, addr, 4);                                            \
+    if (d->rd != 0)                                                              \
+        rv->xreg[d->rd] = old;                                                   \
+    rv->pc += 4;                                                                 \
+    debug(name " : xreg[0x%x] = mem[0x%x](0x%x), operand 0x%x\n",               \
+          d->rd, addr, d->rd != 0 ? old : 0, b);                                 \
+    return 1;
+
+// One host read-modify-write, for operations that do not depend on the
+// byte order (or, for add, on little-endian hosts)
+#define AMO_FETCH(fn, name, host_op)                                             \
+static int fn(rv_machine_t *rv, const rv_insn_t *d) {                            \
+    uint32_t addr = rv->xreg[d->rs1], b = rv->xreg[d->rs2];                      \
+    uint32_t *p = amo_word(rv, addr, 1);                                         \
+    if (p == NULL)                                                               \
+        return 0;                                                                \
+    uint32_t old = le_host(host_op(p, le_host(b), __ATOMIC_SEQ_CST));            \
+    AMO_END(name)                                                                \
+}
+
+// A compare-and-swap loop computing the new value from old and b
+#define AMO_CAS(fn, name, expr)                                                  \
+static int fn(rv_machine_t *rv, const rv_insn_t *d) {                            \
+    uint32_t addr = rv->xreg[d->rs1], b = rv->xreg[d->rs2];                      \
+    uint32_t *p = amo_word(rv, addr, 1);                                         \
+    if (p == NULL)                                                               \
+        return 0;                                                                \
+    uint32_t raw = __atomic_load_n(p, __ATOMIC_RELAXED), old;                    \
+    do {                                                                         \
+        old = le_host(raw);                                                      \
+    } while (!__atomic_compare_exchange_n(p, &raw, le_host(expr), 1,             \
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));  \
+    AMO_END(name)                                                                \
+}
+
+AMO_FETCH(exec_amoswap_w, "amoswap.w", __atomic_exchange_n)
+AMO_FETCH(exec_amoxor_w,  "amoxor.w",  __atomic_fetch_xor)
+AMO_FETCH(exec_amoand_w,  "amoand.w",  __atomic_fetch_and)
+AMO_FETCH(exec_amoor_w,   "amoor.w",   __atomic_fetch_or)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+AMO_FETCH(exec_amoadd_w,  "amoadd.w",  __atomic_fetch_add)
+#else
+AMO_CAS(exec_amoadd_w,    "amoadd.w",  old + b)
+#endif
+AMO_CAS(exec_amomin_w,    "amomin.w",  (int32_t) old < (int32_t) b ? old : b)
+AMO_CAS(exec_amomax_w,    "amomax.w",  (int32_t) old > (int32_t) b ? old : b)
+AMO_CAS(exec_amominu_w,   "amominu.w", old < b ? old : b)
+AMO_CAS(exec_amomaxu_w,   "amomaxu.w", old > b ? old : b)
+
+#undef AMO_FETCH
+#undef AMO_CAS
+#undef AMO_END
+
+/*
+ * predecode_rv32a_instr:
+ *
+ * Decode an RV32A instruction into a rv_insn_t record.
+ * Only instructions with opcode 0x2F and funct3 0x2 (word) are processed;
+ * funct5 (instr[31:27]) selects the operation:
+ *
+ *   LR.W      (0x02) : x[rd] = mem[x[rs1]], reserve x[rs1] (rs2 must be 0)
+ *   SC.W      (0x03) : mem[x[rs1]] = x[rs2] if still reserved; x[rd] = 0 on success, 1 on failure
+ *   AMOSWAP.W (0x01) : x[rd] = mem[x[rs1]], mem[x[rs1]] = x[rs2]
+ *   AMOADD.W  (0x00) : x[rd] = mem[x[rs1]], mem[x[rs1]] += x[rs2]
+ *   AMOXOR.W  (0x04) : ... ^= x[rs2]
+ *   AMOAND.W  (0x0C) : ... &= x[rs2]
+ *   AMOOR.W   (0x08) : ... |= x[rs2]
+ *   AMOMIN.W  (0x10) : ... = min(old, x[rs2]), signed
+ *   AMOMAX.W  (0x14) : ... = max(old, x[rs2]), signed
+ *   AMOMINU.W (0x18) : ... = min(old, x[rs2]), unsigned
+ *   AMOMAXU.W (0x1C) : ... = max(old, x[rs2]), unsigned
+ */
+int predecode_rv32a_instr(uint32_t instr, rv_insn_t *d) {
+    uint32_t opcode = instr & 0x7F;
+    uint32_t rd     = (instr >> 7)  & 0x1F;
+    uint32_t rs1    = (instr >> 15) & 0x1F;
+    uint32_t rs2    = (instr >> 20) & 0x1F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t funct5 = instr >> 27;
+
+    // Process only RV32A instructions (opcode 0x2F with funct3 0x2)
+    if (opcode != 0x2F || funct3 != 0x2) {
+        return 0; // Not an RV32A instruction.
+    }
+
+    switch (funct5) {
+        case 0x02 : // LR.W
+            if (rs2 != 0)
+                return 0;
+            d->op = INSTR_LR_W;      d->handler = exec_lr_w;      break;
+        case 0x03 : d->op = INSTR_SC_W;      d->handler = exec_sc_w;      break;
+        case 0x01 : d->op = INSTR_AMOSWAP_W; d->handler = exec_amoswap_w; break;
+        case 0x00 : d->op = INSTR_AMOADD_W;  d->handler = exec_amoadd_w;  break;
+        case 0x04 : d->op = INSTR_AMOXOR_W;  d->handler = exec_amoxor_w;  break;
+        case 0x0C : d->op = INSTR_AMOAND_W;  d->handler = exec_amoand_w;  break;
+        case 0x08 : d->op = INSTR_AMOOR_W;   d->handler = exec_amoor_w;   break;
+        case 0x10 : d->op = INSTR_AMOMIN_W;  d->handler = exec_amomin_w;  break;
+        case 0x14 : d->op = INSTR_AMOMAX_W;  d->handler = exec_amomax_w;  break;
+        case 0x18 : d->op = INSTR_AMOMINU_W; d->handler = exec_amominu_w; break;
+        case 0x1C : d->op = INSTR_AMOMAXU_W; d->handler = exec_amomaxu_w; break;
+        default :
+            return 0;
+    }
+    d->instr = instr;
+    d->imm   = 0;
+    d->rd    = rd;
+    d->rs1   = rs1;
+    d->rs2   = rs2;
+    return 1;
+}
+
+int decode_rv32a_instr(rv_machine_t *rv, uint32_t instr) {
+    rv_insn_t d;
+    if (predecode_rv32a_instr(instr, &d) == 0)
+        return 0;
+    return d.handler(rv, &d);
+}
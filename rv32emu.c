@@ -4,6 +4,13 @@
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <sys/mman.h>
+
+// ELF32 loader (elf_dev.c). This emulator has a single guest, so the
+// machine handed to the loader and back to the hooks below is NULL.
+struct rv_machine;
+int elf_is_elf(const uint8_t *head, size_t len);
+int elf_load(struct rv_machine *rv, const char *path, uint32_t *entry);
 
 typedef enum {
     INSTR_LUI,
@@ -57,11 +64,24 @@ Instruction decoded_instr;
 
 uint32_t pc; // Program counter
 uint32_t reg[32]; // Register file
-uint8_t mem[1 << 24]; // Memory
+bool halted; // Set by ECALL; x3 is the exit code
+uint8_t mem[1 << 24] __attribute__((aligned(4096))); // Memory
+
+// Guest memory hooks for the ELF loader
+uint8_t *mem_host_page(struct rv_machine *rv, uint32_t addr) {
+    return addr < sizeof(mem) ? mem + (addr & ~0xFFFu) : NULL;
+}
+
+int mem_map_file(struct rv_machine *rv, uint32_t addr, uint32_t len, int fd, int64_t off) {
+    if ((uint64_t) addr + len > sizeof(mem))
+        return -1;
+    void *p = mmap(mem + addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, off);
+    return p == MAP_FAILED ? -1 : 0;
+}
 
 uint32_t csr[4096]; // Control and Status Registers
 
-#define DEBUG
+// Per-instruction trace, compiled in only with -DDEBUG
 #ifdef DEBUG
 #define debug(...) printf(__VA_ARGS__)
 #else
@@ -432,7 +452,8 @@ void execute_instr(uint32_t instr) {
             if (instr == 0x73) {
                 decoded_instr = INSTR_ECALL;
                 debug("ecall : exit(0x%x)\n", reg[3]);
-                exit(reg[3]);
+                halted = true;
+                pc += 4;
             }
             else {
                 uint32_t csr_addr = (instr >> 20) & 0xFFF;
@@ -641,8 +662,8 @@ void print_decoded_instr() {
 }
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s <filename> [budget]\n", argv[0]);
         return 1;
     }
     FILE *fp = fopen(argv[1], "rb");
@@ -650,28 +671,43 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Error: Cannot open file %s\n", argv[1]);
         return 1;
     }
-    // size of file
-    fseek(fp, 0, SEEK_END);
-    size_t file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    // Instructions to run unless ECALL stops the program first
+    uint64_t budget = argc == 3 ? strtoull(argv[2], NULL, 0) : 2000;
+    pc = 0;
 
-    size_t size = fread(mem, 1, file_size, fp);
+    // ELF files are loaded by segment (elf_dev.c), anything else is a
+    // flat binary loaded at address 0
+    uint8_t head[4];
+    size_t head_len = fread(head, 1, sizeof(head), fp);
+    if (elf_is_elf(head, head_len)) {
+        fclose(fp);
+        uint32_t entry;
+        if (elf_load(NULL, argv[1], &entry) != 0)
+            return 1;
+        pc = entry;
+    } else {
+        // size of file
+        fseek(fp, 0, SEEK_END);
+        size_t file_size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
 
-    int MAX = 8000;
-    pc = 0;
+        size_t size = fread(mem, 1, file_size, fp);
+    }
     // print the content of the file in 32-bit hexadecimal
     // with address
-    for (int i = 0; i < MAX; i += 4) {
-        printf("%08x: ", pc);
+    for (uint64_t n = 0; n < budget && !halted; n++) {
+        debug("%08x: ", pc);
         uint32_t instr = 0;
         for (int j = 0; j < 4; j++) {
             instr |= ((uint32_t)mem[pc + j] << (j * 8)) & (0xFF << (j * 8));
         }
-        printf("%08x\n", instr);
+        debug("%08x\n", instr);
         execute_instr(instr);
-        printf("--------------------\n");
+        debug("--------------------\n");
         //print_decoded_instr();
     }
 
+    if (halted)
+        return reg[3];
     return -1;
 }
\ No newline at end of file
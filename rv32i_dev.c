@@ -7,11 +7,489 @@
 
 #include "rv32.h"
 
-extern uint32_t pc;      // Program counter
-extern uint32_t xreg[32]; // Register file
-extern uint8_t  mem[1 << 24]; // Memory
+// === Instruction handlers ===
+// Each handler executes one predecoded instruction and returns 1.
 
-int decode_rv32i_instr(uint32_t instr) {
+static int exec_lui(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    if (rd != 0)
+        rv->xreg[rd] = d->imm;
+    rv->pc = rv->pc + 4;
+    debug("lui : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_auipc(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    if (rd != 0)
+        rv->xreg[rd] = rv->pc + d->imm;
+    rv->pc = rv->pc + 4;
+    debug("auipc : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_jal(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    if (rd != 0)
+        rv->xreg[rd] = rv->pc + 4;
+    rv->pc = rv->pc + d->imm;
+    debug_flow("jal : xreg[0x%x] = 0x%x, pc = 0x%x\n", rd, rd != 0 ? rv->xreg[rd] : 0, rv->pc);
+    return 1;
+}
+
+static int exec_jalr(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    uint32_t t = rv->pc + 4;
+    rv->pc = (rv->xreg[d->rs1] + d->imm) & 0xFFFFFFFE;
+    if (rd != 0)
+        rv->xreg[rd] = t;
+    debug_flow("jalr : xreg[0x%x] = 0x%x, pc = 0x%x\n", rd, rd != 0 ? rv->xreg[rd] : 0, rv->pc);
+    return 1;
+}
+
+// === Branch instructions ===
+
+static int exec_beq(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rs1 = d->rs1, rs2 = d->rs2;
+    int32_t simm_b = d->imm;
+    debug_flow("beq : if(xreg[0x%x](0x%x) == xreg[0x%x](0x%x)) pc (0x%x) = 0x%x + 0x%x\n", rs1, rv->xreg[rs1], rs2, rv->xreg[rs2], rv->pc + simm_b, rv->pc, simm_b);
+    if (rv->xreg[rs1] == rv->xreg[rs2])
+        rv->pc = rv->pc + simm_b;
+    else
+        rv->pc = rv->pc + 4;
+    return 1;
+}
+
+static int exec_bne(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rs1 = d->rs1, rs2 = d->rs2;
+    int32_t simm_b = d->imm;
+    debug_flow("bne : if(xreg[0x%x](0x%x) != xreg[0x%x](0x%x)) pc (0x%x) = 0x%x + 0x%x\n", rs1, rv->xreg[rs1], rs2, rv->xreg[rs2], rv->pc + simm_b, rv->pc, simm_b);
+    if (rv->xreg[rs1] != rv->xreg[rs2])
+        rv->pc = rv->pc + simm_b;
+    else
+        rv->pc = rv->pc + 4;
+    return 1;
+}
+
+static int exec_blt(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rs1 = d->rs1, rs2 = d->rs2;
+    int32_t simm_b = d->imm;
+    debug_flow("blt : if(xreg[0x%x](0x%x) < xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, rv->xreg[rs1], rs2, rv->xreg[rs2], rv->pc + simm_b);
+    if ((int32_t) rv->xreg[rs1] < (int32_t) rv->xreg[rs2])
+        rv->pc = rv->pc + simm_b;
+    else
+        rv->pc = rv->pc + 4;
+    return 1;
+}
+
+static int exec_bge(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rs1 = d->rs1, rs2 = d->rs2;
+    int32_t simm_b = d->imm;
+    debug_flow("bge : if(xreg[0x%x](0x%x) >= xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, (int32_t)rv->xreg[rs1], rs2, (int32_t)rv->xreg[rs2], rv->pc + simm_b);
+    if ((int32_t) rv->xreg[rs1] >= (int32_t) rv->xreg[rs2])
+        rv->pc = rv->pc + simm_b;
+    else
+        rv->pc = rv->pc + 4;
+    return 1;
+}
+
+static int exec_bltu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rs1 = d->rs1, rs2 = d->rs2;
+    int32_t simm_b = d->imm;
+    debug_flow("bltu : if(xreg[0x%x](0x%x) < xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, rv->xreg[rs1], rs2, rv->xreg[rs2], rv->pc + simm_b);
+    if (rv->xreg[rs1] < rv->xreg[rs2])
+        rv->pc = rv->pc + simm_b;
+    else
+        rv->pc = rv->pc + 4;
+    return 1;
+}
+
+static int exec_bgeu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rs1 = d->rs1, rs2 = d->rs2;
+    int32_t simm_b = d->imm;
+    debug_flow("bgeu : if(xreg[0x%x](0x%x) >= xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, rv->xreg[rs1], rs2, rv->xreg[rs2], rv->pc + simm_b);
+    if (rv->xreg[rs1] >= rv->xreg[rs2])
+        rv->pc = rv->pc + simm_b;
+    else
+        rv->pc = rv->pc + 4;
+    return 1;
+}
+
+// === Load instructions ===
+
+static int exec_lb(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    uint32_t addr = rv->xreg[d->rs1] + d->imm;
+    int32_t val = (int8_t) mem_read8(rv, addr);
+    if (rd != 0)
+        rv->xreg[rd] = val;
+    rv->pc = rv->pc + 4;
+    debug("lb : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_lh(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    uint32_t addr = rv->xreg[d->rs1] + d->imm;
+    int32_t val = mem_read16(rv, addr);
+    val = (val << 16) >> 16;
+    if (rd != 0)
+        rv->xreg[rd] = val;
+    rv->pc = rv->pc + 4;
+    debug("lh : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_lw(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    uint32_t addr = rv->xreg[d->rs1] + d->imm;
+    int32_t val = mem_read32(rv, addr);
+    if (rd != 0)
+        rv->xreg[rd] = val;
+    rv->pc = rv->pc + 4;
+    debug("lw : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_lbu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    uint32_t addr = rv->xreg[d->rs1] + d->imm;
+    uint32_t val = mem_read8(rv, addr); // Loads to x0 still access memory
+    if (rd != 0)
+        rv->xreg[rd] = val;
+    rv->pc = rv->pc + 4;
+    debug("lbu : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_lhu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd;
+    uint32_t addr = rv->xreg[d->rs1] + d->imm;
+    uint32_t val = mem_read16(rv, addr); // Loads to x0 still access memory
+    if (rd != 0)
+        rv->xreg[rd] = val;
+    rv->pc = rv->pc + 4;
+    debug("lhu : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+// === Store instructions ===
+
+static int exec_sb(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rs2 = d->rs2;
+    uint32_t addr = rv->xreg[d->rs1] + d->imm;
+    mem_write8(rv, addr, rv->xreg[rs2] & 0xFF);
+    icache_notify_store(rv, addr, 1);
+    rv->pc = rv->pc + 4;
+    debug("sb : mem[0x%x] = 0x%x\n", addr, rv->xreg[rs2] & 0xFF);
+    return 1;
+}
+
+static int exec_sh(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rs2 = d->rs2;
+    uint32_t addr = rv->xreg[d->rs1] + d->imm;
+    mem_write16(rv, addr, rv->xreg[rs2] & 0xFFFF);
+    icache_notify_store(rv, addr, 2);
+    rv->pc = rv->pc + 4;
+    debug("sh : mem[0x%x..0x%x] = 0x%x\n", addr, addr+1, rv->xreg[rs2] & 0xFFFF);
+    return 1;
+}
+
+static int exec_sw(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rs2 = d->rs2;
+    uint32_t addr = rv->xreg[d->rs1] + d->imm;
+    mem_write32(rv, addr, rv->xreg[rs2]);
+    icache_notify_store(rv, addr, 4);
+    rv->pc = rv->pc + 4;
+    debug("sw : mem[0x%x..0x%x] = 0x%x\n", addr, addr+3, rv->xreg[rs2]);
+    return 1;
+}
+
+// === Immediate instructions ===
+
+static int exec_addi(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1;
+    int32_t simm_i = d->imm;
+    debug("addi : xreg[0x%x](0x%x) = 0x%x + 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] + simm_i : 0,
+        (int32_t) rv->xreg[rs1], simm_i);
+    if (rd != 0)
+        rv->xreg[rd] = (int32_t) rv->xreg[rs1] + simm_i;
+    rv->pc += 4;
+    return 1;
+}
+
+static int exec_slti(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1;
+    int32_t simm_i = d->imm;
+    debug("slti : xreg[0x%x](0x%x) = (0x%x < 0x%x) ? 1 : 0\n",
+        rd, rd != 0 ? (rv->xreg[rd] < simm_i) : 0,
+        (int32_t) rv->xreg[rs1], simm_i);
+    if (rd != 0)
+        rv->xreg[rd] = ((int32_t) rv->xreg[rs1] < simm_i) ? 1 : 0;
+    rv->pc += 4;
+    return 1;
+}
+
+static int exec_sltiu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1;
+    int32_t simm_i = d->imm;
+    debug("sltiu : xreg[0x%x](0x%x) = (%u < %u) ? 1 : 0\n",
+        rd, rd != 0 ? (rv->xreg[rd] < simm_i) : 0,
+        rv->xreg[rs1], simm_i);
+    if (rd != 0)
+        rv->xreg[rd] = (rv->xreg[rs1] < (uint32_t) simm_i) ? 1 : 0;
+    rv->pc += 4;
+    return 1;
+}
+
+static int exec_xori(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1;
+    int32_t simm_i = d->imm;
+    debug("xori : xreg[0x%x](0x%x) = 0x%x ^ 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], simm_i);
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] ^ simm_i;
+    rv->pc += 4;
+    return 1;
+}
+
+static int exec_ori(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1;
+    int32_t simm_i = d->imm;
+    debug("ori : xreg[0x%x](0x%x) = 0x%x | 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], simm_i);
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] | simm_i;
+    rv->pc += 4;
+    return 1;
+}
+
+static int exec_andi(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1;
+    int32_t simm_i = d->imm;
+    debug("andi : xreg[0x%x](0x%x) = 0x%x & 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], simm_i);
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] & simm_i;
+    rv->pc += 4;
+    return 1;
+}
+
+static int exec_slli(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1;
+    debug("slli : xreg[0x%x](0x%x) = 0x%x << 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], d->imm);
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] << d->imm;
+    rv->pc += 4;
+    return 1;
+}
+
+static int exec_srli(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1;
+    debug("srli : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], d->imm);
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] >> d->imm;
+    rv->pc += 4;
+    return 1;
+}
+
+static int exec_srai(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1;
+    debug("srai : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], d->imm);
+    if (rd != 0)
+        rv->xreg[rd] = ((int32_t) rv->xreg[rs1]) >> d->imm;
+    rv->pc += 4;
+    return 1;
+}
+
+// === Register instructions ===
+
+static int exec_add(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = (int32_t) rv->xreg[rs1] + (int32_t) rv->xreg[rs2];
+    rv->pc += 4;
+    debug("add : xreg[0x%x](0x%x) = 0x%x + 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], (int32_t) rv->xreg[rs2]);
+    return 1;
+}
+
+static int exec_sub(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = (int32_t) rv->xreg[rs1] - (int32_t) rv->xreg[rs2];
+    rv->pc += 4;
+    debug("sub : xreg[0x%x](0x%x) = 0x%x - 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], (int32_t) rv->xreg[rs2]);
+    return 1;
+}
+
+static int exec_sll(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] << (rv->xreg[rs2] & 0x1F);
+    rv->pc += 4;
+    debug("sll : xreg[0x%x](0x%x) = 0x%x << 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        rv->xreg[rs1], (rv->xreg[rs2] & 0x1F));
+    return 1;
+}
+
+static int exec_slt(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = ((int32_t) rv->xreg[rs1] < (int32_t) rv->xreg[rs2]) ? 1 : 0;
+    rv->pc += 4;
+    debug("slt : xreg[0x%x](0x%x) = (0x%x < 0x%x) ? 1 : 0\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], (int32_t) rv->xreg[rs2]);
+    return 1;
+}
+
+static int exec_sltu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = (rv->xreg[rs1] < rv->xreg[rs2]) ? 1 : 0;
+    rv->pc += 4;
+    debug("sltu : xreg[0x%x](0x%x) = (%u < %u) ? 1 : 0\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        rv->xreg[rs1], rv->xreg[rs2]);
+    return 1;
+}
+
+static int exec_xor(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] ^ rv->xreg[rs2];
+    rv->pc += 4;
+    debug("xor : xreg[0x%x](0x%x) = 0x%x ^ 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], (int32_t) rv->xreg[rs2]);
+    return 1;
+}
+
+static int exec_srl(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] >> (rv->xreg[rs2] & 0x1F);
+    rv->pc += 4;
+    debug("srl : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], (rv->xreg[rs2] & 0x1F));
+    return 1;
+}
+
+static int exec_sra(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = ((int32_t) rv->xreg[rs1]) >> (rv->xreg[rs2] & 0x1F);
+    rv->pc += 4;
+    debug("sra : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], (rv->xreg[rs2] & 0x1F));
+    return 1;
+}
+
+static int exec_or(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] | rv->xreg[rs2];
+    rv->pc += 4;
+    debug("or : xreg[0x%x](0x%x) = 0x%x | 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], (int32_t) rv->xreg[rs2]);
+    return 1;
+}
+
+static int exec_and(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    if (rd != 0)
+        rv->xreg[rd] = rv->xreg[rs1] & rv->xreg[rs2];
+    rv->pc += 4;
+    debug("and : xreg[0x%x](0x%x) = 0x%x & 0x%x\n",
+        rd, rd != 0 ? rv->xreg[rd] : 0,
+        (int32_t) rv->xreg[rs1], (int32_t) rv->xreg[rs2]);
+    return 1;
+}
+
+// The run stops after ECALL with x3 as the exit code; the embedder may
+// resume from the next instruction
+static int exec_ecall(rv_machine_t *rv, const rv_insn_t *d) {
+    debug_flow("ecall : exit(0x%x)\n", rv->xreg[3]);
+    rv->exit_reason = RV_EXIT_ECALL;
+    rv->exit_value  = rv->xreg[3];
+    rv->pc += 4;
+    return RV_HALT;
+}
+
+// Guest loads and stores are plain host accesses, so a full host barrier
+// orders them as seen by the other harts
+static int exec_fence(rv_machine_t *rv, const rv_insn_t *d) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    rv->pc += 4;
+    debug("fence\n");
+    return 1;
+}
+
+// Stores by other harts do not invalidate this hart's cached code, so
+// FENCE.I drops all of it and the following fetches read memory again
+static int exec_fence_i(rv_machine_t *rv, const rv_insn_t *d) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    rv->pc += 4;
+    icache_flush(rv);
+    if (rv->blocks != NULL)
+        block_flush(rv);
+    debug("fence.i\n");
+    return 1;
+}
+
+// Only the read-only CSRs below exist. Reading any other CSR, or writing
+// one of these, is an unknown instruction. CSRRW and CSRRWI always
+// write; the set and clear forms write unless rs1 (or uimm) is 0.
+static int exec_csr(rv_machine_t *rv, const rv_insn_t *d) {
+    static const char *const names[8] __attribute__((unused)) = { // For debug()
+        NULL, "csrrw", "csrrs", "csrrc", NULL, "csrrwi", "csrrsi", "csrrci"
+    };
+    uint32_t rd = d->rd, csr = d->imm;
+    uint32_t funct3 = (d->instr >> 12) & 0x7;
+    uint32_t val;
+    if ((funct3 & 0x3) == 0x1 || d->rs1 != 0)
+        return 0;
+    switch (csr) {
+        case 0xF14 : val = rv->hartid; break; // mhartid
+        case 0xC20 : val = rv->vl; break;     // vl
+        case 0xC21 : val = rv->vtype; break;  // vtype
+        case 0xC22 : val = rv->vlenb; break;  // vlenb
+        default : return 0;
+    }
+    if (rd != 0)
+        rv->xreg[rd] = val;
+    rv->pc += 4;
+    debug("%s : xreg[0x%x] = csr[0x%x](0x%x)\n", names[funct3], rd, csr, rd != 0 ? val : 0);
+    return 1;
+}
+
+/*
+ * predecode_rv32i_instr:
+ *
+ * Decode an RV32I instruction once into a rv_insn_t record.
+ * Returns 1 and fills *d if the instruction is RV32I, 0 otherwise.
+ * Register-register instructions check funct7 so that RV32M encodings
+ * (funct7 = 0x01) are left to predecode_rv32m_instr.
+ */
+int predecode_rv32i_instr(uint32_t instr, rv_insn_t *d) {
     uint32_t opcode = instr & 0x7F;
     uint32_t rd = (instr >> 7) & 0x1F;
     uint32_t rs1 = (instr >> 15) & 0x1F;
@@ -31,316 +509,102 @@ int decode_rv32i_instr(uint32_t instr) {
     int32_t  simm_u = (int32_t) imm_u;
     int32_t  simm_j = ((int32_t) imm_j << 11) >> 11;
 
+    d->instr = instr;
+    d->rd = rd;
+    d->rs1 = rs1;
+    d->rs2 = rs2;
+
+#define SET(o, h, i) do { d->op = (o); d->handler = (h); d->imm = (i); return 1; } while (0)
+
     switch (opcode) {
-        case 0x37 : // LUI (U-type)
-            if (rd != 0)
-                xreg[rd] = simm_u;
-            pc = pc + 4;
-            debug("lui : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? xreg[rd] : 0);
-            return 1;
-        case 0x17 : // AUIPC (U-type)
-            if (rd != 0)
-                xreg[rd] = pc + simm_u;
-            pc = pc + 4;
-            debug("auipc : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? xreg[rd] : 0);
-            return 1;
-        case 0x6F : // JAL (J-type)
-            if (rd != 0)
-                xreg[rd] = pc + 4;
-            pc = pc + simm_j;
-            debug("jal : xreg[0x%x] = 0x%x, pc = 0x%x\n", rd, rd != 0 ? xreg[rd] : 0, pc);
-            return 1;
-        case 0x67 : {// JALR (I-type)
-            uint32_t t = pc + 4;
-            pc = (xreg[rs1] + simm_i) & 0xFFFFFFFE;
-            if (rd != 0)
-                xreg[rd] = t;
-            debug("jalr : xreg[0x%x] = 0x%x, pc = 0x%x\n", rd, rd != 0 ? xreg[rd] : 0, pc);
-            return 1;
-        }
+        case 0x37 : SET(INSTR_LUI, exec_lui, simm_u);     // LUI (U-type)
+        case 0x17 : SET(INSTR_AUIPC, exec_auipc, simm_u); // AUIPC (U-type)
+        case 0x6F : SET(INSTR_JAL, exec_jal, simm_j);     // JAL (J-type)
+        case 0x67 :                                        // JALR (I-type)
+            if (funct3 == 0x0)
+                SET(INSTR_JALR, exec_jalr, simm_i);
+            return 0;
         case 0x63 : // Branch instructions
             switch (funct3) {
-                case 0x0 : // BEQ
-                    debug("beq : if(xreg[0x%x](0x%x) == xreg[0x%x](0x%x)) pc (0x%x) = 0x%x + 0x%x\n", rs1, xreg[rs1], rs2, xreg[rs2], pc + simm_b, pc, simm_b);
-                    if (xreg[rs1] == xreg[rs2])
-                        pc = pc + simm_b;
-                    else
-                        pc = pc + 4;
-                    return 1;
-                case 0x1 : // BNE
-                    debug("bne : if(xreg[0x%x](0x%x) != xreg[0x%x](0x%x)) pc (0x%x) = 0x%x + 0x%x\n", rs1, xreg[rs1], rs2, xreg[rs2], pc + simm_b, pc, simm_b);
-                    if (xreg[rs1] != xreg[rs2])
-                        pc = pc + simm_b;
-                    else
-                        pc = pc + 4;
-                    return 1;
-                case 0x4 : // BLT
-                    debug("blt : if(xreg[0x%x](0x%x) < xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, xreg[rs1], rs2, xreg[rs2], pc + simm_b);
-                    if ((int32_t) xreg[rs1] < (int32_t) xreg[rs2])
-                        pc = pc + simm_b;
-                    else
-                        pc = pc + 4;
-                    return 1;
-                case 0x5 : // BGE
-                    debug("bge : if(xreg[0x%x](0x%x) >= xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, (int32_t)xreg[rs1], rs2, (int32_t)xreg[rs2], pc + simm_b);
-                    if ((int32_t) xreg[rs1] >= (int32_t) xreg[rs2])
-                        pc = pc + simm_b;
-                    else
-                        pc = pc + 4;
-                    return 1;
-                case 0x6 : // BLTU
-                    debug("bltu : if(xreg[0x%x](0x%x) < xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, xreg[rs1], rs2, xreg[rs2], pc + simm_b);
-                    if (xreg[rs1] < xreg[rs2])
-                        pc = pc + simm_b;
-                    else
-                        pc = pc + 4;
-                    return 1;
-                case 0x7 : // BGEU
-                    debug("bgeu : if(xreg[0x%x](0x%x) >= xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, xreg[rs1], rs2, xreg[rs2], pc + simm_b);
-                    if (xreg[rs1] >= xreg[rs2])
-                        pc = pc + simm_b;
-                    else
-                        pc = pc + 4;
-                    return 1;
+                case 0x0 : SET(INSTR_BEQ, exec_beq, simm_b);
+                case 0x1 : SET(INSTR_BNE, exec_bne, simm_b);
+                case 0x4 : SET(INSTR_BLT, exec_blt, simm_b);
+                case 0x5 : SET(INSTR_BGE, exec_bge, simm_b);
+                case 0x6 : SET(INSTR_BLTU, exec_bltu, simm_b);
+                case 0x7 : SET(INSTR_BGEU, exec_bgeu, simm_b);
             }
-        case 0x03 : {// Load instructions
-            uint32_t addr = xreg[rs1] + simm_i;
+            return 0;
+        case 0x03 : // Load instructions
             switch (funct3) {
-                case 0x0 : {// LB
-                    int32_t val = ((int32_t) mem[addr] << 24) >> 24;
-                    if (rd != 0)
-                        xreg[rd] = val;
-                    pc = pc + 4;
-                    debug("lb : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? xreg[rd] : 0);
-                    return 1;
-                }
-                case 0x1 : {// LH
-                    int32_t val = mem[addr] | (mem[addr + 1] << 8);
-                    val = (val << 16) >> 16;
-                    if (rd != 0)
-                        xreg[rd] = val;
-                    pc = pc + 4;
-                    debug("lh : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? xreg[rd] : 0);
-                    return 1;
-                }
-                case 0x2 : {// LW
-                    int32_t val = mem[addr] | (mem[addr + 1] << 8) | (mem[addr + 2] << 16) | (mem[addr + 3] << 24);
-                    if (rd != 0)
-                        xreg[rd] = val;
-                    pc = pc + 4;
-                    debug("lw : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? xreg[rd] : 0);
-                    return 1;
-                }
-                case 0x4 : // LBU
-                    if (rd != 0)
-                        xreg[rd] = mem[addr];
-                    pc = pc + 4;
-                    debug("lbu : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? xreg[rd] : 0);
-                    return 1;
-                case 0x5 : // LHU
-                    if (rd != 0)
-                        xreg[rd] = mem[addr] | (mem[addr + 1] << 8);
-                    pc = pc + 4;
-                    debug("lhu : xreg[0x%x] = 0x%x\n", rd, rd != 0 ? xreg[rd] : 0);
-                    return 1;
+                case 0x0 : SET(INSTR_LB, exec_lb, simm_i);
+                case 0x1 : SET(INSTR_LH, exec_lh, simm_i);
+                case 0x2 : SET(INSTR_LW, exec_lw, simm_i);
+                case 0x4 : SET(INSTR_LBU, exec_lbu, simm_i);
+                case 0x5 : SET(INSTR_LHU, exec_lhu, simm_i);
             }
-        }
-        case 0x23 : {// Store instructions
-            uint32_t addr = xreg[rs1] + simm_s;
+            return 0;
+        case 0x23 : // Store instructions
             switch (funct3) {
-                case 0x0 : // SB
-                    mem[addr] = xreg[rs2] & 0xFF;
-                    pc = pc + 4;
-                    debug("sb : mem[0x%x] = 0x%x\n", addr, xreg[rs2] & 0xFF);
-                    return 1;
-                case 0x1 : // SH
-                    mem[addr] = xreg[rs2] & 0xFF;
-                    mem[addr + 1] = (xreg[rs2] >> 8) & 0xFF;
-                    pc = pc + 4;
-                    debug("sh : mem[0x%x..0x%x] = 0x%x\n", addr, addr+1, xreg[rs2] & 0xFFFF);
-                    return 1;
-                case 0x2 : // SW
-                    mem[addr] = xreg[rs2] & 0xFF;
-                    mem[addr + 1] = (xreg[rs2] >> 8) & 0xFF;
-                    mem[addr + 2] = (xreg[rs2] >> 16) & 0xFF;
-                    mem[addr + 3] = (xreg[rs2] >> 24) & 0xFF;
-                    pc = pc + 4;
-                    debug("sw : mem[0x%x..0x%x] = 0x%x\n", addr, addr+3, xreg[rs2]);
-                    return 1;
+                case 0x0 : SET(INSTR_SB, exec_sb, simm_s);
+                case 0x1 : SET(INSTR_SH, exec_sh, simm_s);
+                case 0x2 : SET(INSTR_SW, exec_sw, simm_s);
             }
-        }
+            return 0;
         case 0x13 : // Immediate instructions
             switch (funct3) {
-                case 0x0 : // ADDI
-                    debug("addi : xreg[0x%x](0x%x) = 0x%x + 0x%x\n",
-                        rd, rd != 0 ? xreg[rd] + simm_i : 0,
-                        (int32_t) xreg[rs1], simm_i);
-                    if (rd != 0)
-                        xreg[rd] = (int32_t) xreg[rs1] + simm_i;
-                    pc += 4;
-                    return 1;
-                case 0x2 : // SLTI
-                    debug("slti : xreg[0x%x](0x%x) = (0x%x < 0x%x) ? 1 : 0\n",
-                        rd, rd != 0 ? (xreg[rd] < simm_i) : 0,
-                        (int32_t) xreg[rs1], simm_i);
-                    if (rd != 0)
-                        xreg[rd] = ((int32_t) xreg[rs1] < simm_i) ? 1 : 0;
-                    pc += 4;
-                    return 1;
-                case 0x3 : // SLTIU
-                    debug("sltiu : xreg[0x%x](0x%x) = (%u < %u) ? 1 : 0\n",
-                        rd, rd != 0 ? (xreg[rd] < simm_i) : 0,
-                        xreg[rs1], simm_i);
-                    if (rd != 0)
-                        xreg[rd] = (xreg[rs1] < simm_i) ? 1 : 0;
-                    pc += 4;
-                    return 1;
-                case 0x4 : // XORI
-                    debug("xori : xreg[0x%x](0x%x) = 0x%x ^ 0x%x\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        (int32_t) xreg[rs1], simm_i);
-                    if (rd != 0)
-                        xreg[rd] = xreg[rs1] ^ simm_i;
-                    pc += 4;
-                    return 1;
-                case 0x6 : // ORI
-                    debug("ori : xreg[0x%x](0x%x) = 0x%x | 0x%x\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        (int32_t) xreg[rs1], simm_i);
-                    if (rd != 0)
-                        xreg[rd] = xreg[rs1] | simm_i;
-                    pc += 4;
-                    return 1;
-                case 0x7 : // ANDI
-                    debug("andi : xreg[0x%x](0x%x) = 0x%x & 0x%x\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        (int32_t) xreg[rs1], simm_i);
-                    if (rd != 0)
-                        xreg[rd] = xreg[rs1] & simm_i;
-                    pc += 4;
-                    return 1;
-                case 0x1 : // SLLI
-                    debug("slli : xreg[0x%x](0x%x) = 0x%x << 0x%x\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        (int32_t) xreg[rs1], (imm_i & 0x1F));
-                    if (rd != 0)
-                        xreg[rd] = xreg[rs1] << (imm_i & 0x1F);
-                    pc += 4;
-                    return 1;
+                case 0x0 : SET(INSTR_ADDI, exec_addi, simm_i);
+                case 0x2 : SET(INSTR_SLTI, exec_slti, simm_i);
+                case 0x3 : SET(INSTR_SLTIU, exec_sltiu, simm_i);
+                case 0x4 : SET(INSTR_XORI, exec_xori, simm_i);
+                case 0x6 : SET(INSTR_ORI, exec_ori, simm_i);
+                case 0x7 : SET(INSTR_ANDI, exec_andi, simm_i);
+                case 0x1 : SET(INSTR_SLLI, exec_slli, imm_i & 0x1F);
                 case 0x5 : // SRLI or SRAI
-                    if ((funct7 >> 5) == 0) {
-                        debug("srli : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n",
-                            rd, rd != 0 ? xreg[rd] : 0,
-                            (int32_t) xreg[rs1], (imm_i & 0x1F));
-                        if (rd != 0)
-                            xreg[rd] = xreg[rs1] >> (imm_i & 0x1F);
-                        pc += 4;
-                        return 1;
-                    } else {
-                        debug("srai : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n",
-                            rd, rd != 0 ? xreg[rd] : 0,
-                            (int32_t) xreg[rs1], (imm_i & 0x1F));
-                        if (rd != 0)
-                            xreg[rd] = ((int32_t) xreg[rs1]) >> (imm_i & 0x1F);
-                        pc += 4;
-                        return 1;
-                    }
+                    if ((funct7 >> 5) == 0)
+                        SET(INSTR_SRLI, exec_srli, imm_i & 0x1F);
+                    else
+                        SET(INSTR_SRAI, exec_srai, imm_i & 0x1F);
             }
+            return 0;
         case 0x33 : // Register instructions
-            switch (funct3) {
-                case 0x0 : // ADD, SUB
-                    if (funct7 == 0x00) {
-                        if (rd != 0)
-                            xreg[rd] = (int32_t) xreg[rs1] + (int32_t) xreg[rs2];
-                        pc += 4;
-                        debug("add : xreg[0x%x](0x%x) = 0x%x + 0x%x\n",
-                            rd, rd != 0 ? xreg[rd] : 0,
-                            (int32_t) xreg[rs1], (int32_t) xreg[rs2]);
-                        return 1;
-                    } else if (funct7 == 0x20) {
-                        if (rd != 0)
-                            xreg[rd] = (int32_t) xreg[rs1] - (int32_t) xreg[rs2];
-                        pc += 4;
-                        debug("sub : xreg[0x%x](0x%x) = 0x%x - 0x%x\n",
-                            rd, rd != 0 ? xreg[rd] : 0,
-                            (int32_t) xreg[rs1], (int32_t) xreg[rs2]);
-                        return 1;
-                    }
-                    return 0;
-                case 0x1 : // SLL
-                    if (rd != 0)
-                        xreg[rd] = xreg[rs1] << (xreg[rs2] & 0x1F);
-                    pc += 4;
-                    debug("sll : xreg[0x%x](0x%x) = 0x%x << 0x%x\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        xreg[rs1], (xreg[rs2] & 0x1F));
-                    return 1;
-                case 0x2 : // SLT
-                    if (rd != 0)
-                        xreg[rd] = ((int32_t) xreg[rs1] < (int32_t) xreg[rs2]) ? 1 : 0;
-                    pc += 4;
-                    debug("slt : xreg[0x%x](0x%x) = (0x%x < 0x%x) ? 1 : 0\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        (int32_t) xreg[rs1], (int32_t) xreg[rs2]);
-                    return 1;
-                case 0x3 : // SLTU
-                    if (rd != 0)
-                        xreg[rd] = (xreg[rs1] < xreg[rs2]) ? 1 : 0;
-                    pc += 4;
-                    debug("sltu : xreg[0x%x](0x%x) = (%u < %u) ? 1 : 0\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        xreg[rs1], xreg[rs2]);
-                    return 1;
-                case 0x4 : // XOR
-                    if (rd != 0)
-                        xreg[rd] = xreg[rs1] ^ xreg[rs2];
-                    pc += 4;
-                    debug("xor : xreg[0x%x](0x%x) = 0x%x ^ 0x%x\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        (int32_t) xreg[rs1], (int32_t) xreg[rs2]);
-                    return 1;
-                case 0x5 : // SRL, SRA
-                    if (funct7 == 0x00) {
-                        if (rd != 0)
-                            xreg[rd] = xreg[rs1] >> (xreg[rs2] & 0x1F);
-                        pc += 4;
-                        debug("srl : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n",
-                            rd, rd != 0 ? xreg[rd] : 0,
-                            (int32_t) xreg[rs1], (xreg[rs2] & 0x1F));
-                        return 1;
-                    } else {
-                        if (rd != 0)
-                            xreg[rd] = ((int32_t) xreg[rs1]) >> (xreg[rs2] & 0x1F);
-                        pc += 4;
-                        debug("sra : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n",
-                            rd, rd != 0 ? xreg[rd] : 0,
-                            (int32_t) xreg[rs1], (xreg[rs2] & 0x1F));
-                        return 1;
-                    }
-                case 0x6 : // OR
-                    if (rd != 0)
-                        xreg[rd] = xreg[rs1] | xreg[rs2];
-                    pc += 4;
-                    debug("or : xreg[0x%x](0x%x) = 0x%x | 0x%x\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        (int32_t) xreg[rs1], (int32_t) xreg[rs2]);
-                    return 1;
-                case 0x7 : // AND
-                    if (rd != 0)
-                        xreg[rd] = xreg[rs1] & xreg[rs2];
-                    pc += 4;
-                    debug("and : xreg[0x%x](0x%x) = 0x%x & 0x%x\n",
-                        rd, rd != 0 ? xreg[rd] : 0,
-                        (int32_t) xreg[rs1], (int32_t) xreg[rs2]);
-                    return 1;
+            if (funct7 == 0x00) {
+                switch (funct3) {
+                    case 0x0 : SET(INSTR_ADD, exec_add, 0);
+                    case 0x1 : SET(INSTR_SLL, exec_sll, 0);
+                    case 0x2 : SET(INSTR_SLT, exec_slt, 0);
+                    case 0x3 : SET(INSTR_SLTU, exec_sltu, 0);
+                    case 0x4 : SET(INSTR_XOR, exec_xor, 0);
+                    case 0x5 : SET(INSTR_SRL, exec_srl, 0);
+                    case 0x6 : SET(INSTR_OR, exec_or, 0);
+                    case 0x7 : SET(INSTR_AND, exec_and, 0);
+                }
+            } else if (funct7 == 0x20) {
+                switch (funct3) {
+                    case 0x0 : SET(INSTR_SUB, exec_sub, 0);
+                    case 0x5 : SET(INSTR_SRA, exec_sra, 0);
+                }
             }
-        case 0x73 : // ECALL
-            if (instr == 0x73) {
-                debug("ecall : exit(0x%x)\n", xreg[3]);
-                exit(xreg[3]);
-            } else {
-                return 0;
+            return 0;
+        case 0x0F : // FENCE and FENCE.I
+            switch (funct3) {
+                case 0x0 : SET(INSTR_FENCE, exec_fence, 0);
+                case 0x1 : SET(INSTR_FENCE_I, exec_fence_i, 0);
             }
+            return 0;
+        case 0x73 : // ECALL and CSR instructions; imm is the CSR number
+            if (instr == 0x73)
+                SET(INSTR_ECALL, exec_ecall, 0);
+            if ((funct3 & 0x3) != 0)
+                SET(INSTR_CSRRW + (funct3 & 0x3) - 1 + (funct3 >> 2) * 3, exec_csr, imm_i);
+            return 0;
     }
+#undef SET
     return 0;
-}
\ No newline at end of file
+}
+
+int decode_rv32i_instr(rv_machine_t *rv, uint32_t instr) {
+    rv_insn_t d;
+    if (predecode_rv32i_instr(instr, &d) == 0)
+        return 0;
+    return d.handler(rv, &d);
+}
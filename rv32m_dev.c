@@ -8,14 +8,130 @@
 
 #include "rv32.h"
 
-extern uint32_t pc;         // Program counter
-extern uint32_t xreg[32];   // Register file
-extern uint8_t  mem[1 << 24]; // Memory
+static int exec_mul(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    int64_t result = (int64_t)((int32_t)rv->xreg[rs1]) * (int64_t)((int32_t)rv->xreg[rs2]);
+    if (rd != 0)
+        rv->xreg[rd] = (uint32_t)result;
+    rv->pc += 4;
+    debug("mul : xreg[0x%x] = (0x%x * 0x%x) = 0x%x\n",
+          rd, rv->xreg[rs1], rv->xreg[rs2], rd ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_mulh(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    int64_t result = (int64_t)((int32_t)rv->xreg[rs1]) * (int64_t)((int32_t)rv->xreg[rs2]);
+    if (rd != 0)
+        rv->xreg[rd] = (uint32_t)(((uint64_t)result) >> 32);
+    rv->pc += 4;
+    debug("mulh : xreg[0x%x] = upper 32 bits of (0x%x * 0x%x) = 0x%x\n",
+          rd, rv->xreg[rs1], rv->xreg[rs2], rd ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_mulhsu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    int64_t result = (int64_t)((int32_t)rv->xreg[rs1]) * (uint64_t)rv->xreg[rs2];
+    if (rd != 0)
+        rv->xreg[rd] = (uint32_t)(((uint64_t)result) >> 32);
+    rv->pc += 4;
+    debug("mulhsu : xreg[0x%x] = upper 32 bits of (0x%x * 0x%x) = 0x%x\n",
+          rd, rv->xreg[rs1], rv->xreg[rs2], rd ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_mulhu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    uint64_t result = (uint64_t)rv->xreg[rs1] * (uint64_t)rv->xreg[rs2];
+    if (rd != 0)
+        rv->xreg[rd] = (uint32_t)(result >> 32);
+    rv->pc += 4;
+    debug("mulhu : xreg[0x%x] = upper 32 bits of (0x%x * 0x%x) = 0x%x\n",
+          rd, rv->xreg[rs1], rv->xreg[rs2], rd ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_div(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    int32_t dividend = (int32_t)rv->xreg[rs1];
+    int32_t divisor  = (int32_t)rv->xreg[rs2];
+    int32_t result;
+    if (divisor == 0) {
+        result = -1;
+    } else if (dividend == INT32_MIN && divisor == -1) {
+        result = INT32_MIN;
+    } else {
+        result = dividend / divisor;
+    }
+    if (rd != 0)
+        rv->xreg[rd] = (uint32_t)result;
+    rv->pc += 4;
+    debug("div : xreg[0x%x] = (0x%x / 0x%x) = 0x%x\n",
+          rd, rv->xreg[rs1], rv->xreg[rs2], rd ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_divu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    uint32_t dividend = rv->xreg[rs1];
+    uint32_t divisor  = rv->xreg[rs2];
+    uint32_t result;
+    if (divisor == 0) {
+        result = 0xFFFFFFFF;
+    } else {
+        result = dividend / divisor;
+    }
+    if (rd != 0)
+        rv->xreg[rd] = result;
+    rv->pc += 4;
+    debug("divu : xreg[0x%x] = (0x%x / 0x%x) = 0x%x\n",
+          rd, rv->xreg[rs1], rv->xreg[rs2], rd ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_rem(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    int32_t dividend = (int32_t)rv->xreg[rs1];
+    int32_t divisor  = (int32_t)rv->xreg[rs2];
+    int32_t result;
+    if (divisor == 0) {
+        result = dividend;
+    } else if (dividend == INT32_MIN && divisor == -1) {
+        result = 0;
+    } else {
+        result = dividend % divisor;
+    }
+    if (rd != 0)
+        rv->xreg[rd] = (uint32_t)result;
+    rv->pc += 4;
+    debug("rem : xreg[0x%x] = (0x%x %% 0x%x) = 0x%x\n",
+          rd, rv->xreg[rs1], rv->xreg[rs2], rd ? rv->xreg[rd] : 0);
+    return 1;
+}
+
+static int exec_remu(rv_machine_t *rv, const rv_insn_t *d) {
+    uint32_t rd = d->rd, rs1 = d->rs1, rs2 = d->rs2;
+    uint32_t dividend = rv->xreg[rs1];
+    uint32_t divisor  = rv->xreg[rs2];
+    uint32_t result;
+    if (divisor == 0) {
+        result = dividend;
+    } else {
+        result = dividend % divisor;
+    }
+    if (rd != 0)
+        rv->xreg[rd] = result;
+    rv->pc += 4;
+    debug("remu : xreg[0x%x] = (0x%x %% 0x%x) = 0x%x\n",
+          rd, rv->xreg[rs1], rv->xreg[rs2], rd ? rv->xreg[rd] : 0);
+    return 1;
+}
 
 /*
- * decode_rv32m_instr:
+ * predecode_rv32m_instr:
  *
- * Emulate an RV32M (M-extension) instruction.
+ * Decode an RV32M (M-extension) instruction into a rv_insn_t record.
  * Only instructions with opcode 0x33 and funct7 0x01 are processed.
  *
  * RV32M instructions:
@@ -34,7 +150,7 @@ extern uint8_t  mem[1 << 24]; // Memory
  *   REMU   (funct3=0x7) : x[rd] = (uint32_t)x[rs1] % (uint32_t)x[rs2]
  *                          (division by 0 returns x[rs1])
  */
-int decode_rv32m_instr(uint32_t instr) {
+int predecode_rv32m_instr(uint32_t instr, rv_insn_t *d) {
     uint32_t opcode = instr & 0x7F;
     uint32_t rd     = (instr >> 7)  & 0x1F;
     uint32_t rs1    = (instr >> 15) & 0x1F;
@@ -47,112 +163,24 @@ int decode_rv32m_instr(uint32_t instr) {
         return 0; // Not an RV32M instruction.
     }
 
-    switch (funct3) {
-        case 0x0: { // MUL
-            int64_t result = (int64_t)((int32_t)xreg[rs1]) * (int64_t)((int32_t)xreg[rs2]);
-            if (rd != 0)
-                xreg[rd] = (uint32_t)result;
-            pc += 4;
-            debug("mul : xreg[0x%x] = (0x%x * 0x%x) = 0x%x\n",
-                  rd, xreg[rs1], xreg[rs2], rd ? xreg[rd] : 0);
-            return 1;
-        }
-        case 0x1: { // MULH
-            int64_t result = (int64_t)((int32_t)xreg[rs1]) * (int64_t)((int32_t)xreg[rs2]);
-            if (rd != 0)
-                xreg[rd] = (uint32_t)(((uint64_t)result) >> 32);
-            pc += 4;
-            debug("mulh : xreg[0x%x] = upper 32 bits of (0x%x * 0x%x) = 0x%x\n",
-                  rd, xreg[rs1], xreg[rs2], rd ? xreg[rd] : 0);
-            return 1;
-        }
-        case 0x2: { // MULHSU
-            int64_t result = (int64_t)((int32_t)xreg[rs1]) * (uint64_t)xreg[rs2];
-            if (rd != 0)
-                xreg[rd] = (uint32_t)(((uint64_t)result) >> 32);
-            pc += 4;
-            debug("mulhsu : xreg[0x%x] = upper 32 bits of (0x%x * 0x%x) = 0x%x\n",
-                  rd, xreg[rs1], xreg[rs2], rd ? xreg[rd] : 0);
-            return 1;
-        }
-        case 0x3: { // MULHU
-            uint64_t result = (uint64_t)xreg[rs1] * (uint64_t)xreg[rs2];
-            if (rd != 0)
-                xreg[rd] = (uint32_t)(result >> 32);
-            pc += 4;
-            debug("mulhu : xreg[0x%x] = upper 32 bits of (0x%x * 0x%x) = 0x%x\n",
-                  rd, xreg[rs1], xreg[rs2], rd ? xreg[rd] : 0);
-            return 1;
-        }
-        case 0x4: { // DIV
-            int32_t dividend = (int32_t)xreg[rs1];
-            int32_t divisor  = (int32_t)xreg[rs2];
-            int32_t result;
-            if (divisor == 0) {
-                result = -1;
-            } else if (dividend == INT32_MIN && divisor == -1) {
-                result = INT32_MIN;
-            } else {
-                result = dividend / divisor;
-            }
-            if (rd != 0)
-                xreg[rd] = (uint32_t)result;
-            pc += 4;
-            debug("div : xreg[0x%x] = (0x%x / 0x%x) = 0x%x\n",
-                  rd, xreg[rs1], xreg[rs2], rd ? xreg[rd] : 0);
-            return 1;
-        }
-        case 0x5: { // DIVU
-            uint32_t dividend = xreg[rs1];
-            uint32_t divisor  = xreg[rs2];
-            uint32_t result;
-            if (divisor == 0) {
-                result = 0xFFFFFFFF;
-            } else {
-                result = dividend / divisor;
-            }
-            if (rd != 0)
-                xreg[rd] = result;
-            pc += 4;
-            debug("divu : xreg[0x%x] = (0x%x / 0x%x) = 0x%x\n",
-                  rd, xreg[rs1], xreg[rs2], rd ? xreg[rd] : 0);
-            return 1;
-        }
-        case 0x6: { // REM
-            int32_t dividend = (int32_t)xreg[rs1];
-            int32_t divisor  = (int32_t)xreg[rs2];
-            int32_t result;
-            if (divisor == 0) {
-                result = dividend;
-            } else if (dividend == INT32_MIN && divisor == -1) {
-                result = 0;
-            } else {
-                result = dividend % divisor;
-            }
-            if (rd != 0)
-                xreg[rd] = (uint32_t)result;
-            pc += 4;
-            debug("rem : xreg[0x%x] = (0x%x %% 0x%x) = 0x%x\n",
-                  rd, xreg[rs1], xreg[rs2], rd ? xreg[rd] : 0);
-            return 1;
-        }
-        case 0x7: { // REMU
-            uint32_t dividend = xreg[rs1];
-            uint32_t divisor  = xreg[rs2];
-            uint32_t result;
-            if (divisor == 0) {
-                result = dividend;
-            } else {
-                result = dividend % divisor;
-            }
-            if (rd != 0)
-                xreg[rd] = result;
-            pc += 4;
-            debug("remu : xreg[0x%x] = (0x%x %% 0x%x) = 0x%x\n",
-                  rd, xreg[rs1], xreg[rs2], rd ? xreg[rd] : 0);
-            return 1;
-        }
-        default:
-            return 0;
-    }
+    static const rv_handler_t handlers[8] = {
+        exec_mul, exec_mulh, exec_mulhsu, exec_mulhu,
+        exec_div, exec_divu, exec_rem, exec_remu
+    };
+
+    d->handler = handlers[funct3];
+    d->instr   = instr;
+    d->imm     = 0;
+    d->op      = INSTR_MUL + funct3;
+    d->rd      = rd;
+    d->rs1     = rs1;
+    d->rs2     = rs2;
+    return 1;
+}
+
+int decode_rv32m_instr(rv_machine_t *rv, uint32_t instr) {
+    rv_insn_t d;
+    if (predecode_rv32m_instr(instr, &d) == 0)
+        return 0;
+    return d.handler(rv, &d);
 }
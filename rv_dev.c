@@ -4,70 +4,223 @@
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "rv32.h"
 
-uint32_t pc;       // Program counter
-uint32_t xreg[32]; // Register file
-uint8_t mem[1 << 18]; // Memory (256KB)
+static rv_machine_t *machine; // The guest of the command line, for the exit reports
+
+static void print_stats(void) {
+    if (machine == NULL)
+        return;
+    mem_print_stats(machine, stderr);
+    icache_print_stats(machine, stderr);
+    vdec_print_stats(machine, stderr);
+    block_print_stats(machine, stderr);
+    jit_print_stats(machine, stderr);
+}
+
+static void print_timing(void) {
+    timing_print_stats(stderr);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s] [-e interp|threaded|block|jit] [-t off|flow|full] [-o tracefile] [-b bintrace] [-k scalar|sse2|avx2] [-v vlen] [-m default|timingfile] [-p profile] [-n budget] [-H harts] [-S seed] [-q quantum] [-j threads] <filename>\n", prog);
+}
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <filename>\n", argv[0]);
-        return 1;
+#ifdef USE_THREADED
+    int engine = RV_ENGINE_THREADED;
+#else
+    int engine = RV_ENGINE_INTERP;
+#endif
+    uint32_t vlen = VLEN_MIN;
+    uint64_t max_cycle = 80;
+    uint32_t nharts = 1;
+    int det = 0; // Deterministic scheduler
+    rv_sched_cfg_t sched = { .quantum = 10000, .threads = 0 };
+    int opt;
+    while ((opt = getopt(argc, argv, "se:t:o:b:k:v:m:p:n:H:S:q:j:")) != -1) {
+        switch (opt) {
+            case 's': // Print predecode cache statistics on exit
+                atexit(print_stats);
+                break;
+            case 'e': // Execution engine
+                if (strcmp(optarg, "interp") == 0) {
+                    engine = RV_ENGINE_INTERP;
+                } else if (strcmp(optarg, "threaded") == 0) {
+                    engine = RV_ENGINE_THREADED;
+                } else if (strcmp(optarg, "block") == 0) {
+                    engine = RV_ENGINE_BLOCK;
+                } else if (strcmp(optarg, "jit") == 0) {
+                    engine = RV_ENGINE_JIT;
+                } else {
+                    fprintf(stderr, "Error: Unknown engine %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't': // Trace level
+                trace_level = trace_parse_level(optarg);
+                if (trace_level < 0) {
+                    fprintf(stderr, "Error: Unknown trace level %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'o': // Trace output file
+                if (trace_open(optarg) != 0) {
+                    fprintf(stderr, "Error: Cannot open trace file %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'b': // Binary trace file
+                if (trace_bin_open(optarg) != 0) {
+                    fprintf(stderr, "Error: Cannot open trace file %s\n", optarg);
+                    return 1;
+                }
+                atexit(trace_bin_close);
+                break;
+            case 'k': // Vector kernel set, the best supported by default
+                if (vkern_init(optarg) != 0) {
+                    fprintf(stderr, "Error: Kernel set %s is unknown or not supported\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'v': // Vector register width in bits, checked by rvv_set_vlen
+                vlen = strtoul(optarg, NULL, 0);
+                break;
+            case 'm': // Timing model, with the built-in or given tables
+                if (timing_load(strcmp(optarg, "default") == 0 ? NULL : optarg) != 0)
+                    return 1;
+                break;
+            case 'p': // Profile, folded stacks to the file and a summary to stderr
+                if (prof_open(optarg) != 0) {
+                    fprintf(stderr, "Error: Cannot open profile file %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'n': // Instructions to run before giving up, 0 for no limit
+                max_cycle = strtoull(optarg, NULL, 0);
+                if (max_cycle == 0)
+                    max_cycle = UINT64_MAX;
+                break;
+            case 'H': // Harts sharing the memory, one host thread each
+                nharts = strtoul(optarg, NULL, 0);
+                if (nharts < 1 || nharts > 1024) {
+                    fprintf(stderr, "Error: The number of harts must be from 1 to 1024\n");
+                    return 1;
+                }
+                break;
+            case 'S': // Run the harts with the deterministic scheduler and this seed
+                det = 1;
+                sched.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'q': // Instructions per hart and round of the deterministic scheduler
+                sched.quantum = strtoul(optarg, NULL, 0);
+                if (sched.quantum == 0) {
+                    fprintf(stderr, "Error: The quantum must be at least 1\n");
+                    return 1;
+                }
+                break;
+            case 'j': // Host threads of the deterministic scheduler
+                sched.threads = strtoul(optarg, NULL, 0);
+                if (sched.threads < 1 || sched.threads > 1024) {
+                    fprintf(stderr, "Error: The number of threads must be from 1 to 1024\n");
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
     }
-    FILE *fp = fopen(argv[1], "rb");
-    if (fp == NULL) {
-        fprintf(stderr, "Error: Cannot open file %s\n", argv[1]);
+    if (optind != argc - 1) {
+        usage(argv[0]);
         return 1;
     }
-
-    // Get file size
-    fseek(fp, 0, SEEK_END);
-    size_t file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    //Load program into memory
-    size_t max_mem_size = sizeof(mem);
-    size_t read_size = file_size > max_mem_size ? max_mem_size : file_size;
-    if (read_size != file_size) {
-        fprintf(stderr, "Warning: File %s is too large, only %zu bytes will be loaded\n", argv[1], max_mem_size);
+    if (nharts > 1 && (timing_enabled || prof_enabled)) {
+        // They keep process-wide state for one machine
+        fprintf(stderr, "Error: The timing model and the profiler support one hart only\n");
+        return 1;
     }
-    size_t bytes_load = fread(mem, 1, read_size, fp);
-    if (bytes_load != read_size) {
-        fprintf(stderr, "Error: fread failed to read file %s\n", argv[1]);
+    if (nharts > 1 && !det && (trace_level != TRACE_OFF || trace_bin_enabled)) {
+        // Only the deterministic scheduler runs one traced hart at a time
+        fprintf(stderr, "Error: Tracing several harts needs the deterministic scheduler (-S)\n");
         return 1;
     }
-
-    int max_cycle = 80;
-    pc = 0;
-    uint32_t cycle_count = 0;
-
-    while (cycle_count < max_cycle) {
-        uint32_t instr = 0;
-        for (int j = 0; j < 4; j++) {
-            instr |= ((uint32_t)mem[pc + j] << (j * 8)) & (0xFF << (j * 8));
+    if (det && sched.threads == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        sched.threads = ncpu > 0 ? ncpu : 1;
+    }
+    if (timing_enabled || prof_enabled) {
+        // The timing model and the profiler are fed by the block engine
+        if (trace_level != TRACE_OFF || trace_bin_enabled) {
+            fprintf(stderr, "Error: The timing model and the profiler cannot be combined with tracing\n");
+            return 1;
         }
-        printf("%08x : %08x : ", pc, instr);
-
-        int instr_valid = 0;
-        instr_valid = decode_rv32i_instr(instr);
-
-        if (instr_valid == 0) {
-            instr_valid = decode_rv32m_instr(instr);
+        if (engine != RV_ENGINE_BLOCK && engine != RV_ENGINE_JIT) {
+            fprintf(stderr, "Warning: the timing model and the profiler use the block engine\n");
+            engine = RV_ENGINE_BLOCK;
         }
-
-        if (instr_valid == 0) {
-            instr_valid = decode_rvv_instr(instr);
+        if (timing_enabled)
+            atexit(print_timing);
+        if (prof_enabled)
+            atexit(prof_close);
+    }
+    if (trace_level != TRACE_OFF || trace_bin_enabled) {
+        // Only the handler loop emits the full trace
+        if (engine != RV_ENGINE_INTERP) {
+            fprintf(stderr, "Warning: tracing uses the interp engine\n");
+            engine = RV_ENGINE_INTERP;
         }
+        if (trace_level != TRACE_OFF)
+            atexit(trace_flush);
+    }
+    const char *filename = argv[optind];
+    machine = rv_create(engine);
+    if (machine == NULL) {
+        fprintf(stderr, "Error: Out of memory for the machine\n");
+        return 1;
+    }
+    if (rvv_set_vlen(machine, vlen) != 0) {
+        fprintf(stderr, "Error: VLEN must be a power of two from %d to %d\n", VLEN_MIN, VLEN_MAX);
+        return 1;
+    }
+    if (rv_load(machine, filename) != 0)
+        return 1;
+    if ((timing_enabled || prof_enabled) && elf_load_symbols(filename) != 0)
+        return 1;
 
-        if (instr_valid == 0) {
-            debug("unknown : instr = 0x%08x\n", instr);
-            pc = pc + 4;  
+    rv_exit_t e;
+    if (nharts > 1) {
+        // Hart 0 is the loaded machine; its exit is the emulator's
+        rv_machine_t **harts = calloc(nharts, sizeof(rv_machine_t *));
+        rv_exit_t *exits = calloc(nharts, sizeof(rv_exit_t));
+        if (harts == NULL || exits == NULL) {
+            fprintf(stderr, "Error: Out of memory for the harts\n");
+            return 1;
         }
-        printf("--------------------\n");
-        cycle_count++;
+        harts[0] = machine;
+        for (uint32_t i = 1; i < nharts; i++) {
+            harts[i] = rv_create_hart(machine, i);
+            if (harts[i] == NULL) {
+                fprintf(stderr, "Error: Out of memory for hart %u\n", i);
+                return 1;
+            }
+        }
+        if ((det ? rv_run_harts_det(harts, nharts, max_cycle, &sched, exits)
+                 : rv_run_harts(harts, nharts, max_cycle, exits)) != 0)
+            return 1;
+        e = exits[0];
+    } else {
+        e = rv_run(machine, max_cycle);
     }
-
-    return -1; // Indicate that the program has not finished
-}
\ No newline at end of file
+    switch (e.reason) {
+        case RV_EXIT_ECALL:
+            return e.value;
+        case RV_EXIT_FAULT:
+            fprintf(stderr, "Error: Access fault at pc 0x%08x, address 0x%08x\n", e.pc, e.value);
+            return 1;
+        default:
+            return -1; // Indicate that the program has not finished
+    }
+}
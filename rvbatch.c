@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rv32.h"
+
+/*
+ * rvbatch : run many guest programs on a pool of host threads
+ *
+ * The manifest lists one job per line, an image (ELF or flat binary, as
+ * for rv_dev) and an optional instruction budget, 0 for no limit:
+ *
+ *     tests/add.elf 100000
+ *     tests/mul.bin
+ *
+ * Blank lines and lines starting with # are skipped. Each worker thread
+ * owns one machine and resets it between jobs, so the caches and the JIT
+ * code buffer are allocated once per thread rather than once per job.
+ *
+ * Jobs are dealt to the workers as contiguous ranges of the manifest. A
+ * worker takes jobs from the front of its own range; when that is empty
+ * it steals the back half of the fullest other range. A range is one
+ * 64-bit word (next job, end) updated with compare-and-swap, so neither
+ * side ever blocks.
+ *
+ * One JSON line per job is written to stdout as jobs finish:
+ *
+ *     {"job":0,"image":"tests/add.elf","reason":"ecall","exit":0,
+ *      "instret":1234,"pc":"0x00000148","wall_us":85}
+ *
+ * reason is ecall, budget, break, fault or error (the image could not be
+ * loaded); exit is the ECALL exit code, or null. A summary with the total
+ * throughput goes to stderr.
+ *
+ * Build: gcc -O2 -o rvbatch rvbatch.c $(ls *_dev.c | grep -v rv_dev.c) -lpthread
+ * Usage: rvbatch [-j threads] [-e interp|threaded|block|jit] [-v vlen] [-n budget] <manifest>
+ */
+
+typedef struct {
+    char     *image;
+    uint64_t  budget;
+} job_t;
+
+// Jobs [next, end) of one worker, as next | end << 32
+typedef struct {
+    uint64_t range;
+    char     pad[56]; // One cache line per worker
+} job_range_t;
+
+typedef struct {
+    int      id;
+    uint64_t jobs;
+    uint64_t instret;
+} worker_t;
+
+static job_t       *jobs;
+static uint32_t     njobs;
+static job_range_t *ranges;
+static int          nworkers;
+static int          engine = RV_ENGINE_JIT;
+static uint32_t     vlen = VLEN_MIN;
+
+static const char *const reason_names[] = {
+    [RV_EXIT_BUDGET] = "budget",
+    [RV_EXIT_BREAK]  = "break",
+    [RV_EXIT_ECALL]  = "ecall",
+    [RV_EXIT_FAULT]  = "fault",
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int read_manifest(const char *path, uint64_t budget) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Cannot open manifest %s\n", path);
+        return -1;
+    }
+    uint32_t cap = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *image = strtok(line, " \t\r\n");
+        if (image == NULL || image[0] == '#')
+            continue;
+        char *b = strtok(NULL, " \t\r\n");
+        if (njobs == cap) {
+            cap = cap ? cap * 2 : 1024;
+            job_t *j = realloc(jobs, cap * sizeof(job_t));
+            if (j == NULL) {
+                fprintf(stderr, "Error: Out of memory for the manifest\n");
+                fclose(fp);
+                return -1;
+            }
+            jobs = j;
+        }
+        jobs[njobs].image  = strdup(image);
+        jobs[njobs].budget = b != NULL ? strtoull(b, NULL, 0) : budget;
+        if (jobs[njobs].budget == 0)
+            jobs[njobs].budget = UINT64_MAX; // No limit, as for -n 0
+        njobs++;
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Next job of worker w from its own range, -1 when the range is empty
+static int64_t take_own(int w) {
+    uint64_t r = __atomic_load_n(&ranges[w].range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t next = (uint32_t) r, end = r >> 32;
+        if (next >= end)
+            return -1;
+        uint64_t n = (uint64_t) end << 32 | (next + 1);
+        if (__atomic_compare_exchange_n(&ranges[w].range, &r, n, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return next;
+    }
+}
+
+// Move the back half of the fullest other range to worker w, and return
+// its first job; -1 when every range is empty
+static int64_t steal(int w) {
+    for (;;) {
+        int victim = -1;
+        uint32_t most = 0;
+        for (int v = 0; v < nworkers; v++) {
+            uint64_t r = __atomic_load_n(&ranges[v].range, __ATOMIC_ACQUIRE);
+            uint32_t left = (uint32_t)(r >> 32) - (uint32_t) r;
+            if (v != w && (uint32_t) r < r >> 32 && left > most) {
+                victim = v;
+                most = left;
+            }
+        }
+        if (victim < 0)
+            return -1;
+
+        uint64_t r = __atomic_load_n(&ranges[victim].range, __ATOMIC_ACQUIRE);
+        uint32_t next = (uint32_t) r, end = r >> 32;
+        if (next >= end)
+            continue;
+        uint32_t mid = end - (end - next + 1) / 2; // At least one job
+        uint64_t n = (uint64_t) mid << 32 | next;
+        if (!__atomic_compare_exchange_n(&ranges[victim].range, &r, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            continue;
+        // Only the owner takes from its range, and it is empty, so a plain
+        // store publishes the stolen jobs after the first
+        __atomic_store_n(&ranges[w].range, (uint64_t) end << 32 | (mid + 1), __ATOMIC_RELEASE);
+        return mid;
+    }
+}
+
+// Append s as a JSON string
+static char *json_str(char *o, const char *end, const char *s) {
+    *o++ = '"';
+    for (; *s != '\0' && o + 8 < end; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            *o++ = '\\';
+            *o++ = c;
+        } else if (c < 0x20) {
+            o += sprintf(o, "\\u%04x", c);
+        } else {
+            *o++ = c;
+        }
+    }
+    *o++ = '"';
+    return o;
+}
+
+static void run_job(rv_machine_t *rv, uint32_t j, worker_t *self) {
+    double t = now();
+    rv_exit_t e = { .reason = -1 };
+    if (rv_reset(rv) != 0) {
+        fprintf(stderr, "Error: Out of memory for job %u\n", j);
+    } else if (rv_load(rv, jobs[j].image) == 0) {
+        e = rv_run(rv, jobs[j].budget);
+    }
+    t = now() - t;
+
+    char line[4096 + 256];
+    char *o = line, *end = line + sizeof(line);
+    o += sprintf(o, "{\"job\":%u,\"image\":", j);
+    o = json_str(o, end - 200, jobs[j].image);
+    if (e.reason < 0) {
+        o += sprintf(o, ",\"reason\":\"error\",\"exit\":null,\"instret\":0");
+    } else {
+        o += sprintf(o, ",\"reason\":\"%s\",\"exit\":", reason_names[e.reason]);
+        if (e.reason == RV_EXIT_ECALL)
+            o += sprintf(o, "%u", e.value);
+        else
+            o += sprintf(o, "null");
+        o += sprintf(o, ",\"instret\":%llu,\"pc\":\"0x%08x\"", (unsigned long long) e.instret, e.pc);
+        self->instret += e.instret;
+    }
+    o += sprintf(o, ",\"wall_us\":%.0f}\n", t * 1e6);
+    fwrite(line, 1, o - line, stdout); // One call, so lines never interleave
+    self->jobs++;
+}
+
+static void *worker(void *arg) {
+    worker_t *self = arg;
+    rv_machine_t *rv = rv_create(engine);
+    if (rv == NULL || rvv_set_vlen(rv, vlen) != 0) {
+        fprintf(stderr, "Error: Out of memory for the machine of worker %d\n", self->id);
+        exit(1);
+    }
+    for (;;) {
+        int64_t j = take_own(self->id);
+        if (j < 0 && (j = steal(self->id)) < 0)
+            break;
+        run_job(rv, j, self);
+    }
+    rv_destroy(rv);
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-j threads] [-e interp|threaded|block|jit] [-v vlen] [-n budget] <manifest>\n", prog);
+}
+
+int main(int argc, char **argv) {
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t budget = 100000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:e:v:n:")) != -1) {
+        switch (opt) {
+            case 'j': // Worker threads, one per host CPU by default
+                nthreads = strtol(optarg, NULL, 0);
+                break;
+            case 'e': // Execution engine
+                if (strcmp(optarg, "interp") == 0) {
+                    engine = RV_ENGINE_INTERP;
+                } else if (strcmp(optarg, "threaded") == 0) {
+                    engine = RV_ENGINE_THREADED;
+                } else if (strcmp(optarg, "block") == 0) {
+                    engine = RV_ENGINE_BLOCK;
+                } else if (strcmp(optarg, "jit") == 0) {
+                    engine = RV_ENGINE_JIT;
+                } else {
+                    fprintf(stderr, "Error: Unknown engine %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'v': // Vector register width in bits
+                vlen = strtoul(optarg, NULL, 0);
+                if (vlen < VLEN_MIN || vlen > VLEN_MAX || (vlen & (vlen - 1)) != 0) {
+                    fprintf(stderr, "Error: VLEN must be a power of two from %d to %d\n", VLEN_MIN, VLEN_MAX);
+                    return 1;
+                }
+                break;
+            case 'n': // Budget of jobs that give none, 0 for no limit
+                budget = strtoull(optarg, NULL, 0);
+                if (budget == 0)
+                    budget = UINT64_MAX;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || nthreads < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (read_manifest(argv[optind], budget) != 0)
+        return 1;
+    if (nthreads > njobs)
+        nthreads = njobs > 0 ? njobs : 1;
+    nworkers = nthreads;
+
+    ranges = aligned_alloc(64, nworkers * sizeof(job_range_t));
+    worker_t *workers = calloc(nworkers, sizeof(worker_t));
+    pthread_t *threads = calloc(nworkers, sizeof(pthread_t));
+    if (ranges == NULL || workers == NULL || threads == NULL) {
+        fprintf(stderr, "Error: Out of memory for the workers\n");
+        return 1;
+    }
+    for (int w = 0; w < nworkers; w++) {
+        uint64_t first = (uint64_t) njobs * w / nworkers;
+        uint64_t last  = (uint64_t) njobs * (w + 1) / nworkers;
+        ranges[w].range = last << 32 | first;
+        workers[w].id = w;
+    }
+
+    double t = now();
+    for (int w = 0; w < nworkers; w++) {
+        if (pthread_create(&threads[w], NULL, worker, &workers[w]) != 0) {
+            fprintf(stderr, "Error: Cannot start worker %d\n", w);
+            return 1;
+        }
+    }
+    uint64_t done = 0, instret = 0;
+    for (int w = 0; w < nworkers; w++) {
+        pthread_join(threads[w], NULL);
+        done += workers[w].jobs;
+        instret += workers[w].instret;
+    }
+    t = now() - t;
+
+    fprintf(stderr, "batch : jobs = %llu, threads = %d, instructions = %llu, time = %.3f s, %.1f jobs/s, %.1f MIPS\n",
+            (unsigned long long) done, nworkers, (unsigned long long) instret, t,
+            t > 0 ? done / t : 0.0, t > 0 ? instret / t / 1e6 : 0.0);
+    free(threads);
+    free(workers);
+    free(ranges);
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * rvbatch_test : runs rvbatch on a small manifest and checks its JSON
+ *
+ * Writes a few flat images to a temporary directory, and a manifest of
+ * TEST_JOBS jobs cycling through them :
+ *
+ *     exit.bin        : ECALL with exit code 7 after 2 instructions
+ *     loop.bin        : 100 iterations, then ECALL with exit code 100
+ *     loop.bin 50     : the same, stopped by its own budget
+ *     spin.bin        : a JAL to itself, stopped by the -n budget
+ *     missing.bin     : no such file
+ *
+ * rvbatch is run on every engine with -j 1 and -j 4. Each job must be
+ * reported exactly once, with the reason, exit code, instructions
+ * retired and pc expected of its image. Exits nonzero if one is not.
+ *
+ * Build: gcc -O2 -o rvbatch_test rvbatch_test.c
+ * Usage: rvbatch_test [rvbatch]
+ */
+
+#define TEST_JOBS   40
+#define TEST_BUDGET 1000 // -n, for the jobs without a budget
+
+typedef struct {
+    const char *line;     // Manifest line, after the directory
+    const char *reason;
+    const char *exit;     // JSON value
+    uint64_t    instret;
+    int64_t     pc;       // -1 when not reported
+} kind_t;
+
+static const kind_t kinds[] = {
+    { "exit.bin",     "ecall",  "7",    2,           0x08 },
+    { "loop.bin",     "ecall",  "100",  204,         0x18 },
+    { "loop.bin 50",  "budget", "null", 50,          0x08 },
+    { "spin.bin",     "budget", "null", TEST_BUDGET, 0x00 },
+    { "missing.bin",  "error",  "null", 0,           -1 },
+};
+#define NKINDS (sizeof(kinds) / sizeof(kinds[0]))
+
+static const char *const engines[] = { "interp", "threaded", "block", "jit" };
+static char dir[] = "/tmp/rvbatch_test.XXXXXX";
+static int fails;
+
+#define ADDI(rd, a, i)  (((uint32_t) (i) << 20) | ((a) << 15) | ((rd) << 7) | 0x13)
+#define BLT_BACK4(a, b) (0xFE000EE3u | ((b) << 20) | ((a) << 15) | (0x4 << 12)) // blt a, b, -4
+#define JAL_SELF        0x0000006F
+#define ECALL           0x00000073
+
+static int write_image(const char *name, const uint32_t *code, size_t n) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "wb");
+    int ok = fp != NULL && fwrite(code, 4, n, fp) == n;
+    if (fp != NULL)
+        fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "Error: Cannot write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_files(void) {
+    static const uint32_t exit_code[] = { ADDI(3, 0, 7), ECALL };
+    static const uint32_t loop_code[] = {
+        ADDI(5, 0, 0), ADDI(6, 0, 100), ADDI(5, 5, 1), BLT_BACK4(5, 6), ADDI(3, 5, 0), ECALL };
+    static const uint32_t spin_code[] = { JAL_SELF };
+    if (write_image("exit.bin", exit_code, 2) != 0 || write_image("loop.bin", loop_code, 6) != 0 ||
+        write_image("spin.bin", spin_code, 1) != 0)
+        return -1;
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/manifest", dir);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Cannot write %s\n", path);
+        return -1;
+    }
+    fprintf(fp, "# rvbatch_test\n\n");
+    for (uint32_t j = 0; j < TEST_JOBS; j++)
+        fprintf(fp, "%s/%s\n", dir, kinds[j % NKINDS].line);
+    fclose(fp);
+    return 0;
+}
+
+// Checks one output line; returns the job number, or -1
+static int check_line(const char *run, const char *line) {
+    unsigned job;
+    char image[256], reason[16], exit_val[16];
+    unsigned long long instret;
+    if (sscanf(line, "{\"job\":%u,\"image\":\"%255[^\"]\",\"reason\":\"%15[^\"]\",\"exit\":%15[^,],\"instret\":%llu",
+               &job, image, reason, exit_val, &instret) != 5 || job >= TEST_JOBS) {
+        printf("FAIL %s : bad line %s", run, line);
+        fails++;
+        return -1;
+    }
+    const kind_t *k = &kinds[job % NKINDS];
+    const char *pc = strstr(line, "\"pc\":\"");
+    long long pc_val = pc != NULL ? strtoll(pc + 6, NULL, 16) : -1;
+    char want_image[256];
+    snprintf(want_image, sizeof(want_image), "%s/%s", dir, k->line);
+    want_image[strcspn(want_image, " ")] = '\0';
+
+    if (strcmp(image, want_image) != 0 || strcmp(reason, k->reason) != 0 ||
+        strcmp(exit_val, k->exit) != 0 || instret != k->instret || pc_val != k->pc ||
+        strstr(line, "\"wall_us\":") == NULL) {
+        printf("FAIL %s : job %u (%s) gave %s", run, job, k->line, line);
+        fails++;
+    }
+    return job;
+}
+
+static void check(const char *rvbatch, const char *engine, int threads) {
+    char cmd[512], run[64], line[1024];
+    int seen[TEST_JOBS] = { 0 };
+    snprintf(run, sizeof(run), "-e %s -j %d", engine, threads);
+    snprintf(cmd, sizeof(cmd), "%s %s -n %d %s/manifest 2>/dev/null", rvbatch, run, TEST_BUDGET, dir);
+
+    FILE *fp = popen(cmd, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Cannot run %s\n", cmd);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int job = check_line(run, line);
+        if (job >= 0)
+            seen[job]++;
+    }
+    if (pclose(fp) != 0) {
+        printf("FAIL %s : rvbatch failed\n", run);
+        fails++;
+    }
+    for (uint32_t j = 0; j < TEST_JOBS; j++) {
+        if (seen[j] != 1) {
+            printf("FAIL %s : job %u reported %d times\n", run, j, seen[j]);
+            fails++;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *rvbatch = argc > 1 ? argv[1] : "./rvbatch";
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Error: Cannot create a temporary directory\n");
+        return 1;
+    }
+    if (write_files() == 0) {
+        for (uint32_t e = 0; e < 4; e++) {
+            check(rvbatch, engines[e], 1);
+            check(rvbatch, engines[e], 4);
+        }
+    } else {
+        fails++;
+    }
+
+    static const char *const files[] = { "exit.bin", "loop.bin", "spin.bin", "manifest" };
+    char path[256];
+    for (uint32_t f = 0; f < 4; f++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[f]);
+        unlink(path);
+    }
+    rmdir(dir);
+
+    printf("rvbatch : %s\n", fails ? "FAIL" : "ok");
+    return fails != 0;
+}
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rv32.h"
+
+/*
+ * rvtrace : print a binary trace written by rv_dev -b
+ *
+ * The register file is rebuilt from the header and the rd values in the
+ * records, so every line comes out exactly as the emulator's debug
+ * output at the same trace level ("-t full" by default). Traces of
+ * several harts keep a register file per hart, starting from the
+ * TRACE_REC_REG records, and switch at each TRACE_REC_HART.
+ *
+ * Usage: rvtrace [-t flow|full] <tracefile>
+ */
+
+static uint32_t pc;
+static uint32_t xreg[32]; // Of the current hart
+static int level = TRACE_FULL;
+
+#define HARTS_MAX 1024
+
+static struct {
+    uint32_t id;
+    uint32_t xreg[32];
+} harts[HARTS_MAX];
+static uint32_t nharts;
+static int      cur = -1; // Index in harts of the current hart, -1 before the first
+
+static uint32_t hart_index(uint32_t id) {
+    for (uint32_t i = 0; i < nharts; i++)
+        if (harts[i].id == id)
+            return i;
+    if (nharts == HARTS_MAX) {
+        fprintf(stderr, "Error: More than %d harts in the trace\n", HARTS_MAX);
+        exit(1);
+    }
+    harts[nharts].id = id;
+    return nharts++;
+}
+
+#define out(...)      do { if (level >= TRACE_FULL) printf(__VA_ARGS__); } while (0)
+#define out_flow(...) printf(__VA_ARGS__)
+
+static int32_t imm_of(uint8_t op, uint32_t instr) {
+    uint32_t imm_s = ((instr >> 25) << 5) | ((instr >> 7) & 0x1F);
+    uint32_t imm_b = ((instr >> 31) << 12) | (((instr >> 7) & 0x1) << 11) | (((instr >> 25) & 0x3F) << 5) | (((instr >> 8) & 0xF) << 1);
+    uint32_t imm_j = (((instr >> 31) & 0x01) << 20) | (((instr >> 21) & 0x3FF) << 1) | (((instr >> 20) & 0x1) << 11) | (((instr >> 12) & 0xFF) << 12);
+
+    switch (op) {
+        case INSTR_LUI: case INSTR_AUIPC:
+            return (int32_t)(instr & 0xFFFFF000);
+        case INSTR_JAL:
+            return ((int32_t) imm_j << 11) >> 11;
+        case INSTR_BEQ: case INSTR_BNE: case INSTR_BLT:
+        case INSTR_BGE: case INSTR_BLTU: case INSTR_BGEU:
+            return ((int32_t) imm_b << 19) >> 19;
+        case INSTR_SB: case INSTR_SH: case INSTR_SW:
+            return ((int32_t) imm_s << 20) >> 20;
+        case INSTR_SLLI: case INSTR_SRLI: case INSTR_SRAI:
+            return (instr >> 20) & 0x1F;
+        default:
+            return (int32_t) instr >> 20;
+    }
+}
+
+// Print one executed instruction. x holds the registers before it ran,
+// v the value its rd held afterwards. Returns 0 after ECALL, which ends
+// the run of its hart.
+static int print_insn(const trace_rec_t *r) {
+    uint32_t instr = r->instr;
+    uint32_t rd  = (instr >> 7) & 0x1F;
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t rs2 = (instr >> 20) & 0x1F;
+    int32_t  imm = imm_of(r->op, instr);
+    uint32_t v   = rd != 0 ? r->value : 0;
+    uint32_t *x  = xreg;
+    uint32_t y[32]; // Registers after the instruction
+    memcpy(y, xreg, sizeof(y));
+    if (rd != 0)
+        y[rd] = r->value;
+
+    switch (r->op) {
+        case INSTR_LUI:   out("lui : xreg[0x%x] = 0x%x\n", rd, v); break;
+        case INSTR_AUIPC: out("auipc : xreg[0x%x] = 0x%x\n", rd, v); break;
+        case INSTR_JAL:
+            out_flow("jal : xreg[0x%x] = 0x%x, pc = 0x%x\n", rd, v, pc + imm);
+            break;
+        case INSTR_JALR:
+            out_flow("jalr : xreg[0x%x] = 0x%x, pc = 0x%x\n", rd, v, (x[rs1] + imm) & 0xFFFFFFFE);
+            break;
+        case INSTR_BEQ:
+            out_flow("beq : if(xreg[0x%x](0x%x) == xreg[0x%x](0x%x)) pc (0x%x) = 0x%x + 0x%x\n", rs1, x[rs1], rs2, x[rs2], pc + imm, pc, imm);
+            break;
+        case INSTR_BNE:
+            out_flow("bne : if(xreg[0x%x](0x%x) != xreg[0x%x](0x%x)) pc (0x%x) = 0x%x + 0x%x\n", rs1, x[rs1], rs2, x[rs2], pc + imm, pc, imm);
+            break;
+        case INSTR_BLT:
+            out_flow("blt : if(xreg[0x%x](0x%x) < xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, x[rs1], rs2, x[rs2], pc + imm);
+            break;
+        case INSTR_BGE:
+            out_flow("bge : if(xreg[0x%x](0x%x) >= xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, x[rs1], rs2, x[rs2], pc + imm);
+            break;
+        case INSTR_BLTU:
+            out_flow("bltu : if(xreg[0x%x](0x%x) < xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, x[rs1], rs2, x[rs2], pc + imm);
+            break;
+        case INSTR_BGEU:
+            out_flow("bgeu : if(xreg[0x%x](0x%x) >= xreg[0x%x](0x%x)) pc = 0x%x\n", rs1, x[rs1], rs2, x[rs2], pc + imm);
+            break;
+        case INSTR_LB:  out("lb : xreg[0x%x] = 0x%x\n", rd, v); break;
+        case INSTR_LH:  out("lh : xreg[0x%x] = 0x%x\n", rd, v); break;
+        case INSTR_LW:  out("lw : xreg[0x%x] = 0x%x\n", rd, v); break;
+        case INSTR_LBU: out("lbu : xreg[0x%x] = 0x%x\n", rd, v); break;
+        case INSTR_LHU: out("lhu : xreg[0x%x] = 0x%x\n", rd, v); break;
+        case INSTR_SB:  out("sb : mem[0x%x] = 0x%x\n", r->addr, r->value); break;
+        case INSTR_SH:  out("sh : mem[0x%x..0x%x] = 0x%x\n", r->addr, r->addr + 1, r->value); break;
+        case INSTR_SW:  out("sw : mem[0x%x..0x%x] = 0x%x\n", r->addr, r->addr + 3, r->value); break;
+
+        // Immediate instructions print the registers before they run
+        case INSTR_ADDI:
+            out("addi : xreg[0x%x](0x%x) = 0x%x + 0x%x\n", rd, rd != 0 ? x[rd] + imm : 0, x[rs1], imm);
+            break;
+        case INSTR_SLTI:
+            out("slti : xreg[0x%x](0x%x) = (0x%x < 0x%x) ? 1 : 0\n", rd, rd != 0 ? (x[rd] < (uint32_t) imm) : 0, x[rs1], imm);
+            break;
+        case INSTR_SLTIU:
+            out("sltiu : xreg[0x%x](0x%x) = (%u < %u) ? 1 : 0\n", rd, rd != 0 ? (x[rd] < (uint32_t) imm) : 0, x[rs1], imm);
+            break;
+        case INSTR_XORI: out("xori : xreg[0x%x](0x%x) = 0x%x ^ 0x%x\n", rd, rd != 0 ? x[rd] : 0, x[rs1], imm); break;
+        case INSTR_ORI:  out("ori : xreg[0x%x](0x%x) = 0x%x | 0x%x\n", rd, rd != 0 ? x[rd] : 0, x[rs1], imm); break;
+        case INSTR_ANDI: out("andi : xreg[0x%x](0x%x) = 0x%x & 0x%x\n", rd, rd != 0 ? x[rd] : 0, x[rs1], imm); break;
+        case INSTR_SLLI: out("slli : xreg[0x%x](0x%x) = 0x%x << 0x%x\n", rd, rd != 0 ? x[rd] : 0, x[rs1], imm); break;
+        case INSTR_SRLI: out("srli : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n", rd, rd != 0 ? x[rd] : 0, x[rs1], imm); break;
+        case INSTR_SRAI: out("srai : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n", rd, rd != 0 ? x[rd] : 0, x[rs1], imm); break;
+
+        // Register instructions print the registers after they run
+        case INSTR_ADD:  out("add : xreg[0x%x](0x%x) = 0x%x + 0x%x\n", rd, v, y[rs1], y[rs2]); break;
+        case INSTR_SUB:  out("sub : xreg[0x%x](0x%x) = 0x%x - 0x%x\n", rd, v, y[rs1], y[rs2]); break;
+        case INSTR_SLL:  out("sll : xreg[0x%x](0x%x) = 0x%x << 0x%x\n", rd, v, y[rs1], y[rs2] & 0x1F); break;
+        case INSTR_SLT:  out("slt : xreg[0x%x](0x%x) = (0x%x < 0x%x) ? 1 : 0\n", rd, v, y[rs1], y[rs2]); break;
+        case INSTR_SLTU: out("sltu : xreg[0x%x](0x%x) = (%u < %u) ? 1 : 0\n", rd, v, y[rs1], y[rs2]); break;
+        case INSTR_XOR:  out("xor : xreg[0x%x](0x%x) = 0x%x ^ 0x%x\n", rd, v, y[rs1], y[rs2]); break;
+        case INSTR_SRL:  out("srl : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n", rd, v, y[rs1], y[rs2] & 0x1F); break;
+        case INSTR_SRA:  out("sra : xreg[0x%x](0x%x) = 0x%x >> 0x%x\n", rd, v, y[rs1], y[rs2] & 0x1F); break;
+        case INSTR_OR:   out("or : xreg[0x%x](0x%x) = 0x%x | 0x%x\n", rd, v, y[rs1], y[rs2]); break;
+        case INSTR_AND:  out("and : xreg[0x%x](0x%x) = 0x%x & 0x%x\n", rd, v, y[rs1], y[rs2]); break;
+
+        case INSTR_MUL:    out("mul : xreg[0x%x] = (0x%x * 0x%x) = 0x%x\n", rd, y[rs1], y[rs2], v); break;
+        case INSTR_MULH:   out("mulh : xreg[0x%x] = upper 32 bits of (0x%x * 0x%x) = 0x%x\n", rd, y[rs1], y[rs2], v); break;
+        case INSTR_MULHSU: out("mulhsu : xreg[0x%x] = upper 32 bits of (0x%x * 0x%x) = 0x%x\n", rd, y[rs1], y[rs2], v); break;
+        case INSTR_MULHU:  out("mulhu : xreg[0x%x] = upper 32 bits of (0x%x * 0x%x) = 0x%x\n", rd, y[rs1], y[rs2], v); break;
+        case INSTR_DIV:    out("div : xreg[0x%x] = (0x%x / 0x%x) = 0x%x\n", rd, y[rs1], y[rs2], v); break;
+        case INSTR_DIVU:   out("divu : xreg[0x%x] = (0x%x / 0x%x) = 0x%x\n", rd, y[rs1], y[rs2], v); break;
+        case INSTR_REM:    out("rem : xreg[0x%x] = (0x%x %% 0x%x) = 0x%x\n", rd, y[rs1], y[rs2], v); break;
+        case INSTR_REMU:   out("remu : xreg[0x%x] = (0x%x %% 0x%x) = 0x%x\n", rd, y[rs1], y[rs2], v); break;
+
+        case INSTR_LR_W:
+            out("lr.w : xreg[0x%x] = mem[0x%x](0x%x)\n", rd, r->addr, v);
+            break;
+        case INSTR_SC_W:
+            out("sc.w : mem[0x%x] = 0x%x, xreg[0x%x] = 0x%x\n", r->addr, x[rs2], rd, v);
+            break;
+        case INSTR_AMOSWAP_W: case INSTR_AMOADD_W: case INSTR_AMOXOR_W: case INSTR_AMOAND_W:
+        case INSTR_AMOOR_W: case INSTR_AMOMIN_W: case INSTR_AMOMAX_W: case INSTR_AMOMINU_W:
+        case INSTR_AMOMAXU_W: {
+            static const char *const names[] = {
+                "amoswap.w", "amoadd.w", "amoxor.w", "amoand.w", "amoor.w",
+                "amomin.w", "amomax.w", "amominu.w", "amomaxu.w"
+            };
+            out("%s : xreg[0x%x] = mem[0x%x](0x%x), operand 0x%x\n",
+                names[r->op - INSTR_AMOSWAP_W], rd, r->addr, v, x[rs2]);
+            break;
+        }
+
+        case INSTR_FENCE:   out("fence\n"); break;
+        case INSTR_FENCE_I: out("fence.i\n"); break;
+        case INSTR_CSRRW: case INSTR_CSRRS: case INSTR_CSRRC:
+        case INSTR_CSRRWI: case INSTR_CSRRSI: case INSTR_CSRRCI: {
+            static const char *const names[] = { "csrrw", "csrrs", "csrrc", "csrrwi", "csrrsi", "csrrci" };
+            out("%s : xreg[0x%x] = csr[0x%x](0x%x)\n", names[r->op - INSTR_CSRRW], rd, instr >> 20, v);
+            break;
+        }
+
+        case INSTR_ECALL:
+            out_flow("ecall : exit(0x%x)\n", x[3]);
+            return 0;
+        default:
+            break;
+    }
+    return 1;
+}
+
+static void print_vset(const trace_rec_t *r) {
+    const char *name = ((r->instr >> 31) & 1) == 0 ? "vsetvli"
+                     : ((r->instr >> 30) & 3) == 3 ? "vsetivli" : "vsetvl";
+    out("%s : vl=%d, vtype=%d\n", name, (int) r->value, (int) r->addr);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't' && strcmp(optarg, "flow") == 0) {
+            level = TRACE_FLOW;
+            continue;
+        }
+        if (opt == 't' && strcmp(optarg, "full") == 0) {
+            level = TRACE_FULL;
+            continue;
+        }
+        fprintf(stderr, "Usage: %s [-t flow|full] <tracefile>\n", argv[0]);
+        return 1;
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-t flow|full] <tracefile>\n", argv[0]);
+        return 1;
+    }
+    FILE *fp = fopen(argv[optind], "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Cannot open file %s\n", argv[optind]);
+        return 1;
+    }
+
+    trace_header_t h;
+    if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, TRACE_MAGIC, 4) != 0 ||
+        h.version != TRACE_VERSION || h.rec_size != sizeof(trace_rec_t)) {
+        fprintf(stderr, "Error: %s is not a trace file\n", argv[optind]);
+        return 1;
+    }
+    memcpy(xreg, h.xreg, sizeof(xreg));
+    uint32_t next_pc = h.pc;
+
+    static trace_rec_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, sizeof(trace_rec_t), 4096, fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            const trace_rec_t *r = &buf[i];
+            if (r->kind == TRACE_REC_PC) {
+                next_pc = r->addr;
+                continue;
+            }
+            if (r->kind == TRACE_REC_REG) {
+                uint32_t h = hart_index(r->instr);
+                if ((int) h == cur)
+                    xreg[r->op & 0x1F] = r->value;
+                else
+                    harts[h].xreg[r->op & 0x1F] = r->value;
+                continue;
+            }
+            if (r->kind == TRACE_REC_HART) {
+                if (cur >= 0)
+                    memcpy(harts[cur].xreg, xreg, sizeof(xreg));
+                cur = hart_index(r->value);
+                memcpy(xreg, harts[cur].xreg, sizeof(xreg));
+                out_flow("hart 0x%x\n", r->value);
+                next_pc = r->addr;
+                continue;
+            }
+            pc = next_pc + r->pc_delta;
+            next_pc = pc + 4;
+            out("%08x : %08x : ", pc, r->instr);
+
+            if (r->kind == TRACE_REC_UNKNOWN) {
+                out("unknown : instr = 0x%08x\n", r->instr);
+            } else if (r->kind == TRACE_REC_VSET) {
+                print_vset(r);
+            } else if (print_insn(r) == 0) {
+                continue; // Not followed by a separator
+            }
+            out("--------------------\n");
+
+            uint32_t rd = (r->instr >> 7) & 0x1F;
+            if (r->kind != TRACE_REC_UNKNOWN && rd != 0 &&
+                r->op != INSTR_SB && r->op != INSTR_SH && r->op != INSTR_SW)
+                xreg[rd] = r->value;
+        }
+    }
+    return 0;
+}
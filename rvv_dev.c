@@ -1,51 +1,161 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "rv32.h"
 
-#define VLEN 128
+#define VLENB_MAX  (VLEN_MAX / 8)
+#define VGROUP_MAX (8 * VLENB_MAX) // Bytes in a group of eight registers
 
-extern uint32_t pc;           // Program counter
-extern uint32_t xreg[32];     // Register file
-extern uint8_t  mem[1 << 24]; // Memory
+// v0-v31, then room for groups and segments that run past v31 (the
+// decoder does not check register alignment), which are not visible
+#define VREG_SLOTS 64
 
-uint8_t  vreg[32][VLEN/8]; // Vector Register file
-uint32_t vl;           // Vector Length
-uint32_t vtype;        // Vector Type Register
+// First byte of register r of rv; element i of the group starting at r
+// is at VREG(r)[i * eew] for every LMUL
+#define VREG(r) (rv->vreg + (r) * rv->vlenb)
 
-// Build vector mask from v0 register
-void build_vmask(uint8_t vmask[VLEN]) {
-    for (uint32_t i = 0; i < vl; i++) {
-        int byte_index = i / 8;
-        int bit_index  = i % 8;
-        vmask[i] = (vreg[0][byte_index] >> bit_index) & 0x1;
+// === Decode cache ===
+// A vector instruction is resolved once per (instruction word, vtype)
+// into a vdec_t by vdec_resolve : the routine that runs it, its kernel
+// slot, and the fields and widths it needs. vtype fixes SEW and LMUL, so
+// a loop body with a stable vtype goes from the lookup straight to its
+// kernel. Kernel slots are held by address, so vkern_init may still
+// switch sets; VLMAX depends on VLEN, so rvv_set_vlen flushes the cache.
+#define VDEC_BITS 8
+
+enum {
+    VDEC_VV, // Vector operand vs1
+    VDEC_VS, // Uniform shift amount, through vkern_vs
+    VDEC_VX  // x[rs1] or the immediate, broadcast to a vector
+};
+
+typedef struct vdec vdec_t;
+struct vdec {
+    uint32_t instr;                 // Tag : instruction word
+    uint32_t vtype;                 // Tag : vtype when resolved
+    void (*exec)(rv_machine_t *rv, const vdec_t *v); // NULL when the entry is empty
+    const vkern_vv_t  *k;           // vkern_vv or vkern_mv slot
+    const vkern_vs_t  *ks;          // vkern_vs slot (VDEC_VS)
+    const vkern_red_t *kr;          // vkern_red slot
+    uint32_t vlmax;                 // vsetvli, vsetivli : VLMAX of vtypei, 0 when invalid
+    uint8_t vtypei;                 // vsetvli, vsetivli : requested vtype
+    uint8_t funct6, funct3, vm;
+    uint8_t vs2, rs1, vd;           // rs1 holds vs1, rs1 or the immediate
+    uint8_t vsew, eew, dw;          // SEW as vsew and in bytes, write-back width in bytes
+    uint8_t form;                   // Operand kind, VDEC_VV / VDEC_VS / VDEC_VX
+};
+
+struct vdec_cache {
+    vdec_t   entry[1 << VDEC_BITS];
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// Select the VLEN of rv, a power of two from VLEN_MIN to VLEN_MAX bits.
+// The register file is reallocated and cleared, and vl is reset.
+int rvv_set_vlen(rv_machine_t *rv, uint32_t bits) {
+    if (bits < VLEN_MIN || bits > VLEN_MAX || (bits & (bits - 1)) != 0)
+        return -1;
+    uint8_t *vreg = aligned_alloc(64, VREG_SLOTS * (bits / 8));
+    if (vreg == NULL || (rv->vdec == NULL && (rv->vdec = malloc(sizeof(vdec_cache_t))) == NULL)) {
+        free(vreg);
+        return -1;
+    }
+    memset(vreg, 0, VREG_SLOTS * (bits / 8));
+    free(rv->vreg);
+    rv->vreg  = vreg;
+    rv->vlen  = bits;
+    rv->vlenb = bits / 8;
+    rv->vl    = 0;
+    memset(rv->vdec, 0, sizeof(vdec_cache_t)); // VLMAX changes
+    return 0;
+}
+
+void rvv_free(rv_machine_t *rv) {
+    free(rv->vreg);
+    free(rv->vdec);
+}
+
+// === Mask registers ===
+// Bit i of a mask register belongs to element i. Masks are handled as
+// VMASK_WORDS little-endian 64-bit words, so the mask instructions work a
+// word at a time and masked loops visit only the active elements. vl never
+// exceeds VLEN, so one register holds the mask of a whole group.
+#define VMASK_MAX   (VLEN_MAX / 64) // Words for arrays
+#define VMASK_WORDS (rv->vlen / 64)
+
+static inline uint64_t vmask_word(rv_machine_t *rv, uint8_t r, uint32_t w) {
+    return load_le64(&VREG(r)[w * 8]);
+}
+
+static inline void vmask_set_word(rv_machine_t *rv, uint8_t r, uint32_t w, uint64_t m) {
+    store_le64(&VREG(r)[w * 8], m);
+}
+
+// Bits of word w that belong to the first n elements
+static inline uint64_t vmask_body(uint32_t w, uint32_t n) {
+    if (n >= (w + 1) * 64)
+        return ~0ull;
+    if (n <= w * 64)
+        return 0;
+    return (1ull << (n - w * 64)) - 1;
+}
+
+// Elements below n an instruction acts on : all of them when vm is set
+// (v0 is not read at all), else those whose v0 bit is set
+static inline void vmask_active(rv_machine_t *rv, uint64_t act[VMASK_MAX], uint8_t vm, uint32_t n) {
+    for (uint32_t w = 0; w < VMASK_WORDS; w++)
+        act[w] = vm ? vmask_body(w, n) : vmask_word(rv, 0, w) & vmask_body(w, n);
+}
+
+// Run the following statement for each set bit of act, lowest first, with
+// the element index in i
+#define VMASK_FOR_EACH(i, act) \
+    for (uint32_t w_ = 0; w_ < VMASK_WORDS; w_++) \
+        for (uint64_t b_ = (act)[w_]; b_ != 0 && ((i) = w_ * 64 + __builtin_ctzll(b_), 1); b_ &= b_ - 1)
+
+// Next run of set bits of act at or after element i and below n : returns
+// its first element (n when there is none) and its length in *len
+static inline uint32_t vmask_run(rv_machine_t *rv, const uint64_t *act, uint32_t i, uint32_t n, uint32_t *len) {
+    if (i >= n)
+        return n;
+    uint32_t w = i / 64;
+    uint64_t b = (i % 64) ? act[w] & (~0ull << (i % 64)) : act[w];
+    while (b == 0) {
+        if (++w * 64 >= n)
+            return n;
+        b = act[w];
     }
+    uint32_t start = w * 64 + __builtin_ctzll(b);
+    b = ~act[w] & (~0ull << (start % 64));
+    while (b == 0 && ++w < VMASK_WORDS)
+        b = ~act[w];
+    uint32_t end = (b == 0) ? w * 64 : w * 64 + __builtin_ctzll(b);
+    *len = (end < n ? end : n) - start;
+    return start;
 }
 
-uint8_t compute_avl(uint8_t rs1, uint8_t rd) {
+uint32_t compute_avl(rv_machine_t *rv, uint8_t rs1, uint8_t rd) {
     if (rs1 != 0) {
-        return xreg[rs1] & 0x1F;
+        return rv->xreg[rs1];
     } else if (rd != 0) {
-        return UINT8_MAX;
+        return UINT32_MAX; // vl = VLMAX
     } else {
-        return vl;
+        return rv->vl;
     }
 }
 
-void execute_vsetvl(uint8_t rd, uint8_t avl, uint32_t vtypei) {
+// VLMAX for a vtype value, 0 when it is invalid (reserved bits set, or
+// an unsupported vsew or vlmul)
+static uint32_t vtype_vlmax(rv_machine_t *rv, uint32_t vtypei) {
     uint8_t vlmul = vtypei & 0x7;
     uint8_t vsew = (vtypei >> 3) & 0x7;
-    uint8_t vta  = (vtypei >> 6) & 0x1;
-    uint8_t vma  = (vtypei >> 7) & 0x1;
 
     // Check for invalid reserved bits or invalid vsew/vlmul
-    if ((vtypei & 0xFFFFFF00) != 0 || vsew > 0x3 || vlmul > 0x7) {
-        vtype = 0x80000000; // Set vill bit (bit 31)
-        vl = 0;
-        if (rd != 0) xreg[rd] = 0;
-        return;
-    }
+    if ((vtypei & 0xFFFFFF00) != 0 || vsew > 0x3 || vlmul > 0x7)
+        return 0;
 
     // Compute SEW and LMUL
     uint32_t sew = 8 * (1 << vsew);
@@ -58,35 +168,362 @@ void execute_vsetvl(uint8_t rd, uint8_t avl, uint32_t vtypei) {
         case 5: lmul_num = 1; lmul_den = 8; break;
         case 6: lmul_num = 1; lmul_den = 4; break;
         case 7: lmul_num = 1; lmul_den = 2; break;
-        default: vtype = 0x80000000; // Set vill bit (bit 31)
-            vl = 0;
-            if (rd != 0) xreg[rd] = 0;
-            return;
+        default: return 0;
     }
 
     // Calculate VLMAX
-    uint32_t vlmax = (VLEN * lmul_num) / (sew * lmul_den);
+    return (rv->vlen * lmul_num) / (sew * lmul_den);
+}
+
+// Set vl and vtype from avl and vtypei, given vlmax = vtype_vlmax(vtypei)
+static void vsetvl_apply(rv_machine_t *rv, uint8_t rd, uint32_t avl, uint32_t vtypei, uint32_t vlmax) {
     if (vlmax == 0) {
-        vtype = 0x80000000; // Set vill bit (bit 31)
-        vl = 0;
-        if (rd != 0) xreg[rd] = 0;
+        rv->vtype = 0x80000000; // Set vill bit (bit 31)
+        rv->vl = 0;
+        if (rd != 0) rv->xreg[rd] = 0;
         return;
     }
 
     // Set VL
     if (avl <= vlmax) {
-        vl = avl;
+        rv->vl = avl;
     } else {
-        vl = vlmax;
+        rv->vl = vlmax;
     }
-    if (rd != 0) xreg[rd] = vl;
+    if (rd != 0) rv->xreg[rd] = rv->vl;
 
     // Set VTYPE
-    vtype = (vma << 7) | (vta << 6) | (vsew << 3) | vlmul;
-    return;
+    uint8_t vlmul = vtypei & 0x7;
+    uint8_t vsew = (vtypei >> 3) & 0x7;
+    uint8_t vta  = (vtypei >> 6) & 0x1;
+    uint8_t vma  = (vtypei >> 7) & 0x1;
+    rv->vtype = (vma << 7) | (vta << 6) | (vsew << 3) | vlmul;
+}
+
+void execute_vsetvl(rv_machine_t *rv, uint8_t rd, uint32_t avl, uint32_t vtypei) {
+    vsetvl_apply(rv, rd, avl, vtypei, vtype_vlmax(rv, vtypei));
+}
+
+// Copy one eew-byte element between guest memory and a vector register
+static inline void load_elem(rv_machine_t *rv, uint8_t *dst, uint32_t addr, uint32_t eew) {
+    switch (eew) {
+        case 1:  dst[0] = mem_read8(rv, addr); break;
+        case 2:  store_le16(dst, mem_read16(rv, addr)); break;
+        case 4:  store_le32(dst, mem_read32(rv, addr)); break;
+        default: store_le64(dst, mem_read32(rv, addr) | (uint64_t) mem_read32(rv, addr + 4) << 32); break;
+    }
+}
+
+static inline void store_elem(rv_machine_t *rv, uint32_t addr, const uint8_t *src, uint32_t eew) {
+    switch (eew) {
+        case 1:  mem_write8(rv, addr, src[0]); break;
+        case 2:  mem_write16(rv, addr, load_le16(src)); break;
+        case 4:  mem_write32(rv, addr, load_le32(src)); break;
+        default: mem_write32(rv, addr, load_le32(src)); mem_write32(rv, addr + 4, load_le32(src + 4)); break;
+    }
+}
+
+// Offsets held in the first n elements of an index register, read at SEW
+static void vidx_offsets(rv_machine_t *rv, uint32_t *off, uint8_t index_reg, uint32_t n) {
+    const uint8_t *v = VREG(index_reg);
+    switch ((rv->vtype >> 3) & 0x7) {
+        case 0:  // 8-bit SEW
+            for (uint32_t k = 0; k < n; k++)
+                off[k] = v[k];
+            break;
+        case 1:  // 16-bit SEW
+            for (uint32_t k = 0; k < n; k++)
+                off[k] = load_le16(v + k * 2);
+            break;
+        case 2:  // 32-bit SEW
+            for (uint32_t k = 0; k < n; k++)
+                off[k] = load_le32(v + k * 4);
+            break;
+        case 3:  // 64-bit SEW, cut to the 32-bit address space
+            for (uint32_t k = 0; k < n; k++)
+                off[k] = load_le32(v + k * 8);
+            break;
+        default:
+            memset(off, 0, n * sizeof(uint32_t));
+            break;
+    }
+}
+
+// 1 with the common difference in *stride when the n offsets step evenly
+static int vidx_stride(const uint32_t *off, uint32_t n, uint32_t *stride) {
+    if (n < 2)
+        return 0;
+    uint32_t d = off[1] - off[0];
+    for (uint32_t k = 2; k < n; k++) {
+        if (off[k] - off[k - 1] != d)
+            return 0;
+    }
+    *stride = d;
+    return 1;
+}
+
+// Copy len bytes between guest memory at addr and the host, a page at a
+// time, as guest accesses
+static void vmem_load(rv_machine_t *rv, uint8_t *dst, uint32_t addr, uint32_t len) {
+    while (len > 0) {
+        uint32_t n = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (n > len)
+            n = len;
+        memcpy(dst, mem_ptr(rv, addr), n);
+        addr += n;
+        dst += n;
+        len -= n;
+    }
+}
+
+static void vmem_store(rv_machine_t *rv, uint32_t addr, const uint8_t *src, uint32_t len) {
+    while (len > 0) {
+        uint32_t n = MEM_PAGE_SIZE - (addr & MEM_PAGE_MASK);
+        if (n > len)
+            n = len;
+        memcpy(mem_ptr_w(rv, addr), src, n);
+        icache_notify_store(rv, addr, n);
+        addr += n;
+        src += n;
+        len -= n;
+    }
+}
+
+// Registers from one field of a segment access to the next : the group
+// size EMUL = LMUL * EEW / SEW, at least one register
+static uint32_t vseg_emul(rv_machine_t *rv, uint32_t eew) {
+    int vlmul = rv->vtype & 0x7;
+    int log2_emul = (vlmul < 4 ? vlmul : vlmul - 8) + __builtin_ctz(eew) - (int)((rv->vtype >> 3) & 0x7);
+    return log2_emul > 0 ? 1u << log2_emul : 1;
+}
+
+// Copy the active elements of the span loaded in tmp, which starts at
+// element i, into the register group at d
+static inline void vblend(rv_machine_t *rv, uint8_t *d, const uint8_t *tmp, uint32_t i, const uint64_t *act,
+                          uint32_t eew) {
+    uint32_t k;
+    VMASK_FOR_EACH(k, act)
+        memcpy(d + k * eew, tmp + (k - i) * eew, eew);
+}
+
+// Segment (de)interleave of elements [i, i + len) between the array of
+// nf-field records in seg and the register groups vr, vr + emul, ...
+// Inlined with a constant eew by the switches below, which list every
+// element size the loads and stores decode.
+static inline void vseg_split(rv_machine_t *rv, uint8_t vr, uint32_t emul, const uint8_t *seg, uint32_t i,
+                              uint32_t len, uint32_t eew, uint32_t nf) {
+    for (uint32_t s = 0; s < nf; s++) {
+        uint8_t *d = VREG(vr + s * emul);
+        for (uint32_t k = i; k < i + len; k++)
+            memcpy(d + k * eew, seg + (k * nf + s) * eew, eew);
+    }
+}
+
+static inline void vseg_join(rv_machine_t *rv, uint8_t *seg, uint8_t vr, uint32_t emul, uint32_t i,
+                             uint32_t len, uint32_t eew, uint32_t nf) {
+    for (uint32_t s = 0; s < nf; s++) {
+        const uint8_t *v = VREG(vr + s * emul);
+        for (uint32_t k = i; k < i + len; k++)
+            memcpy(seg + (k * nf + s) * eew, v + k * eew, eew);
+    }
+}
+
+// Unit-stride load of the active elements below n, each of nf fields.
+// With one field, a single run of active elements (any unmasked load) is
+// one block copy into the register group. Otherwise the span from the
+// first to the last active element is loaded once and blended into the
+// group, so only the active elements change; the span starts at the
+// first active element, which is where an access fault is reported.
+// Segments are loaded a run at a time into a record buffer that is then
+// split into the field register groups, emul registers apart.
+static void vload_unit(rv_machine_t *rv, uint8_t vd, uint32_t emul, uint32_t base, uint32_t eew, uint32_t nf,
+                       uint32_t n, const uint64_t *act) {
+    uint32_t rec = eew * nf; // Bytes per element in memory
+    uint32_t len = 0;
+    if (nf == 1) {
+        uint32_t i = vmask_run(rv, act, 0, n, &len);
+        if (i >= n)
+            return;
+        uint32_t end = i + len; // One past the last active element
+        for (uint32_t w = VMASK_WORDS; w-- > 0; ) {
+            if (act[w] != 0) {
+                end = w * 64 + 64 - __builtin_clzll(act[w]);
+                break;
+            }
+        }
+        if (end == i + len) {
+            vmem_load(rv, VREG(vd) + i * eew, base + i * eew, len * eew);
+            return;
+        }
+        uint8_t tmp[VGROUP_MAX];
+        vmem_load(rv, tmp, base + i * eew, (end - i) * eew);
+        switch (eew) {
+            case 1:  vblend(rv, VREG(vd), tmp, i, act, 1); break;
+            case 2:  vblend(rv, VREG(vd), tmp, i, act, 2); break;
+            case 4:  vblend(rv, VREG(vd), tmp, i, act, 4); break;
+            case 8:  vblend(rv, VREG(vd), tmp, i, act, 8); break;
+            default: __builtin_unreachable();
+        }
+        return;
+    }
+    uint8_t seg[VGROUP_MAX];
+    for (uint32_t i = 0; (i = vmask_run(rv, act, i, n, &len)) < n; i += len) {
+        vmem_load(rv, seg + i * rec, base + i * rec, len * rec);
+        switch (eew) {
+            case 1:  vseg_split(rv, vd, emul, seg, i, len, 1, nf); break;
+            case 2:  vseg_split(rv, vd, emul, seg, i, len, 2, nf); break;
+            case 4:  vseg_split(rv, vd, emul, seg, i, len, 4, nf); break;
+            case 8:  vseg_split(rv, vd, emul, seg, i, len, 8, nf); break;
+            default: __builtin_unreachable();
+        }
+    }
+}
+
+static void vstore_unit(rv_machine_t *rv, uint8_t vs3, uint32_t emul, uint32_t base, uint32_t eew, uint32_t nf,
+                        uint32_t n, const uint64_t *act) {
+    uint32_t rec = eew * nf;
+    uint32_t len = 0;
+    if (nf == 1) {
+        for (uint32_t i = 0; (i = vmask_run(rv, act, i, n, &len)) < n; i += len)
+            vmem_store(rv, base + i * eew, VREG(vs3) + i * eew, len * eew);
+        return;
+    }
+    uint8_t seg[VGROUP_MAX];
+    for (uint32_t i = 0; (i = vmask_run(rv, act, i, n, &len)) < n; i += len) {
+        switch (eew) {
+            case 1:  vseg_join(rv, seg, vs3, emul, i, len, 1, nf); break;
+            case 2:  vseg_join(rv, seg, vs3, emul, i, len, 2, nf); break;
+            case 4:  vseg_join(rv, seg, vs3, emul, i, len, 4, nf); break;
+            case 8:  vseg_join(rv, seg, vs3, emul, i, len, 8, nf); break;
+            default: __builtin_unreachable();
+        }
+        vmem_store(rv, base + i * rec, seg + i * rec, len * rec);
+    }
+}
+
+// Element by element access of the active elements : element i, field s
+// is at base + i * es + s * fs. Serves the strided mode and indexed
+// accesses, whose field s is at offset s * eew of each record.
+static void vload_strided(rv_machine_t *rv, uint8_t vd, uint32_t emul, uint32_t base, uint32_t es, uint32_t fs,
+                          uint32_t eew, uint32_t nf, const uint64_t *act) {
+    uint32_t i;
+    VMASK_FOR_EACH(i, act) {
+        for (uint32_t s = 0; s < nf; s++)
+            load_elem(rv, &VREG(vd + s * emul)[i * eew], base + i * es + s * fs, eew);
+    }
+}
+
+static void vstore_strided(rv_machine_t *rv, uint8_t vs3, uint32_t emul, uint32_t base, uint32_t es, uint32_t fs,
+                           uint32_t eew, uint32_t nf, const uint64_t *act) {
+    uint32_t i;
+    VMASK_FOR_EACH(i, act) {
+        for (uint32_t s = 0; s < nf; s++) {
+            uint32_t addr = base + i * es + s * fs;
+            store_elem(rv, addr, &VREG(vs3 + s * emul)[i * eew], eew);
+            icache_notify_store(rv, addr, eew);
+        }
+    }
 }
 
-void execute_vload(uint32_t instr) {
+// Indexed load (gather) of the active elements below n, record i at
+// base + off[i]. Ordered accesses are done one element at a time in
+// element order. Unordered ones may be combined : offsets stepping evenly
+// go through the strided loop without reading the index again, and runs
+// of active elements whose records follow each other in memory, such as a
+// contiguous index vector, are copied as blocks like unit-stride loads.
+static void vload_indexed(rv_machine_t *rv, uint8_t vd, uint32_t emul, uint32_t base, const uint32_t *off,
+                          int ordered, uint32_t eew, uint32_t nf, uint32_t n,
+                          const uint64_t *act) {
+    uint32_t rec = eew * nf;
+    uint32_t stride, len = 0;
+    if (ordered) {
+        uint32_t i;
+        VMASK_FOR_EACH(i, act) {
+            for (uint32_t s = 0; s < nf; s++)
+                load_elem(rv, &VREG(vd + s * emul)[i * eew], base + off[i] + s * eew, eew);
+        }
+        return;
+    }
+    if (vidx_stride(off, n, &stride) && stride != rec) {
+        vload_strided(rv, vd, emul, base + off[0], stride, eew, eew, nf, act);
+        return;
+    }
+    uint8_t seg[VGROUP_MAX];
+    for (uint32_t i = 0; (i = vmask_run(rv, act, i, n, &len)) < n; i += len) {
+        for (uint32_t j = i, r; j < i + len; j = r) {
+            for (r = j + 1; r < i + len && off[r] == off[r - 1] + rec; r++)
+                ;
+            uint32_t addr = base + off[j];
+            if (r - j == 1) {
+                for (uint32_t s = 0; s < nf; s++)
+                    load_elem(rv, &VREG(vd + s * emul)[j * eew], addr + s * eew, eew);
+            } else if (nf == 1) {
+                vmem_load(rv, VREG(vd) + j * eew, addr, (r - j) * eew);
+            } else {
+                vmem_load(rv, seg + j * rec, addr, (r - j) * rec);
+                switch (eew) {
+                    case 1:  vseg_split(rv, vd, emul, seg, j, r - j, 1, nf); break;
+                    case 2:  vseg_split(rv, vd, emul, seg, j, r - j, 2, nf); break;
+                    case 4:  vseg_split(rv, vd, emul, seg, j, r - j, 4, nf); break;
+                    case 8:  vseg_split(rv, vd, emul, seg, j, r - j, 8, nf); break;
+                    default: __builtin_unreachable();
+                }
+            }
+        }
+    }
+}
+
+// Indexed store (scatter), combined as for loads when unordered. Runs are
+// still written in element order, so the last of several elements with
+// the same address wins either way.
+static void vstore_indexed(rv_machine_t *rv, uint8_t vs3, uint32_t emul, uint32_t base, const uint32_t *off,
+                           int ordered, uint32_t eew, uint32_t nf, uint32_t n,
+                           const uint64_t *act) {
+    uint32_t rec = eew * nf;
+    uint32_t stride, len = 0;
+    if (ordered) {
+        uint32_t i;
+        VMASK_FOR_EACH(i, act) {
+            for (uint32_t s = 0; s < nf; s++) {
+                uint32_t addr = base + off[i] + s * eew;
+                store_elem(rv, addr, &VREG(vs3 + s * emul)[i * eew], eew);
+                icache_notify_store(rv, addr, eew);
+            }
+        }
+        return;
+    }
+    if (vidx_stride(off, n, &stride) && stride != rec) {
+        vstore_strided(rv, vs3, emul, base + off[0], stride, eew, eew, nf, act);
+        return;
+    }
+    uint8_t seg[VGROUP_MAX];
+    for (uint32_t i = 0; (i = vmask_run(rv, act, i, n, &len)) < n; i += len) {
+        for (uint32_t j = i, r; j < i + len; j = r) {
+            for (r = j + 1; r < i + len && off[r] == off[r - 1] + rec; r++)
+                ;
+            uint32_t addr = base + off[j];
+            if (r - j == 1) {
+                for (uint32_t s = 0; s < nf; s++) {
+                    store_elem(rv, addr + s * eew, &VREG(vs3 + s * emul)[j * eew], eew);
+                    icache_notify_store(rv, addr + s * eew, eew);
+                }
+            } else if (nf == 1) {
+                vmem_store(rv, addr, VREG(vs3) + j * eew, (r - j) * eew);
+            } else {
+                switch (eew) {
+                    case 1:  vseg_join(rv, seg, vs3, emul, j, r - j, 1, nf); break;
+                    case 2:  vseg_join(rv, seg, vs3, emul, j, r - j, 2, nf); break;
+                    case 4:  vseg_join(rv, seg, vs3, emul, j, r - j, 4, nf); break;
+                    case 8:  vseg_join(rv, seg, vs3, emul, j, r - j, 8, nf); break;
+                    default: __builtin_unreachable();
+                }
+                vmem_store(rv, addr, seg + j * rec, (r - j) * rec);
+            }
+        }
+    }
+}
+
+void execute_vload(rv_machine_t *rv, uint32_t instr) {
     // Decode instruction fields from the 32-bit instruction word
     uint8_t nf = (instr >> 29) & 0x7;       // Number of fields minus 1
     uint8_t mew = (instr >> 28) & 0x1;      // Memory element width
@@ -104,108 +541,58 @@ void execute_vload(uint32_t instr) {
         case 0: eew = 1; break; // 8-bit
         case 1: eew = 2; break; // 16-bit
         case 2: eew = 4; break; // 32-bit
+        case 3: eew = 8; break; // 64-bit
         default: return;        // Unsupported width
     }
 
     // Calculate base address for memory operations
-    uint32_t base = xreg[rs1];
+    uint32_t base = rv->xreg[rs1];
 
-    // Get mask bits from v0 register if masked operation (vm=0)
-    uint8_t vmask[VLEN];
-    build_vmask(vmask);
+    // Active elements, from v0 if masked operation (vm=0)
+    uint64_t act[VMASK_MAX];
+    vmask_active(rv, act, vm, rv->vl);
 
     // Calculate total number of fields to load
     uint8_t NFIELDS = nf + 1;
     if (NFIELDS > 8) return;    // Spec limits to maximum 8 fields
+    uint32_t emul = vseg_emul(rv, eew); // Registers per field
+    if (NFIELDS * emul > 8 && !(mop == 0x0 && ((instr >> 20) & 0x1F) == 0x08))
+        return; // Reserved : more than 8 registers, except whole register moves
 
-    // --- Handle whole register load mode ---
-    if (mop == 0) {
+    // --- Handle unit-stride, segment and whole register modes ---
+    if (mop == 0x0) {
         uint8_t lumop = (instr >> 20) & 0x1F;
+        uint32_t n = rv->vl;
         if (lumop == 0x08) {  // Whole register load unit-stride
-            uint32_t evl = VLEN/eew;  // Elements per register
-            for (uint32_t i = 0; i < evl; i++) {
-                for (uint32_t s = 0; s < NFIELDS; s++) {
-                    uint32_t addr = base + i * NFIELDS * eew + s * eew;
-                    for (uint32_t j = 0; j < eew; j++) {
-                        if (vm == 1 || (vm == 0 && vmask[i] == 1))
-                            vreg[vd + s][i * eew + j] = mem[addr + j];
-                    }
-                }
-            }
-            return;
+            n = rv->vlenb/eew;  // Elements per register
+            emul = 1;
+            vmask_active(rv, act, vm, n);
+        } else if (lumop == 0xB) {  // Load mask bits (unit-stride)
+            if (width != 0) return;  // Must be byte width
+            if (nf != 0) return;     // Must be single-field
+            eew = 1;  // Force 8-bit elements
         }
+        vload_unit(rv, vd, emul, base, eew, NFIELDS, n, act);
+        return;
     }
 
-    // --- Handle unit-stride and strided modes ---
-    if (mop == 0x0 || mop == 0x2) {
-        uint32_t stride;
-        if (mop == 0) {  // Unit-stride mode
-            uint8_t lumop = (instr >> 20) & 0x1F;
-            if (lumop == 0) {  // Regular unit-stride
-                ; // eew already set by width
-            } else if (lumop == 0xB) {  // Load mask bits (unit-stride)
-                if (width != 0) return;  // Must be byte width
-                if (nf != 0) return;     // Must be single-field
-                eew = 1;  // Force 8-bit elements
-            }
-            stride = eew;  // In unit-stride, stride equals EEW
-        } else if (mop == 0x2) {  // Strided mode
-            stride = (instr >> 20) & 0x1F;  // Explicit stride value
-        } else {
-            return;  // Should be unreachable
-        }
-
-        // Load data from memory to vector registers
-        for (uint32_t i = 0; i < vl; i++) {  // Loop through elements up to vector length
-            for (uint32_t s = 0; s < NFIELDS; s++) {  // Loop through fields
-                uint32_t addr = base + i * stride * NFIELDS + s * stride;
-                for (uint32_t j = 0; j < eew; j++) {  // Loop through bytes in element
-                    if (vm == 1 || (vm == 0 && vmask[i] == 1))
-                        vreg[vd + s][i * eew + j] = mem[addr + j];
-                }
-            }
-        }
+    // --- Handle strided mode ---
+    if (mop == 0x2) {
+        uint32_t stride = (instr >> 20) & 0x1F;  // Explicit stride value
+        vload_strided(rv, vd, emul, base, stride * NFIELDS, stride, eew, NFIELDS, act);
         return;
     } 
     // --- Handle indexed modes ---
     else if (mop == 0x1 || mop == 0x3) {  // Indexed (unordered or ordered)
         uint8_t index_reg = (instr >> 20) & 0x1F;  // Register containing index values
-        for (uint32_t i = 0; i < vl; i++) {
-            // Extract offset from index register based on SEW
-            uint32_t offset = 0;
-            uint8_t sew_bits = (vtype >> 3) & 0x7;
-            switch (sew_bits) {
-                case 0: {  // 8-bit SEW
-                    offset = vreg[index_reg][i];
-                    break;
-                }
-                case 1: {  // 16-bit SEW
-                    offset = vreg[index_reg][i * 2] 
-                            | (vreg[index_reg][i * 2 + 1] << 8);
-                    break;
-                }
-                case 2: {  // 32-bit SEW
-                    offset = vreg[index_reg][i * 4] 
-                            | (vreg[index_reg][i * 4 + 1] << 8) 
-                            | (vreg[index_reg][i * 4 + 2] << 16) 
-                            | (vreg[index_reg][i * 4 + 3] << 24);
-                    break;
-                }
-            }
-            // Load each field using calculated offset
-            for (uint32_t s = 0; s < NFIELDS; s++) {
-                uint32_t addr = base + offset + s * eew;
-                for (uint32_t j = 0; j < eew; j++) {
-                    if (vm == 1 || (vm == 0 && vmask[i] == 1))
-                        vreg[vd + s][i * eew + j] = mem[addr + j];
-                }
-            }
-        }
+        uint32_t off[VLEN_MAX];
+        vidx_offsets(rv, off, index_reg, rv->vl);
+        vload_indexed(rv, vd, emul, base, off, mop == 0x3, eew, NFIELDS, rv->vl, act);
         return;
     }
 }
 
-void execute_vstore(uint32_t instr) {
+void execute_vstore(rv_machine_t *rv, uint32_t instr) {
     // Decode instruction fields
     uint8_t nf = (instr >> 29) & 0x7;       // Number of fields minus 1
     uint8_t mew = (instr >> 28) & 0x1;      // Memory element width
@@ -223,670 +610,486 @@ void execute_vstore(uint32_t instr) {
         case 0: eew = 1; break; // 8-bit
         case 1: eew = 2; break; // 16-bit
         case 2: eew = 4; break; // 32-bit
+        case 3: eew = 8; break; // 64-bit
         default: return;        // Unsupported width
     }
 
     // Calculate base address for memory operations
-    uint32_t base = xreg[rs1];
+    uint32_t base = rv->xreg[rs1];
 
-    // Get mask bits from v0 register if masked operation (vm=0)
-    uint8_t vmask[VLEN];
-    build_vmask(vmask);
+    // Active elements, from v0 if masked operation (vm=0)
+    uint64_t act[VMASK_MAX];
+    vmask_active(rv, act, vm, rv->vl);
 
     // Calculate total number of fields to store
     uint8_t NFIELDS = nf + 1;
     if (NFIELDS > 8) return;    // Spec limits to maximum 8 fields
+    uint32_t emul = vseg_emul(rv, eew); // Registers per field
+    if (NFIELDS * emul > 8 && !(mop == 0x0 && ((instr >> 20) & 0x1F) == 0x08))
+        return; // Reserved : more than 8 registers, except whole register moves
 
-    // --- Handle whole register store mode ---
+    // --- Handle unit-stride, segment and whole register modes ---
     if (mop == 0x0) {
         uint8_t sumop = (instr >> 20) & 0x1F;
+        uint32_t n = rv->vl;
         if (sumop == 0x8) {  // Whole register store
-            uint32_t evl = VLEN/eew;  // Elements per register
-            for (uint32_t i = 0; i < evl; i++) {
-                for (uint32_t s = 0; s < NFIELDS; s++) {
-                    uint32_t addr = base + i * NFIELDS * eew + s * eew;
-                    for (uint32_t j = 0; j < eew; j++) {
-                        if (vm == 1 || (vm == 0 && vmask[i] == 1))
-                            mem[addr + j] = vreg[vs3 + s][i * eew + j];
-                    }
-                }
-            }
-            return;
+            n = rv->vlenb/eew;  // Elements per register
+            emul = 1;
+            vmask_active(rv, act, vm, n);
+        } else if (sumop == 0xB) {  // Store mask bits (unit-stride)
+            if (width != 0) return;  // Must be byte width
+            if (nf != 0) return;     // Must be single-field
+            eew = 1;  // Force 8-bit elements
         }
+        vstore_unit(rv, vs3, emul, base, eew, NFIELDS, n, act);
     }
-
-    // --- Handle unit-stride and strided modes ---
-    if (mop == 0x0 || mop == 0x2) {
-        uint32_t stride;
-        if (mop == 0) {  // Unit-stride mode
-            uint8_t sumop = (instr >> 20) & 0x1F;
-            if (sumop == 0) {  // Regular unit-stride
-                ; // eew already set by width
-            } else if (sumop == 0xB) {  // Store mask bits (unit-stride)
-                if (width != 0) return;  // Must be byte width
-                if (nf != 0) return;     // Must be single-field
-                eew = 1;  // Force 8-bit elements
-            }
-            stride = eew;  // In unit-stride, stride equals EEW
-        } else if (mop == 0x2) {  // Strided mode
-            stride = (instr >> 20) & 0x1F;  // Explicit stride value
-        } else {
-            return;  // Should be unreachable
-        }
-
-        // Store data from vector registers to memory
-        for (uint32_t i = 0; i < vl; i++) {  // Loop through elements up to vector length
-            for (uint32_t s = 0; s < NFIELDS; s++) {  // Loop through fields
-                uint32_t addr = base + i * stride * NFIELDS + s * stride;
-                for (uint32_t j = 0; j < eew; j++) {  // Loop through bytes in element
-                    if (vm == 1 || (vm == 0 && vmask[i] == 1))
-                        mem[addr + j] = vreg[vs3 + s][i * eew + j];
-                }
-            }
-        }
+    // --- Handle strided mode ---
+    else if (mop == 0x2) {
+        uint32_t stride = (instr >> 20) & 0x1F;  // Explicit stride value
+        vstore_strided(rv, vs3, emul, base, stride * NFIELDS, stride, eew, NFIELDS, act);
     } 
     // --- Handle indexed modes ---
     else if (mop == 0x1 || mop == 0x3) {  // Indexed (unordered or ordered)
         uint8_t index_reg = (instr >> 20) & 0x1F;  // Register containing index values
-        for (uint32_t i = 0; i < vl; i++) {
-            // Extract offset from index register based on SEW
-            uint32_t offset = 0;
-            uint8_t sew_bits = (vtype >> 3) & 0x7;
-            switch (sew_bits) {
-                case 0: {  // 8-bit SEW
-                    offset = vreg[index_reg][i];
-                    break;
-                }
-                case 1: {  // 16-bit SEW
-                    offset = vreg[index_reg][i * 2] 
-                            | (vreg[index_reg][i * 2 + 1] << 8);
-                    break;
-                }
-                case 2: {  // 32-bit SEW
-                    offset = vreg[index_reg][i * 4] 
-                            | (vreg[index_reg][i * 4 + 1] << 8) 
-                            | (vreg[index_reg][i * 4 + 2] << 16) 
-                            | (vreg[index_reg][i * 4 + 3] << 24);
-                    break;
-                }
-            }
-            // Store each field using calculated offset
-            for (uint32_t s = 0; s < NFIELDS; s++) {
-                uint32_t addr = base + offset + s * eew;
-                for (uint32_t j = 0; j < eew; j++) {
-                    if (vm == 1 || (vm == 0 && vmask[i] == 1))
-                        mem[addr + j] = vreg[vs3 + s][i * eew + j];
-                }
-            }
-        }
+        uint32_t off[VLEN_MAX];
+        vidx_offsets(rv, off, index_reg, rv->vl);
+        vstore_indexed(rv, vs3, emul, base, off, mop == 0x3, eew, NFIELDS, rv->vl, act);
     }  
 }
 
 int32_t signed_extend(uint32_t val, uint8_t size) {
-    if (val & (1 << (size - 1))) {
+    if (size >= 32) {
+        return (int32_t)val; // Shifting by 32 is undefined
+    }
+    if (val & (1u << (size - 1))) {
         return (int32_t)(val | (0xFFFFFFFF << size));
     } else {
         return (int32_t)val;
     }
 }
 
-void execute_varith(uint32_t instr) {
-    // === Extract instruction fields ===
-    uint8_t funct6 = (instr >> 26) & 0x3F;  // Operation type
-    uint8_t funct3 = (instr >> 12) & 0x7;   // Instruction format
-    uint8_t vm     = (instr >> 25) & 0x1;   // Masking mode
-    uint8_t vs2    = (instr >> 20) & 0x1F;  // Source register 2
-    uint8_t vd     = (instr >> 7) & 0x1F;   // Destination register
-    
-    // Build mask information from v0 register
-    uint8_t vmask[VLEN];
-    build_vmask(vmask);
-
-    // Determine effective element width (in bytes)
-    uint8_t vsew = (vtype >> 3) & 0x7;
-    uint8_t eew = 1 << vsew;
-
-    // Check if instruction is supported
-    // OPIVV(0x0), OPIVI(0x3), OPIVX(0x4), OPMVV(0x2), OPMVX(0x6), OPFVV(0x1), OPMVX(0x5)
-    if (funct3 == 0x0 || funct3 == 0x1 || funct3 == 0x2 || funct3 == 0x3 || 
-        funct3 == 0x4 || funct3 == 0x5 || funct3 == 0x6 || funct3 == 0x7) { 
-        
-        // === Handle reduction operations (OPFVV format, funct3 = 0x1) ===
-        if (funct3 == 0x1 && (funct6 >= 0x00 && funct6 <= 0x07)) {
-            // Reduction operations: result goes to scalar vd[0]
-            uint8_t vs1 = (instr >> 15) & 0x1F;  // Source register 1
-            
-            uint32_t op1 = 0, acc = 0;
-            int32_t op1s = 0, accs = 0;
-            
-            // Initialize accumulator with vs1[0] (neutral element)
-            for (uint32_t j = 0; j < eew; j++) {
-                op1 |= (uint32_t)vreg[vs1][j] << (j * 8);
+// Elements of SEW eew bytes, zero-extended to 64 bits
+static inline uint64_t velem_get(const uint8_t *p, uint32_t eew) {
+    switch (eew) {
+        case 1:  return p[0];
+        case 2:  return load_le16(p);
+        case 4:  return load_le32(p);
+        default: return load_le64(p);
+    }
+}
+
+static inline void velem_put(uint8_t *p, uint32_t eew, uint64_t v) {
+    switch (eew) {
+        case 1:  p[0] = v; break;
+        case 2:  store_le16(p, v); break;
+        case 4:  store_le32(p, v); break;
+        default: store_le64(p, v); break;
+    }
+}
+
+static inline int64_t velem_sext(uint64_t v, uint32_t eew) {
+    uint32_t s = 64 - 8 * eew;
+    return (int64_t)(v << s) >> s;
+}
+
+// The scalar operand of an OPIVX, OPMVX or OPIVI instruction at SEW :
+// x[rs1] or the immediate, sign-extended to 64 bits and cut to eew bytes
+static inline uint64_t varith_scalar(rv_machine_t *rv, uint8_t funct3, uint8_t rs1, uint32_t eew) {
+    uint64_t s = (funct3 == 0x3) ? (uint64_t)(int64_t) signed_extend(rs1, 5)
+                                 : (uint64_t)(int64_t)(int32_t) rv->xreg[rs1];
+    return eew == 8 ? s : s & ((1ull << (8 * eew)) - 1);
+}
+
+// Element-wise integer ops (OPIVV, OPIVX, OPIVI) and multiplies (OPMVV,
+// OPMVX) through the host kernels of vkern_dev.c. The scalar operand is
+// truncated to SEW and the immediate sign-extended, except for shift
+// amounts. Widening multiplies write 2 * SEW.
+static void vdec_kernel(rv_machine_t *rv, const vdec_t *v) {
+    uint32_t eew = v->eew, dw = v->dw;
+    int opm = (v->funct3 == 0x2 || v->funct3 == 0x6);
+    uint8_t res[VGROUP_MAX];              // Masked results are merged afterwards
+    uint8_t *dst = v->vm ? VREG(v->vd) : res;
+    if (!v->vm && opm)
+        memcpy(res, VREG(v->vd), rv->vl * dw); // Multiply-adds read vd
+    if (v->form == VDEC_VV) {
+        (*v->k)(dst, VREG(v->vs2), VREG(v->rs1), rv->vl);
+    } else if (v->form == VDEC_VS) {
+        uint32_t s = (v->funct3 == 0x4) ? rv->xreg[v->rs1] : v->rs1;
+        (*v->ks)(dst, VREG(v->vs2), s & (8 * eew - 1), rv->vl);
+    } else {
+        uint64_t s = varith_scalar(rv, v->funct3, v->rs1, eew);
+        uint8_t opnd[VGROUP_MAX];
+        for (uint32_t i = 0; i < rv->vl; i++)
+            velem_put(&opnd[i * eew], eew, s);
+        (*v->k)(dst, VREG(v->vs2), opnd, rv->vl);
+    }
+
+    if (!v->vm) {
+        uint64_t act[VMASK_MAX];
+        uint32_t i;
+        vmask_active(rv, act, 0, rv->vl);
+        VMASK_FOR_EACH(i, act)
+            memcpy(&VREG(v->vd)[i * dw], &res[i * dw], dw);
+    }
+}
+
+// Reductions (vredsum ... vredmax, funct6 0x00-0x07) and widening sums
+// (vwredsumu, vwredsum, funct6 0x30-0x31) : vd[0] = vs1[0] op the active
+// elements of vs2, a run of active elements per kernel call. The widening
+// sums read vs1[0] and write vd[0] at 2 * SEW. The rest of vd is left
+// alone, and nothing changes when vl is 0.
+static void vdec_reduce(rv_machine_t *rv, const vdec_t *v) {
+    vkern_red_t k = *v->kr;
+    if (k == NULL || rv->vl == 0)
+        return; // No 128-bit sums
+
+    uint64_t act[VMASK_MAX];
+    vmask_active(rv, act, v->vm, rv->vl);
+    uint64_t acc = velem_get(VREG(v->rs1), v->dw);
+    uint32_t i = 0, len;
+    while ((i = vmask_run(rv, act, i, rv->vl, &len)) < rv->vl) {
+        acc = k(&VREG(v->vs2)[i * v->eew], acc, len);
+        i += len;
+    }
+    velem_put(VREG(v->vd), v->dw, acc);
+}
+
+// Element loop of the operations without a host kernel. eew is a
+// constant at every call, so each SEW compiles to its own loop. Operands
+// are carried in 64 bits : x from vs2 and y from vs1, rs1 or the
+// immediate, zero-extended (sx and sy sign-extended). Widening operations
+// write 2 * SEW; their .w forms and the narrowing shifts read vs2 at
+// 2 * SEW. Unknown operations leave vd alone.
+static inline __attribute__((always_inline))
+void varith_elems(rv_machine_t *rv, uint32_t instr, uint8_t funct6, uint8_t funct3,
+                  const uint64_t act[VMASK_MAX], const uint32_t eew) {
+    uint8_t vs2 = (instr >> 20) & 0x1F;
+    uint8_t rs1 = (instr >> 15) & 0x1F;
+    uint8_t vd  = (instr >> 7) & 0x1F;
+    int opm = (funct3 == 0x2 || funct3 == 0x6);
+    uint32_t xw = (!opm && (funct6 >> 2 == 0xB || (funct6 >= 0x34 && funct6 <= 0x37))) ? 2 * eew : eew;
+    uint32_t dw = (funct6 >= 0x30) ? 2 * eew : eew;
+    if (xw > 8 || dw > 8)
+        return; // 128-bit elements
+    uint64_t ys = (funct3 == 0x3 && funct6 >> 2 == 0xB) ? rs1 : varith_scalar(rv, funct3, rs1, eew);
+    uint32_t i;
+
+    VMASK_FOR_EACH(i, act) {
+        uint64_t x = velem_get(&VREG(vs2)[i * xw], xw);
+        uint64_t y = (funct3 == 0x0 || funct3 == 0x2) ? velem_get(&VREG(rs1)[i * eew], eew) : ys;
+        int64_t sx = velem_sext(x, xw), sy = velem_sext(y, eew);
+        uint64_t res;
+
+        if (!opm) {
+            switch (funct6) {
+                // Narrowing shifts, by up to 2 * SEW - 1
+                case 0x2C: res = x >> (y & (8 * xw - 1)); break;    // vnsrl
+                case 0x2D: res = sx >> (y & (8 * xw - 1)); break;   // vnsra
+
+                // Widening operations
+                case 0x30: res = x + y; break;                      // vwaddu
+                case 0x31: res = sx + sy; break;                    // vwadd
+                case 0x32: res = x - y; break;                      // vwsubu
+                case 0x33: res = sx - sy; break;                    // vwsub
+                case 0x34: res = x + y; break;                      // vwaddu.w
+                case 0x35: res = sx + sy; break;                    // vwadd.w
+                case 0x36: res = x - y; break;                      // vwsubu.w
+                case 0x37: res = sx - sy; break;                    // vwsub.w
+                default: return;
             }
-            op1s = signed_extend(op1, 8 * eew);
-            
-            // Neutral element depends on operation
+        } else {
             switch (funct6) {
-                case 0x00: // vredsum
-                    acc = 0;
-                    accs = 0;
-                    break;
-                case 0x01: // vredand
-                    acc = 0xFFFFFFFF;
+                // High halves of products; SEW 64 goes through 128 bits
+                case 0x09: // vmulh
+                    res = (eew == 8) ? (uint64_t)(((__int128) sx * sy) >> 64)
+                                     : (uint64_t)((sx * sy) >> (8 * eew));
                     break;
-                case 0x02: // vredor
-                    acc = 0;
+                case 0x0A: // vmulhu
+                    res = (eew == 8) ? (uint64_t)(((unsigned __int128) x * y) >> 64)
+                                     : (x * y) >> (8 * eew);
                     break;
-                case 0x03: // vredxor
-                    acc = 0;
+                case 0x0B: // vmulhsu
+                    res = (eew == 8) ? (uint64_t)(((__int128) sx * (__int128) y) >> 64)
+                                     : (uint64_t)((sx * (int64_t) y) >> (8 * eew));
                     break;
-                case 0x04: // vredminu
-                    acc = 0xFFFFFFFF; // Maximum unsigned value
+
+                // Division by zero gives all ones (quotient) or the
+                // dividend (remainder); overflow gives the dividend and 0
+                case 0x0C: // vdiv
+                    res = (sy == 0) ? ~0ull : (sy == -1) ? 0 - x : (uint64_t)(sx / sy);
                     break;
-                case 0x05: // vredmin
-                    accs = 0x7FFFFFFF; // Maximum signed value
-                    acc = (uint32_t)accs;
+                case 0x0D: // vdivu
+                    res = (y == 0) ? ~0ull : x / y;
                     break;
-                case 0x06: // vredmaxu
-                    acc = 0; // Minimum unsigned value
+                case 0x0E: // vrem
+                    res = (sy == 0) ? x : (sy == -1) ? 0 : (uint64_t)(sx % sy);
                     break;
-                case 0x07: // vredmax
-                    accs = 0x80000000; // Minimum signed value
-                    acc = (uint32_t)accs;
+                case 0x0F: // vremu
+                    res = (y == 0) ? x : x % y;
                     break;
+                default: return;
             }
-            
-            // Process vector elements and accumulate result
-            for (uint32_t i = 0; i < vl; i++) {
-                if (vm == 1 || (vm == 0 && vmask[i] == 1)) {
-                    uint32_t op2 = 0;
-                    int32_t op2s = 0;
-                    
-                    // Load operand from vs2
-                    for (uint32_t j = 0; j < eew; j++) {
-                        op2 |= (uint32_t)vreg[vs2][i * eew + j] << (j * 8);
-                    }
-                    op2s = signed_extend(op2, 8 * eew);
-                    
-                    // Perform reduction operation
-                    switch (funct6) {
-                        case 0x00: // vredsum
-                            accs += op2s;
-                            acc = (uint32_t)accs;
-                            break;
-                        case 0x01: // vredand
-                            acc &= op2;
-                            break;
-                        case 0x02: // vredor
-                            acc |= op2;
-                            break;
-                        case 0x03: // vredxor
-                            acc ^= op2;
-                            break;
-                        case 0x04: // vredminu
-                            acc = (op2 < acc) ? op2 : acc;
-                            break;
-                        case 0x05: // vredmin
-                            accs = (op2s < accs) ? op2s : accs;
-                            acc = (uint32_t)accs;
-                            break;
-                        case 0x06: // vredmaxu
-                            acc = (op2 > acc) ? op2 : acc;
-                            break;
-                        case 0x07: // vredmax
-                            accs = (op2s > accs) ? op2s : accs;
-                            acc = (uint32_t)accs;
-                            break;
-                    }
-                }
-            }
-            
-            // Write result to scalar vd[0]
-            for (uint32_t j = 0; j < eew; j++) {
-                vreg[vd][j] = (acc >> (j * 8)) & 0xFF;
-            }
-            
-            // Clear unused elements
-            for (uint32_t i = 1; i < vl; i++) {
-                for (uint32_t j = 0; j < eew; j++) {
-                    vreg[vd][i * eew + j] = 0;
-                }
-            }
-            
-            return; // Early return after handling reduction
-        }
-        
-        // === Handle mask operations (OPMVV format, funct3 = 0x2, special funct6) ===
-        else if (funct3 == 0x2 && (funct6 >= 0x50 && funct6 <= 0x57)) {
-            uint8_t vs1 = (instr >> 15) & 0x1F;  // Source register 1
-            
-            // For vpopc and vfirst, result goes to x[rd]
-            if (funct6 == 0x50 || funct6 == 0x51) {
-                uint32_t result = 0;
-                
-                switch (funct6) {
-                    case 0x50: // vpopc - Count number of set bits in vs2
-                        for (uint32_t i = 0; i < vl; i++) {
-                            if (vm == 1 || (vm == 0 && vmask[i] == 1)) {
-                                uint8_t bit = (vreg[vs2][i / 8] >> (i % 8)) & 0x1;
-                                result += bit;
-                            }
-                        }
-                        break;
-                        
-                    case 0x51: // vfirst - Find first set bit in vs2
-                        result = 0xFFFFFFFF; // -1 if no set bit found
-                        for (uint32_t i = 0; i < vl; i++) {
-                            if ((vm == 1 || (vm == 0 && vmask[i] == 1)) && 
-                                ((vreg[vs2][i / 8] >> (i % 8)) & 0x1)) {
-                                result = i;
-                                break;
-                            }
-                        }
-                        break;
-                }
-                
-                // Store result in scalar register
-                xreg[vd] = result;
-                return; // Early return after handling
-            }
-            
-            // Mask logical operations
-            else if (funct6 >= 0x52 && funct6 <= 0x57) {
-                for (uint32_t i = 0; i < vl; i++) {
-                    if (vm == 1 || (vm == 0 && vmask[i] == 1)) {
-                        // Extract source bits
-                        uint8_t vs2_bit = (vreg[vs2][i / 8] >> (i % 8)) & 0x1;
-                        uint8_t vs1_bit = (vreg[vs1][i / 8] >> (i % 8)) & 0x1;
-                        uint8_t result_bit = 0;
-                        
-                        // Perform mask operation
-                        switch (funct6) {
-                            case 0x52: // vmand
-                                result_bit = vs1_bit & vs2_bit;
-                                break;
-                            case 0x53: // vmor
-                                result_bit = vs1_bit | vs2_bit;
-                                break;
-                            case 0x54: // vmxor
-                                result_bit = vs1_bit ^ vs2_bit;
-                                break;
-                            case 0x55: // vmnand
-                                result_bit = ~(vs1_bit & vs2_bit) & 0x1;
-                                break;
-                            case 0x56: // vmnor
-                                result_bit = ~(vs1_bit | vs2_bit) & 0x1;
-                                break;
-                            case 0x57: // vmxnor
-                                result_bit = ~(vs1_bit ^ vs2_bit) & 0x1;
-                                break;
-                        }
-                        
-                        // Set/clear bit in destination
-                        if (result_bit) {
-                            vreg[vd][i / 8] |= (1 << (i % 8));
-                        } else {
-                            vreg[vd][i / 8] &= ~(1 << (i % 8));
-                        }
-                    }
-                }
-                return; // Early return after handling
-            }
-        }
-        
-        // === Handle mask.set and mask.clear (OPIVV, special funct6) ===
-        else if (funct3 == 0x0 && (funct6 == 0x58 || funct6 == 0x59)) {
-            for (uint32_t i = 0; i < vl; i++) {
-                if (vm == 1 || (vm == 0 && vmask[i] == 1)) {
-                    // Set or clear bits
-                    if (funct6 == 0x58) { // vmclr.m - Clear all bits
-                        vreg[vd][i / 8] &= ~(1 << (i % 8));
-                    } else { // vmset.m - Set all bits
-                        vreg[vd][i / 8] |= (1 << (i % 8));
-                    }
-                }
-            }
-            return; // Early return after handling
         }
-        
-        // === Handle vcompress (OPMVV, special funct6) ===
-        else if (funct3 == 0x2 && funct6 == 0x5F) {
-            uint8_t vs1 = (instr >> 15) & 0x1F;  // Source register 1
-            uint32_t dest_idx = 0;
-            
-            // Temporary buffer for compressed data
-            uint8_t tmp_reg[VLEN];
-            memset(tmp_reg, 0, VLEN); // Clear temp buffer
-            
-            // Compress vs1 into temporary buffer based on vs2 mask bits
-            for (uint32_t i = 0; i < vl; i++) {
-                uint8_t mask_bit = (vreg[vs2][i / 8] >> (i % 8)) & 0x1;
-                
-                if (mask_bit) {
-                    // Copy element from vs1 to temp buffer
-                    for (uint32_t j = 0; j < eew; j++) {
-                        tmp_reg[dest_idx * eew + j] = vreg[vs1][i * eew + j];
-                    }
-                    dest_idx++;
-                }
-            }
-            
-            // Copy from temp buffer to destination register
-            for (uint32_t i = 0; i < vl; i++) {
-                for (uint32_t j = 0; j < eew; j++) {
-                    if (i < dest_idx) {
-                        vreg[vd][i * eew + j] = tmp_reg[i * eew + j];
-                    } else {
-                        vreg[vd][i * eew + j] = 0; // Zero out remaining elements
-                    }
-                }
+        velem_put(&VREG(vd)[i * dw], dw, res);
+    }
+}
+
+// One entry per SEW, so that each compiles varith_elems with a constant eew
+#define VDEC_ELEMS(name, n)                                              \
+    static void name(rv_machine_t *rv, const vdec_t *v) {                \
+        uint64_t act[VMASK_MAX];                                         \
+        vmask_active(rv, act, v->vm, rv->vl);                            \
+        varith_elems(rv, v->instr, v->funct6, v->funct3, act, n);        \
+    }
+VDEC_ELEMS(vdec_elems8, 1)
+VDEC_ELEMS(vdec_elems16, 2)
+VDEC_ELEMS(vdec_elems32, 4)
+VDEC_ELEMS(vdec_elems64, 8)
+
+// vcpop.m and vfirst.m (OPMVV, funct6 0x10 with vs1 0x10 and 0x11) :
+// the set bits of vs2 among the active elements, counted or the lowest
+// found (-1 for none), into x[rd]
+static void vdec_mask_scalar(rv_machine_t *rv, const vdec_t *v) {
+    uint64_t act[VMASK_MAX];
+    vmask_active(rv, act, v->vm, rv->vl);
+    uint32_t result = 0;
+
+    if (v->rs1 == 0x10) { // vcpop - Count number of set bits in vs2
+        for (uint32_t w = 0; w < VMASK_WORDS; w++)
+            result += __builtin_popcountll(vmask_word(rv, v->vs2, w) & act[w]);
+    } else { // vfirst - Find first set bit in vs2
+        result = 0xFFFFFFFF; // -1 if no set bit found
+        for (uint32_t w = 0; w < VMASK_WORDS; w++) {
+            uint64_t m = vmask_word(rv, v->vs2, w) & act[w];
+            if (m != 0) {
+                result = w * 64 + __builtin_ctzll(m);
+                break;
             }
-            
-            return; // Early return after handling
         }
-        
-        // === Process regular vector operations ===
-        uint8_t vd = (instr >> 7) & 0x1F; // Destination vector register vd
-
-        for (uint32_t i = 0; i < vl; i++) {
-            if (vm == 1 || (vm == 0 && vmask[i] == 1)) {
-                // === Load operands ===
-                uint32_t op1 = 0, op2 = 0, res = 0;
-                int32_t op1s = 0, op2s = 0, ress = 0;
-                uint32_t vd_val = 0;
-                int32_t vd_vals = 0;
-                
-                // Load operand 2 from vs2 register
-                for (uint32_t j = 0; j < eew; j++) {
-                    op2 |= (uint32_t)vreg[vs2][i * eew + j] << (j * 8);
-                }
-                op2s = signed_extend(op2, 8 * eew);
-
-                // Select operand 1 based on instruction format
-                if (funct3 == 0x0 || funct3 == 0x2) { 
-                    // OPIVV or OPMVV: Get operand 1 from vector register vs1
-                    uint8_t vs1 = (instr >> 15) & 0x1F;
-                    for (uint32_t j = 0; j < eew; j++) {
-                        op1 |= (uint32_t)vreg[vs1][i * eew + j] << (j * 8);
-                    }
-                    op1s = signed_extend(op1, 8 * eew);
-                } 
-                else if (funct3 == 0x3) { 
-                    // OPIVI: Get operand 1 from immediate value
-                    op1 = (instr >> 15) & 0x1F;
-                    op1s = signed_extend(op1, 5);
-                } 
-                else if (funct3 == 0x4 || funct3 == 0x6) { 
-                    // OPIVX or OPMVX: Get operand 1 from scalar register
-                    op1 = xreg[(instr >> 15) & 0x1F];
-                    op1s = signed_extend(op1, 8 * eew);
-                }
+    }
+    if (v->vd != 0)
+        rv->xreg[v->vd] = result;
+}
 
-                // Load current vd value for fused operations
-                if ((funct3 == 0x2 || funct3 == 0x6) && funct6 >= 0x20 && funct6 <= 0x23) {
-                    for (uint32_t j = 0; j < eew; j++) {
-                        vd_val |= (uint32_t)vreg[vd][i * eew + j] << (j * 8);
-                    }
-                    vd_vals = signed_extend(vd_val, 8 * eew);
-                }
-                
-                // === Execute operation based on instruction format and opcode ===
-                if (funct3 == 0x0 || funct3 == 0x3 || funct3 == 0x4) {
-                    // Integer vector instructions (OPIVV, OPIVI, OPIVX)
-                    switch (funct6) {
-                        // Arithmetic operations
-                        case 0x00: res = op2s + op1s; break;           // vadd
-                        case 0x02: res = op2s - op1s; break;           // vsub
-                        case 0x03: res = op1s - op2s; break;           // vrsub
-                        
-                        // Min/Max operations
-                        case 0x04: res = (op2 < op1) ? op2 : op1; break;   // vminu
-                        case 0x05: res = (op2s < op1s) ? op2s : op1s; break; // vmin
-                        case 0x06: res = (op2 > op1) ? op2 : op1; break;   // vmaxu
-                        case 0x07: res = (op2s > op1s) ? op2s : op1s; break; // vmax
-                        
-                        // Logical operations
-                        case 0x09: res = op2 & op1; break;             // vand
-                        case 0x0A: res = op2 | op1; break;             // vor
-                        case 0x0B: res = op2 ^ op1; break;             // vxor
-                        
-                        // Comparison operations
-                        case 0x10: res = (op2 == op1); break;          // vmseq
-                        case 0x11: res = (op2 != op1); break;          // vmsne
-                        case 0x12: res = (op2 < op1); break;           // vmsltu
-                        case 0x13: res = (op2s < op1s); break;         // vmslt
-                        case 0x14: res = (op2 <= op1); break;          // vmsleu
-                        case 0x15: res = (op2s <= op1s); break;        // vmsle
-                        case 0x16: res = (op2 > op1); break;           // vmsgtu
-                        case 0x17: res = (op2s > op1s); break;         // vmsgt
-                        
-                        // Shift operations
-                        case 0x25: res = op2 << op1; break;            // vsll
-                        case 0x26: res = op2 >> op1; break;            // vsrl
-                        case 0x27: res = op2s >> op1; break;           // vsra
-                        case 0x2C: res = op2 >> op1; break;            // vnsrl
-                        case 0x2D: res = op2s >> op1; break;           // vnsra
-                        
-                        // Widening operations
-                        case 0x30: res = op2 + op1; break;             // vwaddu
-                        case 0x31: res = op2s + op1s; break;           // vwadd
-                        case 0x32: res = op2 - op1; break;             // vwsubu
-                        case 0x33: res = op2s - op1s; break;           // vwsub
-                        case 0x34: res = op2 + op1; break;             // vwaddu.w
-                        case 0x35: res = op2s + op1s; break;           // vwadd.w
-                        case 0x36: res = op2 - op1; break;             // vwsubu.w
-                        case 0x37: res = op2s - op1s; break;           // vwsub.w
-                    }
-                } 
-                else if (funct3 == 0x2 || funct3 == 0x6) {
-                    // Multiplication/Division vector instructions (OPMVV, OPMVX)
-                    switch (funct6) {
-                        // Multiplication operations
-                        case 0x08:
-                            // vmul: Standard multiplication
-                            res = op2s * op1s;
-                            break;
-                            
-                        case 0x09:
-                            // vmulh: Signed multiplication (high bits)
-                            if (eew == 1) { // 8-bit
-                                ress = ((int16_t)op2s * (int16_t)op1s) >> 8;
-                            } else if (eew == 2) { // 16-bit
-                                ress = ((int32_t)op2s * (int32_t)op1s) >> 16;
-                            } else { // 32-bit (approximate calculation)
-                                if ((op2s >> 16) == 0 && (op1s >> 16) == 0) {
-                                    ress = 0; // If both values are small, high bits are 0
-                                } else {
-                                    ress = ((op2s >> 16) * op1s + (op1s >> 16) * (op2s & 0xFFFF));
-                                }
-                            }
-                            res = (uint32_t)ress;
-                            break;
-                            
-                        case 0x0A:
-                            // vmulhu: Unsigned multiplication (high bits)
-                            if (eew == 1) { // 8-bit
-                                res = ((uint16_t)op2 * (uint16_t)op1) >> 8;
-                            } else if (eew == 2) { // 16-bit
-                                res = ((uint32_t)op2 * (uint32_t)op1) >> 16;
-                            } else { // 32-bit (approximate calculation)
-                                if ((op2 >> 16) == 0 && (op1 >> 16) == 0) {
-                                    res = 0; // If both values are small, high bits are 0
-                                } else {
-                                    res = ((op2 >> 16) * op1 + (op1 >> 16) * (op2 & 0xFFFF));
-                                }
-                            }
-                            break;
-                            
-                        case 0x0B:
-                            // vmulhsu: Signed×Unsigned multiplication (high bits)
-                            if (eew == 1) { // 8-bit
-                                ress = ((int16_t)op2s * (uint16_t)op1) >> 8;
-                            } else if (eew == 2) { // 16-bit
-                                ress = ((int32_t)op2s * (uint32_t)op1) >> 16;
-                            } else { // 32-bit (approximate calculation)
-                                if ((op2s >> 16) == 0 && (op1 >> 16) == 0) {
-                                    ress = 0; // If both values are small, high bits are 0
-                                } else {
-                                    ress = ((op2s >> 16) * op1 + (op1 >> 16) * (op2s & 0xFFFF));
-                                }
-                            }
-                            res = (uint32_t)ress;
-                            break;
-                            
-                        // Division operations
-                        case 0x0C:
-                            // vdiv: Signed division
-                            if (op1s == 0) {
-                                res = 0xFFFFFFFF; // Division by zero: set all bits to 1
-                            } else {
-                                ress = op2s / op1s;
-                                res = (uint32_t)ress;
-                            }
-                            break;
-                            
-                        case 0x0D:
-                            // vdivu: Unsigned division
-                            if (op1 == 0) {
-                                res = 0xFFFFFFFF; // Division by zero: set all bits to 1
-                            } else {
-                                res = op2 / op1;
-                            }
-                            break;
-                            
-                        case 0x0E:
-                            // vrem: Signed remainder
-                            if (op1s == 0) {
-                                res = (uint32_t)op2s; // Division by zero: return dividend
-                            } else {
-                                ress = op2s % op1s;
-                                res = (uint32_t)ress;
-                            }
-                            break;
-                            
-                        case 0x0F:
-                            // vremu: Unsigned remainder
-                            if (op1 == 0) {
-                                res = op2; // Division by zero: return dividend
-                            } else {
-                                res = op2 % op1;
-                            }
-                            break;
-                            
-                        // Fused multiply operations
-                        case 0x20:
-                            // vmacc: Multiply-accumulate (vd = vd + (vs1 * vs2))
-                            res = vd_val + (op1s * op2s);
-                            break;
-                            
-                        case 0x21:
-                            // vnmsac: Negate multiply-accumulate (vd = vd - (vs1 * vs2))
-                            res = vd_val - (op1s * op2s);
-                            break;
-                            
-                        case 0x22:
-                            // vmadd: Multiply-add (vd = (vd * vs1) + vs2)
-                            res = (vd_vals * op1s) + op2s;
-                            break;
-                            
-                        case 0x23:
-                            // vnmsub: Negate multiply-subtract (vd = -(vd * vs1) + vs2)
-                            res = -(vd_vals * op1s) + op2s;
-                            break;
-                    }
-                }
+// Mask logical operations (OPMVV, funct6 0x18-0x1F, always unmasked) :
+// a word at a time, changing only the first vl bits of vd. vmclr.m and
+// vmset.m are vmxor.mm and vmxnor.mm with vd = vs2 = vs1.
+static void vdec_mask(rv_machine_t *rv, const vdec_t *v) {
+    for (uint32_t w = 0; w < VMASK_WORDS; w++) {
+        uint64_t m1 = vmask_word(rv, v->rs1, w);
+        uint64_t m2 = vmask_word(rv, v->vs2, w);
+        uint64_t body = vmask_body(w, rv->vl);
+        uint64_t res = 0;
 
-                // === Write back results ===
-                // Determine write-back width based on operation
-                uint8_t write_back_eew = eew;
-                
-                // For widening operations
-                if (funct6 >> 4 == 0x3) {
-                    if (eew == 1) {
-                        write_back_eew = 2;       // 8bit -> 16bit
-                    } else if (eew == 2) {
-                        write_back_eew = 4;       // 16bit -> 32bit
-                    } else {
-                        write_back_eew = 8;       // 32bit -> 64bit
-                    }
-                } 
-                // For narrowing operations
-                else if (funct6 >> 2 == 0xB) {
-                    if (eew == 8) {
-                        write_back_eew = 4;       // 64bit -> 32bit
-                    } else if (eew == 4) {
-                        write_back_eew = 2;       // 32bit -> 16bit
-                    } else {
-                        write_back_eew = 1;       // 16bit -> 8bit
-                    }
-                } 
-                // For mask operations
-                else if (funct6 >> 3 == 0x3) {
-                    write_back_eew = 1;           // Always 1-bit (mask value)
-                }
-                
-                // Write result back to vector register
-                for (uint32_t j = 0; j < write_back_eew; j++) {
-                    vreg[vd][i * write_back_eew + j] = (res >> (j * 8)) & 0xFF;
-                }
-            }
+        switch (v->funct6) {
+            case 0x18: res = m2 & ~m1; break;     // vmandn
+            case 0x19: res = m2 & m1; break;      // vmand
+            case 0x1A: res = m2 | m1; break;      // vmor
+            case 0x1B: res = m2 ^ m1; break;      // vmxor
+            case 0x1C: res = m2 | ~m1; break;     // vmorn
+            case 0x1D: res = ~(m2 & m1); break;   // vmnand
+            case 0x1E: res = ~(m2 | m1); break;   // vmnor
+            case 0x1F: res = ~(m2 ^ m1); break;   // vmxnor
         }
+        vmask_set_word(rv, v->vd, w, (vmask_word(rv, v->vd, w) & ~body) | (res & body));
     }
 }
 
-int decode_rvv_instr(uint32_t instr) {
-    uint32_t opcode = instr & 0x7F;
-    uint8_t funct3 = (instr >> 12) & 0x7;
-    switch (opcode) {
-        case 0x57 : 
-            if (funct3 == 0x7) {
-                uint8_t rd = (instr >> 7) & 0x1F;
-                uint8_t rs1 = (instr >> 15) & 0x1F;
-                uint8_t avl;
-                uint8_t vtypei;
-                if (((instr >> 12) &0x7) == 0x7) { // VSETVL
-                    if (((instr >> 31) & 1) == 0x0) { // vsetvli
-                        pc = pc + 4;
-                        avl = compute_avl(rs1, rd);
-                        vtypei = (instr >> 20) & 0x3FF;
-                        execute_vsetvl(rd, avl, vtypei);
-                        debug("vsetvli : vl=%d, vtype=%d\n", vl, vtype);
-                        return 1;
-                    }
-                    if (((instr >> 30) & 0x3) == 0x3) { // vsetivli
-                        pc = pc + 4;
-                        avl = (instr >> 15) & 0x1F;
-                        vtypei = (instr >> 20) & 0x3FF;
-                        execute_vsetvl(rd, avl, vtypei);
-                        debug("vsetivli : vl=%d, vtype=%d\n", vl, vtype);
-                        return 1;
-                    }
-                    if (((instr >> 30) & 0x3) == 0x2) { // vsetvl
-                        pc = pc + 4;
-                        avl = compute_avl(rs1, rd);
-                        vtypei = xreg[(instr >> 20) & 0x1F];
-                        execute_vsetvl(rd, avl, vtypei);
-                        debug("vsetvl : vl=%d, vtype=%d\n", vl, vtype);
-                        return 1;
-                    }
-                    return 0;
-                }
-                return 0;
-            } else {
-                execute_varith(instr);
-                return 1;
-            }
-        case 0x07: {
-            pc = pc + 4;
-            execute_vload(instr);
+// vcompress.vm (OPMVV, funct6 0x17) : the elements of vs2 selected by the
+// mask vs1 among the first vl are packed into the low elements of vd;
+// the rest of vd is left alone. Element i goes to an index at most i, so
+// the copy is also right in place.
+static void vdec_compress(rv_machine_t *rv, const vdec_t *v) {
+    uint32_t eew = v->eew;
+    uint32_t dest_idx = 0;
+    uint32_t i;
+
+    uint64_t sel[VMASK_MAX];
+    for (uint32_t w = 0; w < VMASK_WORDS; w++)
+        sel[w] = vmask_word(rv, v->rs1, w) & vmask_body(w, rv->vl);
+    VMASK_FOR_EACH(i, sel) {
+        memmove(&VREG(v->vd)[dest_idx * eew], &VREG(v->vs2)[i * eew], eew);
+        dest_idx++;
+    }
+}
+
+// Decoded but not executed : reserved encodings and the floating-point
+// formats
+static void vdec_nop(rv_machine_t *rv, const vdec_t *v) {
+}
+
+static void vdec_vsetvli(rv_machine_t *rv, const vdec_t *v) {
+    vsetvl_apply(rv, v->vd, compute_avl(rv, v->rs1, v->vd), v->vtypei, v->vlmax);
+    debug("vsetvli : vl=%d, vtype=%d\n", rv->vl, rv->vtype);
+}
+
+static void vdec_vsetivli(rv_machine_t *rv, const vdec_t *v) {
+    vsetvl_apply(rv, v->vd, v->rs1, v->vtypei, v->vlmax);
+    debug("vsetivli : vl=%d, vtype=%d\n", rv->vl, rv->vtype);
+}
+
+static void vdec_vsetvl(rv_machine_t *rv, const vdec_t *v) {
+    uint8_t vtypei = rv->xreg[v->vs2];
+    execute_vsetvl(rv, v->vd, compute_avl(rv, v->rs1, v->vd), vtypei);
+    debug("vsetvl : vl=%d, vtype=%d\n", rv->vl, rv->vtype);
+}
+
+static void vdec_load(rv_machine_t *rv, const vdec_t *v) {
+    execute_vload(rv, v->instr);
+}
+
+static void vdec_store(rv_machine_t *rv, const vdec_t *v) {
+    execute_vstore(rv, v->instr);
+}
+
+// Fill v for instr under vtype vt. Returns 0 for instructions that are
+// not vector instructions or not implemented.
+static int vdec_resolve(rv_machine_t *rv, uint32_t instr, uint32_t vt, vdec_t *v) {
+    v->instr  = instr;
+    v->vtype  = vt;
+    v->funct6 = (instr >> 26) & 0x3F;  // Operation type
+    v->funct3 = (instr >> 12) & 0x7;   // Instruction format
+    v->vm     = (instr >> 25) & 0x1;   // Masking mode
+    v->vs2    = (instr >> 20) & 0x1F;  // Source register 2
+    v->rs1    = (instr >> 15) & 0x1F;  // vs1, rs1 or imm
+    v->vd     = (instr >> 7) & 0x1F;   // Destination register
+    v->vsew   = (vt >> 3) & 0x7;
+    v->eew    = 1 << v->vsew;
+    v->dw     = v->eew;
+    v->form   = VDEC_VV;
+    v->k      = NULL;
+    v->ks     = NULL;
+    v->kr     = NULL;
+    v->vlmax  = 0;
+    v->vtypei = 0;
+
+    uint8_t funct6 = v->funct6, funct3 = v->funct3, vsew = v->vsew;
+    switch (instr & 0x7F) {
+        case 0x07: v->exec = vdec_load; return 1;
+        case 0x27: v->exec = vdec_store; return 1;
+        case 0x57: break;
+        default: return 0;
+    }
+
+    // === vsetvli, vsetivli and vsetvl ===
+    if (funct3 == 0x7) {
+        if (((instr >> 31) & 1) == 0x0) {
+            v->exec = vdec_vsetvli;
+        } else if (((instr >> 30) & 0x3) == 0x3) {
+            v->exec = vdec_vsetivli;
+        } else if (((instr >> 30) & 0x3) == 0x2) {
+            v->exec = vdec_vsetvl;
             return 1;
+        } else {
+            return 0;
         }
-        case 0x27: {
-            pc = pc + 4;
-            execute_vstore(instr);
-            return 1;
+        v->vtypei = (instr >> 20) & 0x3FF;
+        v->vlmax = vtype_vlmax(rv, v->vtypei);
+        return 1;
+    }
+
+    // === Reductions (funct3 = 0x1) ===
+    if (funct3 == 0x1 && (funct6 <= 0x07 || funct6 == 0x30 || funct6 == 0x31)) {
+        v->exec = vdec_reduce;
+        v->kr = &vkern_red[funct6][vsew];
+        if (funct6 >= 0x30)
+            v->dw = 2 * v->eew;
+        return 1;
+    }
+
+    // === Mask operations and vcompress ===
+    if (funct3 == 0x2 && funct6 == 0x10 && (v->rs1 == 0x10 || v->rs1 == 0x11)) {
+        v->exec = vdec_mask_scalar;
+        return 1;
+    }
+    if (funct3 == 0x2 && funct6 >= 0x18 && funct6 <= 0x1F && v->vm) {
+        v->exec = vdec_mask;
+        return 1;
+    }
+    if (funct3 == 0x2 && funct6 == 0x17 && v->vm) {
+        v->exec = vdec_compress;
+        return 1;
+    }
+
+    // OPIVV, OPIVI, OPIVX, OPMVV and OPMVX from here on
+    v->exec = vdec_nop;
+    if (funct3 == 0x1 || funct3 == 0x5)
+        return 1;
+
+    // Widening and narrowing operations need a 2 * LMUL group
+    if ((funct6 >= 0x30 || funct6 >> 2 == 0xB) && (vt & 0x7) == 0x3)
+        return 1; // Reserved : LMUL 8
+
+    // === Element-wise operations with a host kernel ===
+    int opm = (funct3 == 0x2 || funct3 == 0x6);
+    const vkern_vv_t *k = opm ? &vkern_mv[funct6][vsew] : &vkern_vv[funct6][vsew];
+    if (*k != NULL) {
+        v->exec = vdec_kernel;
+        v->k = k;
+        if (opm && funct6 >= 0x30)
+            v->dw = 2 * v->eew;
+        if (funct3 == 0x0 || funct3 == 0x2) {
+            v->form = VDEC_VV;
+        } else if (!opm && vkern_vs[funct6][vsew] != NULL) {
+            v->form = VDEC_VS;
+            v->ks = &vkern_vs[funct6][vsew];
+        } else {
+            v->form = VDEC_VX;
         }
-        default:
+        return 1;
+    }
+
+    // === The other operations, one loop per SEW ===
+    switch (v->eew) {
+        case 1:  v->exec = vdec_elems8; break;
+        case 2:  v->exec = vdec_elems16; break;
+        case 4:  v->exec = vdec_elems32; break;
+        default: v->exec = vdec_elems64; break;
+    }
+    return 1;
+}
+
+void vdec_print_stats(rv_machine_t *rv, FILE *fp) {
+    uint64_t hits = rv->vdec->hits, misses = rv->vdec->misses;
+    uint64_t total = hits + misses;
+    fprintf(fp, "vdec   : hits = %llu, misses = %llu, hit rate = %.2f%%\n",
+            (unsigned long long)hits, (unsigned long long)misses,
+            total ? 100.0 * hits / total : 0.0);
+}
+
+int decode_rvv_instr(rv_machine_t *rv, uint32_t instr) {
+    uint32_t h = ((instr ^ (rv->vtype * 0x9E3779B1u)) * 0x9E3779B1u) >> (32 - VDEC_BITS);
+    vdec_t *v = &rv->vdec->entry[h];
+    if (v->exec != NULL && v->instr == instr && v->vtype == rv->vtype) {
+        rv->vdec->hits++;
+    } else {
+        rv->vdec->misses++;
+        if (!vdec_resolve(rv, instr, rv->vtype, v)) {
+            v->exec = NULL;
             return 0;
+        }
     }
+    rv->pc = rv->pc + 4;
+    v->exec(rv, v);
+    return 1;
+}
+
+static int exec_rvv(rv_machine_t *rv, const rv_insn_t *d) {
+    return decode_rvv_instr(rv, d->instr);
+}
+
+// Vector instructions are cached as-is and decoded by decode_rvv_instr
+// when executed.
+int predecode_rvv_instr(uint32_t instr, rv_insn_t *d) {
+    uint32_t opcode = instr & 0x7F;
+    if (opcode != 0x57 && opcode != 0x07 && opcode != 0x27)
+        return 0;
+    d->handler = exec_rvv;
+    d->instr   = instr;
+    d->imm     = 0;
+    d->op      = INSTR_RVV;
+    d->rd      = (instr >> 7) & 0x1F;
+    d->rs1     = (instr >> 15) & 0x1F;
+    d->rs2     = (instr >> 20) & 0x1F;
+    return 1;
 }
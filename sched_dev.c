@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rv32.h"
+
+/*
+ * Deterministic multi-hart scheduler
+ *
+ * rv_run_harts_det runs the harts in rounds in which every hart still
+ * running retires one quantum of instructions. What the harts compute,
+ * and how many instructions each retires, depends on the program, the
+ * seed and the quantum only : not on the number of host threads, nor on
+ * how the host schedules them.
+ *
+ * Each guest page is shared or owned by one hart, and a round has two
+ * phases :
+ *
+ *   1. Up to cfg->threads harts run their quantum at once. A hart may
+ *      read shared pages and read and write its own. Nobody writes a
+ *      shared page in this phase, so all a hart reads is fixed by the
+ *      previous round and its own stores. Its first access outside these
+ *      rights parks it just before the access.
+ *   2. The parked harts finish their quantum one at a time, with no
+ *      restriction, in an order drawn from the seed and the round.
+ *
+ * At the end of the round each page a hart touched gets a new state : a
+ * page written by one hart and touched by no other becomes that hart's,
+ * any other touched page becomes shared. Harts that keep to their own
+ * stacks and data soon run in phase 1 only, in parallel; shared
+ * counters and locks send their harts to phase 2.
+ *
+ * Accesses are seen through the TLBs. Every hart's TLBs are flushed when
+ * a round starts, so the first load and the first store to each page in
+ * the round reach mem_translate_slow, which calls sched_access. Fetching
+ * already predecoded or compiled code is not an access : as with
+ * rv_run_harts, a hart sees code another hart wrote only after a FENCE.I,
+ * so its code does not depend on when the other hart ran.
+ *
+ * MEM_GUARD builds have no TLB to watch, and every hart runs its quantum
+ * in phase 2. Runs are as reproducible, but on one host core and with
+ * another interleaving than the TLB build.
+ *
+ * When tracing, phase 1 also runs one hart at a time, in the order of
+ * phase 2, and trace_dev.c holds back the output of an instruction until
+ * it completes (trace_commit); the trace is the same for any
+ * cfg->threads.
+ *
+ * As with rv_run_harts, once harts[0] stops the other harts are stopped
+ * at the end of the round and report RV_EXIT_STOP.
+ */
+#define SCHED_PAGES (1u << (32 - PAGE_SHIFT))
+#define SCHED_HARTS_MAX 0xFFFF // Hart index + 1 fits the owner of a page
+
+enum { SCHED_IDLE, SCHED_RUN, SCHED_PARKED, SCHED_DONE };
+
+// Page flags of the round being merged
+#define SCHED_WRITTEN 1
+#define SCHED_SHARED  2
+
+typedef struct {
+    uint32_t round;  // Round + 1 of the last touch
+    uint16_t owner;  // Hart index + 1, 0 for a shared page
+    uint16_t first;  // First hart that touched it in that round
+    uint8_t  flags;  // SCHED_*
+} sched_page_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;     // A hart parked or finished its quantum
+    uint32_t        quantum;
+    uint32_t        running;  // Harts in phase 1
+    int             exit;     // Hart threads return
+    sched_page_t   *pages;
+    uint32_t       *merged;   // Pages touched in the round
+    uint32_t        nmerged;
+    uint32_t        merged_cap;
+} sched_t;
+
+struct sched_hart {
+    sched_t       *s;
+    rv_machine_t  *rv;
+    uint32_t       index;
+    pthread_t      thread;
+    pthread_cond_t wake;
+    int            go;       // Start or resume, under s->lock
+    int            state;    // SCHED_*, under s->lock
+    int            checked;  // Accesses are checked against page states (phase 1)
+    int            active;   // Runs in the next round
+    uint64_t       left;     // Budget left
+    uint64_t       instret;
+    rv_exit_t      exit;     // Of the last rv_run
+    uint32_t      *touched;  // page << 1 | write, for each translation in the round
+    uint32_t       ntouched;
+    uint32_t       touched_cap;
+};
+
+static void sched_oom(void) {
+    fprintf(stderr, "Error: Out of memory for the scheduler\n");
+    exit(1);
+}
+
+static void sched_push(uint32_t **v, uint32_t *n, uint32_t *cap, uint32_t x) {
+    if (*n == *cap) {
+        *cap = *cap != 0 ? *cap * 2 : 256;
+        *v = realloc(*v, *cap * sizeof(uint32_t));
+        if (*v == NULL)
+            sched_oom();
+    }
+    (*v)[(*n)++] = x;
+}
+
+// Called with s->lock held
+static void sched_go(sched_hart_t *h) {
+    h->state = SCHED_RUN;
+    h->go = 1;
+    pthread_cond_signal(&h->wake);
+}
+
+// Park the hart until phase 2 gives it its turn
+static void sched_park(sched_hart_t *h) {
+    sched_t *s = h->s;
+    pthread_mutex_lock(&s->lock);
+    h->checked = 0;
+    h->state = SCHED_PARKED;
+    s->running--;
+    pthread_cond_signal(&s->cond);
+    while (!h->go)
+        pthread_cond_wait(&h->wake, &s->lock);
+    h->go = 0;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void sched_access(rv_machine_t *rv, uint32_t page, int write) {
+    sched_hart_t *h = rv->sched;
+    if (h->checked) {
+        uint32_t owner = h->s->pages[page].owner;
+        if (owner != h->index + 1 && (write || owner != 0))
+            sched_park(h);
+    }
+    sched_push(&h->touched, &h->ntouched, &h->touched_cap, page << 1 | (write != 0));
+}
+
+static void *sched_hart_run(void *arg) {
+    sched_hart_t *h = arg;
+    sched_t *s = h->s;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (!h->go)
+            pthread_cond_wait(&h->wake, &s->lock);
+        h->go = 0;
+        if (s->exit)
+            break;
+        pthread_mutex_unlock(&s->lock);
+
+        rv_exit_t e = rv_run(h->rv, h->left < s->quantum ? h->left : s->quantum);
+        h->instret += e.instret;
+        h->left -= e.instret;
+        h->exit = e;
+        if (e.reason != RV_EXIT_BUDGET || h->left == 0)
+            h->active = 0;
+
+        pthread_mutex_lock(&s->lock);
+        if (h->checked) {
+            h->checked = 0;
+            s->running--;
+        }
+        h->state = SCHED_DONE;
+        pthread_cond_signal(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// splitmix64
+static uint64_t sched_next(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static void sched_shuffle(uint32_t *order, uint32_t n, uint64_t seed, uint64_t round) {
+    uint64_t x = seed ^ (round * 0xD1B54A32D192ED03ull);
+    for (uint32_t i = n; i > 1; i--) {
+        uint32_t j = sched_next(&x) % i;
+        uint32_t t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = t;
+    }
+}
+
+// New page states from the pages each hart touched, in hart order
+static void sched_merge(sched_t *s, sched_hart_t *h, uint32_t n, uint64_t round) {
+    uint32_t stamp = (uint32_t) round + 1;
+    s->nmerged = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t k = 0; k < h[i].ntouched; k++) {
+            sched_page_t *p = &s->pages[h[i].touched[k] >> 1];
+            int write = h[i].touched[k] & 1;
+            if (p->round != stamp) {
+                p->round = stamp;
+                p->first = i;
+                p->flags = write ? SCHED_WRITTEN : 0;
+                sched_push(&s->merged, &s->nmerged, &s->merged_cap, h[i].touched[k] >> 1);
+                continue;
+            }
+            if (p->first != i)
+                p->flags |= SCHED_SHARED;
+            if (write)
+                p->flags |= SCHED_WRITTEN;
+        }
+        h[i].ntouched = 0;
+    }
+    for (uint32_t k = 0; k < s->nmerged; k++) {
+        sched_page_t *p = &s->pages[s->merged[k]];
+        p->owner = p->flags == SCHED_WRITTEN ? p->first + 1 : 0;
+    }
+}
+
+int rv_run_harts_det(rv_machine_t **harts, uint32_t n, uint64_t budget,
+                     const rv_sched_cfg_t *cfg, rv_exit_t *exits) {
+    if (n > SCHED_HARTS_MAX || cfg->quantum == 0) {
+        fprintf(stderr, "Error: The scheduler takes up to %u harts and a quantum of at least 1\n",
+                SCHED_HARTS_MAX);
+        return -1;
+    }
+    sched_t s;
+    memset(&s, 0, sizeof(s));
+    s.quantum = cfg->quantum;
+    s.pages = calloc(SCHED_PAGES, sizeof(sched_page_t));
+    sched_hart_t *h = calloc(n, sizeof(sched_hart_t));
+    uint32_t *order = calloc(n, sizeof(uint32_t));
+    if (s.pages == NULL || h == NULL || order == NULL) {
+        fprintf(stderr, "Error: Out of memory for the scheduler\n");
+        free(s.pages);
+        free(h);
+        free(order);
+        return -1;
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+
+    int tracing = trace_level != TRACE_OFF || trace_bin_enabled;
+#ifdef MEM_GUARD
+    int parallel = 0;
+#else
+    int parallel = 1;
+#endif
+    uint32_t threads = tracing || cfg->threads == 0 ? 1 : cfg->threads;
+    if (tracing)
+        trace_harts_begin(harts, n);
+
+    // Every hart runs on a thread of its own, also when threads is 1, so
+    // that a parked hart keeps its place in the middle of an instruction
+    int ret = 0;
+    uint32_t started;
+    for (started = 0; started < n; started++) {
+        h[started].s      = &s;
+        h[started].rv     = harts[started];
+        h[started].index  = started;
+        h[started].left   = budget;
+        h[started].active = budget > 0;
+        h[started].exit   = (rv_exit_t) { .reason = RV_EXIT_BUDGET, .pc = harts[started]->pc };
+        pthread_cond_init(&h[started].wake, NULL);
+        harts[started]->sched = &h[started];
+        if (pthread_create(&h[started].thread, NULL, sched_hart_run, &h[started]) != 0) {
+            fprintf(stderr, "Error: Cannot start the thread of hart %u\n", harts[started]->hartid);
+            pthread_cond_destroy(&h[started].wake);
+            ret = -1;
+            break;
+        }
+    }
+
+    for (uint64_t round = 0; ret == 0 && h[0].active; round++) {
+        uint32_t m = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (!h[i].active)
+                continue;
+            order[m++] = i;
+            h[i].state = SCHED_IDLE;
+            h[i].checked = parallel;
+#ifndef MEM_GUARD
+            mem_tlb_flush(harts[i]);
+#endif
+        }
+        sched_shuffle(order, m, cfg->seed, round);
+
+        pthread_mutex_lock(&s.lock);
+        if (parallel) {
+            uint32_t next = 0;
+            s.running = 0;
+            while (next < m || s.running > 0) {
+                if (next < m && s.running < threads) {
+                    sched_go(&h[order[next++]]);
+                    s.running++;
+                    continue;
+                }
+                pthread_cond_wait(&s.cond, &s.lock);
+            }
+        }
+        for (uint32_t k = 0; k < m; k++) {
+            sched_hart_t *t = &h[order[k]];
+            if (t->state == SCHED_DONE)
+                continue;
+            sched_go(t);
+            while (t->state != SCHED_DONE)
+                pthread_cond_wait(&s.cond, &s.lock);
+        }
+        pthread_mutex_unlock(&s.lock);
+
+        sched_merge(&s, h, n, round);
+    }
+
+    pthread_mutex_lock(&s.lock);
+    s.exit = 1;
+    for (uint32_t i = 0; i < started; i++)
+        sched_go(&h[i]);
+    pthread_mutex_unlock(&s.lock);
+    for (uint32_t i = 0; i < n; i++) {
+        if (i < started) {
+            pthread_join(h[i].thread, NULL);
+            pthread_cond_destroy(&h[i].wake);
+        }
+        harts[i]->sched = NULL;
+        exits[i] = h[i].exit;
+        exits[i].instret = h[i].instret;
+        if (i != 0 && (h[i].active || i >= started))
+            exits[i].reason = RV_EXIT_STOP;
+        free(h[i].touched);
+    }
+    if (tracing)
+        trace_harts_end();
+
+    pthread_mutex_destroy(&s.lock);
+    pthread_cond_destroy(&s.cond);
+    free(s.pages);
+    free(s.merged);
+    free(h);
+    free(order);
+    return ret;
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * sched_test : checks that rv_run_harts_det does not depend on the threads
+ *
+ * n harts run a program whose results depend on how they interleave.
+ * TEST_ITERS times, each hart :
+ *
+ *     adds 1 to a shared counter with LW, ADDI and SW, a racy update
+ *     appends its mhartid to a shared log at an index from AMOADD.W
+ *     adds the loop count into a word of a page of its own
+ *
+ * The run is repeated on every engine and for several seeds, with one
+ * host thread and with threads host threads. The exits, x registers and
+ * instructions retired of each hart, and the shared and private pages,
+ * must be the same in both runs. Exits nonzero if they are not.
+ *
+ * Build: gcc -O2 -o sched_test sched_test.c $(ls *_dev.c | grep -v '^rv_dev.c$') -lpthread
+ * Usage: sched_test [harts [threads]]
+ */
+
+#define TEST_SHARED  0x10000 // Counter, log index, harts done, log at 0x100
+#define TEST_PRIVATE 0x20000 // One page per hart
+#define TEST_ITERS   500
+#define TEST_QUANTUM 64
+#define TEST_HARTS_MAX 16
+
+static const char *const engines[] = { "interp", "threaded", "block", "jit" };
+static int fails;
+
+static uint32_t code[48];
+static uint32_t len;
+
+typedef struct {
+    rv_exit_t exits[TEST_HARTS_MAX];
+    uint32_t  xreg[TEST_HARTS_MAX][32];
+    uint64_t  instret[TEST_HARTS_MAX];
+    uint8_t   shared[MEM_PAGE_SIZE];
+    uint8_t   priv[TEST_HARTS_MAX][MEM_PAGE_SIZE];
+} result_t;
+
+static uint32_t r_type(uint32_t f7, uint32_t rs2, uint32_t rs1, uint32_t f3, uint32_t rd, uint32_t op) {
+    return (f7 << 25) | (rs2 << 20) | (rs1 << 15) | (f3 << 12) | (rd << 7) | op;
+}
+
+static uint32_t s_type(int32_t imm, uint32_t rs2, uint32_t rs1) {
+    uint32_t u = (uint32_t) imm;
+    return ((u >> 5) << 25) | (rs2 << 20) | (rs1 << 15) | (0x2 << 12) | ((u & 0x1F) << 7) | 0x23;
+}
+
+static uint32_t b_type(int32_t off, uint32_t rs2, uint32_t rs1, uint32_t f3) {
+    uint32_t u = (uint32_t) off;
+    return (((u >> 12) & 1) << 31) | (((u >> 5) & 0x3F) << 25) | (rs2 << 20) | (rs1 << 15) |
+           (f3 << 12) | (((u >> 1) & 0xF) << 8) | (((u >> 11) & 1) << 7) | 0x63;
+}
+
+#define ADD(rd, a, b)     r_type(0x00, b, a, 0x0, rd, 0x33)
+#define AMOADD(rd, b, a)  r_type(0x00, b, a, 0x2, rd, 0x2F)
+#define ADDI(rd, a, i)    (((uint32_t) (i) << 20) | ((a) << 15) | ((rd) << 7) | 0x13)
+#define ANDI(rd, a, i)    (((uint32_t) (i) << 20) | ((a) << 15) | (0x7 << 12) | ((rd) << 7) | 0x13)
+#define SLLI(rd, a, i)    (((uint32_t) (i) << 20) | ((a) << 15) | (0x1 << 12) | ((rd) << 7) | 0x13)
+#define LW(rd, a, i)      (((uint32_t) (i) << 20) | ((a) << 15) | (0x2 << 12) | ((rd) << 7) | 0x03)
+#define SW(b, a, i)       s_type(i, b, a)
+#define LUI(rd, i)        (((uint32_t) (i) << 12) | ((rd) << 7) | 0x37)
+#define CSRR(rd, csr)     (((uint32_t) (csr) << 20) | (0x2 << 12) | ((rd) << 7) | 0x73)
+#define BNE(a, b, off)    b_type(off, b, a, 0x1)
+#define BLT(a, b, off)    b_type(off, b, a, 0x4)
+#define ECALL             0x00000073
+
+static uint32_t emit(uint32_t instr) {
+    code[len] = instr;
+    return 4 * len++;
+}
+
+static int32_t back(uint32_t target) {
+    return (int32_t) target - (int32_t) (4 * len);
+}
+
+// x15 holds the number of harts, set on each hart before the run
+static void build(void) {
+    emit(LUI(7, TEST_SHARED >> 12));
+    emit(CSRR(13, 0xF14));                 // mhartid
+    emit(SLLI(16, 13, 12));
+    emit(LUI(17, TEST_PRIVATE >> 12));
+    emit(ADD(16, 16, 17));                 // x16 = the hart's page
+    emit(ADDI(5, 0, 0));
+    emit(ADDI(6, 0, TEST_ITERS));
+    emit(ADDI(8, 0, 1));
+    emit(ADDI(9, 7, 4));
+    uint32_t top = emit(LW(10, 7, 0));
+    emit(ADDI(10, 10, 1));
+    emit(SW(10, 7, 0));
+    emit(AMOADD(11, 8, 9));
+    emit(ANDI(11, 11, 0xFF));
+    emit(SLLI(11, 11, 2));
+    emit(ADD(11, 11, 7));
+    emit(SW(13, 11, 0x100));
+    emit(LW(12, 16, 0));
+    emit(ADD(12, 12, 5));
+    emit(SW(12, 16, 0));
+    emit(ADDI(5, 5, 1));
+    emit(BLT(5, 6, back(top)));
+    emit(ADDI(12, 7, 8));
+    emit(AMOADD(0, 8, 12));
+    emit(BNE(13, 0, 12));                  // Secondary harts go to the ECALL
+    uint32_t wait = emit(LW(14, 7, 8));
+    emit(BLT(14, 15, back(wait)));
+    emit(ECALL);
+}
+
+static void run(int engine, uint32_t n, uint64_t seed, uint32_t threads, result_t *res) {
+    rv_machine_t *harts[TEST_HARTS_MAX];
+    rv_sched_cfg_t cfg = { .seed = seed, .quantum = TEST_QUANTUM, .threads = threads };
+
+    harts[0] = rv_create(engine);
+    if (harts[0] == NULL) {
+        fprintf(stderr, "Error: Out of memory for the machine\n");
+        exit(1);
+    }
+    mem_map_ram(harts[0], 0, TEST_PRIVATE + TEST_HARTS_MAX * MEM_PAGE_SIZE);
+    rv_write_mem(harts[0], 0, code, 4 * len);
+    rv_set_pc(harts[0], 0);
+    for (uint32_t i = 1; i < n; i++) {
+        harts[i] = rv_create_hart(harts[0], i);
+        if (harts[i] == NULL) {
+            fprintf(stderr, "Error: Out of memory for hart %u\n", i);
+            exit(1);
+        }
+    }
+    for (uint32_t i = 0; i < n; i++)
+        rv_set_reg(harts[i], 15, n);
+
+    memset(res, 0, sizeof(*res));
+    if (rv_run_harts_det(harts, n, UINT64_MAX, &cfg, res->exits) != 0)
+        exit(1);
+
+    rv_read_mem(harts[0], TEST_SHARED, res->shared, MEM_PAGE_SIZE);
+    for (uint32_t i = 0; i < n; i++) {
+        for (uint32_t r = 0; r < 32; r++)
+            res->xreg[i][r] = rv_get_reg(harts[i], r);
+        res->instret[i] = harts[i]->instret;
+        rv_read_mem(harts[0], TEST_PRIVATE + i * MEM_PAGE_SIZE, res->priv[i], MEM_PAGE_SIZE);
+    }
+    for (uint32_t i = n; i-- > 0; )
+        rv_destroy(harts[i]);
+}
+
+static void check(int engine, uint32_t n, uint64_t seed, uint32_t threads) {
+    static result_t one, many;
+    const char *name = engines[engine];
+
+    run(engine, n, seed, 1, &one);
+    run(engine, n, seed, threads, &many);
+    if (one.exits[0].reason != RV_EXIT_ECALL) {
+        printf("FAIL %-8s seed %llu : hart 0 stopped with reason %d\n",
+               name, (unsigned long long) seed, one.exits[0].reason);
+        fails++;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const rv_exit_t *a = &one.exits[i], *b = &many.exits[i];
+        if (a->reason != b->reason || a->pc != b->pc || a->value != b->value ||
+            a->instret != b->instret) {
+            printf("FAIL %-8s seed %llu : hart %u exits %d at %08x and %d at %08x\n",
+                   name, (unsigned long long) seed, i, a->reason, a->pc, b->reason, b->pc);
+            fails++;
+        }
+        if (one.instret[i] != many.instret[i]) {
+            printf("FAIL %-8s seed %llu : hart %u retired %llu and %llu\n",
+                   name, (unsigned long long) seed, i, (unsigned long long) one.instret[i],
+                   (unsigned long long) many.instret[i]);
+            fails++;
+        }
+        for (uint32_t r = 0; r < 32; r++) {
+            if (one.xreg[i][r] != many.xreg[i][r]) {
+                printf("FAIL %-8s seed %llu : hart %u x%u = %08x and %08x\n",
+                       name, (unsigned long long) seed, i, r, one.xreg[i][r], many.xreg[i][r]);
+                fails++;
+            }
+        }
+        if (memcmp(one.priv[i], many.priv[i], MEM_PAGE_SIZE) != 0) {
+            printf("FAIL %-8s seed %llu : page of hart %u differs\n",
+                   name, (unsigned long long) seed, i);
+            fails++;
+        }
+    }
+    if (memcmp(one.shared, many.shared, MEM_PAGE_SIZE) != 0) {
+        printf("FAIL %-8s seed %llu : shared page differs\n", name, (unsigned long long) seed);
+        fails++;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 4;
+    uint32_t threads = argc > 2 ? strtoul(argv[2], NULL, 0) : n;
+    if (n < 1 || n > TEST_HARTS_MAX || threads < 1) {
+        fprintf(stderr, "Error: From 1 to %d harts, and at least 1 thread\n", TEST_HARTS_MAX);
+        return 1;
+    }
+
+    static const uint64_t seeds[] = { 1, 2, 0x9E3779B97F4A7C15ull };
+    build();
+    for (int e = RV_ENGINE_INTERP; e <= RV_ENGINE_JIT; e++)
+        for (uint32_t k = 0; k < sizeof(seeds) / sizeof(seeds[0]); k++)
+            check(e, n, seeds[k], threads);
+
+    printf("%u harts, 1 and %u threads : %s\n", n, threads, fails ? "FAIL" : "ok");
+    return fails != 0;
+}
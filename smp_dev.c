@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rv32.h"
+
+/*
+ * Multi-hart runner
+ *
+ * harts[0], the boot hart, runs on the calling thread and every other
+ * hart on a thread of its own, all at full speed : guest memory is
+ * shared and only the A extension, FENCE and FENCE.I order what the
+ * harts see of each other. The interleaving is whatever the host
+ * scheduler makes of it, so runs that race are not reproducible;
+ * rv_run_harts_det (sched_dev.c) is the reproducible alternative.
+ *
+ * Harts run in slices of RV_SMP_SLICE instructions and check between
+ * slices whether the boot hart has stopped. Secondary harts usually park
+ * in a loop once their work is done, so without this the run would only
+ * end when their budgets did.
+ */
+typedef struct {
+    rv_machine_t *rv;
+    uint64_t      budget;
+    rv_exit_t    *exit;
+    int           boot;   // harts[0], which ends the run
+    int          *stop;   // Set once the boot hart has stopped
+} smp_hart_t;
+
+static void *smp_run(void *arg) {
+    smp_hart_t *h = arg;
+    uint64_t left = h->budget;
+    rv_exit_t e = { .reason = RV_EXIT_BUDGET, .pc = h->rv->pc };
+    uint64_t instret = 0;
+    while (left > 0) {
+        if (!h->boot && __atomic_load_n(h->stop, __ATOMIC_ACQUIRE)) {
+            e.reason = RV_EXIT_STOP;
+            break;
+        }
+        e = rv_run(h->rv, left < RV_SMP_SLICE ? left : RV_SMP_SLICE);
+        instret += e.instret;
+        left -= e.instret;
+        if (e.reason != RV_EXIT_BUDGET)
+            break;
+    }
+    e.pc = h->rv->pc;
+    e.instret = instret;
+    *h->exit = e;
+    if (h->boot)
+        __atomic_store_n(h->stop, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int rv_run_harts(rv_machine_t **harts, uint32_t n, uint64_t budget, rv_exit_t *exits) {
+    smp_hart_t *h = calloc(n, sizeof(smp_hart_t));
+    pthread_t *threads = calloc(n, sizeof(pthread_t));
+    int stop = 0, ret = 0;
+    if (h == NULL || threads == NULL) {
+        fprintf(stderr, "Error: Out of memory for the harts\n");
+        free(h);
+        free(threads);
+        return -1;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        h[i].rv     = harts[i];
+        h[i].budget = budget;
+        h[i].exit   = &exits[i];
+        h[i].boot   = i == 0;
+        h[i].stop   = &stop;
+    }
+
+    // A hart whose thread cannot start reports RV_EXIT_STOP without running
+    uint32_t started;
+    for (started = 1; started < n; started++) {
+        if (pthread_create(&threads[started], NULL, smp_run, &h[started]) != 0) {
+            fprintf(stderr, "Error: Cannot start the thread of hart %u\n", harts[started]->hartid);
+            ret = -1;
+            break;
+        }
+    }
+    for (uint32_t i = started; i < n; i++)
+        exits[i] = (rv_exit_t) { .reason = RV_EXIT_STOP, .pc = harts[i]->pc };
+
+    smp_run(&h[0]);
+    for (uint32_t i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(h);
+    free(threads);
+    return ret;
+}
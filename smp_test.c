@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * smp_test : checks the A extension across harts on host threads
+ *
+ * rv_run_harts runs n harts of one guest, each adding 1 to two shared
+ * counters TEST_ITERS times :
+ *
+ *     amo  : with AMOADD.W
+ *     lrsc : with an LR.W / SC.W retry loop
+ *
+ * Each hart then adds 1 to a third counter with AMOADD.W and ECALLs; the
+ * boot hart first waits for that counter to reach n. Both counters must
+ * end at n * TEST_ITERS, on every engine. Exits nonzero if one does not.
+ *
+ * Build: gcc -O2 -o smp_test smp_test.c $(ls *_dev.c | grep -v '^rv_dev.c$') -lpthread
+ * Usage: smp_test [harts]
+ */
+
+#define TEST_DATA  0x10000 // amo counter, lrsc counter, harts done
+#define TEST_ITERS 2000
+#define TEST_HARTS_MAX 64
+
+static const char *const engines[] = { "interp", "threaded", "block", "jit" };
+static int fails;
+
+static uint32_t code[32];
+static uint32_t len;
+
+static uint32_t amo(uint32_t funct5, uint32_t rs2, uint32_t rs1, uint32_t rd) {
+    return (funct5 << 27) | (rs2 << 20) | (rs1 << 15) | (0x2 << 12) | (rd << 7) | 0x2F;
+}
+
+static uint32_t b_type(int32_t off, uint32_t rs2, uint32_t rs1, uint32_t f3) {
+    uint32_t u = (uint32_t) off;
+    return (((u >> 12) & 1) << 31) | (((u >> 5) & 0x3F) << 25) | (rs2 << 20) | (rs1 << 15) |
+           (f3 << 12) | (((u >> 1) & 0xF) << 8) | (((u >> 11) & 1) << 7) | 0x63;
+}
+
+#define ADDI(rd, a, i)    (((uint32_t) (i) << 20) | ((a) << 15) | ((rd) << 7) | 0x13)
+#define LW(rd, a, i)      (((uint32_t) (i) << 20) | ((a) << 15) | (0x2 << 12) | ((rd) << 7) | 0x03)
+#define LUI(rd, i)        (((uint32_t) (i) << 12) | ((rd) << 7) | 0x37)
+#define CSRR(rd, csr)     (((uint32_t) (csr) << 20) | (0x2 << 12) | ((rd) << 7) | 0x73)
+#define AMOADD(rd, b, a)  amo(0x00, b, a, rd)
+#define LR(rd, a)         amo(0x02, 0, a, rd)
+#define SC(rd, b, a)      amo(0x03, b, a, rd)
+#define BNE(a, b, off)    b_type(off, b, a, 0x1)
+#define BLT(a, b, off)    b_type(off, b, a, 0x4)
+#define ECALL             0x00000073
+
+static uint32_t emit(uint32_t instr) {
+    code[len] = instr;
+    return 4 * len++;
+}
+
+static int32_t back(uint32_t target) {
+    return (int32_t) target - (int32_t) (4 * len);
+}
+
+// x15 holds the number of harts, set on each hart before the run
+static void build(void) {
+    emit(LUI(7, TEST_DATA >> 12));
+    emit(ADDI(5, 0, 0));
+    emit(ADDI(6, 0, TEST_ITERS));
+    emit(ADDI(8, 0, 1));
+    emit(ADDI(9, 7, 4));
+    uint32_t top = emit(AMOADD(0, 8, 7));
+    uint32_t retry = emit(LR(10, 9));
+    emit(ADDI(10, 10, 1));
+    emit(SC(11, 10, 9));
+    emit(BNE(11, 0, back(retry)));
+    emit(ADDI(5, 5, 1));
+    emit(BLT(5, 6, back(top)));
+    emit(ADDI(12, 7, 8));
+    emit(AMOADD(0, 8, 12));
+    emit(CSRR(13, 0xF14));                 // mhartid
+    emit(BNE(13, 0, 12));                  // Secondary harts go to the ECALL
+    uint32_t wait = emit(LW(14, 7, 8));
+    emit(BLT(14, 15, back(wait)));
+    emit(ECALL);
+}
+
+static void check(int engine, uint32_t n) {
+    rv_machine_t *harts[TEST_HARTS_MAX];
+    rv_exit_t exits[TEST_HARTS_MAX];
+
+    harts[0] = rv_create(engine);
+    if (harts[0] == NULL) {
+        fprintf(stderr, "Error: Out of memory for the machine\n");
+        exit(1);
+    }
+    mem_map_ram(harts[0], 0, TEST_DATA + 0x1000);
+    rv_write_mem(harts[0], 0, code, 4 * len);
+    rv_set_pc(harts[0], 0);
+    for (uint32_t i = 1; i < n; i++) {
+        harts[i] = rv_create_hart(harts[0], i);
+        if (harts[i] == NULL) {
+            fprintf(stderr, "Error: Out of memory for hart %u\n", i);
+            exit(1);
+        }
+    }
+    for (uint32_t i = 0; i < n; i++)
+        rv_set_reg(harts[i], 15, n);
+
+    if (rv_run_harts(harts, n, UINT64_MAX, exits) != 0)
+        exit(1);
+
+    uint32_t count[3];
+    rv_read_mem(harts[0], TEST_DATA, count, sizeof(count));
+    for (uint32_t i = 0; i < n; i++) {
+        if (exits[i].reason != RV_EXIT_ECALL) {
+            printf("FAIL %-8s hart %u stopped with reason %d\n", engines[engine], i, exits[i].reason);
+            fails++;
+        }
+    }
+    if (count[0] != n * TEST_ITERS) {
+        printf("FAIL %-8s amo  = %u, expected %u\n", engines[engine], count[0], n * TEST_ITERS);
+        fails++;
+    }
+    if (count[1] != n * TEST_ITERS) {
+        printf("FAIL %-8s lrsc = %u, expected %u\n", engines[engine], count[1], n * TEST_ITERS);
+        fails++;
+    }
+    for (uint32_t i = n; i-- > 0; )
+        rv_destroy(harts[i]);
+}
+
+int main(int argc, char **argv) {
+    uint32_t n = argc > 1 ? strtoul(argv[1], NULL, 0) : 4;
+    if (n < 1 || n > TEST_HARTS_MAX) {
+        fprintf(stderr, "Error: From 1 to %d harts\n", TEST_HARTS_MAX);
+        return 1;
+    }
+
+    build();
+    for (int e = RV_ENGINE_INTERP; e <= RV_ENGINE_JIT; e++)
+        check(e, n);
+
+    printf("%u harts : %s\n", n, fails ? "FAIL" : "ok");
+    return fails != 0;
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>  // For INT32_MIN
+
+#include "rv32.h"
+
+/*
+ * Direct-threaded execution engine
+ *
+ * Each instruction is a label inside run_threaded. The label address is
+ * stored in the predecoded record (rv_insn_t.label) when the record is
+ * filled, and every label ends with its own copy of NEXT, so the host
+ * branch predictor sees one indirect jump per instruction kind instead
+ * of a single shared one.
+ *
+ * Architectural results are identical to the handler-based loop in
+ * machine_dev.c. The engine does not emit per-instruction debug output.
+ * Vector, atomic, CSR and fence instructions, ECALL and unknown
+ * encodings go through the ordinary handlers.
+ */
+
+#ifdef __GNUC__
+
+uint64_t run_threaded(rv_machine_t *rv, uint64_t max_cycle) {
+    static const void *const labels[INSTR_COUNT] = {
+        [INSTR_LUI]     = &&op_lui,
+        [INSTR_AUIPC]   = &&op_auipc,
+        [INSTR_JAL]     = &&op_jal,
+        [INSTR_JALR]    = &&op_jalr,
+        [INSTR_BEQ]     = &&op_beq,
+        [INSTR_BNE]     = &&op_bne,
+        [INSTR_BLT]     = &&op_blt,
+        [INSTR_BGE]     = &&op_bge,
+        [INSTR_BLTU]    = &&op_bltu,
+        [INSTR_BGEU]    = &&op_bgeu,
+        [INSTR_LB]      = &&op_lb,
+        [INSTR_LH]      = &&op_lh,
+        [INSTR_LW]      = &&op_lw,
+        [INSTR_LBU]     = &&op_lbu,
+        [INSTR_LHU]     = &&op_lhu,
+        [INSTR_SB]      = &&op_sb,
+        [INSTR_SH]      = &&op_sh,
+        [INSTR_SW]      = &&op_sw,
+        [INSTR_ADDI]    = &&op_addi,
+        [INSTR_SLTI]    = &&op_slti,
+        [INSTR_SLTIU]   = &&op_sltiu,
+        [INSTR_XORI]    = &&op_xori,
+        [INSTR_ORI]     = &&op_ori,
+        [INSTR_ANDI]    = &&op_andi,
+        [INSTR_SLLI]    = &&op_slli,
+        [INSTR_SRLI]    = &&op_srli,
+        [INSTR_SRAI]    = &&op_srai,
+        [INSTR_ADD]     = &&op_add,
+        [INSTR_SUB]     = &&op_sub,
+        [INSTR_SLL]     = &&op_sll,
+        [INSTR_SLT]     = &&op_slt,
+        [INSTR_SLTU]    = &&op_sltu,
+        [INSTR_XOR]     = &&op_xor,
+        [INSTR_SRL]     = &&op_srl,
+        [INSTR_SRA]     = &&op_sra,
+        [INSTR_OR]      = &&op_or,
+        [INSTR_AND]     = &&op_and,
+        [INSTR_ECALL]   = &&op_handler,
+        [INSTR_FENCE]   = &&op_handler,
+        [INSTR_FENCE_I] = &&op_handler,
+        [INSTR_CSRRW]   = &&op_handler,
+        [INSTR_CSRRS]   = &&op_handler,
+        [INSTR_CSRRC]   = &&op_handler,
+        [INSTR_CSRRWI]  = &&op_handler,
+        [INSTR_CSRRSI]  = &&op_handler,
+        [INSTR_CSRRCI]  = &&op_handler,
+        [INSTR_MUL]     = &&op_mul,
+        [INSTR_MULH]    = &&op_mulh,
+        [INSTR_MULHSU]  = &&op_mulhsu,
+        [INSTR_MULHU]   = &&op_mulhu,
+        [INSTR_DIV]     = &&op_div,
+        [INSTR_DIVU]    = &&op_divu,
+        [INSTR_REM]     = &&op_rem,
+        [INSTR_REMU]    = &&op_remu,
+        [INSTR_LR_W]      = &&op_handler,
+        [INSTR_SC_W]      = &&op_handler,
+        [INSTR_AMOSWAP_W] = &&op_handler,
+        [INSTR_AMOADD_W]  = &&op_handler,
+        [INSTR_AMOXOR_W]  = &&op_handler,
+        [INSTR_AMOAND_W]  = &&op_handler,
+        [INSTR_AMOOR_W]   = &&op_handler,
+        [INSTR_AMOMIN_W]  = &&op_handler,
+        [INSTR_AMOMAX_W]  = &&op_handler,
+        [INSTR_AMOMINU_W] = &&op_handler,
+        [INSTR_AMOMAXU_W] = &&op_handler,
+        [INSTR_RVV]     = &&op_handler,
+        [INSTR_UNKNOWN] = &&op_handler,
+    };
+
+    // Records decoded before the machine had the label table carry no label
+    if (rv->icache_labels == NULL) {
+        rv->icache_labels = labels;
+        icache_flush(rv);
+    }
+
+    uint64_t start = rv->instret;
+    uint64_t end = max_cycle < UINT64_MAX - start ? start + max_cycle : UINT64_MAX;
+    const rv_insn_t *d;
+
+    // x0 is written freely and cleared again before the next instruction
+#define NEXT() do {                           \
+        rv->xreg[0] = 0;                      \
+        if (++rv->instret >= end)             \
+            return rv->instret - start;       \
+        d = icache_lookup(rv, rv->pc);        \
+        goto *d->label;                       \
+    } while (0)
+
+#define RD   rv->xreg[d->rd]
+#define RS1  rv->xreg[d->rs1]
+#define RS2  rv->xreg[d->rs2]
+#define IMM  d->imm
+
+    if (max_cycle == 0)
+        return 0;
+    d = icache_lookup(rv, rv->pc);
+    goto *d->label;
+
+op_lui:    RD = IMM;           rv->pc += 4; NEXT();
+op_auipc:  RD = rv->pc + IMM;  rv->pc += 4; NEXT();
+op_jal:    RD = rv->pc + 4;    rv->pc += IMM; NEXT();
+op_jalr: {
+    uint32_t t = rv->pc + 4;
+    rv->pc = (RS1 + IMM) & 0xFFFFFFFE;
+    RD = t;
+    NEXT();
+}
+
+op_beq:  rv->pc += (RS1 == RS2) ? IMM : 4; NEXT();
+op_bne:  rv->pc += (RS1 != RS2) ? IMM : 4; NEXT();
+op_blt:  rv->pc += ((int32_t) RS1 <  (int32_t) RS2) ? IMM : 4; NEXT();
+op_bge:  rv->pc += ((int32_t) RS1 >= (int32_t) RS2) ? IMM : 4; NEXT();
+op_bltu: rv->pc += (RS1 <  RS2) ? IMM : 4; NEXT();
+op_bgeu: rv->pc += (RS1 >= RS2) ? IMM : 4; NEXT();
+
+op_lb: {
+    uint32_t addr = RS1 + IMM;
+    RD = (int32_t)(int8_t) mem_read8(rv, addr);
+    rv->pc += 4;
+    NEXT();
+}
+op_lh: {
+    uint32_t addr = RS1 + IMM;
+    RD = (int32_t)(int16_t) mem_read16(rv, addr);
+    rv->pc += 4;
+    NEXT();
+}
+op_lw: {
+    uint32_t addr = RS1 + IMM;
+    RD = mem_read32(rv, addr);
+    rv->pc += 4;
+    NEXT();
+}
+op_lbu: {
+    uint32_t addr = RS1 + IMM;
+    RD = mem_read8(rv, addr);
+    rv->pc += 4;
+    NEXT();
+}
+op_lhu: {
+    uint32_t addr = RS1 + IMM;
+    RD = mem_read16(rv, addr);
+    rv->pc += 4;
+    NEXT();
+}
+
+op_sb: {
+    uint32_t addr = RS1 + IMM;
+    mem_write8(rv, addr, RS2 & 0xFF);
+    icache_notify_store(rv, addr, 1);
+    rv->pc += 4;
+    NEXT();
+}
+op_sh: {
+    uint32_t addr = RS1 + IMM;
+    mem_write16(rv, addr, RS2 & 0xFFFF);
+    icache_notify_store(rv, addr, 2);
+    rv->pc += 4;
+    NEXT();
+}
+op_sw: {
+    uint32_t addr = RS1 + IMM;
+    mem_write32(rv, addr, RS2);
+    icache_notify_store(rv, addr, 4);
+    rv->pc += 4;
+    NEXT();
+}
+
+op_addi:  RD = RS1 + IMM;                          rv->pc += 4; NEXT();
+op_slti:  RD = ((int32_t) RS1 < IMM) ? 1 : 0;      rv->pc += 4; NEXT();
+op_sltiu: RD = (RS1 < (uint32_t) IMM) ? 1 : 0;     rv->pc += 4; NEXT();
+op_xori:  RD = RS1 ^ IMM;                          rv->pc += 4; NEXT();
+op_ori:   RD = RS1 | IMM;                          rv->pc += 4; NEXT();
+op_andi:  RD = RS1 & IMM;                          rv->pc += 4; NEXT();
+op_slli:  RD = RS1 << IMM;                         rv->pc += 4; NEXT();
+op_srli:  RD = RS1 >> IMM;                         rv->pc += 4; NEXT();
+op_srai:  RD = (int32_t) RS1 >> IMM;               rv->pc += 4; NEXT();
+
+op_add:   RD = RS1 + RS2;                          rv->pc += 4; NEXT();
+op_sub:   RD = RS1 - RS2;                          rv->pc += 4; NEXT();
+op_sll:   RD = RS1 << (RS2 & 0x1F);                rv->pc += 4; NEXT();
+op_slt:   RD = ((int32_t) RS1 < (int32_t) RS2) ? 1 : 0; rv->pc += 4; NEXT();
+op_sltu:  RD = (RS1 < RS2) ? 1 : 0;                rv->pc += 4; NEXT();
+op_xor:   RD = RS1 ^ RS2;                          rv->pc += 4; NEXT();
+op_srl:   RD = RS1 >> (RS2 & 0x1F);                rv->pc += 4; NEXT();
+op_sra:   RD = (int32_t) RS1 >> (RS2 & 0x1F);      rv->pc += 4; NEXT();
+op_or:    RD = RS1 | RS2;                          rv->pc += 4; NEXT();
+op_and:   RD = RS1 & RS2;                          rv->pc += 4; NEXT();
+
+op_mul:    RD = (uint32_t)((int64_t)(int32_t) RS1 * (int64_t)(int32_t) RS2); rv->pc += 4; NEXT();
+op_mulh:   RD = (uint32_t)((uint64_t)((int64_t)(int32_t) RS1 * (int64_t)(int32_t) RS2) >> 32); rv->pc += 4; NEXT();
+op_mulhsu: RD = (uint32_t)((uint64_t)((int64_t)(int32_t) RS1 * (uint64_t) RS2) >> 32); rv->pc += 4; NEXT();
+op_mulhu:  RD = (uint32_t)(((uint64_t) RS1 * (uint64_t) RS2) >> 32); rv->pc += 4; NEXT();
+op_div: {
+    int32_t dividend = (int32_t) RS1;
+    int32_t divisor  = (int32_t) RS2;
+    if (divisor == 0)
+        RD = (uint32_t) -1;
+    else if (dividend == INT32_MIN && divisor == -1)
+        RD = (uint32_t) INT32_MIN;
+    else
+        RD = (uint32_t)(dividend / divisor);
+    rv->pc += 4;
+    NEXT();
+}
+op_divu: {
+    uint32_t divisor = RS2;
+    RD = (divisor == 0) ? 0xFFFFFFFF : RS1 / divisor;
+    rv->pc += 4;
+    NEXT();
+}
+op_rem: {
+    int32_t dividend = (int32_t) RS1;
+    int32_t divisor  = (int32_t) RS2;
+    if (divisor == 0)
+        RD = (uint32_t) dividend;
+    else if (dividend == INT32_MIN && divisor == -1)
+        RD = 0;
+    else
+        RD = (uint32_t)(dividend % divisor);
+    rv->pc += 4;
+    NEXT();
+}
+op_remu: {
+    uint32_t divisor = RS2;
+    RD = (divisor == 0) ? RS1 : RS1 % divisor;
+    rv->pc += 4;
+    NEXT();
+}
+
+op_handler: {
+    int r = d->handler(rv, d);
+    if (r != 1) {
+        if (r != 0) {
+            rv->instret += (r == RV_HALT);
+            return rv->instret - start; // ECALL or breakpoint
+        }
+        rv->pc += 4; // Unknown instruction
+    }
+    NEXT();
+}
+
+#undef NEXT
+#undef RD
+#undef RS1
+#undef RS2
+#undef IMM
+}
+
+#else
+
+// Labels-as-values are a GNU extension; other compilers use the handler loop
+uint64_t run_threaded(rv_machine_t *rv, uint64_t max_cycle) {
+    return run_interp(rv, max_cycle);
+}
+
+#endif
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * Timing model
+ *
+ * An estimate of the cycles a simple in-order core would take, next to
+ * the instruction count. Every instruction belongs to a class with two
+ * costs :
+ *
+ *     latency    : cycles from issue until its result in x[rd] can be read
+ *     throughput : cycles from its issue until the next instruction issues
+ *
+ * An instruction issues once the previous one allows it and its sources
+ * are ready, so a load followed by a use stalls for the load latency
+ * while independent work overlaps it. Taken branches and jumps have their
+ * own class; the difference to a not-taken branch is the refill penalty.
+ * Vector instructions are costed by the SEW and LMUL they execute under.
+ *
+ * The model runs over the basic blocks of block_dev.c : a block is costed
+ * once when translated, for both exits of its final branch, and each
+ * execution adds one of the two. Results are tracked within a block; a
+ * block is entered with every register ready. Blocks with vector
+ * instructions are costed again when entered under a different vtype.
+ * Cycles and instructions are charged to the ELF symbol at or below the
+ * start of the block, for a CPI per function.
+ *
+ * Tables can be changed from a text file, one entry per line :
+ *
+ *     # class           latency throughput
+ *     load              3       1
+ *     div               34      34
+ *     vector e32 m2     4       2
+ *     vmem e8 mf2       3       1
+ *
+ * with classes alu, branch, branch_taken, jump, load, store, mul, div,
+ * vset, and vector and vmem (vector arithmetic and vector loads and
+ * stores) for each SEW (e8 ... e64) and LMUL (mf8 ... m8).
+ */
+enum {
+    TIME_ALU,
+    TIME_BRANCH,       // Not taken
+    TIME_BRANCH_TAKEN,
+    TIME_JUMP,
+    TIME_LOAD,
+    TIME_STORE,
+    TIME_MUL,
+    TIME_DIV,
+    TIME_VSET,
+    TIME_CLASSES
+};
+
+#define TIME_RS1 1 // Reads x[rs1]
+#define TIME_RS2 2 // Reads x[rs2]
+#define TIME_RD  4 // Writes x[rd]
+
+typedef struct {
+    uint32_t lat;
+    uint32_t thr;
+} timing_cost_t;
+
+int timing_enabled;
+
+static const char *const timing_names[TIME_CLASSES] = {
+    [TIME_ALU]          = "alu",
+    [TIME_BRANCH]       = "branch",
+    [TIME_BRANCH_TAKEN] = "branch_taken",
+    [TIME_JUMP]         = "jump",
+    [TIME_LOAD]         = "load",
+    [TIME_STORE]        = "store",
+    [TIME_MUL]          = "mul",
+    [TIME_DIV]          = "div",
+    [TIME_VSET]         = "vset",
+};
+
+static timing_cost_t timing_cost[TIME_CLASSES] = {
+    [TIME_ALU]          = { 1, 1 },
+    [TIME_BRANCH]       = { 1, 1 },
+    [TIME_BRANCH_TAKEN] = { 3, 3 },
+    [TIME_JUMP]         = { 2, 2 },
+    [TIME_LOAD]         = { 3, 1 },
+    [TIME_STORE]        = { 1, 1 },
+    [TIME_MUL]          = { 3, 1 },
+    [TIME_DIV]          = { 34, 34 },
+    [TIME_VSET]         = { 1, 1 },
+};
+
+// [vsew][vlmul], filled by timing_init
+static timing_cost_t timing_vector[4][8];
+static timing_cost_t timing_vmem[4][8];
+
+// Class and register use of each instruction
+static const struct {
+    uint8_t cls;
+    uint8_t regs;
+} timing_ops[INSTR_COUNT] = {
+    [INSTR_LUI]     = { TIME_ALU,    TIME_RD },
+    [INSTR_AUIPC]   = { TIME_ALU,    TIME_RD },
+    [INSTR_JAL]     = { TIME_JUMP,   TIME_RD },
+    [INSTR_JALR]    = { TIME_JUMP,   TIME_RS1 | TIME_RD },
+    [INSTR_BEQ]     = { TIME_BRANCH, TIME_RS1 | TIME_RS2 },
+    [INSTR_BNE]     = { TIME_BRANCH, TIME_RS1 | TIME_RS2 },
+    [INSTR_BLT]     = { TIME_BRANCH, TIME_RS1 | TIME_RS2 },
+    [INSTR_BGE]     = { TIME_BRANCH, TIME_RS1 | TIME_RS2 },
+    [INSTR_BLTU]    = { TIME_BRANCH, TIME_RS1 | TIME_RS2 },
+    [INSTR_BGEU]    = { TIME_BRANCH, TIME_RS1 | TIME_RS2 },
+    [INSTR_LB]      = { TIME_LOAD,   TIME_RS1 | TIME_RD },
+    [INSTR_LH]      = { TIME_LOAD,   TIME_RS1 | TIME_RD },
+    [INSTR_LW]      = { TIME_LOAD,   TIME_RS1 | TIME_RD },
+    [INSTR_LBU]     = { TIME_LOAD,   TIME_RS1 | TIME_RD },
+    [INSTR_LHU]     = { TIME_LOAD,   TIME_RS1 | TIME_RD },
+    [INSTR_SB]      = { TIME_STORE,  TIME_RS1 | TIME_RS2 },
+    [INSTR_SH]      = { TIME_STORE,  TIME_RS1 | TIME_RS2 },
+    [INSTR_SW]      = { TIME_STORE,  TIME_RS1 | TIME_RS2 },
+    [INSTR_ADDI]    = { TIME_ALU,    TIME_RS1 | TIME_RD },
+    [INSTR_SLTI]    = { TIME_ALU,    TIME_RS1 | TIME_RD },
+    [INSTR_SLTIU]   = { TIME_ALU,    TIME_RS1 | TIME_RD },
+    [INSTR_XORI]    = { TIME_ALU,    TIME_RS1 | TIME_RD },
+    [INSTR_ORI]     = { TIME_ALU,    TIME_RS1 | TIME_RD },
+    [INSTR_ANDI]    = { TIME_ALU,    TIME_RS1 | TIME_RD },
+    [INSTR_SLLI]    = { TIME_ALU,    TIME_RS1 | TIME_RD },
+    [INSTR_SRLI]    = { TIME_ALU,    TIME_RS1 | TIME_RD },
+    [INSTR_SRAI]    = { TIME_ALU,    TIME_RS1 | TIME_RD },
+    [INSTR_ADD]     = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_SUB]     = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_SLL]     = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_SLT]     = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_SLTU]    = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_XOR]     = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_SRL]     = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_SRA]     = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_OR]      = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AND]     = { TIME_ALU,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_ECALL]   = { TIME_ALU,    0 },
+    [INSTR_FENCE]   = { TIME_ALU,    0 },
+    [INSTR_FENCE_I] = { TIME_ALU,    0 },
+    [INSTR_CSRRW]   = { TIME_ALU,    TIME_RD },
+    [INSTR_CSRRS]   = { TIME_ALU,    TIME_RD },
+    [INSTR_CSRRC]   = { TIME_ALU,    TIME_RD },
+    [INSTR_CSRRWI]  = { TIME_ALU,    TIME_RD },
+    [INSTR_CSRRSI]  = { TIME_ALU,    TIME_RD },
+    [INSTR_CSRRCI]  = { TIME_ALU,    TIME_RD },
+    [INSTR_MUL]     = { TIME_MUL,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_MULH]    = { TIME_MUL,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_MULHSU]  = { TIME_MUL,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_MULHU]   = { TIME_MUL,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_DIV]     = { TIME_DIV,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_DIVU]    = { TIME_DIV,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_REM]     = { TIME_DIV,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_REMU]    = { TIME_DIV,    TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_LR_W]      = { TIME_LOAD,   TIME_RS1 | TIME_RD },
+    [INSTR_SC_W]      = { TIME_STORE,  TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AMOSWAP_W] = { TIME_LOAD,   TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AMOADD_W]  = { TIME_LOAD,   TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AMOXOR_W]  = { TIME_LOAD,   TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AMOAND_W]  = { TIME_LOAD,   TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AMOOR_W]   = { TIME_LOAD,   TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AMOMIN_W]  = { TIME_LOAD,   TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AMOMAX_W]  = { TIME_LOAD,   TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AMOMINU_W] = { TIME_LOAD,   TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_AMOMAXU_W] = { TIME_LOAD,   TIME_RS1 | TIME_RS2 | TIME_RD },
+    [INSTR_RVV]     = { TIME_VSET,   0 }, // See timing_rvv
+    [INSTR_UNKNOWN] = { TIME_ALU,    0 },
+};
+
+static uint64_t timing_cycles;
+static uint64_t timing_instret;
+
+// Counts per symbol, parallel to elf_syms, and for code below every symbol
+static timing_count_t *timing_fn;
+static timing_count_t  timing_fn_none;
+
+// Fill the vector tables : one register per cycle, so LMUL cycles per
+// instruction (one for fractional LMUL) plus two cycles of latency;
+// vector loads and stores take one more
+static void timing_init(void) {
+    for (uint32_t vsew = 0; vsew < 4; vsew++) {
+        for (uint32_t vlmul = 0; vlmul < 8; vlmul++) {
+            uint32_t regs = vlmul < 4 ? 1u << vlmul : 1;
+            timing_vector[vsew][vlmul] = (timing_cost_t) { regs + 2, regs };
+            timing_vmem[vsew][vlmul]   = (timing_cost_t) { regs + 3, regs + 1 };
+        }
+    }
+}
+
+// "e8" ... "e64" to vsew and "mf8" ... "m8" to vlmul, -1 if invalid
+static int timing_parse_sew(const char *s) {
+    for (int vsew = 0; vsew < 4; vsew++) {
+        char name[4];
+        snprintf(name, sizeof(name), "e%d", 8 << vsew);
+        if (strcmp(s, name) == 0)
+            return vsew;
+    }
+    return -1;
+}
+
+static int timing_parse_lmul(const char *s) {
+    static const char *const names[8] = { "m1", "m2", "m4", "m8", NULL, "mf8", "mf4", "mf2" };
+    for (int vlmul = 0; vlmul < 8; vlmul++) {
+        if (names[vlmul] != NULL && strcmp(s, names[vlmul]) == 0)
+            return vlmul;
+    }
+    return -1;
+}
+
+// Enable the model, with the built-in tables updated from path unless it
+// is NULL. Returns 0 on success, -1 on an unreadable or invalid file.
+int timing_load(const char *path) {
+    timing_init();
+    if (path != NULL) {
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL) {
+            fprintf(stderr, "Error: Cannot open timing table %s\n", path);
+            return -1;
+        }
+        char line[256];
+        int lineno = 0;
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            lineno++;
+            char *hash = strchr(line, '#');
+            if (hash != NULL)
+                *hash = '\0';
+
+            char cls[32], sew[8], lmul[8];
+            unsigned lat, thr;
+            timing_cost_t *c = NULL;
+            if (sscanf(line, " %31s", cls) != 1)
+                continue; // Blank or comment
+            if (strcmp(cls, "vector") == 0 || strcmp(cls, "vmem") == 0) {
+                int vsew = -1, vlmul = -1;
+                if (sscanf(line, " %*s %7s %7s %u %u", sew, lmul, &lat, &thr) == 4) {
+                    vsew = timing_parse_sew(sew);
+                    vlmul = timing_parse_lmul(lmul);
+                }
+                if (vsew >= 0 && vlmul >= 0)
+                    c = (strcmp(cls, "vector") == 0) ? &timing_vector[vsew][vlmul] : &timing_vmem[vsew][vlmul];
+            } else if (sscanf(line, " %*s %u %u", &lat, &thr) == 2) {
+                for (int k = 0; k < TIME_CLASSES; k++) {
+                    if (strcmp(cls, timing_names[k]) == 0)
+                        c = &timing_cost[k];
+                }
+            }
+            if (c == NULL || thr == 0) {
+                fprintf(stderr, "Error: %s:%d: Invalid timing entry\n", path, lineno);
+                fclose(fp);
+                return -1;
+            }
+            c->lat = lat;
+            c->thr = thr;
+        }
+        fclose(fp);
+    }
+    timing_enabled = 1;
+    return 0;
+}
+
+// Cost and register use of a vector instruction under vtype vt
+static const timing_cost_t *timing_rvv(uint32_t instr, uint32_t vt, uint8_t *regs) {
+    uint32_t opcode = instr & 0x7F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t funct6 = instr >> 26;
+    uint32_t vsew = (vt >> 3) & 0x3;
+    uint32_t vlmul = vt & 0x7;
+
+    if (opcode != 0x57) {                     // Loads and stores : base in x[rs1]
+        *regs = TIME_RS1;
+        return &timing_vmem[vsew][vlmul];
+    }
+    if (funct3 == 0x7) {
+        if ((instr >> 31) == 0)               // vsetvli
+            *regs = TIME_RS1 | TIME_RD;
+        else if (((instr >> 30) & 0x3) == 0x3) // vsetivli
+            *regs = TIME_RD;
+        else                                  // vsetvl
+            *regs = TIME_RS1 | TIME_RS2 | TIME_RD;
+        return &timing_cost[TIME_VSET];
+    }
+    *regs = (funct3 >= 0x4) ? TIME_RS1 : 0;   // .vx forms read x[rs1]
+    if (funct3 == 0x2 && funct6 == 0x10)
+        *regs = TIME_RD;                      // vcpop and vfirst write x[rd]
+    return &timing_vector[vsew][vlmul];
+}
+
+// vtype after instr, from vtype vt. vsetvl takes its vtype from a
+// register and is assumed to keep vt.
+static uint32_t timing_vset(uint32_t instr, uint32_t vt) {
+    if ((instr & 0x7F) != 0x57 || ((instr >> 12) & 0x7) != 0x7 ||
+        ((instr >> 31) != 0 && ((instr >> 30) & 0x3) != 0x3))
+        return vt;
+    uint32_t vtypei = (instr >> 20) & 0xFF;
+    if (((vtypei >> 3) & 0x7) > 0x3 || (vtypei & 0x7) == 0x4)
+        return 0x80000000; // vill
+    return vtypei;
+}
+
+// Cycles of ops[0] ... ops[n - 1] entered with every register ready and
+// vtype vt. taken selects the class of a final branch.
+static uint32_t timing_run(const rv_insn_t *ops, uint32_t n, uint32_t vt, int taken) {
+    uint32_t ready[32] = { 0 };
+    uint32_t t = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        const rv_insn_t *d = &ops[k];
+        uint8_t regs = timing_ops[d->op].regs;
+        const timing_cost_t *c = &timing_cost[timing_ops[d->op].cls];
+        if (d->op == INSTR_RVV) {
+            c = timing_rvv(d->instr, vt, &regs);
+            vt = timing_vset(d->instr, vt);
+        } else if (c == &timing_cost[TIME_BRANCH] && taken && k == n - 1) {
+            c = &timing_cost[TIME_BRANCH_TAKEN];
+        }
+
+        uint32_t s = t;
+        if ((regs & TIME_RS1) && ready[d->rs1] > s)
+            s = ready[d->rs1];
+        if ((regs & TIME_RS2) && ready[d->rs2] > s)
+            s = ready[d->rs2];
+        t = s + c->thr;
+        if ((regs & TIME_RD) && d->rd != 0)
+            ready[d->rd] = s + c->lat;
+    }
+    return t;
+}
+
+// Cost a block of len instructions, entered under vtype
+void timing_block(timing_block_t *t, const rv_insn_t *ops, uint32_t len, uint32_t vtype) {
+    if (timing_fn == NULL && elf_nsyms > 0)
+        timing_fn = calloc(elf_nsyms, sizeof(timing_count_t));
+    const elf_sym_t *s = (timing_fn != NULL) ? elf_symbol_at(ops[0].pc) : NULL;
+    t->count = (s != NULL) ? &timing_fn[s - elf_syms] : &timing_fn_none;
+
+    t->rvv = 0;
+    for (uint32_t k = 0; k < len; k++) {
+        if (ops[k].op == INSTR_RVV)
+            t->rvv = 1;
+    }
+    t->vtype = vtype;
+    t->cycles[0] = timing_run(ops, len, vtype, 0);
+    t->cycles[1] = timing_run(ops, len, vtype, 1);
+}
+
+// A block with vector instructions is costed again when entered under
+// another vtype
+void timing_block_enter(timing_block_t *t, const rv_insn_t *ops, uint32_t len, uint32_t vtype) {
+    if (t->vtype != vtype) {
+        t->vtype = vtype;
+        t->cycles[0] = timing_run(ops, len, vtype, 0);
+        t->cycles[1] = timing_run(ops, len, vtype, 1);
+    }
+}
+
+// Charge n executed instructions of a block of len; pc is the next pc
+void timing_block_exit(const timing_block_t *t, const rv_insn_t *ops, uint32_t len, uint32_t n,
+                       uint32_t pc) {
+    uint32_t c;
+    if (n == len)
+        c = t->cycles[pc != ops[len - 1].pc + 4];
+    else
+        c = timing_run(ops, n, t->vtype, 0); // Cut short
+    timing_cycles += c;
+    timing_instret += n;
+    t->count->cycles += c;
+    t->count->instret += n;
+}
+
+static int timing_cmp(const void *a, const void *b) {
+    uint64_t x = ((const timing_count_t *) a)->cycles, y = ((const timing_count_t *) b)->cycles;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Totals, then cycles, instructions and CPI per symbol, the most
+// expensive first
+void timing_print_stats(FILE *fp) {
+    fprintf(fp, "timing : cycles = %llu, instret = %llu, CPI = %.3f\n",
+            (unsigned long long)timing_cycles, (unsigned long long)timing_instret,
+            timing_instret ? (double) timing_cycles / timing_instret : 0.0);
+
+    uint32_t n = (timing_fn != NULL) ? elf_nsyms : 0;
+    struct { timing_count_t c; const char *name; } *rows = malloc((n + 1) * sizeof(*rows));
+    if (rows == NULL)
+        return;
+    uint32_t m = 0;
+    for (uint32_t k = 0; k <= n; k++) {
+        const timing_count_t *c = (k < n) ? &timing_fn[k] : &timing_fn_none;
+        if (c->instret == 0)
+            continue;
+        rows[m].c = *c;
+        rows[m].name = (k < n) ? elf_syms[k].name : "(none)";
+        m++;
+    }
+    qsort(rows, m, sizeof(*rows), timing_cmp);
+    fprintf(fp, "%14s %14s %8s  %s\n", "cycles", "instret", "CPI", "function");
+    for (uint32_t k = 0; k < m; k++)
+        fprintf(fp, "%14llu %14llu %8.3f  %s\n", (unsigned long long)rows[k].c.cycles,
+                (unsigned long long)rows[k].c.instret,
+                (double) rows[k].c.cycles / rows[k].c.instret, rows[k].name);
+    free(rows);
+}
@@ -0,0 +1,445 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rv32.h"
+
+/*
+ * Trace output
+ *
+ * Trace lines are formatted straight into a large buffer and written out
+ * with a single fwrite when the buffer fills up, on trace_flush, and at
+ * exit. The trace stream never pays for stdio line buffering.
+ *
+ * Under the deterministic scheduler (trace_harts) a hart can be parked
+ * in the middle of an instruction while others run, so the lines and the
+ * binary record of an instruction are staged per host thread and only
+ * written out by trace_commit once it completes. A "hart" line, and a
+ * TRACE_REC_HART record, mark each change of hart.
+ */
+#define TRACE_BUF_SIZE (1 << 20)
+#define TRACE_LINE_MAX 512
+
+int trace_level = TRACE_OFF;
+int trace_harts;
+
+static char   trace_buf[TRACE_BUF_SIZE];
+static size_t trace_len;
+static FILE  *trace_fp;
+
+void trace_flush(void) {
+    if (trace_len == 0)
+        return;
+    fwrite(trace_buf, 1, trace_len, trace_fp != NULL ? trace_fp : stdout);
+    trace_len = 0;
+}
+
+// Send trace output to path instead of stdout
+int trace_open(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return -1;
+    trace_flush();
+    trace_fp = fp;
+    return 0;
+}
+
+// Format into the buffer, flushing it first when the line may not fit
+static void trace_vprintf(const char *fmt, va_list ap) {
+    va_list again;
+    if (TRACE_BUF_SIZE - trace_len < TRACE_LINE_MAX)
+        trace_flush();
+
+    va_copy(again, ap);
+    int n = vsnprintf(trace_buf + trace_len, TRACE_BUF_SIZE - trace_len, fmt, ap);
+    if (n >= 0 && (size_t) n >= TRACE_BUF_SIZE - trace_len) {
+        // Longer than the space left : flush and format again
+        trace_flush();
+        n = vsnprintf(trace_buf, TRACE_BUF_SIZE, fmt, again);
+        if (n >= 0 && (size_t) n >= TRACE_BUF_SIZE)
+            n = TRACE_BUF_SIZE - 1;
+    }
+    va_end(again);
+    if (n < 0)
+        return;
+    trace_len += n;
+}
+
+static void trace_direct(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    trace_vprintf(fmt, ap);
+    va_end(ap);
+}
+
+static void trace_stage_vprintf(const char *fmt, va_list ap);
+
+void trace_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    if (trace_harts)
+        trace_stage_vprintf(fmt, ap);
+    else
+        trace_vprintf(fmt, ap);
+    va_end(ap);
+}
+
+int trace_parse_level(const char *s) {
+    if (strcmp(s, "off") == 0)
+        return TRACE_OFF;
+    if (strcmp(s, "flow") == 0)
+        return TRACE_FLOW;
+    if (strcmp(s, "full") == 0)
+        return TRACE_FULL;
+    return -1;
+}
+
+/*
+ * Binary trace
+ *
+ * Records are written into a ring of TRACE_CHUNKS chunks. When the
+ * current chunk is full it is handed to a writer thread, which writes it
+ * out while the emulator fills the next one; the emulator only waits
+ * when every chunk is still queued.
+ *
+ * A record is reserved by trace_begin before the instruction runs and
+ * completed by trace_end afterwards, so an instruction that never
+ * returns (a guest access fault) still leaves its record behind.
+ * trace_end works from the record alone : the instruction may have
+ * flushed the predecode cache (FENCE.I, a store to code) and with it the
+ * rv_insn_t it ran from.
+ */
+#define TRACE_CHUNK_RECS (1 << 16)
+#define TRACE_CHUNKS     4
+
+typedef struct {
+    trace_rec_t rec[TRACE_CHUNK_RECS];
+    uint32_t    n;
+    int         full;
+} trace_chunk_t;
+
+int trace_bin_enabled;
+
+static FILE           *trace_bin_fp;
+static trace_chunk_t  *trace_chunks;
+static trace_chunk_t  *trace_cur;
+static int             trace_head;   // Chunk being filled
+static int             trace_tail;   // Next chunk for the writer
+static int             trace_done;
+static int             trace_started;
+static uint32_t        trace_next_pc;
+static pthread_t       trace_thread;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  trace_cond = PTHREAD_COND_INITIALIZER;
+
+static void *trace_writer(void *arg) {
+    pthread_mutex_lock(&trace_lock);
+    for (;;) {
+        trace_chunk_t *c = &trace_chunks[trace_tail];
+        while (!c->full && !trace_done)
+            pthread_cond_wait(&trace_cond, &trace_lock);
+        if (!c->full)
+            break; // Done and drained
+        pthread_mutex_unlock(&trace_lock);
+        fwrite(c->rec, sizeof(trace_rec_t), c->n, trace_bin_fp);
+        pthread_mutex_lock(&trace_lock);
+        c->full = 0;
+        trace_tail = (trace_tail + 1) % TRACE_CHUNKS;
+        pthread_cond_broadcast(&trace_cond);
+    }
+    pthread_mutex_unlock(&trace_lock);
+    return NULL;
+}
+
+// Queue the current chunk and wait for a free one
+static void trace_submit(void) {
+    pthread_mutex_lock(&trace_lock);
+    trace_cur->full = 1;
+    trace_head = (trace_head + 1) % TRACE_CHUNKS;
+    pthread_cond_broadcast(&trace_cond);
+    while (trace_chunks[trace_head].full)
+        pthread_cond_wait(&trace_cond, &trace_lock);
+    pthread_mutex_unlock(&trace_lock);
+    trace_cur = &trace_chunks[trace_head];
+    trace_cur->n = 0;
+}
+
+// Write the header from the state of rv and start the writer thread
+static void trace_bin_start(rv_machine_t *rv) {
+    trace_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRACE_MAGIC, 4);
+    h.version  = TRACE_VERSION;
+    h.rec_size = sizeof(trace_rec_t);
+    h.pc       = rv->pc;
+    memcpy(h.xreg, rv->xreg, sizeof(h.xreg));
+    fwrite(&h, sizeof(h), 1, trace_bin_fp);
+
+    trace_next_pc = rv->pc;
+    trace_cur = &trace_chunks[trace_head];
+    trace_cur->n = 0;
+    pthread_create(&trace_thread, NULL, trace_writer, NULL);
+    trace_started = 1;
+}
+
+int trace_bin_open(const char *path) {
+    trace_bin_fp = fopen(path, "wb");
+    if (trace_bin_fp == NULL)
+        return -1;
+    trace_chunks = calloc(TRACE_CHUNKS, sizeof(trace_chunk_t));
+    if (trace_chunks == NULL) {
+        fclose(trace_bin_fp);
+        return -1;
+    }
+    trace_bin_enabled = 1;
+    return 0;
+}
+
+void trace_bin_close(void) {
+    if (!trace_bin_enabled)
+        return;
+    trace_bin_enabled = 0;
+    if (trace_started) {
+        pthread_mutex_lock(&trace_lock);
+        if (trace_cur->n != 0)
+            trace_cur->full = 1;
+        trace_done = 1;
+        pthread_cond_broadcast(&trace_cond);
+        pthread_mutex_unlock(&trace_lock);
+        pthread_join(trace_thread, NULL);
+    }
+    fclose(trace_bin_fp);
+    free(trace_chunks);
+}
+
+static trace_rec_t *trace_stage_rec(uint32_t pc);
+
+static inline trace_rec_t *trace_alloc(void) {
+    if (trace_cur->n == TRACE_CHUNK_RECS)
+        trace_submit();
+    return &trace_cur->rec[trace_cur->n++];
+}
+
+// Reserve the record of the instruction at pc, after a TRACE_REC_PC
+// record when the distance from the previous one does not fit
+static trace_rec_t *trace_place(uint32_t pc) {
+    int32_t delta = (int32_t)(pc - trace_next_pc);
+    if (delta != (int16_t) delta) {
+        trace_rec_t *p = trace_alloc();
+        memset(p, 0, sizeof(*p));
+        p->kind = TRACE_REC_PC;
+        p->addr = pc;
+        delta = 0;
+    }
+    trace_rec_t *r = trace_alloc();
+    r->pc_delta = delta;
+    trace_next_pc = pc + 4;
+    return r;
+}
+
+trace_rec_t *trace_begin(rv_machine_t *rv, const rv_insn_t *d) {
+    if (!trace_started)
+        trace_bin_start(rv);
+
+    trace_rec_t *r = trace_harts ? trace_stage_rec(rv->pc) : trace_place(rv->pc);
+    r->kind     = TRACE_REC_INSN;
+    r->op       = d->op;
+    r->instr    = d->instr;
+    r->value    = 0;
+    r->addr     = 0;
+    switch (d->op) {
+        case INSTR_LB: case INSTR_LH: case INSTR_LW: case INSTR_LBU: case INSTR_LHU:
+            r->addr = rv->xreg[d->rs1] + d->imm;
+            break;
+        case INSTR_SB:
+            r->addr  = rv->xreg[d->rs1] + d->imm;
+            r->value = rv->xreg[d->rs2] & 0xFF;
+            break;
+        case INSTR_SH:
+            r->addr  = rv->xreg[d->rs1] + d->imm;
+            r->value = rv->xreg[d->rs2] & 0xFFFF;
+            break;
+        case INSTR_SW:
+            r->addr  = rv->xreg[d->rs1] + d->imm;
+            r->value = rv->xreg[d->rs2];
+            break;
+        case INSTR_LR_W: case INSTR_SC_W: case INSTR_AMOSWAP_W: case INSTR_AMOADD_W:
+        case INSTR_AMOXOR_W: case INSTR_AMOAND_W: case INSTR_AMOOR_W: case INSTR_AMOMIN_W:
+        case INSTR_AMOMAX_W: case INSTR_AMOMINU_W: case INSTR_AMOMAXU_W:
+            r->addr = rv->xreg[d->rs1];
+            break;
+        case INSTR_RVV:
+            if ((d->instr & 0x7F) != 0x57)
+                r->addr = rv->xreg[d->rs1]; // Vector load/store base
+            break;
+    }
+    return r;
+}
+
+void trace_end(rv_machine_t *rv, trace_rec_t *r, int valid) {
+    if (valid == 0 || valid == RV_BREAK) {
+        r->kind = TRACE_REC_UNKNOWN;
+        return;
+    }
+    uint32_t rd = (r->instr >> 7) & 0x1F; // d->rd for every decoded instruction
+    switch (r->op) {
+        case INSTR_SB: case INSTR_SH: case INSTR_SW:
+            break;
+        case INSTR_RVV:
+            if ((r->instr & 0x7F) == 0x57 && ((r->instr >> 12) & 0x7) == 0x7) {
+                r->kind  = TRACE_REC_VSET;
+                r->value = rv->vl; // Also the value written to rd
+                r->addr  = rv->vtype;
+                break;
+            }
+            r->value = rv->xreg[rd];
+            break;
+        default:
+            r->value = rv->xreg[rd];
+            break;
+    }
+}
+
+/*
+ * Staging for the deterministic scheduler
+ *
+ * Each hart thread stages the output of its running instruction in a
+ * trace_stage_t of its own, allocated on first use and freed by
+ * trace_harts_end once the hart threads are gone. Only one hart runs at a
+ * time while tracing, so trace_commit writes to the shared buffers
+ * without a lock.
+ */
+typedef struct trace_stage {
+    char               *text;
+    size_t              len;
+    size_t              cap;
+    trace_rec_t         rec;
+    uint32_t            pc;      // Of the staged record
+    int                 has_rec;
+    struct trace_stage *next;
+} trace_stage_t;
+
+static __thread trace_stage_t *trace_stage;
+static trace_stage_t          *trace_stages;  // Of all threads
+static uint32_t                trace_hart_id; // Hart of the last committed instruction
+static int                     trace_hart_known;
+
+static trace_stage_t *trace_stage_get(void) {
+    if (trace_stage != NULL)
+        return trace_stage;
+    trace_stage_t *t = calloc(1, sizeof(trace_stage_t));
+    if (t == NULL) {
+        fprintf(stderr, "Error: Out of memory for the trace\n");
+        exit(1);
+    }
+    pthread_mutex_lock(&trace_lock);
+    t->next = trace_stages;
+    trace_stages = t;
+    pthread_mutex_unlock(&trace_lock);
+    trace_stage = t;
+    return t;
+}
+
+static void trace_stage_vprintf(const char *fmt, va_list ap) {
+    trace_stage_t *t = trace_stage_get();
+    va_list again;
+    va_copy(again, ap);
+    int n = vsnprintf(t->text + t->len, t->cap - t->len, fmt, ap);
+    if (n >= 0 && (size_t) n >= t->cap - t->len) {
+        size_t cap = t->cap != 0 ? t->cap : TRACE_LINE_MAX;
+        while (cap - t->len <= (size_t) n)
+            cap *= 2;
+        char *text = realloc(t->text, cap);
+        if (text == NULL) {
+            fprintf(stderr, "Error: Out of memory for the trace\n");
+            exit(1);
+        }
+        t->text = text;
+        t->cap  = cap;
+        n = vsnprintf(t->text + t->len, t->cap - t->len, fmt, again);
+    }
+    va_end(again);
+    if (n > 0)
+        t->len += n;
+}
+
+static trace_rec_t *trace_stage_rec(uint32_t pc) {
+    trace_stage_t *t = trace_stage_get();
+    t->pc      = pc;
+    t->has_rec = 1;
+    return &t->rec;
+}
+
+// The binary trace header holds harts[0]; a TRACE_REC_REG record gives
+// every other nonzero register of every hart
+void trace_harts_begin(rv_machine_t **harts, uint32_t n) {
+    if (trace_bin_enabled) {
+        if (!trace_started)
+            trace_bin_start(harts[0]);
+        for (uint32_t i = 0; i < n; i++) {
+            for (uint32_t r = 1; r < 32; r++) {
+                if (harts[i]->xreg[r] == 0)
+                    continue;
+                trace_rec_t *p = trace_alloc();
+                memset(p, 0, sizeof(*p));
+                p->kind  = TRACE_REC_REG;
+                p->op    = r;
+                p->instr = harts[i]->hartid;
+                p->value = harts[i]->xreg[r];
+            }
+        }
+    }
+    trace_hart_known = 0;
+    trace_harts = 1;
+}
+
+void trace_harts_end(void) {
+    trace_harts = 0;
+    while (trace_stages != NULL) {
+        trace_stage_t *t = trace_stages;
+        trace_stages = t->next;
+        free(t->text);
+        free(t);
+    }
+    trace_stage = NULL;
+}
+
+// Write out the instruction rv just completed (or faulted on)
+void trace_commit(rv_machine_t *rv) {
+    trace_stage_t *t = trace_stage_get();
+    if (!trace_hart_known || rv->hartid != trace_hart_id) {
+        trace_hart_known = 1;
+        trace_hart_id = rv->hartid;
+        if (trace_level >= TRACE_FLOW)
+            trace_direct("hart 0x%x\n", rv->hartid);
+        if (t->has_rec) {
+            trace_rec_t *p = trace_alloc();
+            memset(p, 0, sizeof(*p));
+            p->kind  = TRACE_REC_HART;
+            p->value = rv->hartid;
+            p->addr  = t->pc;
+            trace_next_pc = t->pc;
+        }
+    }
+    for (size_t off = 0; off < t->len; ) {
+        if (trace_len == TRACE_BUF_SIZE)
+            trace_flush();
+        size_t n = t->len - off;
+        if (n > TRACE_BUF_SIZE - trace_len)
+            n = TRACE_BUF_SIZE - trace_len;
+        memcpy(trace_buf + trace_len, t->text + off, n);
+        trace_len += n;
+        off += n;
+    }
+    t->len = 0;
+    if (t->has_rec) {
+        trace_rec_t *r = trace_place(t->pc);
+        int16_t delta = r->pc_delta;
+        *r = t->rec;
+        r->pc_delta = delta;
+        t->has_rec = 0;
+    }
+}
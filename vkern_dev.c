@@ -0,0 +1,707 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * Host kernels for element-wise vector integer operations
+ *
+ * Each kernel runs one operation over n elements of one SEW:
+ *
+ *     vkern_vv_t : d[i] = op(a[i], b[i])    a = vs2, b = vs1 or a broadcast
+ *     vkern_vs_t : d[i] = op(a[i], s)       shifts by a uniform amount
+ *     vkern_mv   : d[i] = op(a[i], b[i], d[i])  multiplies (OPMVV, OPMVX)
+ *     vkern_red  : acc = op(acc, a[0], ..., a[n - 1])  reductions
+ *
+ * so the vector decode cache of rvv_dev.c resolves funct6 and SEW once per
+ * instruction and vtype, and the element loop has no dispatch left.
+ * Operands are byte arrays in vreg layout (little-endian elements); d may
+ * alias a or b.
+ *
+ * Every operation has a portable C kernel. On x86 there are SSE2 and
+ * AVX2 versions that process 16 or 32 bytes per step and finish the tail
+ * with the C kernel; vkern_init picks the widest set the CPU supports
+ * (CPUID through __builtin_cpu_supports) unless told otherwise.
+ *
+ * Compares produce 0 or 1 per element, and shift amounts are taken
+ * modulo SEW. The widening multiplies read a and b at SEW and read and
+ * write d at 2 * SEW; there are none at SEW 64. Reductions return the
+ * accumulator zero-extended from SEW, or from 2 * SEW for the widening
+ * sums.
+ */
+vkern_vv_t  vkern_vv[64][4];
+vkern_vs_t  vkern_vs[64][4];
+vkern_vv_t  vkern_mv[64][4];
+vkern_red_t vkern_red[64][4];
+const char *vkern_isa;
+
+#define GET8(p)     (*(p))
+#define GET16(p)    load_le16(p)
+#define GET32(p)    load_le32(p)
+#define GET64(p)    load_le64(p)
+#define PUT8(p, v)  (*(p) = (uint8_t)(v))
+#define PUT16(p, v) store_le16(p, (uint16_t)(v))
+#define PUT32(p, v) store_le32(p, (uint32_t)(v))
+#define PUT64(p, v) store_le64(p, (uint64_t)(v))
+
+// The operations : name, funct6, result from x = vs2 and y = vs1 (sx and
+// sy signed, bits = SEW)
+#define VKERN_OPS(X)                            \
+    X(add,  0x00, x + y)                        \
+    X(sub,  0x02, x - y)                        \
+    X(rsub, 0x03, y - x)                        \
+    X(minu, 0x04, x < y ? x : y)                \
+    X(min,  0x05, sx < sy ? sx : sy)            \
+    X(maxu, 0x06, x > y ? x : y)                \
+    X(max,  0x07, sx > sy ? sx : sy)            \
+    X(and,  0x09, x & y)                        \
+    X(or,   0x0A, x | y)                        \
+    X(xor,  0x0B, x ^ y)                        \
+    X(seq,  0x10, x == y)                       \
+    X(sne,  0x11, x != y)                       \
+    X(sltu, 0x12, x < y)                        \
+    X(slt,  0x13, sx < sy)                      \
+    X(sleu, 0x14, x <= y)                       \
+    X(sle,  0x15, sx <= sy)                     \
+    X(sgtu, 0x16, x > y)                        \
+    X(sgt,  0x17, sx > sy)                      \
+    X(sll,  0x25, x << (y & (bits - 1)))        \
+    X(srl,  0x26, x >> (y & (bits - 1)))        \
+    X(sra,  0x27, sx >> (y & (bits - 1)))
+
+#define VKERN_SHIFTS(X)                         \
+    X(sll,  0x25, x << s)                       \
+    X(srl,  0x26, x >> s)                       \
+    X(sra,  0x27, sx >> s)
+
+// Multiplies and multiply-adds : name, funct6, width of d (1 = SEW,
+// 2 = 2 * SEW), result from x = vs2, y = vs1 and z = d. Products are taken
+// in 64 bits, which holds every widening product exactly.
+#define VKERN_MOPS(X)                                           \
+    X(mul,     0x08, 1, (uint64_t) x * y)                       \
+    X(macc,    0x20, 1, z + (uint64_t) x * y)                   \
+    X(nmsac,   0x21, 1, z - (uint64_t) x * y)                   \
+    X(madd,    0x22, 1, z * y + x)                              \
+    X(nmsub,   0x23, 1, x - z * y)                              \
+    X(wmulu,   0x38, 2, (uint64_t) x * y)                       \
+    X(wmulsu,  0x3A, 2, (uint64_t)((int64_t) sx * y))           \
+    X(wmul,    0x3B, 2, (uint64_t)((int64_t) sx * sy))          \
+    X(wmaccu,  0x3C, 2, z + (uint64_t) x * y)                   \
+    X(wmacc,   0x3D, 2, z + (uint64_t)((int64_t) sx * sy))      \
+    X(wmaccus, 0x3E, 2, z + (uint64_t)((int64_t) sx * y))       \
+    X(wmaccsu, 0x3F, 2, z + (uint64_t)((int64_t) sy * x))
+
+// Reductions : name, funct6, SIMD helper for a lane-wise step, result
+// from the accumulator r and the element x (sr and sx signed)
+#define VKERN_REDS(X)                           \
+    X(sum,  0x00, add,  r + x)                  \
+    X(and,  0x01, and,  r & x)                  \
+    X(or,   0x02, or,   r | x)                  \
+    X(xor,  0x03, xor,  r ^ x)                  \
+    X(minu, 0x04, minu, x < r ? x : r)          \
+    X(min,  0x05, min,  sx < sr ? x : r)        \
+    X(maxu, 0x06, maxu, x > r ? x : r)          \
+    X(max,  0x07, max,  sx > sr ? x : r)
+
+// === Portable kernels ===
+
+#define C_KERNEL(op, W, expr)                                                   \
+static void vk_##op##_##W##_c(uint8_t *d, const uint8_t *a, const uint8_t *b,  \
+                              uint32_t n) {                                     \
+    const uint32_t bits = W;                                                    \
+    for (uint32_t i = 0; i < n; i++) {                                          \
+        uint##W##_t x = GET##W(a + i * (W / 8)), y = GET##W(b + i * (W / 8));   \
+        int##W##_t sx = (int##W##_t) x, sy = (int##W##_t) y;                    \
+        (void) bits; (void) sx; (void) sy;                                      \
+        PUT##W(d + i * (W / 8), (expr));                                        \
+    }                                                                           \
+}
+
+#define C_SHIFT(op, W, expr)                                                    \
+static void vk_##op##_##W##_cs(uint8_t *d, const uint8_t *a, uint32_t s,       \
+                               uint32_t n) {                                    \
+    for (uint32_t i = 0; i < n; i++) {                                          \
+        uint##W##_t x = GET##W(a + i * (W / 8));                                \
+        int##W##_t sx = (int##W##_t) x;                                         \
+        (void) sx;                                                              \
+        PUT##W(d + i * (W / 8), (expr));                                        \
+    }                                                                           \
+}
+
+static inline uint64_t vk_get(const uint8_t *p, uint32_t bytes) {
+    switch (bytes) {
+        case 1:  return GET8(p);
+        case 2:  return GET16(p);
+        case 4:  return GET32(p);
+        default: return GET64(p);
+    }
+}
+
+static inline void vk_put(uint8_t *p, uint32_t bytes, uint64_t v) {
+    switch (bytes) {
+        case 1:  PUT8(p, v); break;
+        case 2:  PUT16(p, v); break;
+        case 4:  PUT32(p, v); break;
+        default: PUT64(p, v); break;
+    }
+}
+
+#define C_MKERNEL(op, W, k, expr)                                               \
+static void vk_##op##_##W##_c(uint8_t *d, const uint8_t *a, const uint8_t *b,  \
+                              uint32_t n) {                                     \
+    const uint32_t db = W / 8 * k;                                              \
+    for (uint32_t i = 0; i < n; i++) {                                          \
+        uint##W##_t x = GET##W(a + i * (W / 8)), y = GET##W(b + i * (W / 8));   \
+        int##W##_t sx = (int##W##_t) x, sy = (int##W##_t) y;                    \
+        uint64_t z = vk_get(d + i * db, db);                                    \
+        (void) sx; (void) sy; (void) z;                                         \
+        vk_put(d + i * db, db, (expr));                                         \
+    }                                                                           \
+}
+
+#define C_KERNELS(op, f6, expr) C_KERNEL(op, 8, expr) C_KERNEL(op, 16, expr) C_KERNEL(op, 32, expr) C_KERNEL(op, 64, expr)
+#define C_SHIFTS(op, f6, expr)  C_SHIFT(op, 8, expr) C_SHIFT(op, 16, expr) C_SHIFT(op, 32, expr) C_SHIFT(op, 64, expr)
+#define C_MKERNELS(op, f6, k, expr)                                             \
+    C_MKERNEL(op, 8, k, expr) C_MKERNEL(op, 16, k, expr) C_MKERNEL(op, 32, k, expr) \
+    C_MKERNEL64_##k(op, expr)
+#define C_MKERNEL64_1(op, expr) C_MKERNEL(op, 64, 1, expr)
+#define C_MKERNEL64_2(op, expr) // 128-bit results
+
+#define C_RED(op, W, expr)                                                      \
+static uint64_t vk_red##op##_##W##_c(const uint8_t *a, uint64_t acc, uint32_t n) { \
+    uint##W##_t r = (uint##W##_t) acc;                                          \
+    for (uint32_t i = 0; i < n; i++) {                                          \
+        uint##W##_t x = GET##W(a + i * (W / 8));                                \
+        int##W##_t sx = (int##W##_t) x, sr = (int##W##_t) r;                    \
+        (void) sx; (void) sr;                                                   \
+        r = (expr);                                                             \
+    }                                                                           \
+    return r;                                                                   \
+}
+
+// Widening sums (vwredsumu, vwredsum) into a 2 * SEW accumulator
+#define C_WRED(W)                                                               \
+static uint64_t vk_wredsumu_##W##_c(const uint8_t *a, uint64_t acc, uint32_t n) { \
+    for (uint32_t i = 0; i < n; i++)                                            \
+        acc += GET##W(a + i * (W / 8));                                         \
+    return acc;                                                                 \
+}                                                                               \
+static uint64_t vk_wredsum_##W##_c(const uint8_t *a, uint64_t acc, uint32_t n) { \
+    for (uint32_t i = 0; i < n; i++)                                            \
+        acc += (uint64_t)(int64_t)(int##W##_t) GET##W(a + i * (W / 8));        \
+    return acc;                                                                 \
+}
+
+#define C_REDS(op, f6, lane, expr) C_RED(op, 8, expr) C_RED(op, 16, expr) C_RED(op, 32, expr) C_RED(op, 64, expr)
+
+VKERN_OPS(C_KERNELS)
+VKERN_SHIFTS(C_SHIFTS)
+VKERN_MOPS(C_MKERNELS)
+VKERN_REDS(C_REDS)
+C_WRED(8)
+C_WRED(16)
+C_WRED(32)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// === SIMD kernels ===
+// One set of helpers per instruction set. P is the intrinsic prefix, V
+// the vector type and SI the width suffix of the bitwise intrinsics.
+// Operations SSE2 lacks (most min/max, unsigned compares) are built from
+// signed compares and bitwise selects. SSE2 has no 64-bit compares, so
+// at SEW 64 it only gets the arithmetic helpers.
+
+#define SET1_8(P, v)  P##_set1_epi8(v)
+#define SET1_16(P, v) P##_set1_epi16(v)
+#define SET1_32(P, v) P##_set1_epi32(v)
+#define SET1_64(P, v) P##_set1_epi64x(v)
+
+#define SIMD_HELPERS(isa, P, V, SI)                                                          \
+static inline __attribute__((target(#isa))) V isa##_sel(V m, V x, V y) {                     \
+    return P##_or_##SI(P##_and_##SI(m, x), P##_andnot_##SI(m, y));                            \
+}                                                                                            \
+SIMD_ARITH(isa, P, V, SI, 8)   SIMD_COMPARE(isa, P, V, SI, 8)                                \
+SIMD_ARITH(isa, P, V, SI, 16)  SIMD_COMPARE(isa, P, V, SI, 16)                               \
+SIMD_ARITH(isa, P, V, SI, 32)  SIMD_COMPARE(isa, P, V, SI, 32)                               \
+SIMD_ARITH(isa, P, V, SI, 64)
+
+#define SIMD_ARITH(isa, P, V, SI, W)                                                         \
+static inline __attribute__((target(#isa))) V isa##_add##W(V x, V y)  { return P##_add_epi##W(x, y); } \
+static inline __attribute__((target(#isa))) V isa##_sub##W(V x, V y)  { return P##_sub_epi##W(x, y); } \
+static inline __attribute__((target(#isa))) V isa##_rsub##W(V x, V y) { return P##_sub_epi##W(y, x); } \
+static inline __attribute__((target(#isa))) V isa##_and##W(V x, V y)  { return P##_and_##SI(x, y); }   \
+static inline __attribute__((target(#isa))) V isa##_or##W(V x, V y)   { return P##_or_##SI(x, y); }    \
+static inline __attribute__((target(#isa))) V isa##_xor##W(V x, V y)  { return P##_xor_##SI(x, y); }
+
+#define SIMD_COMPARE(isa, P, V, SI, W)                                                       \
+static inline __attribute__((target(#isa))) V isa##_one##W(void) {                           \
+    return SET1_##W(P, 1);                                                                   \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_bias##W(V x) {                           \
+    return P##_xor_##SI(x, SET1_##W(P, (int##W##_t)(1ull << (W - 1))));                      \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_gtu##W(V x, V y) {                       \
+    return P##_cmpgt_epi##W(isa##_bias##W(x), isa##_bias##W(y));                             \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_seq##W(V x, V y) {                      \
+    return P##_and_##SI(P##_cmpeq_epi##W(x, y), isa##_one##W());                             \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_sne##W(V x, V y) {                      \
+    return P##_andnot_##SI(P##_cmpeq_epi##W(x, y), isa##_one##W());                          \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_sgt##W(V x, V y) {                      \
+    return P##_and_##SI(P##_cmpgt_epi##W(x, y), isa##_one##W());                             \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_slt##W(V x, V y) {                      \
+    return P##_and_##SI(P##_cmpgt_epi##W(y, x), isa##_one##W());                             \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_sle##W(V x, V y) {                      \
+    return P##_andnot_##SI(P##_cmpgt_epi##W(x, y), isa##_one##W());                          \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_sgtu##W(V x, V y) {                     \
+    return P##_and_##SI(isa##_gtu##W(x, y), isa##_one##W());                                 \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_sltu##W(V x, V y) {                     \
+    return P##_and_##SI(isa##_gtu##W(y, x), isa##_one##W());                                 \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_sleu##W(V x, V y) {                     \
+    return P##_andnot_##SI(isa##_gtu##W(x, y), isa##_one##W());                              \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_min##W(V x, V y) {                      \
+    return isa##_sel(P##_cmpgt_epi##W(x, y), y, x);                                          \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_max##W(V x, V y) {                      \
+    return isa##_sel(P##_cmpgt_epi##W(x, y), x, y);                                          \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_minu##W(V x, V y) {                     \
+    return isa##_sel(isa##_gtu##W(x, y), y, x);                                              \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_maxu##W(V x, V y) {                     \
+    return isa##_sel(isa##_gtu##W(x, y), x, y);                                              \
+}
+
+SIMD_HELPERS(sse2, _mm, __m128i, si128)
+SIMD_HELPERS(avx2, _mm256, __m256i, si256)
+SIMD_COMPARE(avx2, _mm256, __m256i, si256, 64)
+
+// Uniform shifts. There are no 8-bit shifts : shift 16-bit lanes and
+// mask off the bits that crossed into the neighbouring byte.
+#define SIMD_SHIFTS(isa, P, V, SI)                                                           \
+static inline __attribute__((target(#isa))) V isa##_sll8s(V x, uint32_t s) {                \
+    return P##_and_##SI(P##_sll_epi16(x, _mm_cvtsi32_si128(s)), P##_set1_epi8((int8_t)(0xFF << s))); \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_srl8s(V x, uint32_t s) {                \
+    return P##_and_##SI(P##_srl_epi16(x, _mm_cvtsi32_si128(s)), P##_set1_epi8((int8_t)(0xFF >> s))); \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_sra8s(V x, uint32_t s) {                \
+    V m = P##_set1_epi8((int8_t)(0x80 >> s));                                                \
+    return P##_sub_epi8(P##_xor_##SI(isa##_srl8s(x, s), m), m);                              \
+}                                                                                            \
+static inline __attribute__((target(#isa))) V isa##_sll16s(V x, uint32_t s) { return P##_sll_epi16(x, _mm_cvtsi32_si128(s)); } \
+static inline __attribute__((target(#isa))) V isa##_srl16s(V x, uint32_t s) { return P##_srl_epi16(x, _mm_cvtsi32_si128(s)); } \
+static inline __attribute__((target(#isa))) V isa##_sra16s(V x, uint32_t s) { return P##_sra_epi16(x, _mm_cvtsi32_si128(s)); } \
+static inline __attribute__((target(#isa))) V isa##_sll32s(V x, uint32_t s) { return P##_sll_epi32(x, _mm_cvtsi32_si128(s)); } \
+static inline __attribute__((target(#isa))) V isa##_srl32s(V x, uint32_t s) { return P##_srl_epi32(x, _mm_cvtsi32_si128(s)); } \
+static inline __attribute__((target(#isa))) V isa##_sra32s(V x, uint32_t s) { return P##_sra_epi32(x, _mm_cvtsi32_si128(s)); } \
+static inline __attribute__((target(#isa))) V isa##_sll64s(V x, uint32_t s) { return P##_sll_epi64(x, _mm_cvtsi32_si128(s)); } \
+static inline __attribute__((target(#isa))) V isa##_srl64s(V x, uint32_t s) { return P##_srl_epi64(x, _mm_cvtsi32_si128(s)); }
+
+SIMD_SHIFTS(sse2, _mm, __m128i, si128)
+SIMD_SHIFTS(avx2, _mm256, __m256i, si256)
+
+// AVX2 has per-element shifts for 32-bit lanes and, without an
+// arithmetic one, for 64-bit lanes
+static inline __attribute__((target("avx2"))) __m256i avx2_amount32(__m256i y) {
+    return _mm256_and_si256(y, _mm256_set1_epi32(31));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_sll32(__m256i x, __m256i y) {
+    return _mm256_sllv_epi32(x, avx2_amount32(y));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_srl32(__m256i x, __m256i y) {
+    return _mm256_srlv_epi32(x, avx2_amount32(y));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_sra32(__m256i x, __m256i y) {
+    return _mm256_srav_epi32(x, avx2_amount32(y));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_sll64(__m256i x, __m256i y) {
+    return _mm256_sllv_epi64(x, _mm256_and_si256(y, _mm256_set1_epi64x(63)));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_srl64(__m256i x, __m256i y) {
+    return _mm256_srlv_epi64(x, _mm256_and_si256(y, _mm256_set1_epi64x(63)));
+}
+
+// Multiplies. The low halves of 16- and 32-bit products come from mullo;
+// the widening 32 -> 64 bit ones extend four elements to 64-bit lanes and
+// multiply their low halves (SSE2 has the unsigned form only, two at a
+// time).
+static inline __attribute__((target("sse2"))) __m128i sse2_mul16(__m128i x, __m128i y) {
+    return _mm_mullo_epi16(x, y);
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_mul16(__m256i x, __m256i y) {
+    return _mm256_mullo_epi16(x, y);
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_mul32(__m256i x, __m256i y) {
+    return _mm256_mullo_epi32(x, y);
+}
+
+#define SSE2_WIDE(op, mul, acc)                                                 \
+static __attribute__((target("sse2")))                                         \
+void vk_##op##_32_sse2(uint8_t *d, const uint8_t *a, const uint8_t *b,         \
+                       uint32_t n) {                                            \
+    const __m128i zero = _mm_setzero_si128();                                   \
+    uint32_t i = 0;                                                             \
+    for (; i + 2 <= n; i += 2) {                                                \
+        __m128i x = _mm_unpacklo_epi32(_mm_loadl_epi64((const __m128i *)(a + i * 4)), zero); \
+        __m128i y = _mm_unpacklo_epi32(_mm_loadl_epi64((const __m128i *)(b + i * 4)), zero); \
+        __m128i p = mul(x, y);                                                  \
+        if (acc)                                                                \
+            p = _mm_add_epi64(p, _mm_loadu_si128((const __m128i *)(d + i * 8))); \
+        _mm_storeu_si128((__m128i *)(d + i * 8), p);                            \
+    }                                                                           \
+    vk_##op##_32_c(d + i * 8, a + i * 4, b + i * 4, n - i);                     \
+}
+
+#define AVX2_WIDE(op, ext, mul, acc)                                            \
+static __attribute__((target("avx2")))                                         \
+void vk_##op##_32_avx2(uint8_t *d, const uint8_t *a, const uint8_t *b,         \
+                       uint32_t n) {                                            \
+    uint32_t i = 0;                                                             \
+    for (; i + 4 <= n; i += 4) {                                                \
+        __m256i x = ext(_mm_loadu_si128((const __m128i *)(a + i * 4)));         \
+        __m256i y = ext(_mm_loadu_si128((const __m128i *)(b + i * 4)));         \
+        __m256i p = mul(x, y);                                                  \
+        if (acc)                                                                \
+            p = _mm256_add_epi64(p, _mm256_loadu_si256((const __m256i *)(d + i * 8))); \
+        _mm256_storeu_si256((__m256i *)(d + i * 8), p);                         \
+    }                                                                           \
+    vk_##op##_32_c(d + i * 8, a + i * 4, b + i * 4, n - i);                     \
+}
+
+SSE2_WIDE(wmulu,  _mm_mul_epu32, 0)
+SSE2_WIDE(wmaccu, _mm_mul_epu32, 1)
+AVX2_WIDE(wmulu,  _mm256_cvtepu32_epi64, _mm256_mul_epu32, 0)
+AVX2_WIDE(wmaccu, _mm256_cvtepu32_epi64, _mm256_mul_epu32, 1)
+AVX2_WIDE(wmul,   _mm256_cvtepi32_epi64, _mm256_mul_epi32, 0)
+AVX2_WIDE(wmacc,  _mm256_cvtepi32_epi64, _mm256_mul_epi32, 1)
+
+// Reductions. The loop combines whole vectors lane-wise; the lanes are
+// then folded into lane 0 by combining each half with the other (shifted
+// down), and the tail goes through the C kernel.
+#define SSE2_FOLD(f, W, r) do {                                                 \
+    r = f(r, _mm_srli_si128(r, 8));                                             \
+    if (W <= 32) r = f(r, _mm_srli_si128(r, 4));                                \
+    if (W <= 16) r = f(r, _mm_srli_si128(r, 2));                                \
+    if (W <= 8)  r = f(r, _mm_srli_si128(r, 1));                                \
+} while (0)
+#define AVX2_FOLD(f, W, r) do {                                                 \
+    r = f(r, _mm256_permute4x64_epi64(r, 0x4E));                                \
+    r = f(r, _mm256_srli_si256(r, 8));                                          \
+    if (W <= 32) r = f(r, _mm256_srli_si256(r, 4));                             \
+    if (W <= 16) r = f(r, _mm256_srli_si256(r, 2));                             \
+    if (W <= 8)  r = f(r, _mm256_srli_si256(r, 1));                             \
+} while (0)
+#define SSE2_LOW(r) (r)
+#define AVX2_LOW(r) _mm256_castsi256_si128(r)
+
+#define SIMD_RED(isa, ISA, V, LOAD, op, lane, W)                                \
+static __attribute__((target(#isa)))                                           \
+uint64_t vk_red##op##_##W##_##isa(const uint8_t *a, uint64_t acc, uint32_t n) { \
+    uint32_t i = 0, bytes = n * (W / 8);                                        \
+    if (bytes >= sizeof(V)) {                                                   \
+        V r = LOAD((const V *) a);                                              \
+        for (i = sizeof(V); i + sizeof(V) <= bytes; i += sizeof(V))             \
+            r = isa##_##lane##W(r, LOAD((const V *)(a + i)));                   \
+        ISA##_FOLD(isa##_##lane##W, W, r);                                      \
+        uint8_t low[8];                                                         \
+        _mm_storel_epi64((__m128i *) low, ISA##_LOW(r));                        \
+        acc = vk_red##op##_##W##_c(low, acc, 1);                                \
+    }                                                                           \
+    return vk_red##op##_##W##_c(a + i, acc, (bytes - i) / (W / 8));             \
+}
+
+#define SSE2_REDS(op, f6, lane, expr)                                           \
+    SIMD_RED(sse2, SSE2, __m128i, _mm_loadu_si128, op, lane, 8)                 \
+    SIMD_RED(sse2, SSE2, __m128i, _mm_loadu_si128, op, lane, 16)                \
+    SIMD_RED(sse2, SSE2, __m128i, _mm_loadu_si128, op, lane, 32)
+#define SSE2_REDS64(op, f6, lane, expr)                                         \
+    SIMD_RED(sse2, SSE2, __m128i, _mm_loadu_si128, op, lane, 64)
+#define AVX2_REDS(op, f6, lane, expr)                                           \
+    SIMD_RED(avx2, AVX2, __m256i, _mm256_loadu_si256, op, lane, 8)              \
+    SIMD_RED(avx2, AVX2, __m256i, _mm256_loadu_si256, op, lane, 16)             \
+    SIMD_RED(avx2, AVX2, __m256i, _mm256_loadu_si256, op, lane, 32)             \
+    SIMD_RED(avx2, AVX2, __m256i, _mm256_loadu_si256, op, lane, 64)
+
+// SSE2 has no 64-bit compares : min and max at SEW 64 stay in C
+#define VKERN_SIMD_REDS64(X)                    \
+    X(sum, 0x00, add, _) X(and, 0x01, and, _)   \
+    X(or,  0x02, or,  _) X(xor, 0x03, xor, _)
+
+VKERN_REDS(SSE2_REDS)
+VKERN_SIMD_REDS64(SSE2_REDS64)
+VKERN_REDS(AVX2_REDS)
+
+// Widening sums. Each step turns a vector of elements into 64-bit partial
+// sums : psadbw against zero adds eight bytes at a time (signed bytes are
+// biased by 0x80 first, taken off at the end), pmaddwd adds pairs of
+// 16-bit elements (unsigned ones biased by 0x8000) and 32-bit elements
+// are extended.
+static inline __attribute__((target("sse2"))) __m128i sse2_wsum32s(__m128i v) {
+    __m128i m = _mm_srai_epi32(v, 31);
+    return _mm_add_epi64(_mm_unpacklo_epi32(v, m), _mm_unpackhi_epi32(v, m));
+}
+static inline __attribute__((target("sse2"))) __m128i sse2_wsum32u(__m128i v) {
+    __m128i z = _mm_setzero_si128();
+    return _mm_add_epi64(_mm_unpacklo_epi32(v, z), _mm_unpackhi_epi32(v, z));
+}
+static inline __attribute__((target("sse2"))) __m128i sse2_wsum16s(__m128i v) {
+    return sse2_wsum32s(_mm_madd_epi16(v, _mm_set1_epi16(1)));
+}
+static inline __attribute__((target("sse2"))) __m128i sse2_wsum16u(__m128i v) {
+    return sse2_wsum16s(_mm_xor_si128(v, _mm_set1_epi16((int16_t) 0x8000)));
+}
+static inline __attribute__((target("sse2"))) __m128i sse2_wsum8u(__m128i v) {
+    return _mm_sad_epu8(v, _mm_setzero_si128());
+}
+static inline __attribute__((target("sse2"))) __m128i sse2_wsum8s(__m128i v) {
+    return sse2_wsum8u(_mm_xor_si128(v, _mm_set1_epi8((int8_t) 0x80)));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_wsum32s(__m256i v) {
+    return _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)),
+                            _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_wsum32u(__m256i v) {
+    return _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(v)),
+                            _mm256_cvtepu32_epi64(_mm256_extracti128_si256(v, 1)));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_wsum16s(__m256i v) {
+    return avx2_wsum32s(_mm256_madd_epi16(v, _mm256_set1_epi16(1)));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_wsum16u(__m256i v) {
+    return avx2_wsum16s(_mm256_xor_si256(v, _mm256_set1_epi16((int16_t) 0x8000)));
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_wsum8u(__m256i v) {
+    return _mm256_sad_epu8(v, _mm256_setzero_si256());
+}
+static inline __attribute__((target("avx2"))) __m256i avx2_wsum8s(__m256i v) {
+    return avx2_wsum8u(_mm256_xor_si256(v, _mm256_set1_epi8((int8_t) 0x80)));
+}
+
+// bias : what the step added to each element
+#define SIMD_WRED(isa, V, LOAD, STORE, ADD, ZERO, name, W, step, bias)         \
+static __attribute__((target(#isa)))                                           \
+uint64_t vk_##name##_##W##_##isa(const uint8_t *a, uint64_t acc, uint32_t n) { \
+    const uint32_t per = sizeof(V) / (W / 8);                                   \
+    uint32_t i = 0;                                                             \
+    V s = ZERO();                                                               \
+    for (; i + per <= n; i += per)                                              \
+        s = ADD(s, isa##_##step(LOAD((const V *)(a + i * (W / 8)))));           \
+    uint8_t lanes[sizeof(V)];                                                   \
+    STORE((V *) lanes, s);                                                      \
+    for (uint32_t k = 0; k < sizeof(V); k += 8)                                 \
+        acc += load_le64(lanes + k);                                            \
+    acc -= (uint64_t)(int64_t)(bias) * i;                                       \
+    return vk_##name##_##W##_c(a + i * (W / 8), acc, n - i);                    \
+}
+
+#define SSE2_WRED(name, W, step, bias) \
+    SIMD_WRED(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi64, _mm_setzero_si128, name, W, step, bias)
+#define AVX2_WRED(name, W, step, bias) \
+    SIMD_WRED(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi64, _mm256_setzero_si256, name, W, step, bias)
+
+SSE2_WRED(wredsumu, 8,  wsum8u,  0)
+SSE2_WRED(wredsum,  8,  wsum8s,  0x80)
+SSE2_WRED(wredsumu, 16, wsum16u, -0x8000)
+SSE2_WRED(wredsum,  16, wsum16s, 0)
+SSE2_WRED(wredsumu, 32, wsum32u, 0)
+SSE2_WRED(wredsum,  32, wsum32s, 0)
+AVX2_WRED(wredsumu, 8,  wsum8u,  0)
+AVX2_WRED(wredsum,  8,  wsum8s,  0x80)
+AVX2_WRED(wredsumu, 16, wsum16u, -0x8000)
+AVX2_WRED(wredsum,  16, wsum16s, 0)
+AVX2_WRED(wredsumu, 32, wsum32u, 0)
+AVX2_WRED(wredsum,  32, wsum32s, 0)
+
+#define SIMD_KERNEL(isa, V, LOAD, STORE, op, W)                                 \
+static __attribute__((target(#isa)))                                           \
+void vk_##op##_##W##_##isa(uint8_t *d, const uint8_t *a, const uint8_t *b,     \
+                           uint32_t n) {                                        \
+    uint32_t i = 0, bytes = n * (W / 8);                                        \
+    for (; i + sizeof(V) <= bytes; i += sizeof(V))                              \
+        STORE((V *)(d + i), isa##_##op##W(LOAD((const V *)(a + i)),             \
+                                          LOAD((const V *)(b + i))));           \
+    vk_##op##_##W##_c(d + i, a + i, b + i, (bytes - i) / (W / 8));              \
+}
+
+#define SIMD_SHIFT(isa, V, LOAD, STORE, op, W)                                  \
+static __attribute__((target(#isa)))                                           \
+void vk_##op##_##W##_##isa##s(uint8_t *d, const uint8_t *a, uint32_t s,        \
+                              uint32_t n) {                                     \
+    uint32_t i = 0, bytes = n * (W / 8);                                        \
+    for (; i + sizeof(V) <= bytes; i += sizeof(V))                              \
+        STORE((V *)(d + i), isa##_##op##W##s(LOAD((const V *)(a + i)), s));     \
+    vk_##op##_##W##_cs(d + i, a + i, s, (bytes - i) / (W / 8));                 \
+}
+
+#define SSE2_KERNELS(op, f6, expr)                                              \
+    SIMD_KERNEL(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, op, 8)        \
+    SIMD_KERNEL(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, op, 16)       \
+    SIMD_KERNEL(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, op, 32)
+#define AVX2_KERNELS(op, f6, expr)                                              \
+    SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, op, 8)  \
+    SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, op, 16) \
+    SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, op, 32) \
+    SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, op, 64)
+#define SSE2_KERNELS64(op, f6, expr)                                            \
+    SIMD_KERNEL(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, op, 64)
+#define SSE2_SHIFTS(op, f6, expr)                                               \
+    SIMD_SHIFT(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, op, 8)         \
+    SIMD_SHIFT(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, op, 16)        \
+    SIMD_SHIFT(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, op, 32)
+#define AVX2_SHIFTS(op, f6, expr)                                               \
+    SIMD_SHIFT(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, op, 8)   \
+    SIMD_SHIFT(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, op, 16)  \
+    SIMD_SHIFT(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, op, 32)
+
+// Element-wise shifts (.vv) have SIMD kernels only for AVX2 at SEW 32 and
+// 64, and shifts at SEW 64 are logical only
+#define VKERN_SIMD_ARITH(X)                                                     \
+    X(add, 0x00, _) X(sub, 0x02, _) X(rsub, 0x03, _)                            \
+    X(and, 0x09, _) X(or, 0x0A, _) X(xor, 0x0B, _)
+#define VKERN_SIMD_OPS(X)                                                       \
+    VKERN_SIMD_ARITH(X)                                                         \
+    X(minu, 0x04, _) X(min, 0x05, _) X(maxu, 0x06, _) X(max, 0x07, _)           \
+    X(seq, 0x10, _) X(sne, 0x11, _) X(sltu, 0x12, _) X(slt, 0x13, _)            \
+    X(sleu, 0x14, _) X(sle, 0x15, _) X(sgtu, 0x16, _) X(sgt, 0x17, _)
+
+VKERN_SIMD_OPS(SSE2_KERNELS)
+VKERN_SIMD_ARITH(SSE2_KERNELS64)
+VKERN_SIMD_OPS(AVX2_KERNELS)
+VKERN_SHIFTS(SSE2_SHIFTS)
+VKERN_SHIFTS(AVX2_SHIFTS)
+SIMD_SHIFT(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, sll, 64)
+SIMD_SHIFT(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, srl, 64)
+SIMD_SHIFT(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, sll, 64)
+SIMD_SHIFT(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, srl, 64)
+SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, sll, 32)
+SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, srl, 32)
+SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, sra, 32)
+SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, sll, 64)
+SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, srl, 64)
+SIMD_KERNEL(sse2, __m128i, _mm_loadu_si128, _mm_storeu_si128, mul, 16)
+SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, mul, 16)
+SIMD_KERNEL(avx2, __m256i, _mm256_loadu_si256, _mm256_storeu_si256, mul, 32)
+
+#endif
+
+// === Selection ===
+
+#define SET_VV(op, f6, isa)                                                     \
+    vkern_vv[f6][0] = vk_##op##_8_##isa;                                        \
+    vkern_vv[f6][1] = vk_##op##_16_##isa;                                       \
+    vkern_vv[f6][2] = vk_##op##_32_##isa;
+#define SET_VS(op, f6, isa)                                                     \
+    vkern_vs[f6][0] = vk_##op##_8_##isa##s;                                     \
+    vkern_vs[f6][1] = vk_##op##_16_##isa##s;                                    \
+    vkern_vs[f6][2] = vk_##op##_32_##isa##s;
+#define SET_MV(op, f6, k, expr)                                                 \
+    vkern_mv[f6][0] = vk_##op##_8_c;                                            \
+    vkern_mv[f6][1] = vk_##op##_16_c;                                           \
+    vkern_mv[f6][2] = vk_##op##_32_c;                                           \
+    SET_MV64_##k(op, f6)
+#define SET_MV64_1(op, f6) vkern_mv[f6][3] = vk_##op##_64_c;
+#define SET_MV64_2(op, f6)
+
+#define SET_C(op, f6, expr)    SET_VV(op, f6, c) vkern_vv[f6][3] = vk_##op##_64_c;
+#define SET_CS(op, f6, expr)   SET_VS(op, f6, c) vkern_vs[f6][3] = vk_##op##_64_cs;
+#define SET_SSE2(op, f6, expr) SET_VV(op, f6, sse2)
+#define SET_AVX2(op, f6, expr) SET_VV(op, f6, avx2) vkern_vv[f6][3] = vk_##op##_64_avx2;
+#define SET_SSE2S(op, f6, expr) SET_VS(op, f6, sse2)
+#define SET_AVX2S(op, f6, expr) SET_VS(op, f6, avx2)
+#define SET_SSE2_64(op, f6, expr) vkern_vv[f6][3] = vk_##op##_64_sse2;
+
+#define SET_RED(op, f6, isa)                                                    \
+    vkern_red[f6][0] = vk_red##op##_8_##isa;                                    \
+    vkern_red[f6][1] = vk_red##op##_16_##isa;                                   \
+    vkern_red[f6][2] = vk_red##op##_32_##isa;
+#define SET_WRED(isa)                                                           \
+    vkern_red[0x30][0] = vk_wredsumu_8_##isa;                                   \
+    vkern_red[0x30][1] = vk_wredsumu_16_##isa;                                  \
+    vkern_red[0x30][2] = vk_wredsumu_32_##isa;                                  \
+    vkern_red[0x31][0] = vk_wredsum_8_##isa;                                    \
+    vkern_red[0x31][1] = vk_wredsum_16_##isa;                                   \
+    vkern_red[0x31][2] = vk_wredsum_32_##isa;
+
+#define SET_RED_C(op, f6, lane, expr)    SET_RED(op, f6, c) vkern_red[f6][3] = vk_red##op##_64_c;
+#define SET_RED_SSE2(op, f6, lane, expr) SET_RED(op, f6, sse2)
+#define SET_RED_SSE2_64(op, f6, lane, expr) vkern_red[f6][3] = vk_red##op##_64_sse2;
+#define SET_RED_AVX2(op, f6, lane, expr) SET_RED(op, f6, avx2) vkern_red[f6][3] = vk_red##op##_64_avx2;
+
+// Select the kernels for isa ("avx2", "sse2" or "scalar"), or the best
+// the host supports when isa is NULL. Returns -1 for an unknown or
+// unsupported isa.
+int vkern_init(const char *isa) {
+    const char *best = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        best = "avx2";
+    else if (__builtin_cpu_supports("sse2"))
+        best = "sse2";
+#endif
+    if (isa == NULL)
+        isa = best;
+    int rank = strcmp(isa, "scalar") == 0 ? 0 : strcmp(isa, "sse2") == 0 ? 1 :
+               strcmp(isa, "avx2") == 0 ? 2 : -1;
+    int best_rank = strcmp(best, "scalar") == 0 ? 0 : strcmp(best, "sse2") == 0 ? 1 : 2;
+    if (rank < 0 || rank > best_rank)
+        return -1;
+
+    memset(vkern_vv, 0, sizeof(vkern_vv));
+    memset(vkern_vs, 0, sizeof(vkern_vs));
+    memset(vkern_mv, 0, sizeof(vkern_mv));
+    memset(vkern_red, 0, sizeof(vkern_red));
+    VKERN_OPS(SET_C)
+    VKERN_SHIFTS(SET_CS)
+    VKERN_MOPS(SET_MV)
+    VKERN_REDS(SET_RED_C)
+    SET_WRED(c)
+#if defined(__x86_64__) || defined(__i386__)
+    if (rank >= 1) {
+        VKERN_SIMD_OPS(SET_SSE2)
+        VKERN_SIMD_ARITH(SET_SSE2_64)
+        VKERN_SHIFTS(SET_SSE2S)
+        vkern_vs[0x25][3] = vk_sll_64_sse2s;
+        vkern_vs[0x26][3] = vk_srl_64_sse2s;
+        vkern_mv[0x08][1] = vk_mul_16_sse2;
+        vkern_mv[0x38][2] = vk_wmulu_32_sse2;
+        vkern_mv[0x3C][2] = vk_wmaccu_32_sse2;
+        VKERN_REDS(SET_RED_SSE2)
+        VKERN_SIMD_REDS64(SET_RED_SSE2_64)
+        SET_WRED(sse2)
+    }
+    if (rank >= 2) {
+        VKERN_SIMD_OPS(SET_AVX2)
+        VKERN_SHIFTS(SET_AVX2S)
+        vkern_vs[0x25][3] = vk_sll_64_avx2s;
+        vkern_vs[0x26][3] = vk_srl_64_avx2s;
+        vkern_vv[0x25][2] = vk_sll_32_avx2;
+        vkern_vv[0x26][2] = vk_srl_32_avx2;
+        vkern_vv[0x27][2] = vk_sra_32_avx2;
+        vkern_vv[0x25][3] = vk_sll_64_avx2;
+        vkern_vv[0x26][3] = vk_srl_64_avx2;
+        vkern_mv[0x08][1] = vk_mul_16_avx2;
+        vkern_mv[0x08][2] = vk_mul_32_avx2;
+        vkern_mv[0x38][2] = vk_wmulu_32_avx2;
+        vkern_mv[0x3B][2] = vk_wmul_32_avx2;
+        vkern_mv[0x3C][2] = vk_wmaccu_32_avx2;
+        vkern_mv[0x3D][2] = vk_wmacc_32_avx2;
+        VKERN_REDS(SET_RED_AVX2)
+        SET_WRED(avx2)
+    }
+#endif
+    vkern_isa = rank == 2 ? "avx2" : rank == 1 ? "sse2" : "scalar";
+    return 0;
+}
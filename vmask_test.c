@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * vmask_test : checks the mask instructions against a bit-at-a-time model
+ *
+ * Runs through decode_rvv_instr, at several vl up to VLEN, on registers
+ * filled with pseudo-random bytes :
+ *
+ *     vmandn.mm ... vmxnor.mm : vd = vs2 op vs1 in the first vl bits
+ *     vmclr.m, vmset.m        : vmxor.mm and vmxnor.mm with vd = vs2 = vs1
+ *     vcpop.m, vfirst.m       : into x[rd], unmasked and under v0.t
+ *     vcompress.vm            : at every SEW, also in place
+ *
+ * After each instruction the whole register file and the x registers are
+ * compared with the model, so bits past vl and untouched registers are
+ * checked too. Prints each mismatch and exits nonzero if any check fails.
+ *
+ * Build: gcc -O2 -o vmask_test vmask_test.c $(ls *_dev.c | grep -v '^rv_dev.c$') -lpthread
+ * Usage: vmask_test [vlen]
+ */
+
+static rv_machine_t *rv;
+static int fails;
+
+static uint8_t  want_v[32 * VLEN_MAX / 8]; // Model of the register file
+static uint32_t want_x[32];
+static uint64_t seed = 0x9E3779B97F4A7C15ull;
+
+static uint32_t vsetvli(uint32_t rd, uint32_t rs1, uint32_t vsew, uint32_t vlmul) {
+    return (((vsew << 3) | vlmul) << 20) | (rs1 << 15) | (0x7 << 12) | (rd << 7) | 0x57;
+}
+
+// OPMVV instruction
+static uint32_t opmvv(uint32_t funct6, uint32_t vm, uint32_t vs2, uint32_t vs1, uint32_t vd) {
+    return (funct6 << 26) | (vm << 25) | (vs2 << 20) | (vs1 << 15) | (0x2 << 12) | (vd << 7) | 0x57;
+}
+
+static uint8_t rand8(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return (uint8_t) (seed >> 32);
+}
+
+static int get_bit(const uint8_t *v, uint32_t r, uint32_t i) {
+    return (v[r * rv->vlenb + i / 8] >> (i % 8)) & 1;
+}
+
+static void set_bit(uint8_t *v, uint32_t r, uint32_t i, int b) {
+    uint8_t *p = &v[r * rv->vlenb + i / 8];
+    *p = (*p & ~(1 << (i % 8))) | (b << (i % 8));
+}
+
+// New random contents for every vector register, copied into the model
+static void scramble(void) {
+    for (uint32_t k = 0; k < 32 * rv->vlenb; k++)
+        rv->vreg[k] = rand8();
+    memcpy(want_v, rv->vreg, 32 * rv->vlenb);
+    memcpy(want_x, rv->xreg, sizeof(want_x));
+}
+
+// Execute instr, then compare the machine with the model
+static void run(const char *test, uint32_t instr) {
+    decode_rvv_instr(rv, instr);
+    for (uint32_t r = 0; r < 32; r++) {
+        if (rv->xreg[r] != want_x[r]) {
+            printf("FAIL %-12s vl=%-4u x%u = %d, expected %d\n",
+                   test, rv->vl, r, (int32_t) rv->xreg[r], (int32_t) want_x[r]);
+            fails++;
+        }
+    }
+    for (uint32_t k = 0; k < 32 * rv->vlenb; k++) {
+        if (rv->vreg[k] != want_v[k]) {
+            printf("FAIL %-12s vl=%-4u v%u byte %u = %02x, expected %02x\n",
+                   test, rv->vl, k / rv->vlenb, k % rv->vlenb, rv->vreg[k], want_v[k]);
+            fails++;
+            return;
+        }
+    }
+}
+
+static void check_logical(void) {
+    static const char *const names[8] = {
+        "vmandn", "vmand", "vmor", "vmxor", "vmorn", "vmnand", "vmnor", "vmxnor" };
+    uint32_t vl = rv->vl;
+
+    for (uint32_t op = 0; op < 8; op++) {
+        scramble();
+        for (uint32_t i = 0; i < vl; i++) {
+            int a = get_bit(want_v, 2, i), b = get_bit(want_v, 3, i), r = 0;
+            switch (op) {
+                case 0: r = a & !b; break;
+                case 1: r = a & b; break;
+                case 2: r = a | b; break;
+                case 3: r = a ^ b; break;
+                case 4: r = a | !b; break;
+                case 5: r = !(a & b); break;
+                case 6: r = !(a | b); break;
+                case 7: r = !(a ^ b); break;
+            }
+            set_bit(want_v, 1, i, r);
+        }
+        run(names[op], opmvv(0x18 + op, 1, 2, 3, 1));
+    }
+
+    // A destination that is also a source
+    scramble();
+    for (uint32_t i = 0; i < vl; i++)
+        set_bit(want_v, 2, i, get_bit(want_v, 2, i) & get_bit(want_v, 3, i));
+    run("vmand vd=vs2", opmvv(0x19, 1, 2, 3, 2));
+
+    scramble();
+    for (uint32_t i = 0; i < vl; i++)
+        set_bit(want_v, 4, i, 0);
+    run("vmclr", opmvv(0x1B, 1, 4, 4, 4));
+    for (uint32_t i = 0; i < vl; i++)
+        set_bit(want_v, 4, i, 1);
+    run("vmset", opmvv(0x1F, 1, 4, 4, 4));
+}
+
+static void check_scalar(void) {
+    uint32_t vl = rv->vl;
+
+    for (uint32_t vm = 0; vm < 2; vm++) {
+        scramble();
+        uint32_t count = 0, first = 0xFFFFFFFF;
+        for (uint32_t i = 0; i < vl; i++) {
+            if (get_bit(want_v, 2, i) && (vm || get_bit(want_v, 0, i))) {
+                count++;
+                if (first == 0xFFFFFFFF)
+                    first = i;
+            }
+        }
+        want_x[10] = count;
+        run(vm ? "vcpop" : "vcpop.t", opmvv(0x10, vm, 2, 0x10, 10));
+        want_x[11] = first;
+        run(vm ? "vfirst" : "vfirst.t", opmvv(0x10, vm, 2, 0x11, 11));
+        run("vcpop x0", opmvv(0x10, vm, 2, 0x10, 0));
+    }
+
+    // No set bit among the first vl
+    scramble();
+    for (uint32_t i = 0; i < vl; i++)
+        set_bit(rv->vreg, 2, i, 0);
+    memcpy(want_v, rv->vreg, 32 * rv->vlenb);
+    want_x[11] = 0xFFFFFFFF;
+    run("vfirst none", opmvv(0x10, 1, 2, 0x11, 11));
+}
+
+// vcompress of v16 under the mask v3 into vd, at eew bytes per element
+static void check_compress(uint32_t eew, uint32_t vd) {
+    uint32_t n = 0;
+    scramble();
+    uint8_t src[8 * VLEN_MAX / 8];
+    memcpy(src, &want_v[16 * rv->vlenb], 8 * rv->vlenb);
+    for (uint32_t i = 0; i < rv->vl; i++) {
+        if (get_bit(want_v, 3, i)) {
+            memcpy(&want_v[vd * rv->vlenb + n * eew], &src[i * eew], eew);
+            n++;
+        }
+    }
+    run(vd == 16 ? "vcompress in place" : "vcompress", opmvv(0x17, 1, 16, 3, vd));
+}
+
+int main(int argc, char **argv) {
+    uint32_t bits = argc > 1 ? strtoul(argv[1], NULL, 0) : VLEN_MIN;
+
+    rv = rv_create(RV_ENGINE_INTERP);
+    if (rv == NULL) {
+        fprintf(stderr, "Error: Out of memory for the machine\n");
+        return 1;
+    }
+    if (rvv_set_vlen(rv, bits) != 0) {
+        fprintf(stderr, "Error: VLEN must be a power of two from %d to %d\n", VLEN_MIN, VLEN_MAX);
+        return 1;
+    }
+
+    // vl inside the first word, on and across word edges, and VLEN
+    uint32_t avls[] = { 1, 13, 63, 64, 65, 100, bits - 1, bits };
+    for (uint32_t k = 0; k < sizeof(avls) / sizeof(avls[0]); k++) {
+        rv->xreg[5] = avls[k];
+        decode_rvv_instr(rv, vsetvli(6, 5, 0, 3)); // e8, m8 : VLMAX = VLEN
+        if (rv->vl != avls[k]) {
+            fprintf(stderr, "Error: vsetvli e8,m8 gave vl=%u, expected %u\n", rv->vl, avls[k]);
+            return 1;
+        }
+        check_logical();
+        check_scalar();
+        check_compress(1, 8);
+        check_compress(1, 16);
+    }
+    for (uint32_t vsew = 1; vsew < 4; vsew++) {
+        rv->xreg[5] = UINT32_MAX;
+        decode_rvv_instr(rv, vsetvli(6, 5, vsew, 3));
+        check_compress(1u << vsew, 8);
+        check_compress(1u << vsew, 16);
+    }
+
+    printf("VLEN %u : %s\n", bits, fails ? "FAIL" : "ok");
+    rv_destroy(rv);
+    return fails != 0;
+}
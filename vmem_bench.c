@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "rv32.h"
+
+/*
+ * vmem_bench : bandwidth of the vector unit-stride loads and stores
+ *
+ * Runs vle / vse through decode_rvv_instr for every SEW and a range of
+ * vl (LMUL 1 to 8) and reports guest bytes moved per second for
+ *
+ *     vle    : unmasked unit-stride load, one block copy
+ *     vse    : unmasked unit-stride store
+ *     vle.m  : load masked by alternating v0 bits, one copy then a blend
+ *     vlseg2 : two-field segment load, copied then deinterleaved
+ *
+ * The buffer stays in a few pages, so the TLB always hits.
+ *
+ * Build: gcc -O2 -o vmem_bench vmem_bench.c $(ls *_dev.c | grep -v '^rv_dev.c$') -lpthread
+ * Usage: vmem_bench [vlen] [iterations]
+ */
+
+static rv_machine_t *rv;
+
+#define BENCH_BASE 0x10000
+#define BENCH_MASK 0x20000 // Alternating mask bytes for v0
+
+static uint32_t vsetvli(uint32_t rd, uint32_t rs1, uint32_t vsew, uint32_t vlmul) {
+    return (((vsew << 3) | vlmul) << 20) | (rs1 << 15) | (0x7 << 12) | (rd << 7) | 0x57;
+}
+
+// Unit-stride load or store of vd/vs3 at [rs1], width 0/1/2/3 for 8/16/32/64
+static uint32_t vmem(int load, uint32_t nf, uint32_t vm, uint32_t rs1, uint32_t width, uint32_t vd) {
+    return (nf << 29) | (vm << 25) | (rs1 << 15) | (width << 12) | (vd << 7) | (load ? 0x07 : 0x27);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// MB/s for n executions of instr moving bytes guest bytes each
+static double bench(uint32_t instr, uint32_t bytes, uint64_t n) {
+    double t = now();
+    for (uint64_t i = 0; i < n; i++)
+        decode_rvv_instr(rv, instr);
+    t = now() - t;
+    return bytes * (double) n / t / 1e6;
+}
+
+int main(int argc, char **argv) {
+    uint32_t bits = argc > 1 ? strtoul(argv[1], NULL, 0) : VLEN_MIN;
+    uint64_t n = argc > 2 ? strtoull(argv[2], NULL, 0) : 2000000;
+
+    rv = rv_create(RV_ENGINE_INTERP);
+    if (rv == NULL) {
+        fprintf(stderr, "Error: Out of memory for the machine\n");
+        return 1;
+    }
+    if (rvv_set_vlen(rv, bits) != 0) {
+        fprintf(stderr, "Error: VLEN must be a power of two from %d to %d\n", VLEN_MIN, VLEN_MAX);
+        return 1;
+    }
+    mem_map_ram(rv, BENCH_BASE, 0x20000);
+    for (uint32_t a = 0; a < 0x10000; a++)
+        mem_write8(rv, BENCH_BASE + a, a * 7);
+    rv->xreg[10] = BENCH_BASE;
+    rv->xreg[11] = BENCH_MASK;
+    for (uint32_t a = 0; a < VLEN_MAX / 8; a++)
+        mem_write8(rv, BENCH_MASK + a, 0x55);
+
+    printf("VLEN %u, MB/s\n", bits);
+    printf("%-12s %10s %10s %10s %10s\n", "", "vle", "vse", "vle.m", "vlseg2");
+    for (uint32_t vsew = 0; vsew < 4; vsew++) {
+        for (uint32_t vlmul = 0; vlmul < 4; vlmul++) {
+            rv->xreg[5] = UINT32_MAX; // vl = VLMAX
+            decode_rvv_instr(rv, vsetvli(6, 5, vsew, vlmul));
+            decode_rvv_instr(rv, vmem(1, 0, 1, 11, 0, 0)); // v0 from the mask bytes
+            uint32_t vl = rv->xreg[6];
+            uint32_t bytes = vl << vsew;
+            uint64_t iters = n / (1 << vlmul);
+            printf("e%-2u vl=%-6u %10.1f %10.1f %10.1f",
+                   8u << vsew, vl,
+                   bench(vmem(1, 0, 1, 10, vsew, 8), bytes, iters),
+                   bench(vmem(0, 0, 1, 10, vsew, 8), bytes, iters),
+                   bench(vmem(1, 0, 0, 10, vsew, 8), bytes / 2, iters));
+            if (vlmul < 3)
+                printf(" %10.1f\n", bench(vmem(1, 1, 1, 10, vsew, 8), 2 * bytes, iters));
+            else
+                printf(" %10s\n", "-"); // Two fields of eight registers
+        }
+    }
+    return 0;
+}
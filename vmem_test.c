@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32.h"
+
+/*
+ * vmem_test : checks the vector loads and stores that take the block paths
+ *
+ * Runs through decode_rvv_instr at SEW=64, LMUL=2, vl=4, where the copied
+ * or deinterleaved data must land in whole 64-bit elements :
+ *
+ *     vle64.v v0.t     : load masked by the non-contiguous mask 0b0101
+ *     vlseg2e64.v      : two-field segment load, then vsseg2e64.v back
+ *     vluxseg2ei64.v   : two-field indexed load with a contiguous index,
+ *                        then vsuxseg2ei64.v back
+ *
+ * Registers are filled and read back with unmasked vle64.v and vse64.v.
+ * Prints each failing element and exits nonzero if any check fails.
+ *
+ * Build: gcc -O2 -o vmem_test vmem_test.c $(ls *_dev.c | grep -v '^rv_dev.c$') -lpthread
+ * Usage: vmem_test [vlen]
+ */
+
+static rv_machine_t *rv;
+static int fails;
+
+#define TEST_SRC  0x10000 // Eight 64-bit source values
+#define TEST_DST  0x10100 // Store targets
+#define TEST_IDX  0x10200 // 64-bit index table
+#define TEST_MASK 0x10300 // Mask byte for v0
+#define TEST_FILL 0x10400 // Register contents before each load
+#define TEST_OUT  0x10500 // Registers stored for checking
+
+#define FILL 0xEEEEEEEEEEEEEEEEull
+
+static uint32_t vsetvli(uint32_t rd, uint32_t rs1, uint32_t vsew, uint32_t vlmul) {
+    return (((vsew << 3) | vlmul) << 20) | (rs1 << 15) | (0x7 << 12) | (rd << 7) | 0x57;
+}
+
+// Unit-stride load or store of vd/vs3 at [rs1], width 0/1/2/3 for 8/16/32/64
+static uint32_t vmem(int load, uint32_t nf, uint32_t vm, uint32_t rs1, uint32_t width, uint32_t vd) {
+    return (nf << 29) | (vm << 25) | (rs1 << 15) | (width << 12) | (vd << 7) | (load ? 0x07 : 0x27);
+}
+
+// Unordered indexed load or store of vd/vs3 at [rs1] + offsets in vs2
+static uint32_t vmem_idx(int load, uint32_t nf, uint32_t vs2, uint32_t rs1, uint32_t width, uint32_t vd) {
+    return vmem(load, nf, 1, rs1, width, vd) | (0x1 << 26) | (vs2 << 20);
+}
+
+static uint64_t src_value(uint32_t k) {
+    return (0x0101010101010101ull * (k + 1)) ^ (0x8000000000000000ull >> k);
+}
+
+static uint64_t read64(uint32_t addr) {
+    return mem_read32(rv, addr) | (uint64_t) mem_read32(rv, addr + 4) << 32;
+}
+
+static void write64(uint32_t addr, uint64_t val) {
+    mem_write32(rv, addr, (uint32_t) val);
+    mem_write32(rv, addr + 4, (uint32_t) (val >> 32));
+}
+
+// The four elements of vr set to FILL
+static void vfill(uint32_t vr) {
+    decode_rvv_instr(rv, vmem(1, 0, 1, 14, 3, vr));
+}
+
+static void expect_elem(const char *test, uint32_t vr, uint32_t i, uint64_t want) {
+    decode_rvv_instr(rv, vmem(0, 0, 1, 15, 3, vr));
+    uint64_t got = read64(TEST_OUT + i * 8);
+    if (got != want) {
+        printf("FAIL %-8s v%u[%u] = %016llx, expected %016llx\n",
+               test, vr, i, (unsigned long long) got, (unsigned long long) want);
+        fails++;
+    }
+}
+
+// Both fields of the four segments read from TEST_SRC into vd and vd + 2
+static void expect_fields(const char *test, uint32_t vd) {
+    for (uint32_t i = 0; i < 4; i++) {
+        expect_elem(test, vd, i, src_value(2 * i));
+        expect_elem(test, vd + 2, i, src_value(2 * i + 1));
+    }
+}
+
+// The eight source values written back at TEST_DST
+static void expect_stored(const char *test) {
+    for (uint32_t k = 0; k < 8; k++) {
+        uint64_t got = read64(TEST_DST + k * 8);
+        if (got != src_value(k)) {
+            printf("FAIL %-8s [dst+%u] = %016llx, expected %016llx\n",
+                   test, k * 8, (unsigned long long) got, (unsigned long long) src_value(k));
+            fails++;
+        }
+    }
+}
+
+static void clear_dst(void) {
+    for (uint32_t a = 0; a < 64; a++)
+        mem_write8(rv, TEST_DST + a, 0);
+}
+
+int main(int argc, char **argv) {
+    uint32_t bits = argc > 1 ? strtoul(argv[1], NULL, 0) : VLEN_MIN;
+
+    rv = rv_create(RV_ENGINE_INTERP);
+    if (rv == NULL) {
+        fprintf(stderr, "Error: Out of memory for the machine\n");
+        return 1;
+    }
+    if (rvv_set_vlen(rv, bits) != 0) {
+        fprintf(stderr, "Error: VLEN must be a power of two from %d to %d\n", VLEN_MIN, VLEN_MAX);
+        return 1;
+    }
+    mem_map_ram(rv, TEST_SRC, 0x1000);
+    for (uint32_t k = 0; k < 8; k++) {
+        write64(TEST_SRC + k * 8, src_value(k));
+        write64(TEST_IDX + k * 8, k * 16); // Segments back to back
+        write64(TEST_FILL + k * 8, FILL);
+    }
+    mem_write8(rv, TEST_MASK, 0x5); // Elements 0 and 2
+    rv->xreg[10] = TEST_SRC;
+    rv->xreg[11] = TEST_DST;
+    rv->xreg[12] = TEST_IDX;
+    rv->xreg[13] = TEST_MASK;
+    rv->xreg[14] = TEST_FILL;
+    rv->xreg[15] = TEST_OUT;
+
+    rv->xreg[5] = 4;
+    decode_rvv_instr(rv, vsetvli(6, 5, 3, 1)); // e64, m2
+    if (rv->xreg[6] != 4) {
+        fprintf(stderr, "Error: vsetvli e64,m2 gave vl=%u, expected 4\n", rv->xreg[6]);
+        return 1;
+    }
+
+    // Masked load : active elements get whole values, the others keep FILL
+    decode_rvv_instr(rv, vmem(1, 0, 1, 13, 0, 0)); // v0 from the mask byte
+    vfill(2);
+    decode_rvv_instr(rv, vmem(1, 0, 0, 10, 3, 2));
+    for (uint32_t i = 0; i < 4; i++)
+        expect_elem("vle.m", 2, i, i % 2 == 0 ? src_value(i) : FILL);
+
+    // Segment unit-stride load and store
+    vfill(4);
+    vfill(6);
+    decode_rvv_instr(rv, vmem(1, 1, 1, 10, 3, 4));
+    expect_fields("vlseg2", 4);
+    clear_dst();
+    decode_rvv_instr(rv, vmem(0, 1, 1, 11, 3, 4));
+    expect_stored("vsseg2");
+
+    // Segment indexed load and store, one contiguous run
+    decode_rvv_instr(rv, vmem(1, 0, 1, 12, 3, 8)); // Offsets into v8
+    vfill(12);
+    vfill(14);
+    decode_rvv_instr(rv, vmem_idx(1, 1, 8, 10, 3, 12));
+    expect_fields("vluxseg2", 12);
+    clear_dst();
+    decode_rvv_instr(rv, vmem_idx(0, 1, 8, 11, 3, 12));
+    expect_stored("vsuxseg2");
+
+    printf("VLEN %u : %s\n", bits, fails ? "FAIL" : "ok");
+    rv_destroy(rv);
+    return fails != 0;
+}